@@ -0,0 +1,299 @@
+#include "batch_calib.h"
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <cstdio>
+#include <cstdlib>
+#include <dirent.h>
+#include <fstream>
+#include <map>
+#include <mutex>
+#include <sstream>
+#include <thread>
+#include "mio/altro/io.h"
+#include "parallel_tasks.h"
+#include "pipeline_trace.h"
+
+
+const char *BatchStateName(const int state){
+  switch(state){
+    case BATCH_OK:        return "ok";
+    case BATCH_FAILED:    return "failed";
+    case BATCH_CANCELLED: return "cancelled";
+    default:              return "pending";
+  }
+}
+
+
+static int BatchStateFromName(const std::string &name){
+  for(int state = BATCH_PENDING; state <= BATCH_CANCELLED; ++state)
+    if(name == BatchStateName(state))
+      return state;
+  return BATCH_PENDING;
+}
+
+
+bool ReadBatchManifest(const std::string &file_name_full, const calibOptions_t &base_opt,
+                       std::vector<calibOptions_t> &dataset_vec){
+  cv::FileStorage fs(file_name_full, cv::FileStorage::READ);
+  EXP_CHK_M(fs.isOpened(), return(false), "could not open " + file_name_full)
+  const size_t slash_pos = file_name_full.find_last_of('/');
+  const std::string manifest_dir = slash_pos == std::string::npos ? "." : file_name_full.substr(0, slash_pos);
+
+  calibOptions_t default_opt = base_opt;
+  const cv::FileNode default_node = fs["defaults"];
+  if( !default_node.empty() )
+    EXP_CHK_M(ReadCalibOptions(default_node, default_opt), return(false), "bad defaults in " + file_name_full)
+
+  const cv::FileNode dataset_node = fs["datasets"];
+  EXP_CHK_M(dataset_node.type() == cv::FileNode::SEQ, return(false), "no datasets sequence in " + file_name_full)
+  dataset_vec.clear();
+  std::map<std::string, size_t> dir_map;
+  for(cv::FileNodeIterator it = dataset_node.begin(); it != dataset_node.end(); ++it){
+    calibOptions_t opt = default_opt;
+    opt.cal_photo_dir.clear();
+    EXP_CHK_M(ReadCalibOptions(*it, opt), return(false), "bad dataset entry in " + file_name_full)
+    EXP_CHK_M(!opt.cal_photo_dir.empty(), return(false), "dataset without cal_photo_dir in " + file_name_full)
+    if(opt.cal_photo_dir[0] != '/')
+      opt.cal_photo_dir = manifest_dir + "/" + opt.cal_photo_dir;
+    mio::FormatFilePath(opt.cal_photo_dir);
+    //the directory identifies a dataset in the journal
+    EXP_CHK_M(dir_map.count(opt.cal_photo_dir) == 0, return(false), "dataset listed twice: " + opt.cal_photo_dir)
+    EXP_CHK_M(opt.NumCamera() >= 1, return(false), "dataset without file prefix: " + opt.cal_photo_dir)
+    dir_map[opt.cal_photo_dir] = dataset_vec.size();
+    dataset_vec.push_back(opt);
+  }
+  printf( "ReadBatchManifest(): %zu datasets in %s\n", dataset_vec.size(), file_name_full.c_str() );
+
+  return true;
+}
+
+
+//the last line of a directory wins, so a dataset retried after failing is recorded as ok
+static void ReadJournal(const std::string &file_name_full, std::map<std::string, batchDatasetResult_t> &entry_map){
+  std::ifstream file( file_name_full.c_str() );
+  std::string line;
+  while( std::getline(file, line) ){
+    std::istringstream iss(line);
+    std::string field;
+    std::vector<std::string> field_vec;
+    while( std::getline(iss, field, '\t') )
+      field_vec.push_back(field);
+    if(field_vec.size() != 7)
+      continue; //torn last line of a crashed run
+    batchDatasetResult_t entry;
+    entry.state = BatchStateFromName(field_vec[0]);
+    entry.num_views = static_cast<size_t>( atol( field_vec[1].c_str() ) );
+    entry.rms_error = atof( field_vec[2].c_str() );
+    entry.epipolar_error = atof( field_vec[3].c_str() );
+    entry.time_s = atof( field_vec[4].c_str() );
+    entry.num_threads = atoi( field_vec[5].c_str() );
+    entry.cal_photo_dir = field_vec[6];
+    entry.from_journal = true;
+    if(entry.state == BATCH_OK || entry.state == BATCH_FAILED)
+      entry_map[entry.cal_photo_dir] = entry;
+  }
+}
+
+
+static size_t CountDirEntries(const std::string &dir){
+  DIR *dir_handle = opendir( dir.c_str() );
+  if(!dir_handle)
+    return 0;
+  size_t num_entry = 0;
+  for(struct dirent *entry = readdir(dir_handle); entry; entry = readdir(dir_handle))
+    ++num_entry;
+  closedir(dir_handle);
+  return num_entry;
+}
+
+
+static void CalibrateDataset(const calibOptions_t &dataset_opt, const int num_threads, pipelineProgress_t *progress,
+                             batchDatasetResult_t &result){
+  calibOptions_t opt = dataset_opt;
+  opt.num_threads = num_threads;
+  opt.num_decode_threads = std::max( 1, std::min(opt.num_decode_threads, num_threads) );
+  opt.trace_file.clear(); //datasets run concurrently, only the batch is traced
+  result.num_threads = num_threads;
+
+  ScopedTrace trace( "dataset", "batch", opt.cal_photo_dir.c_str() );
+  const auto start_time = std::chrono::steady_clock::now();
+  int ret = -1;
+  try{
+    if( opt.RigMode() ){
+      rigCalData_t rig_data;
+      rigCalibResult_t rig_result;
+      ret = RunRigCalibrationPipeline(opt, rig_data, rig_result, progress);
+      result.num_views = rig_data.NumView();
+      result.rms_error = rig_result.rms_error;
+    }
+    else{
+      stereoCalData_t cal_data;
+      calibResult_t calib_result;
+      ret = RunCalibrationPipeline(opt, cal_data, calib_result, false, NULL, progress);
+      result.num_views = cal_data.GetNumImgPerCam();
+      result.rms_error = calib_result.rms_error;
+      result.epipolar_error = opt.StereoMode() ? calib_result.reprojection_error : 0;
+    }
+  }
+  //runs on a job thread, where anything escaping would terminate every dataset of the batch
+  catch(cv::Exception &e){
+    printf( "RunBatchCalibration() - %s: %s\n", opt.cal_photo_dir.c_str(), e.what() );
+    ret = -1;
+  }
+  catch(std::exception &e){
+    printf( "RunBatchCalibration() - %s: caught exception - %s\n", opt.cal_photo_dir.c_str(), e.what() );
+    ret = -1;
+  }
+  catch(...){
+    printf( "RunBatchCalibration() - %s: caught unknown exception\n", opt.cal_photo_dir.c_str() );
+    ret = -1;
+  }
+  result.time_s = std::chrono::duration<double>(std::chrono::steady_clock::now() - start_time).count();
+  result.state = ret == 0 ? BATCH_OK : (ret == 1 ? BATCH_CANCELLED : BATCH_FAILED);
+}
+
+
+int RunBatchCalibration(const std::vector<calibOptions_t> &dataset_vec, const batchParams_t &params,
+                        std::vector<batchDatasetResult_t> &result_vec, const std::atomic<bool> *cancel){
+  const size_t num_dataset = dataset_vec.size();
+  result_vec.assign( num_dataset, batchDatasetResult_t() );
+  for(size_t d = 0; d < num_dataset; ++d)
+    result_vec[d].cal_photo_dir = dataset_vec[d].cal_photo_dir;
+
+  //datasets finished by an earlier run
+  std::map<std::string, batchDatasetResult_t> journal_map;
+  if( params.resume && !params.journal_file.empty() )
+    ReadJournal(params.journal_file, journal_map);
+  std::vector<size_t> todo_vec;
+  for(size_t d = 0; d < num_dataset; ++d){
+    auto it = journal_map.find(result_vec[d].cal_photo_dir);
+    if( it != journal_map.end() && !(params.retry_failed && it->second.state == BATCH_FAILED) )
+      result_vec[d] = it->second;
+    else
+      todo_vec.push_back(d);
+  }
+  if(todo_vec.size() < num_dataset)
+    printf("RunBatchCalibration(): %zu of %zu datasets already finished, resuming\n", num_dataset - todo_vec.size(),
+           num_dataset);
+
+  FILE *journal = NULL;
+  if( !params.journal_file.empty() ){
+    journal = fopen(params.journal_file.c_str(), params.resume ? "a" : "w");
+    EXP_CHK_M(journal, return(-1), "could not open " + params.journal_file)
+  }
+
+  TraceSession trace_session(params.trace_file);
+  const auto start_time = std::chrono::steady_clock::now();
+  const int num_threads = ResolveNumThreads(params.num_threads);
+  const int num_jobs = static_cast<int>( std::min( static_cast<size_t>( params.num_jobs > 0 ? params.num_jobs :
+                                                                        std::max(num_threads / 2, 1) ),
+                                                   std::max(todo_vec.size(), size_t(1)) ) );
+
+  //longest first, ordered by the file count since the image sets are not scanned yet
+  std::vector<size_t> size_vec(num_dataset, 0);
+  ParallelTasks(todo_vec.size(), num_threads, [&](const size_t k){
+    size_vec[ todo_vec[k] ] = CountDirEntries(dataset_vec[ todo_vec[k] ].cal_photo_dir);
+  });
+  std::stable_sort( todo_vec.begin(), todo_vec.end(), [&size_vec](const size_t a, const size_t b){
+    return size_vec[a] > size_vec[b];
+  } );
+  printf("RunBatchCalibration(): %zu datasets, %d jobs sharing %d threads\n", todo_vec.size(), num_jobs, num_threads);
+
+  std::vector<pipelineProgress_t> progress_vec(num_jobs); //one per job slot, only the cancel flag is used
+  std::atomic<size_t> next_todo(0), num_left( todo_vec.size() );
+  std::mutex mutex;
+  std::condition_variable done_cv;
+  int num_job_running = num_jobs;
+  auto job = [&](const int slot){
+    for(size_t k = next_todo++; k < todo_vec.size() && !progress_vec[slot].Cancelled(); k = next_todo++){
+      const size_t d = todo_vec[k];
+      //the threads are split among the datasets still running, the last ones get more each
+      const int share = std::max( 1, num_threads / static_cast<int>( std::min( static_cast<size_t>(num_jobs),
+                                                                               num_left.load() ) ) );
+      printf( "RunBatchCalibration(): starting %s with %d threads\n", dataset_vec[d].cal_photo_dir.c_str(), share );
+      batchDatasetResult_t &result = result_vec[d];
+      CalibrateDataset(dataset_vec[d], share, &progress_vec[slot], result);
+      --num_left;
+      printf( "RunBatchCalibration(): %s %s in %.1f s, %zu views, rms %f\n", result.cal_photo_dir.c_str(),
+              BatchStateName(result.state), result.time_s, result.num_views, result.rms_error );
+      if(journal && result.state != BATCH_CANCELLED){
+        std::lock_guard<std::mutex> lock(mutex);
+        fprintf( journal, "%s\t%zu\t%.9g\t%.9g\t%.3f\t%d\t%s\n", BatchStateName(result.state), result.num_views,
+                 result.rms_error, result.epipolar_error, result.time_s, result.num_threads,
+                 result.cal_photo_dir.c_str() );
+        fflush(journal);
+      }
+    }
+    std::lock_guard<std::mutex> lock(mutex);
+    --num_job_running;
+    done_cv.notify_all();
+  };
+  std::vector<std::thread> job_vec;
+  for(int slot = 0; slot < num_jobs; ++slot)
+    job_vec.emplace_back(job, slot);
+
+  //the caller's cancel flag is passed on to the running datasets
+  {
+    std::unique_lock<std::mutex> lock(mutex);
+    while(num_job_running > 0){
+      done_cv.wait_for( lock, std::chrono::milliseconds(100) );
+      if(cancel && *cancel)
+        for(auto &progress : progress_vec)
+          progress.cancel = true;
+    }
+  }
+  for(auto &thread : job_vec)
+    thread.join();
+  if(journal)
+    fclose(journal);
+
+  const double wall_time_s = std::chrono::duration<double>(std::chrono::steady_clock::now() - start_time).count();
+  if( PipelineTrace *trace = trace_session.Trace() ){
+    trace->SetInfo("mode", "batch");
+    trace->SetInfo( "num_dataset", static_cast<double>(num_dataset) );
+    trace->SetInfo("num_jobs", num_jobs);
+    trace->SetInfo("num_threads", num_threads);
+  }
+  if( !params.summary_file.empty() && WriteBatchSummary(params.summary_file, result_vec, wall_time_s) )
+    printf( "RunBatchCalibration(): wrote %s\n", params.summary_file.c_str() );
+
+  return cancel && *cancel ? 1 : 0;
+}
+
+
+bool WriteBatchSummary(const std::string &file_name_full, const std::vector<batchDatasetResult_t> &result_vec,
+                       const double wall_time_s){
+  cv::FileStorage fs(file_name_full, cv::FileStorage::WRITE);
+  EXP_CHK_M(fs.isOpened(), return(false), "could not write " + file_name_full)
+
+  int num_state[BATCH_CANCELLED + 1] = {0};
+  size_t num_run_views = 0;
+  for(auto &result : result_vec){
+    ++num_state[result.state];
+    if(!result.from_journal && result.state == BATCH_OK)
+      num_run_views += result.num_views;
+  }
+  fs << "num_dataset" << static_cast<int>( result_vec.size() );
+  for(int state = BATCH_PENDING; state <= BATCH_CANCELLED; ++state)
+    fs << std::string("num_") + BatchStateName(state) << num_state[state];
+  fs << "wall_time_s" << wall_time_s;
+  //throughput of this run only, datasets taken from the journal did not cost anything
+  fs << "views_per_s" << (wall_time_s > 0 ? num_run_views / wall_time_s : 0.0);
+  fs << "datasets" << "[";
+  for(auto &result : result_vec){
+    fs << "{";
+    fs << "cal_photo_dir" << result.cal_photo_dir;
+    fs << "state" << BatchStateName(result.state);
+    fs << "from_journal" << static_cast<int>(result.from_journal);
+    fs << "num_views" << static_cast<int>(result.num_views);
+    fs << "rms_error" << result.rms_error;
+    fs << "epipolar_error" << result.epipolar_error;
+    fs << "time_s" << result.time_s;
+    fs << "num_threads" << result.num_threads;
+    fs << "}";
+  }
+  fs << "]";
+
+  return true;
+}
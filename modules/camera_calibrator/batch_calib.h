@@ -0,0 +1,64 @@
+#ifndef __BATCH_CALIB__
+#define __BATCH_CALIB__
+
+#include <atomic>
+#include <string>
+#include <vector>
+#include "calib_pipeline.h"
+
+
+struct batchParams_t{
+  int num_jobs;             //datasets calibrated at once, <= 0 uses half the threads
+  int num_threads;          //threads shared by the jobs, <= 0 uses one per core
+  std::string journal_file; //one line per finished dataset, appended as they finish
+  std::string summary_file; //YAML summary of every dataset, written when the batch ends
+  std::string trace_file;   //Chrome trace of the whole batch, empty for none, see PipelineTrace
+  bool resume;              //skip the datasets journal_file lists as finished
+  bool retry_failed;        //with resume, run datasets that failed again
+
+  batchParams_t() : num_jobs(0), num_threads(0), resume(true), retry_failed(false) {}
+};
+
+enum{
+  BATCH_PENDING = 0,
+  BATCH_OK,
+  BATCH_FAILED,
+  BATCH_CANCELLED
+};
+
+struct batchDatasetResult_t{
+  std::string cal_photo_dir;
+  int state;               //BATCH_*
+  bool from_journal;       //finished by an earlier run of the batch
+  size_t num_views;        //image sets used by the calibration
+  double rms_error;
+  double epipolar_error;   //stereo only
+  double time_s;
+  int num_threads;
+
+  batchDatasetResult_t() : state(BATCH_PENDING), from_journal(false), num_views(0), rms_error(0), epipolar_error(0),
+                           time_s(0), num_threads(0) {}
+};
+
+const char *BatchStateName(const int state);
+
+//Reads a manifest of datasets. Each entry of its "datasets" sequence is a map with any config file key
+//(see ReadCalibOptions()) and at least cal_photo_dir; it is layered over the manifest's optional "defaults"
+//map, which is layered over base_opt. Relative cal_photo_dir paths are relative to the manifest.
+bool ReadBatchManifest(const std::string &file_name_full, const calibOptions_t &base_opt,
+                       std::vector<calibOptions_t> &dataset_vec);
+
+//Calibrates every dataset with RunCalibrationPipeline() or RunRigCalibrationPipeline(), num_jobs at a time.
+//Datasets are taken largest first (by directory entries) from a shared queue so long ones do not end up last,
+//and each job splits the batch threads with the jobs still running, so image level detection speeds up as
+//the queue drains. Finished datasets are appended to the journal, which a later run with resume reads to
+//skip them; cancelled and interrupted datasets are not journaled and run again. cancel stops the running
+//datasets at their next image set or stage. result_vec is indexed like dataset_vec. Returns 0 when every
+//dataset finished (failed ones included, see result_vec), 1 when cancelled, -1 on failure.
+int RunBatchCalibration(const std::vector<calibOptions_t> &dataset_vec, const batchParams_t &params,
+                        std::vector<batchDatasetResult_t> &result_vec, const std::atomic<bool> *cancel = NULL);
+
+bool WriteBatchSummary(const std::string &file_name_full, const std::vector<batchDatasetResult_t> &result_vec,
+                       const double wall_time_s);
+
+#endif //__BATCH_CALIB__
@@ -0,0 +1,74 @@
+#ifndef __BOUNDED_QUEUE__
+#define __BOUNDED_QUEUE__
+
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+
+
+//Multi-producer/multi-consumer FIFO with a fixed capacity. Push() blocks while the queue is full and Pop()
+//blocks while it is empty, which bounds how far producers can run ahead of consumers. After Close(), Push()
+//fails immediately and Pop() drains what is left, then fails. Producers that must never wait (ie. a live
+//camera) use PushDropOldest() instead, which makes room by discarding the oldest item.
+template <typename T>
+class BoundedQueue{
+  public:
+    explicit BoundedQueue(const size_t capacity) : m_capacity(capacity > 0 ? capacity : 1), m_closed(false) {}
+
+    bool Push(T item){
+      std::unique_lock<std::mutex> lock(m_mutex);
+      m_not_full.wait(lock, [this](){ return m_closed || m_queue.size() < m_capacity; });
+      if(m_closed)
+        return false;
+      m_queue.push_back( std::move(item) );
+      m_not_empty.notify_one();
+      return true;
+    }
+
+    //never blocks, returns the number of items discarded to make room (0 or 1), or -1 once closed
+    int PushDropOldest(T item){
+      std::lock_guard<std::mutex> lock(m_mutex);
+      if(m_closed)
+        return -1;
+      int num_dropped = 0;
+      if(m_queue.size() >= m_capacity){
+        m_queue.pop_front();
+        num_dropped = 1;
+      }
+      m_queue.push_back( std::move(item) );
+      m_not_empty.notify_one();
+      return num_dropped;
+    }
+
+    bool Pop(T &item){
+      std::unique_lock<std::mutex> lock(m_mutex);
+      m_not_empty.wait(lock, [this](){ return m_closed || !m_queue.empty(); });
+      if( m_queue.empty() )
+        return false;
+      item = std::move( m_queue.front() );
+      m_queue.pop_front();
+      m_not_full.notify_one();
+      return true;
+    }
+
+    void Close(){
+      std::lock_guard<std::mutex> lock(m_mutex);
+      m_closed = true;
+      m_not_full.notify_all();
+      m_not_empty.notify_all();
+    }
+
+    size_t Size(){
+      std::lock_guard<std::mutex> lock(m_mutex);
+      return m_queue.size();
+    }
+
+  private:
+    const size_t m_capacity;
+    bool m_closed;
+    std::deque<T> m_queue;
+    std::mutex m_mutex;
+    std::condition_variable m_not_full, m_not_empty;
+};
+
+#endif //__BOUNDED_QUEUE__
@@ -0,0 +1,236 @@
+#include "cal_binary.h"
+#include <algorithm>
+#include <cstdio>
+#include <fstream>
+#include <vector>
+#include "mio/altro/io.h"
+
+
+std::string CalBinaryFileName(const std::string &file_name){
+  const size_t dot_pos = file_name.rfind('.'),
+               slash_pos = file_name.rfind('/');
+  const bool has_ext = dot_pos != std::string::npos && (slash_pos == std::string::npos || dot_pos > slash_pos);
+  return (has_ext ? file_name.substr(0, dot_pos) : file_name) + ".ccal";
+}
+
+
+//copies up to max_size elements of mat as doubles, returns the number copied
+static uint32_t CopyMat(const cv::Mat &mat, double *dst, const size_t max_size){
+  if( mat.empty() )
+    return 0;
+  cv::Mat mat_64f;
+  mat.convertTo(mat_64f, CV_64F);
+  const size_t size = std::min(mat_64f.total(), max_size);
+  std::copy(mat_64f.ptr<double>(), mat_64f.ptr<double>() + size, dst);
+  return static_cast<uint32_t>(size);
+}
+
+
+static cv::Mat ToMat(const double *src, const int rows, const int cols){
+  cv::Mat mat(rows, cols, CV_64F);
+  std::copy( src, src + rows*cols, mat.ptr<double>() );
+  return mat;
+}
+
+
+static calBinCamera_t EmptyCamera(const cv::Size img_size){
+  calBinCamera_t camera;
+  memset( &camera, 0, sizeof(camera) );
+  camera.width = img_size.width;
+  camera.height = img_size.height;
+  camera.R[0] = camera.R[4] = camera.R[8] = 1;
+  return camera;
+}
+
+
+static uint64_t Align64(const uint64_t offset){
+  return (offset + 63) / 64 * 64;
+}
+
+
+static uint64_t ChecksumMat(const cv::Mat &mat, uint64_t hash){
+  for(int r = 0; r < mat.rows; ++r) //row by row, the maps may be ROIs
+    hash = CalBinChecksum(mat.ptr(r), mat.cols * mat.elemSize(), hash);
+  return hash;
+}
+
+
+static void WritePadding(std::ofstream &ofs, const uint64_t offset){
+  static const char padding[64] = {0};
+  const uint64_t pos = static_cast<uint64_t>( ofs.tellp() );
+  if(offset > pos)
+    ofs.write( padding, static_cast<std::streamsize>(offset - pos) );
+}
+
+
+//fills in the layout fields and checksums of header/camera_vec and writes the file
+static bool WriteCalBinary(const std::string &file_name_full, calBinHeader_t &header,
+                           std::vector<calBinCamera_t> &camera_vec, const rectMaps_t *rect_maps){
+  const size_t num_camera = camera_vec.size();
+  memcpy(header.magic, "CCAL", 4);
+  header.version = CAL_BIN_VERSION;
+  header.header_size = sizeof(calBinHeader_t);
+  header.camera_size = sizeof(calBinCamera_t);
+  header.num_camera = static_cast<uint32_t>(num_camera);
+
+  const bool with_maps = rect_maps && !rect_maps->Empty();
+  if(with_maps){
+    EXP_CHK_M(rect_maps->map_xy.size() == num_camera && rect_maps->map_interp.size() == num_camera, return(false),
+              "SaveCalBinary() - rectification maps do not match the cameras")
+    for(size_t j = 0; j < num_camera; ++j)
+      EXP_CHK_M(rect_maps->map_xy[j].type() == CV_16SC2 && rect_maps->map_interp[j].type() == CV_16UC1 &&
+                rect_maps->map_xy[j].size() == cv::Size(camera_vec[j].width, camera_vec[j].height) &&
+                rect_maps->map_interp[j].size() == rect_maps->map_xy[j].size(),
+                return(false), "SaveCalBinary() - maps must be CV_16SC2 + CV_16UC1 of the image size")
+    header.flags |= CAL_BIN_HAS_MAPS;
+  }
+
+  uint64_t offset = header.header_size + num_camera * sizeof(calBinCamera_t);
+  header.maps_checksum = 0;
+  if(with_maps){
+    uint64_t hash = 14695981039346656037ULL;
+    for(size_t j = 0; j < num_camera; ++j){
+      const uint64_t num_pixel = static_cast<uint64_t>(camera_vec[j].width) * camera_vec[j].height;
+      camera_vec[j].map_xy_offset = offset = Align64(offset);
+      offset += 4*num_pixel;
+      camera_vec[j].map_interp_offset = offset = Align64(offset);
+      offset += 2*num_pixel;
+      hash = ChecksumMat(rect_maps->map_xy[j], hash);
+      hash = ChecksumMat(rect_maps->map_interp[j], hash);
+    }
+    header.maps_checksum = hash;
+  }
+  header.file_size = offset;
+  header.params_checksum = CalBinParamsChecksum(&header, &camera_vec[0]);
+
+  //written to a temporary file and renamed so a runtime mapping the file never sees a partial one
+  const std::string tmp_file_name_full = file_name_full + ".tmp";
+  {
+    std::ofstream ofs(tmp_file_name_full, std::ios::binary | std::ios::trunc);
+    EXP_CHK_M(ofs.is_open(), return(false), "could not write " + tmp_file_name_full)
+    ofs.write( reinterpret_cast<const char*>(&header), sizeof(header) );
+    ofs.write( reinterpret_cast<const char*>(&camera_vec[0]), num_camera * sizeof(calBinCamera_t) );
+    for(size_t j = 0; j < num_camera && with_maps; ++j){
+      const cv::Mat *map[2] = { &rect_maps->map_xy[j], &rect_maps->map_interp[j] };
+      const uint64_t map_offset[2] = { camera_vec[j].map_xy_offset, camera_vec[j].map_interp_offset };
+      for(int k = 0; k < 2; ++k){
+        WritePadding(ofs, map_offset[k]);
+        for(int r = 0; r < map[k]->rows; ++r)
+          ofs.write( reinterpret_cast<const char*>( map[k]->ptr(r) ), map[k]->cols * map[k]->elemSize() );
+      }
+    }
+    EXP_CHK_M(ofs.good() && static_cast<uint64_t>( ofs.tellp() ) == header.file_size, return(false),
+              "error writing " + tmp_file_name_full)
+  }
+  EXP_CHK_M(rename(tmp_file_name_full.c_str(), file_name_full.c_str()) == 0, return(false),
+            "could not replace " + file_name_full)
+
+  return true;
+}
+
+
+bool SaveStereoCalBinary(const std::string &file_name_full, const stereoCalData_t &cal_data, const size_t num_camera,
+                         const rectMaps_t *rect_maps){
+  EXP_CHK(num_camera == 1 || num_camera == 2, return(false))
+  calBinHeader_t header;
+  memset( &header, 0, sizeof(header) );
+  std::vector<calBinCamera_t> camera_vec;
+  bool has_rect = num_camera == 2 && !cal_data.Q.empty();
+  for(size_t j = 0; j < num_camera; ++j){
+    calBinCamera_t camera = EmptyCamera(cal_data.img_size);
+    EXP_CHK_M(CopyMat(cal_data.K[j], camera.K, 9) == 9, return(false), "SaveStereoCalBinary() - no camera matrix")
+    camera.num_dist = CopyMat(cal_data.D[j], camera.D, 14);
+    if(j == 1){
+      EXP_CHK_M(CopyMat(cal_data.R, camera.R, 9) == 9 && CopyMat(cal_data.T, camera.T, 3) == 3, return(false),
+                "SaveStereoCalBinary() - no extrinsics")
+    }
+    has_rect = has_rect && CopyMat(cal_data.R_rect[j], camera.R_rect, 9) == 9 &&
+               CopyMat(cal_data.P_rect[j], camera.P_rect, 12) == 12;
+    camera_vec.push_back(camera);
+  }
+  if(has_rect){
+    CopyMat(cal_data.Q, header.Q, 16);
+    header.flags |= CAL_BIN_HAS_RECT;
+  }
+  else{
+    for(auto &camera : camera_vec){
+      memset( camera.R_rect, 0, sizeof(camera.R_rect) );
+      memset( camera.P_rect, 0, sizeof(camera.P_rect) );
+    }
+  }
+  //maps without the rectification they were made from would be meaningless
+  const bool maps_match = rect_maps && has_rect && rect_maps->params_hash == RectParamsHash(cal_data);
+  if(rect_maps && !maps_match)
+    printf("SaveStereoCalBinary(): rectification maps do not match the calibration, not included\n");
+
+  return WriteCalBinary(file_name_full, header, camera_vec, maps_match ? rect_maps : NULL);
+}
+
+
+bool SaveRigCalBinary(const std::string &file_name_full, const rigCalData_t &rig_data){
+  EXP_CHK(rig_data.NumCamera() > 0, return(false))
+  calBinHeader_t header;
+  memset( &header, 0, sizeof(header) );
+  std::vector<calBinCamera_t> camera_vec;
+  for(size_t j = 0; j < rig_data.NumCamera(); ++j){
+    calBinCamera_t camera = EmptyCamera(rig_data.img_size[j]);
+    EXP_CHK_M(CopyMat(rig_data.K[j], camera.K, 9) == 9, return(false), "SaveRigCalBinary() - no camera matrix")
+    camera.num_dist = CopyMat(rig_data.D[j], camera.D, 14);
+    if( !rig_data.R[j].empty() ){
+      CopyMat(rig_data.R[j], camera.R, 9);
+      CopyMat(rig_data.T[j], camera.T, 3);
+    }
+    camera_vec.push_back(camera);
+  }
+  return WriteCalBinary(file_name_full, header, camera_vec, NULL);
+}
+
+
+bool LoadStereoCalBinary(const std::string &file_name_full, stereoCalData_t &cal_data, rectMaps_t *rect_maps,
+                         const bool verify_maps){
+  std::ifstream ifs(file_name_full, std::ios::binary | std::ios::ate);
+  if( !ifs.is_open() )
+    return false;
+  const std::streamoff size = ifs.tellg();
+  EXP_CHK_M(size > 0, return(false), file_name_full + " is empty")
+  std::vector<uint64_t> buffer( (static_cast<size_t>(size) + 7) / 8 ); //8 byte aligned for CalBinParse()
+  ifs.seekg(0);
+  EXP_CHK_M(ifs.read(reinterpret_cast<char*>(&buffer[0]), size), return(false), "could not read " + file_name_full)
+
+  calBinFile_t file;
+  const int err = CalBinParse(&buffer[0], static_cast<size_t>(size), verify_maps, &file);
+  EXP_CHK_M(err == CAL_BIN_OK, return(false), file_name_full + ": " + CalBinErrorString(err))
+  EXP_CHK_M(file.NumCamera() <= 2, return(false), file_name_full + " holds a rig, not a stereo pair")
+
+  //only the parameters are replaced, the detected views of cal_data are kept
+  cal_data.img_size = cv::Size(file.camera[0].width, file.camera[0].height);
+  for(size_t j = 0; j < file.NumCamera(); ++j){
+    const calBinCamera_t &camera = file.camera[j];
+    cal_data.K[j] = ToMat(camera.K, 3, 3);
+    cal_data.D[j] = ToMat( camera.D, 1, static_cast<int>( std::min(camera.num_dist, 14U) ) );
+    if( file.HasRect() ){
+      cal_data.R_rect[j] = ToMat(camera.R_rect, 3, 3);
+      cal_data.P_rect[j] = ToMat(camera.P_rect, 3, 4);
+    }
+  }
+  if(file.NumCamera() == 2){
+    cal_data.R = ToMat(file.camera[1].R, 3, 3);
+    cal_data.T = ToMat(file.camera[1].T, 3, 1);
+  }
+  if( file.HasRect() )
+    cal_data.Q = ToMat(file.header->Q, 4, 4);
+
+  if( rect_maps && file.HasMaps() ){
+    rectMaps_t maps;
+    maps.img_size = cal_data.img_size;
+    maps.params_hash = RectParamsHash(cal_data);
+    for(size_t j = 0; j < file.NumCamera(); ++j){
+      const cv::Size map_size(file.camera[j].width, file.camera[j].height);
+      maps.map_xy.push_back( cv::Mat( map_size, CV_16SC2, const_cast<int16_t*>( file.MapXY(j) ) ).clone() );
+      maps.map_interp.push_back( cv::Mat( map_size, CV_16UC1, const_cast<uint16_t*>( file.MapInterp(j) ) ).clone() );
+    }
+    *rect_maps = maps;
+  }
+
+  return true;
+}
@@ -0,0 +1,30 @@
+#ifndef __CAL_BINARY__
+#define __CAL_BINARY__
+
+#include <string>
+#include "opencv2/core.hpp"
+#include "mvg/stereo_compute.h"
+#include "cal_binary_loader.h"
+#include "rect_maps.h"
+#include "rig_calib.h"
+
+
+//Compact binary calibration output next to the cv::FileStorage files, for runtimes that should not parse
+//XML/YAML at startup. The layout is documented in cal_binary_loader.h, which reads it without OpenCV.
+
+//file name of the binary next to a calibration file, ie. "extrinsics.yml" -> "extrinsics.ccal"
+std::string CalBinaryFileName(const std::string &file_name);
+
+//K, D (and R, T, R_rect, P_rect, Q in stereo mode) of the first num_camera cameras of cal_data. rect_maps, when
+//non-NULL and made for cal_data, adds the rectification tables. Written to a temporary file and renamed.
+bool SaveStereoCalBinary(const std::string &file_name_full, const stereoCalData_t &cal_data, const size_t num_camera,
+                         const rectMaps_t *rect_maps = NULL);
+//K, D, R, T of every rig camera, no rectification
+bool SaveRigCalBinary(const std::string &file_name_full, const rigCalData_t &rig_data);
+
+//reads a file written by SaveStereoCalBinary() back into cal_data (and rect_maps when non-NULL and present),
+//verify_maps also checks the map checksum
+bool LoadStereoCalBinary(const std::string &file_name_full, stereoCalData_t &cal_data, rectMaps_t *rect_maps = NULL,
+                         const bool verify_maps = false);
+
+#endif //__CAL_BINARY__
@@ -0,0 +1,203 @@
+#ifndef __CAL_BINARY_LOADER__
+#define __CAL_BINARY_LOADER__
+
+//Standalone reader of the binary calibration files written by SaveStereoCalBinary()/SaveRigCalBinary(). Only
+//needs the C++ standard headers (and POSIX for CalBinMapFile()), no OpenCV, and never allocates: the file is
+//mapped or read into a caller owned buffer and calBinFile_t points into it. Copy this header into the runtime.
+//
+//Layout, native byte order (little endian on every supported platform), all offsets from the start of the file:
+//  0:                                  calBinHeader_t
+//  header_size:                        calBinCamera_t[num_camera]
+//  camera[j].map_xy_offset:            CV_16SC2 rectification map of camera j, width*height*4 bytes, row major
+//  camera[j].map_interp_offset:        CV_16UC1 interpolation table of camera j, width*height*2 bytes, row major
+//The map tables are 64 byte aligned and can be wrapped in cv::Mat headers and passed to cv::remap() directly.
+//params_checksum covers the header and the camera records and is always checked, maps_checksum covers the
+//map tables and is only checked on request since it touches every byte.
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#if defined(__unix__) || defined(__APPLE__)
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+
+#define CAL_BIN_VERSION 1
+
+enum{
+  CAL_BIN_HAS_RECT = 1, //R_rect, P_rect and Q are set
+  CAL_BIN_HAS_MAPS = 2  //every camera has map tables
+};
+
+enum{
+  CAL_BIN_OK = 0,
+  CAL_BIN_TRUNCATED,
+  CAL_BIN_BAD_MAGIC,
+  CAL_BIN_BAD_VERSION,
+  CAL_BIN_BAD_LAYOUT,
+  CAL_BIN_BAD_CHECKSUM
+};
+
+struct calBinHeader_t{
+  char magic[4];            //"CCAL"
+  uint32_t version;         //CAL_BIN_VERSION
+  uint32_t header_size;     //sizeof(calBinHeader_t)
+  uint32_t camera_size;     //sizeof(calBinCamera_t)
+  uint32_t num_camera;
+  uint32_t flags;           //CAL_BIN_HAS_*
+  uint64_t file_size;
+  uint64_t params_checksum; //CalBinChecksum() of the header with both checksums zeroed, then the camera records
+  uint64_t maps_checksum;   //CalBinChecksum() of the map tables in camera order, 0 without maps
+  double Q[16];             //row major 4x4 disparity-to-depth matrix (stereo), zero if none
+};
+
+//camera j relative to camera 0: a point x_0 in camera 0 is x_j = R*x_0 + T in camera j
+struct calBinCamera_t{
+  int32_t width, height;
+  uint32_t num_dist;          //used entries of D (k1 k2 p1 p2 [k3 [k4 k5 k6 [s1 s2 s3 s4 [tx ty]]]])
+  uint32_t reserved;
+  double K[9];                //row major
+  double D[14];
+  double R[9], T[3];          //identity and zero for camera 0
+  double R_rect[9], P_rect[12]; //row major, zero without CAL_BIN_HAS_RECT
+  uint64_t map_xy_offset;     //0 without CAL_BIN_HAS_MAPS
+  uint64_t map_interp_offset;
+};
+
+static_assert(sizeof(calBinHeader_t) == 176, "calBinHeader_t layout");
+static_assert(sizeof(calBinCamera_t) == 480, "calBinCamera_t layout");
+
+//FNV-1a 64, continue a running checksum by passing the previous value as hash
+inline uint64_t CalBinChecksum(const void *data, const size_t size, uint64_t hash = 14695981039346656037ULL){
+  const unsigned char *byte = static_cast<const unsigned char*>(data);
+  for(size_t i = 0; i < size; ++i){
+    hash ^= byte[i];
+    hash *= 1099511628211ULL;
+  }
+  return hash;
+}
+
+inline uint64_t CalBinParamsChecksum(const calBinHeader_t *header, const calBinCamera_t *camera){
+  calBinHeader_t header_copy; //on the stack
+  memcpy( &header_copy, header, sizeof(header_copy) );
+  header_copy.params_checksum = 0;
+  header_copy.maps_checksum = 0;
+  const uint64_t hash = CalBinChecksum( &header_copy, sizeof(header_copy) );
+  return CalBinChecksum(camera, header->num_camera * sizeof(calBinCamera_t), hash);
+}
+
+//a parsed file, points into the caller's buffer which must outlive it
+struct calBinFile_t{
+  const calBinHeader_t *header;
+  const calBinCamera_t *camera; //[header->num_camera]
+  const unsigned char *data;
+
+  size_t NumCamera() const { return header->num_camera; }
+  bool HasRect() const { return (header->flags & CAL_BIN_HAS_RECT) != 0; }
+  bool HasMaps() const { return (header->flags & CAL_BIN_HAS_MAPS) != 0; }
+  //width*height interleaved x, y pairs and width*height interpolation indices of camera j, NULL without maps
+  const int16_t *MapXY(const size_t j) const {
+    return HasMaps() ? reinterpret_cast<const int16_t*>(data + camera[j].map_xy_offset) : NULL;
+  }
+  const uint16_t *MapInterp(const size_t j) const {
+    return HasMaps() ? reinterpret_cast<const uint16_t*>(data + camera[j].map_interp_offset) : NULL;
+  }
+};
+
+//Validates data (size bytes, 8 byte aligned, ie. from CalBinMapFile()) and fills file. verify_maps also
+//checks maps_checksum. Returns CAL_BIN_OK or one of the CAL_BIN_* errors.
+inline int CalBinParse(const void *data, const size_t size, const bool verify_maps, calBinFile_t *file){
+  const unsigned char *byte = static_cast<const unsigned char*>(data);
+  if( size < sizeof(calBinHeader_t) || reinterpret_cast<uintptr_t>(data) % 8 != 0 )
+    return CAL_BIN_TRUNCATED;
+  const calBinHeader_t *header = reinterpret_cast<const calBinHeader_t*>(byte);
+  if( memcmp(header->magic, "CCAL", 4) != 0 )
+    return CAL_BIN_BAD_MAGIC;
+  if(header->version != CAL_BIN_VERSION)
+    return CAL_BIN_BAD_VERSION;
+  if( header->header_size != sizeof(calBinHeader_t) || header->camera_size != sizeof(calBinCamera_t) ||
+      header->num_camera == 0 || header->num_camera > 1024 )
+    return CAL_BIN_BAD_LAYOUT;
+  if( header->file_size > size || header->header_size + header->num_camera * sizeof(calBinCamera_t) > header->file_size )
+    return CAL_BIN_TRUNCATED;
+  const calBinCamera_t *camera = reinterpret_cast<const calBinCamera_t*>(byte + header->header_size);
+  if( CalBinParamsChecksum(header, camera) != header->params_checksum )
+    return CAL_BIN_BAD_CHECKSUM;
+
+  if(header->flags & CAL_BIN_HAS_MAPS){
+    uint64_t hash = 14695981039346656037ULL;
+    for(uint32_t j = 0; j < header->num_camera; ++j){
+      const uint64_t num_pixel = static_cast<uint64_t>(camera[j].width) * static_cast<uint64_t>(camera[j].height);
+      //written so that no sum or product can wrap around for a corrupt or crafted file
+      const uint64_t file_size = header->file_size;
+      if( camera[j].width <= 0 || camera[j].height <= 0 || num_pixel > file_size / 4 ||
+          camera[j].map_xy_offset % 8 != 0 || camera[j].map_interp_offset % 8 != 0 ||
+          camera[j].map_xy_offset > file_size || 4*num_pixel > file_size - camera[j].map_xy_offset ||
+          camera[j].map_interp_offset > file_size || 2*num_pixel > file_size - camera[j].map_interp_offset )
+        return CAL_BIN_BAD_LAYOUT;
+      if(verify_maps){
+        hash = CalBinChecksum(byte + camera[j].map_xy_offset, 4*num_pixel, hash);
+        hash = CalBinChecksum(byte + camera[j].map_interp_offset, 2*num_pixel, hash);
+      }
+    }
+    if(verify_maps && hash != header->maps_checksum)
+      return CAL_BIN_BAD_CHECKSUM;
+  }
+
+  file->header = header;
+  file->camera = camera;
+  file->data = byte;
+  return CAL_BIN_OK;
+}
+
+inline const char *CalBinErrorString(const int err){
+  switch(err){
+    case CAL_BIN_OK:           return "ok";
+    case CAL_BIN_TRUNCATED:    return "truncated or misaligned file";
+    case CAL_BIN_BAD_MAGIC:    return "not a calibration file";
+    case CAL_BIN_BAD_VERSION:  return "unsupported version";
+    case CAL_BIN_BAD_LAYOUT:   return "inconsistent layout";
+    case CAL_BIN_BAD_CHECKSUM: return "checksum mismatch";
+    default:                   return "unknown error";
+  }
+}
+
+#if defined(__unix__) || defined(__APPLE__)
+struct calBinMapping_t{
+  void *addr;
+  size_t size;
+};
+
+//maps file_name read only, false if it can not be opened or mapped
+inline bool CalBinMapFile(const char *file_name, calBinMapping_t *mapping){
+  mapping->addr = NULL;
+  mapping->size = 0;
+  const int fd = open(file_name, O_RDONLY);
+  if(fd < 0)
+    return false;
+  struct stat st;
+  if(fstat(fd, &st) != 0 || st.st_size <= 0){
+    close(fd);
+    return false;
+  }
+  void *addr = mmap(NULL, static_cast<size_t>(st.st_size), PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd); //the mapping stays valid
+  if(addr == MAP_FAILED)
+    return false;
+  mapping->addr = addr;
+  mapping->size = static_cast<size_t>(st.st_size);
+  return true;
+}
+
+inline void CalBinUnmapFile(calBinMapping_t *mapping){
+  if(mapping->addr)
+    munmap(mapping->addr, mapping->size);
+  mapping->addr = NULL;
+  mapping->size = 0;
+}
+#endif
+
+#endif //__CAL_BINARY_LOADER__
@@ -0,0 +1,391 @@
+#include "cal_image_store.h"
+#include "cal_target_detect.h"
+#include "opencv2/imgproc.hpp"
+#include "opencv2/calib3d.hpp"
+#include <algorithm>
+
+
+static size_t ImgBytes(const cv::Mat &img){
+  return img.total() * img.elemSize();
+}
+
+
+CalImageStore::CalImageStore(const size_t mem_cap_bytes, const size_t prefetch_radius) :
+    m_num_camera(0), m_generation(0), m_mem_usage(0), m_mem_cap(mem_cap_bytes), m_prefetch_radius(prefetch_radius),
+    m_stop(false){
+  m_prefetch_thread = std::thread(&CalImageStore::PrefetchThread, this);
+}
+
+
+CalImageStore::~CalImageStore(){
+  {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_stop = true;
+  }
+  m_cv.notify_all();
+  m_prefetch_thread.join();
+}
+
+
+void CalImageStore::Reset(const std::string &cal_img_dir, const camCalTarget_t &cal_target, const stereoCalData_t &cal_data,
+                          const size_t num_camera){
+  std::lock_guard<std::mutex> lock(m_mutex);
+  m_cal_img_dir = cal_img_dir;
+  m_cal_target = cal_target;
+  m_num_camera = num_camera;
+  m_file_names.assign(num_camera, std::vector<std::string>());
+  m_img_points.assign( num_camera, std::vector< std::vector<cv::Point2f> >() );
+  for(size_t j = 0; j < num_camera; ++j){
+    m_file_names[j] = cal_data.good_img_file_names[j];
+    m_img_points[j] = cal_data.img_points[j];
+  }
+  m_residuals.clear();
+  m_rect_maps = rectMaps_t();
+  m_cache.clear();
+  m_lru.clear();
+  m_mem_usage = 0;
+  m_prefetch_queue.clear();
+  ++m_generation;
+}
+
+
+//drops the rectified views made with the old maps, views in flight are discarded through m_generation
+void CalImageStore::EvictRectifiedLocked(){
+  for(auto it = m_lru.begin(); it != m_lru.end();){
+    if(*it % 2 == 1){
+      m_mem_usage -= ImgBytes(m_cache[*it].img);
+      m_cache.erase(*it);
+      it = m_lru.erase(it);
+    }
+    else
+      ++it;
+  }
+  ++m_generation;
+}
+
+
+void CalImageStore::SetRectification(const rectMaps_t &rect_maps){
+  std::lock_guard<std::mutex> lock(m_mutex);
+  m_rect_maps = rect_maps;
+  EvictRectifiedLocked();
+}
+
+
+void CalImageStore::ClearRectification(){
+  std::lock_guard<std::mutex> lock(m_mutex);
+  m_rect_maps = rectMaps_t();
+  EvictRectifiedLocked();
+}
+
+
+void CalImageStore::SetRawParams(const rawImageParams_t &raw){
+  std::lock_guard<std::mutex> lock(m_mutex);
+  if(raw.bit_depth == m_raw.bit_depth && raw.bayer_pattern == m_raw.bayer_pattern)
+    return;
+  m_raw = raw;
+  m_cache.clear();
+  m_lru.clear();
+  m_mem_usage = 0;
+  ++m_generation;
+}
+
+
+bool CalImageStore::HasRectification(){
+  std::lock_guard<std::mutex> lock(m_mutex);
+  return !m_rect_maps.Empty();
+}
+
+
+size_t CalImageStore::NumViews(){
+  std::lock_guard<std::mutex> lock(m_mutex);
+  return m_file_names.empty() ? 0 : m_file_names[0].size();
+}
+
+
+std::string CalImageStore::ViewName(const size_t idx){
+  std::lock_guard<std::mutex> lock(m_mutex);
+  std::string name;
+  for(size_t j = 0; j < m_num_camera; ++j)
+    if( idx < m_file_names[j].size() )
+      name += (j > 0 ? ", " : "") + m_file_names[j][idx];
+  return name;
+}
+
+
+//builds a view from the image files without holding the lock, generation tells the caller if the inputs
+//changed meanwhile
+cv::Mat CalImageStore::MakeView(const size_t key, size_t &generation){
+  const size_t idx = key / 2;
+  const bool rectified = key % 2 == 1;
+  std::string cal_img_dir;
+  std::vector<std::string> file_names;
+  rectMaps_t rect_maps;
+  rawImageParams_t raw;
+  {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    generation = m_generation;
+    if( m_num_camera == 0 || idx >= m_file_names[0].size() || ( rectified && m_rect_maps.Empty() ) )
+      return cv::Mat();
+    cal_img_dir = m_cal_img_dir;
+    for(size_t j = 0; j < m_num_camera; ++j)
+      file_names.push_back(m_file_names[j][idx]);
+    rect_maps = m_rect_maps; //cv::Mat headers only, the tables are shared
+    raw = m_raw;
+  }
+
+  std::vector<cv::Mat> img_vec( file_names.size() );
+  for(size_t j = 0; j < file_names.size(); ++j){
+    img_vec[j] = DisplayCalImage(DecodeCalImage(cal_img_dir + "/" + file_names[j], raw), raw);
+    if( img_vec[j].empty() )
+      return cv::Mat();
+  }
+
+  if(rectified)
+    for(size_t j = 0; j < img_vec.size() && j < rect_maps.map_xy.size(); ++j)
+      cv::remap(img_vec[j], img_vec[j], rect_maps.map_xy[j], rect_maps.map_interp[j], cv::INTER_LINEAR);
+
+  return ConcatCalImages(img_vec);
+}
+
+
+void CalImageStore::InsertLocked(const size_t key, const cv::Mat &img){
+  const size_t img_bytes = ImgBytes(img);
+  if(img_bytes > m_mem_cap || m_cache.count(key) > 0)
+    return;
+  m_lru.push_front(key);
+  m_cache[key] = cacheItem_t{img, m_lru.begin()};
+  m_mem_usage += img_bytes;
+  while(m_mem_usage > m_mem_cap && m_lru.size() > 1){ //evict least recently used, never the new view
+    const size_t evict_key = m_lru.back();
+    m_mem_usage -= ImgBytes(m_cache[evict_key].img);
+    m_cache.erase(evict_key);
+    m_lru.pop_back();
+  }
+}
+
+
+cv::Mat CalImageStore::Get(const size_t idx, const bool rectified){
+  const size_t key = Key(idx, rectified);
+  cv::Mat img;
+  {
+    std::unique_lock<std::mutex> lock(m_mutex);
+    m_cv.wait(lock, [&](){ return m_in_flight.count(key) == 0; }); //the prefetch thread is already making it
+    auto it = m_cache.find(key);
+    if( it != m_cache.end() ){
+      m_lru.splice(m_lru.begin(), m_lru, it->second.lru_it);
+      img = it->second.img;
+    }
+    else
+      m_in_flight.insert(key);
+    m_prefetch_queue.clear(); //neighbours of an earlier view are no longer interesting
+  }
+
+  if( img.empty() ){
+    size_t generation;
+    img = MakeView(key, generation);
+    {
+      std::lock_guard<std::mutex> lock(m_mutex);
+      m_in_flight.erase(key);
+      if(!img.empty() && generation == m_generation)
+        InsertLocked(key, img);
+    }
+    m_cv.notify_all();
+  }
+
+  for(size_t r = 1; r <= m_prefetch_radius; ++r){
+    Prefetch(idx + r, rectified);
+    if(idx >= r)
+      Prefetch(idx - r, rectified);
+  }
+
+  return img;
+}
+
+
+bool CalImageStore::TryGet(const size_t idx, const bool rectified, cv::Mat &img){
+  std::lock_guard<std::mutex> lock(m_mutex);
+  auto it = m_cache.find( Key(idx, rectified) );
+  if( it == m_cache.end() )
+    return false;
+  m_lru.splice(m_lru.begin(), m_lru, it->second.lru_it);
+  img = it->second.img;
+  return true;
+}
+
+
+cv::Mat CalImageStore::RenderForDisplay(const size_t idx, const bool rectified, const cv::Size max_size, const bool wait){
+  cv::Mat view;
+  if(wait)
+    view = Get(idx, rectified);
+  else
+    TryGet(idx, rectified, view);
+  if(view.empty() || max_size.width <= 0 || max_size.height <= 0)
+    return cv::Mat();
+
+  camCalTarget_t cal_target;
+  std::vector< std::vector<cv::Point2f> > img_points, residuals;
+  size_t num_camera;
+  {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    cal_target = m_cal_target;
+    num_camera = std::max(m_num_camera, size_t(1));
+    if(!rectified)
+      for(size_t j = 0; j < m_num_camera; ++j)
+        if( idx < m_img_points[j].size() )
+          img_points.push_back(m_img_points[j][idx]);
+    if( !rectified && m_residuals.size() == img_points.size() )
+      for(size_t j = 0; j < m_residuals.size(); ++j)
+        residuals.push_back( idx < m_residuals[j].size() ? m_residuals[j][idx] : std::vector<cv::Point2f>() );
+  }
+
+  //only the screen sized image is converted and drawn on, the cached view is shared and stays untouched
+  const double scale = std::min( 1.0, std::min( static_cast<double>(max_size.width) / view.cols,
+                                                static_cast<double>(max_size.height) / view.rows ) );
+  cv::Mat disp_img;
+  if(scale < 1)
+    cv::resize(view, disp_img, cv::Size( std::max( 1, cvRound(view.cols * scale) ), std::max( 1, cvRound(view.rows * scale) ) ),
+               0, 0, cv::INTER_AREA);
+  else
+    disp_img = view;
+  const bool overlay = rectified || !img_points.empty();
+  if(disp_img.channels() == 1 && !overlay)
+    return disp_img;
+  if(disp_img.channels() == 1)
+    cv::cvtColor(disp_img, disp_img, cv::COLOR_GRAY2BGR);
+  else if(disp_img.data == view.data)
+    disp_img = disp_img.clone();
+
+  if(rectified)
+    for(int y = 0; y < disp_img.rows; y += 16) //epipolar lines
+      cv::line(disp_img, cv::Point(0, y), cv::Point(disp_img.cols, y), cv::Scalar(0, 255, 0), 1);
+  const double cam_width = static_cast<double>(view.cols) / num_camera;
+  for(size_t j = 0; j < img_points.size(); ++j){
+    std::vector<cv::Point2f> disp_points( img_points[j].size() );
+    for(size_t k = 0; k < disp_points.size(); ++k)
+      disp_points[k] = cv::Point2f( static_cast<float>( (img_points[j][k].x + j * cam_width) * scale ),
+                                    static_cast<float>(img_points[j][k].y * scale) );
+    cv::drawChessboardCorners(disp_img, cal_target.size, disp_points, true);
+    if( j < residuals.size() && residuals[j].size() == disp_points.size() )
+      for(size_t k = 0; k < disp_points.size(); ++k)
+        cv::arrowedLine( disp_img, disp_points[k], disp_points[k] + residuals[j][k] * static_cast<float>(scale),
+                         cv::Scalar(0, 0, 255), 1, cv::LINE_AA, 0, 0.2 );
+  }
+  cv::cvtColor(disp_img, disp_img, cv::COLOR_BGR2RGB);
+
+  return disp_img;
+}
+
+
+void CalImageStore::Put(const size_t idx, const bool rectified, const cv::Mat &img){
+  std::lock_guard<std::mutex> lock(m_mutex);
+  if( !img.empty() && m_num_camera > 0 && idx < m_file_names[0].size() )
+    InsertLocked(Key(idx, rectified), img);
+}
+
+
+void CalImageStore::Prefetch(const size_t idx, const bool rectified){
+  const size_t key = Key(idx, rectified);
+  {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    if( m_num_camera == 0 || idx >= m_file_names[0].size() || ( rectified && m_rect_maps.Empty() ) ||
+        m_cache.count(key) > 0 || m_in_flight.count(key) > 0 ||
+        std::find(m_prefetch_queue.begin(), m_prefetch_queue.end(), key) != m_prefetch_queue.end() )
+      return;
+    m_prefetch_queue.push_back(key);
+  }
+  m_cv.notify_all();
+}
+
+
+void CalImageStore::PrefetchThread(){
+  std::unique_lock<std::mutex> lock(m_mutex);
+  while(true){
+    m_cv.wait(lock, [this](){ return m_stop || !m_prefetch_queue.empty(); });
+    if(m_stop)
+      return;
+    const size_t key = m_prefetch_queue.front();
+    m_prefetch_queue.pop_front();
+    if(m_cache.count(key) > 0 || m_in_flight.count(key) > 0)
+      continue;
+    m_in_flight.insert(key);
+
+    lock.unlock();
+    size_t generation;
+    const cv::Mat img = MakeView(key, generation);
+    lock.lock();
+
+    m_in_flight.erase(key);
+    if(!img.empty() && generation == m_generation)
+      InsertLocked(key, img);
+    m_cv.notify_all();
+  }
+}
+
+
+void CalImageStore::SetViews(const stereoCalData_t &cal_data){
+  std::lock_guard<std::mutex> lock(m_mutex);
+  for(size_t j = 0; j < m_num_camera; ++j){
+    m_file_names[j] = cal_data.good_img_file_names[j];
+    m_img_points[j] = cal_data.img_points[j];
+  }
+  m_residuals.clear();
+  //views are cached by index, which shifted
+  m_cache.clear();
+  m_lru.clear();
+  m_mem_usage = 0;
+  m_prefetch_queue.clear();
+  ++m_generation;
+}
+
+
+//existing views keep their index, so nothing cached has to be dropped
+size_t CalImageStore::AppendView(const std::vector<std::string> &file_names,
+                                 const std::vector< std::vector<cv::Point2f> > &img_points, const cv::Mat &img){
+  std::lock_guard<std::mutex> lock(m_mutex);
+  for(size_t j = 0; j < m_num_camera; ++j){
+    m_file_names[j].push_back( j < file_names.size() ? file_names[j] : std::string() );
+    m_img_points[j].push_back( j < img_points.size() ? img_points[j] : std::vector<cv::Point2f>() );
+  }
+  const size_t idx = m_num_camera > 0 ? m_file_names[0].size() - 1 : 0;
+  if( !img.empty() && m_num_camera > 0 )
+    InsertLocked(Key(idx, false), img);
+  return idx;
+}
+
+
+//only the rendering changes, the cached views stay valid
+void CalImageStore::SetResidualVectors(const std::vector< std::vector< std::vector<cv::Point2f> > > &residuals){
+  std::lock_guard<std::mutex> lock(m_mutex);
+  m_residuals = residuals;
+  ++m_generation;
+}
+
+
+size_t CalImageStore::Generation(){
+  std::lock_guard<std::mutex> lock(m_mutex);
+  return m_generation;
+}
+
+
+size_t CalImageStore::MemoryUsage(){
+  std::lock_guard<std::mutex> lock(m_mutex);
+  return m_mem_usage;
+}
+
+
+size_t CalImageStore::MemoryCap(){
+  std::lock_guard<std::mutex> lock(m_mutex);
+  return m_mem_cap;
+}
+
+
+void CalImageStore::SetMemoryCap(const size_t mem_cap_bytes){
+  std::lock_guard<std::mutex> lock(m_mutex);
+  m_mem_cap = mem_cap_bytes;
+  while(m_mem_usage > m_mem_cap && !m_lru.empty() ){
+    const size_t evict_key = m_lru.back();
+    m_mem_usage -= ImgBytes(m_cache[evict_key].img);
+    m_cache.erase(evict_key);
+    m_lru.pop_back();
+  }
+}
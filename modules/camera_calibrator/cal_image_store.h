@@ -0,0 +1,100 @@
+#ifndef __CAL_IMAGE_STORE__
+#define __CAL_IMAGE_STORE__
+
+#include <condition_variable>
+#include <deque>
+#include <list>
+#include <mutex>
+#include <set>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+#include "opencv2/core.hpp"
+#include "mvg/stereo_compute.h"
+#include "rect_maps.h"
+
+
+//Lazy, memory bounded replacement for fully materialized calibration image vectors. A view is the side by
+//side image of one detected image set, as decoded or rectified, at full resolution and without overlays. Views
+//are made on demand from the image files, kept in an LRU cache limited to a byte budget, and the neighbours of
+//the last requested view are prepared on a background thread. RenderForDisplay() scales a view down and draws
+//the detected points (or epipolar lines) on the small image.
+class CalImageStore{
+  public:
+    explicit CalImageStore(const size_t mem_cap_bytes = size_t(1024) << 20, const size_t prefetch_radius = 2);
+    ~CalImageStore();
+
+    //copies the detected views (good_img_file_names/img_points) of cal_data and drops every cached view
+    void Reset(const std::string &cal_img_dir, const camCalTarget_t &cal_target, const stereoCalData_t &cal_data,
+               const size_t num_camera);
+    //rectified views are remapped with rect_maps (stereo only), drops cached rectified views
+    void SetRectification(const rectMaps_t &rect_maps);
+    void ClearRectification();
+    bool HasRectification();
+    //how the image files are decoded, views are always 8 bit, drops every cached view when it changes
+    void SetRawParams(const rawImageParams_t &raw);
+
+    size_t NumViews();
+    std::string ViewName(const size_t idx);
+    //returns an empty Mat if idx is out of range or the images can not be read
+    cv::Mat Get(const size_t idx, const bool rectified);
+    //non-blocking Get(), false when the view is not in the cache (ie. the prefetch thread is still making it)
+    bool TryGet(const size_t idx, const bool rectified, cv::Mat &img);
+    //the view scaled to fit max_size (never enlarged) with the detected points drawn on the scaled image, or
+    //epipolar lines for rectified views. 8 bit gray or RGB channel order, ready to be wrapped by a display
+    //toolkit. With wait false an empty Mat is returned while the view is not cached.
+    cv::Mat RenderForDisplay(const size_t idx, const bool rectified, const cv::Size max_size, const bool wait = true);
+    //seeds a view made elsewhere (ie. during detection), ignored if it does not fit the budget
+    void Put(const size_t idx, const bool rectified, const cv::Mat &img);
+    void Prefetch(const size_t idx, const bool rectified);
+
+    //takes the view list of cal_data after views were dropped or restored, keeps the rectification
+    void SetViews(const stereoCalData_t &cal_data);
+    //adds a view behind the current ones (ie. while detection is still running), img may be empty
+    size_t AppendView(const std::vector<std::string> &file_names, const std::vector< std::vector<cv::Point2f> > &img_points,
+                      const cv::Mat &img = cv::Mat());
+    //residual vectors [camera][view][point], already magnified (see ResidualVectors()), drawn as arrows from the
+    //detected points of unrectified views; empty turns them off. Reset() and SetViews() drop them.
+    void SetResidualVectors(const std::vector< std::vector< std::vector<cv::Point2f> > > &residuals);
+
+    //changes whenever cached views become invalid, for caches built on top of the store
+    size_t Generation();
+    size_t MemoryUsage();
+    size_t MemoryCap();
+    void SetMemoryCap(const size_t mem_cap_bytes);
+
+  private:
+    struct cacheItem_t{
+      cv::Mat img;
+      std::list<size_t>::iterator lru_it;
+    };
+
+    static size_t Key(const size_t idx, const bool rectified){ return idx*2 + (rectified ? 1 : 0); }
+    cv::Mat MakeView(const size_t key, size_t &generation);
+    void InsertLocked(const size_t key, const cv::Mat &img);
+    void EvictRectifiedLocked();
+    void PrefetchThread();
+
+    std::mutex m_mutex;
+    std::condition_variable m_cv;
+    std::string m_cal_img_dir;
+    camCalTarget_t m_cal_target;
+    size_t m_num_camera;
+    std::vector< std::vector<std::string> > m_file_names;               //[camera][view]
+    std::vector< std::vector< std::vector<cv::Point2f> > > m_img_points; //[camera][view]
+    std::vector< std::vector< std::vector<cv::Point2f> > > m_residuals; //[camera][view]
+    rectMaps_t m_rect_maps;
+    rawImageParams_t m_raw;
+    size_t m_generation;                                                 //bumped by Reset()/rectification changes
+
+    std::unordered_map<size_t, cacheItem_t> m_cache;
+    std::list<size_t> m_lru; //front is most recently used
+    size_t m_mem_usage, m_mem_cap, m_prefetch_radius;
+    std::set<size_t> m_in_flight;
+    std::deque<size_t> m_prefetch_queue;
+    bool m_stop;
+    std::thread m_prefetch_thread;
+};
+
+#endif //__CAL_IMAGE_STORE__
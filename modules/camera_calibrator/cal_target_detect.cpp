@@ -0,0 +1,529 @@
+#include "cal_target_detect.h"
+#include "opencv2/imgproc.hpp"
+#include "opencv2/imgcodecs.hpp"
+#include "opencv2/calib3d.hpp"
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <limits>
+#include <numeric>
+#include <thread>
+#include "mio/altro/io.h"
+#include "bounded_queue.h"
+#include "cal_image_store.h"
+#include "calib_coverage.h"
+#include "detection_cache.h"
+#include "parallel_tasks.h"
+#include "pipeline_progress.h"
+#include "pipeline_trace.h"
+#include "rig_calib.h"
+
+
+static double ElapsedMs(const int64 start_tick){
+  return 1000.0 * static_cast<double>(cv::getTickCount() - start_tick) / cv::getTickFrequency();
+}
+
+
+cv::Mat DecodeCalImage(const std::string &file_name_full, const rawImageParams_t &raw){
+  try{
+    return cv::imread( file_name_full, raw.ImreadFlags() );
+  }
+  catch(cv::Exception &e){
+    printf( "DecodeCalImage() - %s: %s\n", file_name_full.c_str(), e.what() );
+    return cv::Mat();
+  }
+}
+
+
+bool FindCalTarget(const cv::Mat &img, const camCalTarget_t &cal_target, const int find_target_flags,
+                   std::vector<cv::Point2f> &img_points, const cv::Mat &refine_img){
+  img_points.clear();
+  if( img.empty() )
+    return false;
+
+  bool found = false;
+  if(cal_target.type_str == "chess"){
+    found = cv::findChessboardCorners(img, cal_target.size, img_points, find_target_flags);
+    if(found)
+      cv::cornerSubPix( refine_img.empty() ? img : refine_img, img_points, cv::Size(11, 11), cv::Size(-1, -1),
+                        cv::TermCriteria(cv::TermCriteria::EPS + cv::TermCriteria::COUNT, 30, 0.01) );
+  }
+  else if(cal_target.type_str == "circle" || cal_target.type_str == "a-circle")
+    found = cv::findCirclesGrid(img, cal_target.size, img_points, find_target_flags);
+
+  return found;
+}
+
+
+cv::Rect TargetSearchRect(const std::vector<cv::Point2f> &img_points, const cv::Size img_size, const double margin){
+  if( img_points.empty() )
+    return cv::Rect();
+  const cv::Rect bound = cv::boundingRect(img_points);
+  const int dx = cvCeil(bound.width * margin), dy = cvCeil(bound.height * margin);
+  return cv::Rect(bound.x - dx, bound.y - dy, bound.width + 2*dx, bound.height + 2*dy) & cv::Rect(cv::Point(0, 0), img_size);
+}
+
+
+//smallest distance between grid neighbours, bounds the refinement window so it never reaches the next point
+static double MinPointSpacing(const std::vector<cv::Point2f> &img_points, const cv::Size target_size){
+  double min_dist = std::numeric_limits<double>::max();
+  const int w = target_size.width;
+  for(int y = 0; y < target_size.height; ++y)
+    for(int x = 0; x < w; ++x){
+      const cv::Point2f &pt = img_points[y*w + x];
+      if(x + 1 < w)
+        min_dist = std::min( min_dist, cv::norm(img_points[y*w + x + 1] - pt) );
+      if(y + 1 < target_size.height)
+        min_dist = std::min( min_dist, cv::norm(img_points[(y + 1)*w + x] - pt) );
+    }
+  return min_dist;
+}
+
+
+//centroid of the dark blob in a window around each point, the window must hold one whole circle
+static void RefineCircleCenters(const cv::Mat &img_gray, const int half_win, std::vector<cv::Point2f> &img_points){
+  const cv::Rect img_rect( cv::Point(0, 0), img_gray.size() );
+  for(auto &pt : img_points){
+    const cv::Rect roi = cv::Rect(cvRound(pt.x) - half_win, cvRound(pt.y) - half_win, 2*half_win + 1, 2*half_win + 1) &
+                         img_rect;
+    if(roi.area() == 0)
+      continue;
+    cv::Mat blob;
+    cv::threshold(img_gray(roi), blob, 0, 255, cv::THRESH_BINARY_INV | cv::THRESH_OTSU);
+    const cv::Moments m = cv::moments(blob, true);
+    if(m.m00 > 0)
+      pt = cv::Point2f( static_cast<float>(roi.x + m.m10 / m.m00), static_cast<float>(roi.y + m.m01 / m.m00) );
+  }
+}
+
+
+//runs the finder on roi of img_gray downscaled by scale, points are returned in full resolution coordinates
+//but not refined
+static bool FindCalTargetScaled(const cv::Mat &img_gray, const cv::Rect &roi, const camCalTarget_t &cal_target,
+                                const int find_target_flags, const double scale, std::vector<cv::Point2f> &img_points){
+  img_points.clear();
+  cv::Mat search_img = img_gray(roi);
+  if(scale < 1)
+    cv::resize(search_img, search_img, cv::Size(), scale, scale, cv::INTER_AREA);
+  if(search_img.cols < 16 || search_img.rows < 16)
+    return false;
+  bool found = false;
+  if(cal_target.type_str == "chess")
+    found = cv::findChessboardCorners(search_img, cal_target.size, img_points, find_target_flags);
+  else if(cal_target.type_str == "circle" || cal_target.type_str == "a-circle")
+    found = cv::findCirclesGrid(search_img, cal_target.size, img_points, find_target_flags);
+  if(!found)
+    return false;
+  //pixel centres of the INTER_AREA downscale sit at (u + 0.5) / scale - 0.5 in the source
+  const double s = scale < 1 ? scale : 1;
+  for(auto &pt : img_points)
+    pt = cv::Point2f( static_cast<float>( (pt.x + 0.5) / s - 0.5 + roi.x ), static_cast<float>( (pt.y + 0.5) / s - 0.5 + roi.y ) );
+  return true;
+}
+
+
+bool FindCalTargetCoarseToFine(const cv::Mat &img, const camCalTarget_t &cal_target, const int find_target_flags,
+                               const double detect_scale, const cv::Rect &search_hint,
+                               std::vector<cv::Point2f> &img_points, const cv::Mat &refine_img){
+  img_points.clear();
+  if( img.empty() )
+    return false;
+  const bool full_res = detect_scale <= 0 || detect_scale >= 1;
+  const cv::Rect img_rect( cv::Point(0, 0), img.size() ), hint = search_hint & img_rect;
+  if(full_res && hint.area() == 0)
+    return FindCalTarget(img, cal_target, find_target_flags, img_points, refine_img);
+
+  const double scale = full_res ? 1 : detect_scale;
+  bool found = hint.area() > 0 && hint != img_rect &&
+               FindCalTargetScaled(img, hint, cal_target, find_target_flags, scale, img_points);
+  if(!found)
+    found = FindCalTargetScaled(img, img_rect, cal_target, find_target_flags, scale, img_points);
+  if( !found || img_points.size() != static_cast<size_t>( cal_target.size.area() ) )
+    return false;
+
+  //the window covers the downscale error, and for chessboards at least the usual 11 pixels, but stays well
+  //inside the spacing of the points
+  const double spacing = MinPointSpacing(img_points, cal_target.size);
+  if(cal_target.type_str == "chess"){
+    const int max_half_win = std::max( 2, static_cast<int>(0.4 * spacing) ),
+              half_win = std::min( std::max(11, cvCeil(2 / scale) + 2), max_half_win );
+    cv::cornerSubPix( refine_img.empty() ? img : refine_img, img_points, cv::Size(half_win, half_win), cv::Size(-1, -1),
+                      cv::TermCriteria(cv::TermCriteria::EPS + cv::TermCriteria::COUNT, 30, 0.01) );
+  }
+  else if(!full_res)
+    RefineCircleCenters( img, std::max( 2, static_cast<int>(0.42 * spacing) ), img_points );
+
+  return true;
+}
+
+
+cv::Mat ConcatCalImages(const std::vector<cv::Mat> &img_vec){
+  if(img_vec.size() == 1)
+    return img_vec[0];
+  cv::Mat concat_img;
+  if( !img_vec.empty() )
+    cv::hconcat(img_vec, concat_img);
+  return concat_img;
+}
+
+
+cv::Mat DrawCalImage(const std::vector<cv::Mat> &img_vec, const std::vector< std::vector<cv::Point2f> > &img_points,
+                     const camCalTarget_t &cal_target){
+  cv::Mat draw_img;
+  for(size_t j = 0; j < img_vec.size(); ++j){
+    cv::Mat img_bgr;
+    if(img_vec[j].channels() == 1)
+      cv::cvtColor(img_vec[j], img_bgr, cv::COLOR_GRAY2BGR);
+    else
+      img_bgr = img_vec[j].clone(); //the decoded image is shared, do not draw into it
+    if( j < img_points.size() )
+      cv::drawChessboardCorners(img_bgr, cal_target.size, img_points[j], true);
+    if( draw_img.empty() )
+      draw_img = img_bgr;
+    else
+      cv::hconcat(draw_img, img_bgr, draw_img);
+  }
+  return draw_img;
+}
+
+
+//detects the target in every camera image of a decoded image set, stops at the first miss unless all_cameras
+//is set. search_hint_vec (indexed by camera) is searched first and updated with each found target, NULL for no hints
+static void DetectImageSet(const decodedImageSet_t &img_set, const camCalTarget_t &cal_target,
+                           const int find_target_flags, const double detect_scale, const rawImageParams_t &raw,
+                           const bool all_cameras, std::vector<cv::Rect> *search_hint_vec, calTargetDetection_t &det){
+  const size_t num_camera = img_set.img_vec.size();
+  det.found = false;
+  det.decode_time_ms = img_set.decode_time_ms;
+  det.img_points.assign( num_camera, std::vector<cv::Point2f>() );
+  det.cam_img_size.assign( num_camera, cv::Size() );
+  det.cam_state.assign(num_camera, -1);
+  det.detect_time_ms.assign(num_camera, 0);
+
+  size_t num_found = 0;
+  for(size_t j = 0; j < num_camera; ++j){
+    ScopedTrace trace("detect", "detection");
+    const int64 start_tick = cv::getTickCount();
+    const cv::Mat &img = img_set.img_vec[j];
+    if( img.empty() ){
+      if(all_cameras)
+        continue;
+      return;
+    }
+    det.cam_img_size[j] = img.size();
+    if(det.img_size.area() == 0)
+      det.img_size = img.size();
+    else if(img.size() != det.img_size && !all_cameras)
+      return;
+    bool found = false;
+    try{
+      cv::Mat img_gray, img_refine;
+      PrepareCalImage(img, raw, img_gray, img_refine);
+      const cv::Rect search_hint = search_hint_vec ? (*search_hint_vec)[j] : cv::Rect();
+      found = FindCalTargetCoarseToFine(img_gray, cal_target, find_target_flags, detect_scale, search_hint,
+                                        det.img_points[j], img_refine);
+      if(found && search_hint_vec)
+        (*search_hint_vec)[j] = TargetSearchRect(det.img_points[j], img.size(), 0.5);
+    }
+    catch(cv::Exception &e){
+      printf( "DetectImageSet() - caught error - %s\n", e.what() );
+    }
+    det.detect_time_ms[j] = ElapsedMs(start_tick);
+    det.cam_state[j] = found ? 1 : 0;
+    if(!found){
+      det.img_points[j].clear();
+      if(!all_cameras)
+        return;
+    }
+    num_found += found;
+  }
+  det.found = num_found == num_camera;
+}
+
+
+//fills det from the cache when every camera image of the set has a valid entry, or when a camera that
+//would be detected first has a cached miss (the set can not be found then, unless all_cameras is set)
+static bool LookupImageSet(DetectionCache &cache, const uint64_t settings_hash, const std::vector<std::string> &img_file_name_vec,
+                           const size_t num_camera, const bool all_cameras, const size_t set_idx, calTargetDetection_t &det){
+  calTargetDetection_t cached_det;
+  cached_det.from_cache = true;
+  cached_det.img_points.resize(num_camera);
+  cached_det.cam_img_size.resize(num_camera);
+  cached_det.cam_state.assign(num_camera, -1);
+  cached_det.detect_time_ms.assign(num_camera, 0);
+  size_t num_found = 0;
+  for(size_t j = 0; j < num_camera; ++j){
+    detectionCacheEntry_t entry;
+    if( !cache.Lookup(img_file_name_vec[set_idx*num_camera + j], settings_hash, entry) )
+      return false;
+    if(j == 0)
+      cached_det.img_size = entry.img_size;
+    else if(entry.img_size != cached_det.img_size && !all_cameras)
+      return false;
+    cached_det.cam_img_size[j] = entry.img_size;
+    cached_det.cam_state[j] = entry.found ? 1 : 0;
+    if(!entry.found){
+      if(all_cameras)
+        continue;
+      det = cached_det;
+      return true;
+    }
+    cached_det.img_points[j] = entry.img_points;
+    ++num_found;
+  }
+  cached_det.found = num_found == num_camera;
+  det = cached_det;
+  return true;
+}
+
+
+//Decode and detection pass shared by ExtractCalTargetPointsMT() and ExtractRigTargetPointsMT(). det_vec gets
+//one result per image set. view_vec gets the ConcatCalImages() views of found sets, as far as view_budget
+//bytes allow. Returns false when params.progress was cancelled.
+static bool DetectImageSets(const std::string &cal_img_dir, const camCalTarget_t &cal_target,
+                            const std::vector<std::string> &img_file_name_vec, const int find_target_flags,
+                            const size_t num_camera, const bool all_cameras, const detectPipelineParams_t &params,
+                            const size_t view_budget, std::vector<calTargetDetection_t> &det_vec,
+                            std::vector<cv::Mat> &view_vec){
+  const size_t num_img_set = img_file_name_vec.size() / num_camera;
+  const int num_worker = ResolveNumThreads(params.num_threads),
+            num_decoder = std::max(params.num_decode_threads, 1);
+  printf("DetectImageSets(): detecting %zu image sets, %d decode / %d detection threads, prefetch %zu\n",
+         num_img_set, num_decoder, num_worker, params.prefetch_depth);
+  if(params.detect_scale > 0 && params.detect_scale < 1)
+    printf("DetectImageSets(): coarse-to-fine detection at scale %.2f%s\n", params.detect_scale,
+           params.use_search_hint ? ", previous target as search hint" : "");
+
+  DetectionCache cache;
+  const uint64_t settings_hash = DetectionSettingsHash(cal_target, find_target_flags, params.detect_scale, params.raw);
+  if(params.use_cache){
+    cache.Load(cal_img_dir);
+    printf( "DetectImageSets(): %zu detection cache entries\n", cache.Size() );
+  }
+
+  ScopedTrace trace("detection");
+  const int64 start_tick = cv::getTickCount();
+  det_vec.assign( num_img_set, calTargetDetection_t() );
+  view_vec.assign( view_budget > 0 ? num_img_set : 0, cv::Mat() );
+  std::atomic<size_t> view_bytes(0);
+  BoundedQueue<decodedImageSet_t> img_set_queue(params.prefetch_depth);
+
+  //progress is reported once per image set, from whichever thread finished it
+  pipelineProgress_t *progress = params.progress;
+  const bool report_sets = progress && progress->on_image_set;
+  std::atomic<size_t> num_done(0), num_found(0);
+  auto report_set = [&](const size_t i, const cv::Mat &view_img){
+    if(params.coverage && (det_vec[i].found || all_cameras))
+      params.coverage->AddDetection(det_vec[i]);
+    imageSetProgress_t set_progress;
+    set_progress.num_found = det_vec[i].found ? ++num_found : num_found.load();
+    set_progress.num_done = ++num_done;
+    TraceCounter( "image sets found", static_cast<double>(set_progress.num_found) );
+    if(!report_sets)
+      return;
+    set_progress.set_idx = i;
+    set_progress.num_total = num_img_set;
+    set_progress.file_names.assign(img_file_name_vec.begin() + i*num_camera, img_file_name_vec.begin() + (i + 1)*num_camera);
+    set_progress.det = &det_vec[i];
+    set_progress.view_img = view_img;
+    progress->on_image_set(set_progress);
+  };
+
+  //decoders, the last one to finish closes the queue so the detection workers drain it and stop
+  std::atomic<size_t> next_set(0);
+  std::atomic<int> num_active_decoder(num_decoder);
+  auto decoder = [&](){
+    for(size_t i = next_set++; i < num_img_set && !ProgressCancelled(progress); i = next_set++){
+      decodedImageSet_t img_set;
+      img_set.set_idx = i;
+      //a cache hit only needs decoding when the set seeds the viewer
+      if( params.use_cache && LookupImageSet(cache, settings_hash, img_file_name_vec, num_camera, all_cameras, i, det_vec[i]) ){
+        if(!det_vec[i].found || view_bytes >= view_budget){
+          report_set( i, cv::Mat() );
+          continue;
+        }
+        img_set.detected = true;
+      }
+      const int64 decode_tick = cv::getTickCount();
+      img_set.img_vec.resize(num_camera);
+      for(size_t j = 0; j < num_camera; ++j){
+        const std::string &file_name = img_file_name_vec[i*num_camera + j];
+        ScopedTrace trace( "decode", "detection", file_name.c_str() );
+        img_set.img_vec[j] = DecodeCalImage(cal_img_dir + "/" + file_name, params.raw);
+      }
+      img_set.decode_time_ms = ElapsedMs(decode_tick);
+      if( !img_set_queue.Push( std::move(img_set) ) )
+        break;
+    }
+    if(--num_active_decoder == 0)
+      img_set_queue.Close();
+  };
+  std::vector<std::thread> decoder_vec;
+  for(int i = 0; i < num_decoder; ++i)
+    decoder_vec.emplace_back(decoder);
+
+  //one detection task per image set, each task only writes to its own slot in det_vec/view_vec. The decoded
+  //images of a set are released as soon as it has been detected.
+  try{
+    ParallelTasks(num_worker, num_worker, [&](const size_t){
+      std::vector<cv::Rect> search_hint_vec(num_camera); //this worker's last found targets
+      decodedImageSet_t img_set;
+      while( img_set_queue.Pop(img_set) ){
+        if( ProgressCancelled(progress) ){
+          img_set_queue.Close(); //unblocks the decoders, the sets still queued are dropped
+          break;
+        }
+        calTargetDetection_t &det = det_vec[img_set.set_idx];
+        if(!img_set.detected){
+          DetectImageSet(img_set, cal_target, find_target_flags, params.detect_scale, params.raw, all_cameras,
+                         params.use_search_hint ? &search_hint_vec : NULL, det);
+          if(params.use_cache)
+            for(size_t j = 0; j < num_camera; ++j)
+              if(det.cam_state[j] >= 0)
+                cache.Insert(img_file_name_vec[img_set.set_idx*num_camera + j], settings_hash, det.cam_state[j] == 1,
+                             det.cam_img_size[j], det.img_points[j]);
+        }
+        cv::Mat view_img;
+        if(det.found && view_bytes < view_budget){
+          if( params.raw.Raw() ) //the viewer shows 8 bit views
+            for(auto &img : img_set.img_vec)
+              img = DisplayCalImage(img, params.raw);
+          view_img = ConcatCalImages(img_set.img_vec);
+          view_vec[img_set.set_idx] = view_img;
+          view_bytes += view_img.total() * view_img.elemSize();
+        }
+        report_set(img_set.set_idx, view_img);
+      }
+    });
+  }
+  catch(...){
+    img_set_queue.Close();
+    for(auto &thread : decoder_vec)
+      thread.join();
+    throw;
+  }
+  for(auto &thread : decoder_vec)
+    thread.join();
+  const double wall_time_ms = ElapsedMs(start_tick);
+  if(params.use_cache)
+    cache.Save();
+  if( ProgressCancelled(progress) ){
+    printf("DetectImageSets(): cancelled after %zu of %zu image sets\n", num_done.load(), num_img_set);
+    return false;
+  }
+
+  double decode_time_ms = 0, detect_time_ms = 0;
+  size_t num_cache_hit = 0;
+  for(size_t i = 0; i < num_img_set; ++i){
+    const calTargetDetection_t &det = det_vec[i];
+    const double set_time_ms = std::accumulate(det.detect_time_ms.begin(), det.detect_time_ms.end(), 0.0);
+    decode_time_ms += det.decode_time_ms;
+    detect_time_ms += set_time_ms;
+    num_cache_hit += det.from_cache;
+    const size_t num_cam_found = std::count(det.cam_state.begin(), det.cam_state.end(), 1);
+    printf( "%s: %s", img_file_name_vec[i*num_camera].c_str(), det.found ? "found" : "not found" );
+    if(all_cameras && !det.found && num_cam_found > 0)
+      printf(" (found by %zu of %zu cameras)", num_cam_found, num_camera);
+    printf( " (%s, decode %.1f ms, detect %.1f ms)\n", det.from_cache ? "cached" : "detected", det.decode_time_ms, set_time_ms );
+  }
+  printf("DetectImageSets(): %zu of %zu image sets from the detection cache\n", num_cache_hit, num_img_set);
+  printf( "DetectImageSets(): %.1f ms wall time, %.1f ms summed decode, %.1f ms summed detection (%.2fx)\n",
+          wall_time_ms, decode_time_ms, detect_time_ms,
+          wall_time_ms > 0 ? (decode_time_ms + detect_time_ms) / wall_time_ms : 0.0 );
+
+  return true;
+}
+
+
+int ExtractCalTargetPointsMT(const std::string &cal_img_dir, const camCalTarget_t &cal_target,
+                             const std::vector<std::string> &img_file_name_vec, stereoCalData_t &cal_data,
+                             const int find_target_flags, const size_t num_camera,
+                             const detectPipelineParams_t &params, CalImageStore *img_store){
+  EXP_CHK(num_camera == 1 || num_camera == 2, return(0))
+  EXP_CHK_M(img_file_name_vec.size() % num_camera == 0, return(0), "Image list is not a multiple of num_camera")
+  const size_t num_img_set = img_file_name_vec.size() / num_camera;
+
+  //views are kept until the store is seeded, limited to what the store could hold anyway
+  std::vector<calTargetDetection_t> det_vec;
+  std::vector<cv::Mat> view_vec;
+  if( !DetectImageSets(cal_img_dir, cal_target, img_file_name_vec, find_target_flags, num_camera, false, params,
+                       img_store ? img_store->MemoryCap() : 0, det_vec, view_vec) )
+    return 0;
+
+  //commit in list order so results do not depend on scheduling
+  for(size_t j = 0; j < num_camera; ++j){
+    cal_data.img_points[j].clear();
+    cal_data.good_img_file_names[j].clear();
+  }
+  std::vector<size_t> good_set_idx_vec;
+  for(size_t i = 0; i < num_img_set; ++i){
+    const calTargetDetection_t &det = det_vec[i];
+    if(!det.found)
+      continue;
+    if( cal_data.good_img_file_names[0].empty() )
+      cal_data.img_size = det.img_size;
+    else if(det.img_size != cal_data.img_size){
+      printf( "%s: image size differs from the first detected image, skipping\n", img_file_name_vec[i*num_camera].c_str() );
+      continue;
+    }
+    for(size_t j = 0; j < num_camera; ++j){
+      cal_data.img_points[j].push_back(det.img_points[j]);
+      cal_data.good_img_file_names[j].push_back(img_file_name_vec[i*num_camera + j]);
+    }
+    good_set_idx_vec.push_back(i);
+  }
+  if(img_store){
+    img_store->Reset(cal_img_dir, cal_target, cal_data, num_camera);
+    for(size_t k = 0; k < good_set_idx_vec.size(); ++k)
+      img_store->Put(k, false, view_vec[ good_set_idx_vec[k] ]);
+  }
+
+  return static_cast<int>( cal_data.good_img_file_names[0].size() );
+}
+
+
+int ExtractRigTargetPointsMT(const std::string &cal_img_dir, const camCalTarget_t &cal_target,
+                             const std::vector<std::string> &img_file_name_vec, rigCalData_t &rig_data,
+                             const int find_target_flags, const size_t num_camera,
+                             const detectPipelineParams_t &params){
+  EXP_CHK(num_camera >= 1, return(0))
+  EXP_CHK_M(img_file_name_vec.size() % num_camera == 0, return(0), "Image list is not a multiple of num_camera")
+  const size_t num_img_set = img_file_name_vec.size() / num_camera;
+
+  std::vector<calTargetDetection_t> det_vec;
+  std::vector<cv::Mat> view_vec;
+  if( !DetectImageSets(cal_img_dir, cal_target, img_file_name_vec, find_target_flags, num_camera, true, params, 0,
+                       det_vec, view_vec) )
+    return 0;
+
+  //commit in list order, a view is kept when at least one camera found the target
+  rig_data.Resize(num_camera);
+  for(size_t j = 0; j < num_camera; ++j){
+    rig_data.img_points[j].clear();
+    rig_data.good_img_file_names[j].clear();
+  }
+  for(size_t i = 0; i < num_img_set; ++i){
+    const calTargetDetection_t &det = det_vec[i];
+    if( std::count(det.cam_state.begin(), det.cam_state.end(), 1) == 0 )
+      continue;
+    bool size_ok = true;
+    for(size_t j = 0; j < num_camera; ++j)
+      if(det.cam_state[j] == 1){
+        if(rig_data.img_size[j].area() == 0)
+          rig_data.img_size[j] = det.cam_img_size[j];
+        else if(det.cam_img_size[j] != rig_data.img_size[j]){
+          printf( "%s: image size differs from the first detected image of the camera, skipping\n",
+                  img_file_name_vec[i*num_camera + j].c_str() );
+          size_ok = false;
+        }
+      }
+    if(!size_ok)
+      continue;
+    for(size_t j = 0; j < num_camera; ++j){
+      rig_data.img_points[j].push_back(det.img_points[j]);
+      rig_data.good_img_file_names[j].push_back(img_file_name_vec[i*num_camera + j]);
+    }
+  }
+
+  return static_cast<int>( rig_data.NumView() );
+}
@@ -0,0 +1,109 @@
+#ifndef __CAL_TARGET_DETECT__
+#define __CAL_TARGET_DETECT__
+
+#include <string>
+#include <vector>
+#include "opencv2/core.hpp"
+#include "mvg/stereo_compute.h"
+#include "raw_image.h"
+
+class CalCoverage;
+class CalImageStore;
+struct pipelineProgress_t;
+struct rigCalData_t;
+
+
+//detection result for one image set (one image per camera)
+struct calTargetDetection_t{
+  bool found, from_cache;
+  cv::Size img_size;                  //first decoded camera image
+  std::vector<cv::Size> cam_img_size; //indexed by camera, empty size if not decoded
+  std::vector< std::vector<cv::Point2f> > img_points; //indexed by camera
+  std::vector<signed char> cam_state; //indexed by camera, 1 found, 0 not found, -1 not run or not decodable
+  std::vector<double> detect_time_ms; //indexed by camera
+  double decode_time_ms; //all cameras
+
+  calTargetDetection_t() : found(false), from_cache(false), decode_time_ms(0) {}
+};
+
+//decoded images of one image set. The cv::Mat buffers are reference counted, so detection and the viewer
+//share the single decode.
+struct decodedImageSet_t{
+  size_t set_idx;
+  std::vector<cv::Mat> img_vec; //indexed by camera, empty Mat if the file could not be decoded
+  double decode_time_ms;
+  bool detected; //detection result already known (cache hit), the set was only decoded for the viewer
+
+  decodedImageSet_t() : set_idx(0), decode_time_ms(0), detected(false) {}
+};
+
+//decoders prefetch up to prefetch_depth image sets ahead of the detection workers
+struct detectPipelineParams_t{
+  int num_threads;         //detection workers, <= 0 uses one per core
+  int num_decode_threads;  //decoder workers, <= 0 uses one
+  size_t prefetch_depth;   //decoded image sets allowed to wait for a detection worker
+  bool use_cache;          //reuse/update the DetectionCache file in the calibration directory
+  double detect_scale;     //search on images downscaled by this, see FindCalTargetCoarseToFine(), >= 1 for full resolution
+  bool use_search_hint;    //search around the target a worker found in its previous image set first
+  pipelineProgress_t *progress; //per image set progress and cancellation, NULL for none
+  CalCoverage *coverage;        //gets each found image set as it finishes, NULL for none
+  rawImageParams_t raw;         //bit depth and Bayer pattern of the image files
+
+  detectPipelineParams_t() : num_threads(0), num_decode_threads(2), prefetch_depth(8), use_cache(true), detect_scale(1),
+                             use_search_hint(false), progress(NULL), coverage(NULL) {}
+};
+
+//8 bit unless raw.Raw(), then at the stored depth and channels, see rawImageParams_t
+cv::Mat DecodeCalImage(const std::string &file_name_full, const rawImageParams_t &raw = rawImageParams_t());
+
+//refine_img, when given, is a full precision (CV_32F) copy of img the chessboard corners are refined on, see
+//PrepareCalImage()
+bool FindCalTarget(const cv::Mat &img, const camCalTarget_t &cal_target, const int find_target_flags,
+                   std::vector<cv::Point2f> &img_points, const cv::Mat &refine_img = cv::Mat());
+
+//bounding box of img_points grown by margin (a fraction of its size) on every side, clipped to img_size
+cv::Rect TargetSearchRect(const std::vector<cv::Point2f> &img_points, const cv::Size img_size, const double margin);
+
+//Coarse-to-fine FindCalTarget() for large images. The finder runs on img downscaled by detect_scale, then each
+//point is refined at full resolution in a small window around it: cornerSubPix() for chessboards, the centroid
+//of the dark blob for circle grids. When search_hint is non-empty (full resolution, ie. the TargetSearchRect()
+//of the previous frame of a sequence) that region is searched first, then the whole image. detect_scale >= 1
+//searches at full resolution. img must be single channel 8 bit, refine_img as for FindCalTarget().
+bool FindCalTargetCoarseToFine(const cv::Mat &img, const camCalTarget_t &cal_target, const int find_target_flags,
+                               const double detect_scale, const cv::Rect &search_hint,
+                               std::vector<cv::Point2f> &img_points, const cv::Mat &refine_img = cv::Mat());
+
+//places the camera images side by side, a single image is returned without copying
+cv::Mat ConcatCalImages(const std::vector<cv::Mat> &img_vec);
+
+//draws the detected points on each camera image and places the images side by side (BGR)
+cv::Mat DrawCalImage(const std::vector<cv::Mat> &img_vec, const std::vector< std::vector<cv::Point2f> > &img_points,
+                     const camCalTarget_t &cal_target);
+
+//Same contract as ExtractCalTargetPoints() in mvg. Decoder threads read image sets ahead of the detection
+//workers through a bounded queue so disk/decode time overlaps detection. img_file_name_vec is interleaved by
+//camera (as returned by ScanImageSets()). Results are committed to cal_data in img_file_name_vec order
+//regardless of task completion order. When img_store is non-NULL it is Reset() to the detected views and seeded
+//with ConcatCalImages() views made from the same decode, as far as its memory cap allows. With
+//params.detect_scale < 1 detection runs coarse-to-fine, see FindCalTargetCoarseToFine(). With
+//params.use_search_hint each worker first searches around the last target it found; sets are handed out in list
+//order, so for sequential captures that is a recent frame. With params.use_cache, image sets with a valid
+//DetectionCache entry are not detected again, and are only decoded to seed img_store. When params.progress is
+//cancelled the remaining image sets are skipped, finished detections still go to the cache, cal_data and
+//img_store are left unchanged and 0 is returned. Returns the number of images per camera that were detected.
+int ExtractCalTargetPointsMT(const std::string &cal_img_dir, const camCalTarget_t &cal_target,
+                             const std::vector<std::string> &img_file_name_vec, stereoCalData_t &cal_data,
+                             const int find_target_flags, const size_t num_camera,
+                             const detectPipelineParams_t &params = detectPipelineParams_t(),
+                             CalImageStore *img_store = NULL);
+
+//ExtractCalTargetPointsMT() for rigs of any number of cameras. Every camera image of a set is searched, also
+//after a miss, and the cameras may differ in image size. A set is kept when at least one camera found the
+//target; img_points of the cameras that did not are left empty. No viewer images are made. Returns the
+//number of views committed to rig_data, 0 when cancelled.
+int ExtractRigTargetPointsMT(const std::string &cal_img_dir, const camCalTarget_t &cal_target,
+                             const std::vector<std::string> &img_file_name_vec, rigCalData_t &rig_data,
+                             const int find_target_flags, const size_t num_camera,
+                             const detectPipelineParams_t &params = detectPipelineParams_t());
+
+#endif //__CAL_TARGET_DETECT__
@@ -0,0 +1,315 @@
+#include "calib_coverage.h"
+#include "opencv2/calib3d.hpp"
+#include "opencv2/imgproc.hpp"
+#include <algorithm>
+#include <cmath>
+#include <sstream>
+#include "mio/altro/io.h"
+#include "cal_target_detect.h"
+#include "incremental_calib.h"
+
+
+cameraCoverage_t::cameraCoverage_t() : num_cell_hit(0), num_view(0), tilt_sum_deg(0){
+  std::fill(tilt_hist, tilt_hist + COVERAGE_TILT_BINS, 0);
+  std::fill(dir_hist, dir_hist + COVERAGE_DIR_BINS, 0);
+  std::fill(scale_hist, scale_hist + COVERAGE_SCALE_BINS, 0);
+}
+
+
+int cameraCoverage_t::NumTiltDirs() const {
+  return static_cast<int>( std::count_if( dir_hist, dir_hist + COVERAGE_DIR_BINS, [](const int n){ return n > 0; } ) );
+}
+
+
+int cameraCoverage_t::NumScaleBins() const {
+  return static_cast<int>( std::count_if( scale_hist, scale_hist + COVERAGE_SCALE_BINS, [](const int n){ return n > 0; } ) );
+}
+
+
+//the cell grid over an image, grid_cells along its longer side
+static cv::Size CellGrid(const cv::Size img_size, const int grid_cells){
+  const double cell_size = static_cast<double>( std::max(img_size.width, img_size.height) ) / std::max(grid_cells, 1);
+  return cv::Size( static_cast<int>( std::ceil(img_size.width / cell_size) ),
+                   static_cast<int>( std::ceil(img_size.height / cell_size) ) );
+}
+
+
+//the grid cell a point falls in, points outside the image go to the nearest cell
+static cv::Point CellOf(const cv::Point2f &point, const cv::Size img_size, const cv::Size grid){
+  const double cell_w = static_cast<double>(img_size.width) / grid.width,
+               cell_h = static_cast<double>(img_size.height) / grid.height;
+  return cv::Point( std::min( std::max(static_cast<int>(point.x / cell_w), 0), grid.width - 1 ),
+                    std::min( std::max(static_cast<int>(point.y / cell_h), 0), grid.height - 1 ) );
+}
+
+
+CalCoverage::CalCoverage(const coverageParams_t &params) : m_params(params) {}
+
+
+void CalCoverage::Reset(const camCalTarget_t &cal_target, const size_t num_camera){
+  std::lock_guard<std::mutex> lock(m_mutex);
+  m_cal_target = cal_target;
+  m_obj_points = CalTargetObjectPoints(cal_target);
+  m_K.assign( num_camera, cv::Mat() );
+  m_D.assign( num_camera, cv::Mat() );
+  m_camera.assign( num_camera, cameraCoverage_t() );
+}
+
+
+void CalCoverage::SetIntrinsics(const size_t j, const cv::Mat &K, const cv::Mat &D){
+  std::lock_guard<std::mutex> lock(m_mutex);
+  EXP_CHK(j < m_camera.size(), return)
+  m_K[j] = K.clone();
+  m_D[j] = D.clone();
+}
+
+
+void CalCoverage::AddView(const size_t j, const cv::Size img_size, const std::vector<cv::Point2f> &img_points){
+  cv::Mat K, D;
+  std::vector<cv::Point3f> obj_points;
+  {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    EXP_CHK(j < m_camera.size(), return)
+    if(img_points.size() != m_obj_points.size() || img_size.area() == 0)
+      return;
+    K = m_K[j];
+    D = m_D[j];
+    obj_points = m_obj_points;
+  }
+
+  //the pose is solved outside the lock, workers only wait for the histogram update
+  const double max_side = std::max(img_size.width, img_size.height);
+  if( K.empty() ){
+    const double focal = m_params.focal_guess * max_side;
+    K = ( cv::Mat_<double>(3, 3) << focal, 0, 0.5 * (img_size.width - 1),
+                                    0, focal, 0.5 * (img_size.height - 1),
+                                    0, 0, 1 );
+  }
+  double tilt_deg = 0;
+  int dir_bin = -1;
+  cv::Mat rvec, tvec, R;
+  try{
+    if( cv::solvePnP(obj_points, img_points, K, D, rvec, tvec) ){
+      cv::Rodrigues(rvec, R);
+      //target normal in the camera frame, made to face the camera
+      double n[3] = { R.at<double>(0, 2), R.at<double>(1, 2), R.at<double>(2, 2) };
+      if(n[2] > 0)
+        for(int k = 0; k < 3; ++k)
+          n[k] = -n[k];
+      tilt_deg = std::acos( std::min(-n[2], 1.0) ) * 180 / CV_PI;
+      if(tilt_deg >= m_params.min_tilt_deg){
+        const double dir = std::atan2(n[1], n[0]) + CV_PI; //0..2pi
+        dir_bin = std::min( static_cast<int>(dir / (2*CV_PI) * COVERAGE_DIR_BINS), COVERAGE_DIR_BINS - 1 );
+      }
+    }
+  }
+  catch(cv::Exception &e){
+    printf( "CalCoverage::AddView() - caught error - %s\n", e.what() );
+  }
+  const cv::Rect bbox = cv::boundingRect(img_points);
+  const double img_diag = std::sqrt( static_cast<double>(img_size.width) * img_size.width +
+                                     static_cast<double>(img_size.height) * img_size.height ),
+               target_diag = std::sqrt( static_cast<double>(bbox.width) * bbox.width +
+                                        static_cast<double>(bbox.height) * bbox.height );
+  const int scale_bin = std::min( static_cast<int>(target_diag / img_diag * COVERAGE_SCALE_BINS), COVERAGE_SCALE_BINS - 1 );
+  const int tilt_bin = std::min( static_cast<int>(tilt_deg / 10), COVERAGE_TILT_BINS - 1 );
+
+  std::lock_guard<std::mutex> lock(m_mutex);
+  if( j >= m_camera.size() )
+    return; //Reset() meanwhile
+  cameraCoverage_t &cam = m_camera[j];
+  if(cam.num_view == 0){
+    cam.img_size = img_size;
+    cam.grid = CellGrid(img_size, m_params.grid_cells);
+    cam.cell_count = cv::Mat::zeros(cam.grid.height, cam.grid.width, CV_32S);
+  }
+  else if(img_size != cam.img_size)
+    return;
+  for(auto &point : img_points){
+    const cv::Point cell = CellOf(point, img_size, cam.grid);
+    int &count = cam.cell_count.at<int>(cell.y, cell.x);
+    cam.num_cell_hit += count == 0;
+    ++count;
+  }
+  ++cam.num_view;
+  ++cam.tilt_hist[tilt_bin];
+  if(dir_bin >= 0)
+    ++cam.dir_hist[dir_bin];
+  ++cam.scale_hist[scale_bin];
+  cam.tilt_sum_deg += tilt_deg;
+}
+
+
+int CalCoverage::NumNewCells(const size_t j, const cv::Size img_size, const std::vector<cv::Point2f> &img_points){
+  std::lock_guard<std::mutex> lock(m_mutex);
+  EXP_CHK(j < m_camera.size(), return(0))
+  const cameraCoverage_t &cam = m_camera[j];
+  if(img_size.area() == 0 || (cam.num_view > 0 && img_size != cam.img_size))
+    return 0; //AddView() would drop the view
+  const cv::Size grid = cam.num_view > 0 ? cam.grid : CellGrid(img_size, m_params.grid_cells);
+  std::vector<int> cell_vec;
+  for(auto &point : img_points){
+    const cv::Point cell = CellOf(point, img_size, grid);
+    if(cam.num_view == 0 || cam.cell_count.at<int>(cell.y, cell.x) == 0)
+      cell_vec.push_back(cell.y * grid.width + cell.x);
+  }
+  std::sort( cell_vec.begin(), cell_vec.end() );
+  return static_cast<int>( std::unique( cell_vec.begin(), cell_vec.end() ) - cell_vec.begin() );
+}
+
+
+void CalCoverage::AddDetection(const calTargetDetection_t &det){
+  for(size_t j = 0; j < det.img_points.size(); ++j){
+    const bool found = j < det.cam_state.size() ? det.cam_state[j] == 1 : det.found;
+    const cv::Size img_size = j < det.cam_img_size.size() && det.cam_img_size[j].area() > 0 ? det.cam_img_size[j] : det.img_size;
+    if(found)
+      AddView(j, img_size, det.img_points[j]);
+  }
+}
+
+
+void CalCoverage::AddCalData(const stereoCalData_t &cal_data, const size_t num_camera){
+  for(size_t j = 0; j < num_camera && j < 2; ++j)
+    for(auto &img_points : cal_data.img_points[j])
+      AddView(j, cal_data.img_size, img_points);
+}
+
+
+size_t CalCoverage::NumCamera(){
+  std::lock_guard<std::mutex> lock(m_mutex);
+  return m_camera.size();
+}
+
+
+cameraCoverage_t CalCoverage::Camera(const size_t j){
+  std::lock_guard<std::mutex> lock(m_mutex);
+  EXP_CHK( j < m_camera.size(), return( cameraCoverage_t() ) )
+  cameraCoverage_t cam = m_camera[j];
+  cam.cell_count = m_camera[j].cell_count.clone();
+  return cam;
+}
+
+
+bool CalCoverage::SufficientLocked(const size_t j) const {
+  const cameraCoverage_t &cam = m_camera[j];
+  return cam.CoverageFraction() >= m_params.min_coverage && cam.NumTiltDirs() >= m_params.min_tilt_dirs &&
+         cam.NumScaleBins() >= m_params.min_scale_bins;
+}
+
+
+bool CalCoverage::Sufficient(const size_t j){
+  std::lock_guard<std::mutex> lock(m_mutex);
+  EXP_CHK(j < m_camera.size(), return(false))
+  return SufficientLocked(j);
+}
+
+
+cv::Mat CalCoverage::CoverageImage(const size_t j, const cv::Size max_size){
+  const cameraCoverage_t cam = Camera(j);
+  if(cam.num_view == 0 || max_size.area() == 0)
+    return cv::Mat();
+
+  //log scale so a few crowded cells do not wash out the rest
+  cv::Mat level(cam.grid.height, cam.grid.width, CV_8UC1);
+  double max_count = 0;
+  cv::minMaxLoc(cam.cell_count, NULL, &max_count);
+  for(int y = 0; y < cam.grid.height; ++y)
+    for(int x = 0; x < cam.grid.width; ++x){
+      const int count = cam.cell_count.at<int>(y, x);
+      level.at<unsigned char>(y, x) = count == 0 ? 0 :
+        static_cast<unsigned char>( 64 + 191 * std::log1p(count) / std::log1p( std::max(max_count, 1.0) ) );
+    }
+  cv::Mat heat_map;
+  cv::applyColorMap(level, heat_map, cv::COLORMAP_JET);
+  heat_map.setTo(cv::Scalar::all(0), level == 0);
+
+  const double scale = std::min( static_cast<double>(max_size.width) / cam.img_size.width,
+                                 static_cast<double>(max_size.height) / cam.img_size.height );
+  const cv::Size disp_size( std::max( static_cast<int>(cam.img_size.width * scale), 1 ),
+                            std::max( static_cast<int>(cam.img_size.height * scale), 1 ) );
+  cv::Mat img;
+  cv::resize(heat_map, img, disp_size, 0, 0, cv::INTER_NEAREST);
+  return img;
+}
+
+
+//bars of hist scaled to its largest bin in rect, with the name in the top left corner
+static void DrawHistogram(cv::Mat &img, const cv::Rect rect, const int *hist, const int num_bin,
+                          const std::string &name){
+  const int max_count = std::max( *std::max_element(hist, hist + num_bin), 1 );
+  const double bar_w = static_cast<double>(rect.width) / num_bin;
+  const int base_y = rect.y + rect.height - 1;
+  for(int b = 0; b < num_bin; ++b){
+    const int bar_h = static_cast<int>( (rect.height - 2) * static_cast<double>(hist[b]) / max_count + 0.5 );
+    const cv::Point top_left( rect.x + static_cast<int>(b * bar_w) + 1, base_y - bar_h ),
+                    bottom_right( rect.x + static_cast<int>( (b + 1) * bar_w ) - 1, base_y );
+    if(bar_h > 0)
+      cv::rectangle( img, top_left, bottom_right, cv::Scalar(255, 160, 0), cv::FILLED );
+  }
+  cv::line( img, cv::Point(rect.x, base_y), cv::Point(rect.x + rect.width - 1, base_y), cv::Scalar::all(128) );
+  cv::putText( img, name, cv::Point(rect.x + 2, rect.y + 10), cv::FONT_HERSHEY_PLAIN, 0.8, cv::Scalar::all(255) );
+}
+
+
+cv::Mat CalCoverage::HistogramImage(const size_t j, const cv::Size size){
+  const cameraCoverage_t cam = Camera(j);
+  if(cam.num_view == 0 || size.area() == 0)
+    return cv::Mat();
+
+  cv::Mat img = cv::Mat::zeros(size, CV_8UC3);
+  const int panel_h = size.height / 3;
+  DrawHistogram( img, cv::Rect(0, 0, size.width, panel_h), cam.tilt_hist, COVERAGE_TILT_BINS, "tilt 0-90 deg" );
+  DrawHistogram( img, cv::Rect(0, panel_h, size.width, panel_h), cam.dir_hist, COVERAGE_DIR_BINS, "tilt direction" );
+  DrawHistogram( img, cv::Rect(0, 2*panel_h, size.width, size.height - 2*panel_h), cam.scale_hist, COVERAGE_SCALE_BINS,
+                 "target size" );
+  return img;
+}
+
+
+std::string CalCoverage::Summary(){
+  std::lock_guard<std::mutex> lock(m_mutex);
+  std::ostringstream oss;
+  oss.precision(3);
+  for(size_t j = 0; j < m_camera.size(); ++j){
+    const cameraCoverage_t &cam = m_camera[j];
+    oss << "camera " << j << ": " << cam.num_view << " views, coverage " << 100 * cam.CoverageFraction()
+        << "%, mean tilt " << cam.MeanTiltDeg() << " deg, " << cam.NumTiltDirs() << "/" << COVERAGE_DIR_BINS
+        << " tilt directions, " << cam.NumScaleBins() << " target scales"
+        << (SufficientLocked(j) ? ", sufficient" : "") << "\n";
+  }
+  return oss.str();
+}
+
+
+void CalCoverage::Print(){
+  printf( "%s", Summary().c_str() );
+}
+
+
+bool CalCoverage::Write(const std::string &file_name_full){
+  std::lock_guard<std::mutex> lock(m_mutex);
+  cv::FileStorage fs(file_name_full, cv::FileStorage::WRITE);
+  EXP_CHK_M(fs.isOpened(), return(false), "could not write " + file_name_full)
+  fs << "num_camera" << static_cast<int>( m_camera.size() );
+  fs << "cameras" << "[";
+  for(size_t j = 0; j < m_camera.size(); ++j){
+    const cameraCoverage_t &cam = m_camera[j];
+    fs << "{";
+    fs << "image_width" << cam.img_size.width;
+    fs << "image_height" << cam.img_size.height;
+    fs << "num_view" << static_cast<int>(cam.num_view);
+    fs << "coverage" << cam.CoverageFraction();
+    fs << "mean_tilt_deg" << cam.MeanTiltDeg();
+    fs << "num_tilt_dirs" << cam.NumTiltDirs();
+    fs << "sufficient" << static_cast<int>( SufficientLocked(j) );
+    fs << "tilt_hist_10deg" << std::vector<int>(cam.tilt_hist, cam.tilt_hist + COVERAGE_TILT_BINS);
+    fs << "tilt_dir_hist_45deg" << std::vector<int>(cam.dir_hist, cam.dir_hist + COVERAGE_DIR_BINS);
+    fs << "scale_hist" << std::vector<int>(cam.scale_hist, cam.scale_hist + COVERAGE_SCALE_BINS);
+    if( !cam.cell_count.empty() )
+      fs << "cell_count" << cam.cell_count;
+    fs << "}";
+  }
+  fs << "]";
+
+  return true;
+}
@@ -0,0 +1,92 @@
+#ifndef __CALIB_COVERAGE__
+#define __CALIB_COVERAGE__
+
+#include <mutex>
+#include <string>
+#include <vector>
+#include "opencv2/core.hpp"
+#include "mvg/stereo_compute.h"
+
+struct calTargetDetection_t;
+
+
+#define COVERAGE_TILT_BINS 9   //10 degree bins of the angle between target normal and optical axis, the last takes >= 80
+#define COVERAGE_DIR_BINS 8    //45 degree sectors of the direction the target is tilted towards
+#define COVERAGE_SCALE_BINS 10 //target bounding box diagonal over the image diagonal, 0.1 wide
+
+struct coverageParams_t{
+  int grid_cells;          //cells along the longer image side
+  double focal_guess;      //focal length in longer image sides used for the poses until SetIntrinsics() (1 is ~53 deg fov)
+  double min_tilt_deg;     //views tilted less than this count as frontal and have no tilt direction
+  double min_coverage;     //Sufficient(): fraction of cells holding a corner,
+  int min_tilt_dirs;       //tilt directions with a view,
+  int min_scale_bins;      //and distinct target scales
+
+  coverageParams_t() : grid_cells(16), focal_guess(1), min_tilt_deg(15), min_coverage(0.6), min_tilt_dirs(4),
+                       min_scale_bins(3) {}
+};
+
+//what the views of one camera have covered so far
+struct cameraCoverage_t{
+  cv::Size img_size, grid;
+  cv::Mat cell_count;     //CV_32S, grid.height x grid.width, detected corners per cell
+  int num_cell_hit;
+  size_t num_view;
+  int tilt_hist[COVERAGE_TILT_BINS];
+  int dir_hist[COVERAGE_DIR_BINS];
+  int scale_hist[COVERAGE_SCALE_BINS];
+  double tilt_sum_deg;
+
+  cameraCoverage_t();
+  double CoverageFraction() const { return grid.area() > 0 ? static_cast<double>(num_cell_hit) / grid.area() : 0; }
+  double MeanTiltDeg() const { return num_view > 0 ? tilt_sum_deg / num_view : 0; }
+  int NumTiltDirs() const;
+  int NumScaleBins() const;
+};
+
+//Coverage map and pose statistics of the detected views, updated one view at a time as detection finishes
+//them so there is never a pass over all points. Each view adds its corners to a grid over the image and its
+//target pose to histograms of tilt, tilt direction and apparent size. The pose comes from solvePnP() with
+//SetIntrinsics() or, before a calibration exists, an ideal pinhole of coverageParams_t::focal_guess; that is
+//accurate enough to tell frontal from tilted views. Thread safe, detection workers add views concurrently.
+class CalCoverage{
+  public:
+    explicit CalCoverage(const coverageParams_t &params = coverageParams_t());
+    //drops every view
+    void Reset(const camCalTarget_t &cal_target, const size_t num_camera);
+    //poses of the views added afterwards use K/D of camera j
+    void SetIntrinsics(const size_t j, const cv::Mat &K, const cv::Mat &D);
+    void AddView(const size_t j, const cv::Size img_size, const std::vector<cv::Point2f> &img_points);
+    //cells of camera j that AddView() of img_points would cover for the first time
+    int NumNewCells(const size_t j, const cv::Size img_size, const std::vector<cv::Point2f> &img_points);
+    //every camera of det that found the target
+    void AddDetection(const calTargetDetection_t &det);
+    //all views of cal_data, ie. for results loaded from file
+    void AddCalData(const stereoCalData_t &cal_data, const size_t num_camera);
+
+    size_t NumCamera();
+    //a copy, safe to read while views are being added
+    cameraCoverage_t Camera(const size_t j);
+    //coverage and pose spread reach the coverageParams_t thresholds, enough views to stop capturing
+    bool Sufficient(const size_t j);
+    //cells as a heat map scaled to fit max_size, uncovered cells black, BGR
+    cv::Mat CoverageImage(const size_t j, const cv::Size max_size);
+    //tilt, tilt direction and scale histograms as bar charts stacked in an image of size, BGR
+    cv::Mat HistogramImage(const size_t j, const cv::Size size);
+    //one line per camera
+    std::string Summary();
+    void Print();
+    bool Write(const std::string &file_name_full);
+
+  private:
+    bool SufficientLocked(const size_t j) const;
+
+    coverageParams_t m_params;
+    std::mutex m_mutex;
+    camCalTarget_t m_cal_target;
+    std::vector<cv::Point3f> m_obj_points;
+    std::vector<cv::Mat> m_K, m_D;          //[camera], empty until SetIntrinsics()
+    std::vector<cameraCoverage_t> m_camera; //[camera]
+};
+
+#endif //__CALIB_COVERAGE__
@@ -0,0 +1,679 @@
+#include "calib_pipeline.h"
+#include "opencv2/calib3d.hpp"
+#include "opencv2/imgcodecs.hpp"
+#include <cstdio>
+#include <functional>
+#include <iostream>
+#include "mio/altro/io.h"
+#include "cal_binary.h"
+#include "calib_coverage.h"
+#include "model_compare.h"
+#include "outlier_rejection.h"
+#include "parallel_tasks.h"
+#include "pipeline_trace.h"
+#include "residual_diagnostics.h"
+
+
+struct flagName_t{
+  const char *name;
+  int flag;
+};
+
+static const flagName_t calibration_flag_names[] = {
+  {"fix_intrinsic",         cv::CALIB_FIX_INTRINSIC},
+  {"use_intrinsic_guess",   cv::CALIB_USE_INTRINSIC_GUESS},
+  {"fix_principal_point",   cv::CALIB_FIX_PRINCIPAL_POINT},
+  {"fix_focal_length",      cv::CALIB_FIX_FOCAL_LENGTH},
+  {"fix_aspect_ratio",      cv::CALIB_FIX_ASPECT_RATIO},
+  {"same_focal_length",     cv::CALIB_SAME_FOCAL_LENGTH},
+  {"zero_tangent_dist",     cv::CALIB_ZERO_TANGENT_DIST},
+  {"fix_k1",                cv::CALIB_FIX_K1},
+  {"fix_k2",                cv::CALIB_FIX_K2},
+  {"fix_k3",                cv::CALIB_FIX_K3},
+  {"fix_k4",                cv::CALIB_FIX_K4},
+  {"fix_k5",                cv::CALIB_FIX_K5},
+  {"fix_k6",                cv::CALIB_FIX_K6},
+  {"rational_model",        cv::CALIB_RATIONAL_MODEL},
+  {"thin_prism_model",      cv::CALIB_THIN_PRISM_MODEL},
+  {"fix_s1_s2_s3_s4",       cv::CALIB_FIX_S1_S2_S3_S4},
+  {"tilted_model",          cv::CALIB_TILTED_MODEL},
+  {"fix_taux_tauy",         cv::CALIB_FIX_TAUX_TAUY}
+};
+
+//the chessboard and circle grid flags share values, so each target type gets its own table
+static const flagName_t chess_flag_names[] = {
+  {"adaptive_thresh",       cv::CALIB_CB_ADAPTIVE_THRESH},
+  {"normalize_image",       cv::CALIB_CB_NORMALIZE_IMAGE},
+  {"filter_quads",          cv::CALIB_CB_FILTER_QUADS},
+  {"fast_check",            cv::CALIB_CB_FAST_CHECK}
+};
+
+static const flagName_t circle_flag_names[] = {
+  {"clustering",            cv::CALIB_CB_CLUSTERING}
+};
+
+template <size_t N>
+static bool FlagFromName(const flagName_t (&table)[N], const std::string &name, int &flag){
+  for(size_t i = 0; i < N; ++i)
+    if(name == table[i].name){
+      flag = table[i].flag;
+      return true;
+    }
+  return false;
+}
+
+template <size_t N>
+static std::vector<std::string> FlagNames(const flagName_t (&table)[N], const int flags){
+  std::vector<std::string> name_vec;
+  for(size_t i = 0; i < N; ++i)
+    if( (flags & table[i].flag) == table[i].flag )
+      name_vec.push_back(table[i].name);
+  return name_vec;
+}
+
+bool CalibrationFlagFromName(const std::string &name, int &flag){
+  return FlagFromName(calibration_flag_names, name, flag);
+}
+
+bool FindTargetFlagFromName(const std::string &target_type_str, const std::string &name, int &flag){
+  return target_type_str == "chess" ? FlagFromName(chess_flag_names, name, flag) :
+                                      FlagFromName(circle_flag_names, name, flag);
+}
+
+std::vector<std::string> CalibrationFlagNames(const int flags){
+  return FlagNames(calibration_flag_names, flags);
+}
+
+//the grid type bit is implied by the target type and is not named
+std::vector<std::string> FindTargetFlagNames(const std::string &target_type_str, const int flags){
+  return target_type_str == "chess" ? FlagNames(chess_flag_names, flags) :
+                                      FlagNames(circle_flag_names, flags);
+}
+
+int GridTypeFlag(const std::string &target_type_str){
+  if(target_type_str == "circle")
+    return cv::CALIB_CB_SYMMETRIC_GRID;
+  if(target_type_str == "a-circle")
+    return cv::CALIB_CB_ASYMMETRIC_GRID;
+  return 0;
+}
+
+
+template <typename T>
+static void ReadNode(const cv::FileNode &node, T &value){
+  if( !node.empty() )
+    node >> value;
+}
+
+static bool ReadFlagNode(const cv::FileNode &node, const std::function<bool(const std::string&, int&)> &flag_from_name,
+                         int &flags){
+  if( node.empty() )
+    return true;
+  EXP_CHK_M(node.type() == cv::FileNode::SEQ, return(false), "flag list must be a sequence of flag names")
+  flags = 0;
+  for(cv::FileNodeIterator it = node.begin(); it != node.end(); ++it){
+    const std::string name = static_cast<std::string>(*it);
+    int flag;
+    EXP_CHK_M(flag_from_name(name, flag), return(false), "unknown flag name: " + name)
+    flags |= flag;
+  }
+  return true;
+}
+
+bool ReadCalibOptions(const cv::FileNode &node, calibOptions_t &opt){
+  ReadNode(node["cal_photo_dir"], opt.cal_photo_dir);
+  ReadNode(node["img_ext"], opt.img_ext);
+  const cv::FileNode prefix_node = node["file_prefix"];
+  if( !prefix_node.empty() ){
+    opt.file_prefix.clear();
+    for(cv::FileNodeIterator it = prefix_node.begin(); it != prefix_node.end(); ++it)
+      opt.file_prefix.push_back( static_cast<std::string>(*it) );
+  }
+  ReadNode(node["file_glob"], opt.file_glob);
+  ReadNode(node["file_regex"], opt.file_regex);
+  ReadNode(node["pair_tolerance"], opt.pair_tolerance);
+
+  const std::string prev_target_type_str = opt.target_type_str;
+  ReadNode(node["target_type"], opt.target_type_str);
+  ReadNode(node["target_width"], opt.target_size.width);
+  ReadNode(node["target_height"], opt.target_size.height);
+  ReadNode(node["target_spacing"], opt.target_spacing);
+
+  int pre_calibrate = opt.pre_calibrate, intrinsic_from_file = opt.intrinsic_from_file,
+      rect_hartley = !opt.rect_use_opencv, rect_zero_disparity = opt.rect_zero_disparity,
+      use_detection_cache = opt.use_detection_cache, reject_outliers = opt.reject_outliers,
+      detect_use_hint = opt.detect_use_hint, live_save_views = opt.live_save_views;
+  ReadNode(node["pre_calibrate"], pre_calibrate);
+  ReadNode(node["intrinsic_from_file"], intrinsic_from_file);
+  ReadNode(node["input_intrinsic_1"], opt.input_intrinsic_file_name[0]);
+  ReadNode(node["input_intrinsic_2"], opt.input_intrinsic_file_name[1]);
+  ReadNode(node["reject_outliers"], reject_outliers);
+  ReadNode(node["reject_max_error"], opt.reject_max_error);
+  ReadNode(node["reject_percentile"], opt.reject_percentile);
+  ReadNode(node["reject_max_passes"], opt.reject_max_passes);
+  const cv::FileNode models_node = node["compare_models"];
+  if( !models_node.empty() ){
+    opt.compare_models.clear();
+    for(cv::FileNodeIterator it = models_node.begin(); it != models_node.end(); ++it)
+      opt.compare_models.push_back( static_cast<std::string>(*it) );
+  }
+  ReadNode(node["compare_folds"], opt.compare_folds);
+  ReadNode(node["rect_hartley"], rect_hartley);
+  ReadNode(node["rect_zero_disparity"], rect_zero_disparity);
+  ReadNode(node["rect_alpha"], opt.rect_alpha);
+  ReadNode(node["rect_output_dir"], opt.rect_output_dir);
+  opt.pre_calibrate = pre_calibrate != 0;
+  opt.reject_outliers = reject_outliers != 0;
+  opt.intrinsic_from_file = intrinsic_from_file != 0;
+  opt.rect_use_opencv = rect_hartley == 0;
+  opt.rect_zero_disparity = rect_zero_disparity != 0;
+
+  ReadNode(node["intrinsic_file_name"], opt.intrinsic_file_name);
+  ReadNode(node["extrinsic_file_name"], opt.extrinsic_file_name);
+  int write_binary = opt.write_binary, binary_with_maps = opt.binary_with_maps;
+  ReadNode(node["write_binary"], write_binary);
+  ReadNode(node["binary_with_maps"], binary_with_maps);
+  opt.write_binary = write_binary != 0;
+  opt.binary_with_maps = binary_with_maps != 0;
+  ReadNode(node["num_threads"], opt.num_threads);
+  ReadNode(node["num_decode_threads"], opt.num_decode_threads);
+  ReadNode(node["prefetch_depth"], opt.prefetch_depth);
+  ReadNode(node["use_detection_cache"], use_detection_cache);
+  opt.use_detection_cache = use_detection_cache != 0;
+  ReadNode(node["detect_scale"], opt.detect_scale);
+  ReadNode(node["detect_use_hint"], detect_use_hint);
+  opt.detect_use_hint = detect_use_hint != 0;
+  ReadNode(node["raw_bit_depth"], opt.raw_bit_depth);
+  std::string raw_bayer;
+  ReadNode(node["raw_bayer"], raw_bayer);
+  EXP_CHK_M(raw_bayer.empty() || BayerPatternFromName(raw_bayer, opt.raw_bayer), return(false),
+            "unknown Bayer pattern " + raw_bayer)
+  ReadNode(node["live_source"], opt.live_source);
+  ReadNode(node["live_max_views"], opt.live_max_views);
+  ReadNode(node["live_save_views"], live_save_views);
+  opt.live_save_views = live_save_views != 0;
+  ReadNode(node["trace_file"], opt.trace_file);
+
+  auto find_target_flag_from_name = [&opt](const std::string &name, int &flag){
+    return FindTargetFlagFromName(opt.target_type_str, name, flag);
+  };
+  //find target flags share bits between target types, those set for another type do not carry over
+  if(opt.target_type_str != prev_target_type_str)
+    opt.find_target_flags = 0;
+  if( !ReadFlagNode(node["find_target_flags"], find_target_flag_from_name, opt.find_target_flags) ||
+      !ReadFlagNode(node["calib_flags"], CalibrationFlagFromName, opt.calib_flags) )
+    return false;
+
+  return true;
+}
+
+
+bool ReadCalibOptions(const std::string &file_name_full, calibOptions_t &opt){
+  try{
+    cv::FileStorage fs(file_name_full, cv::FileStorage::READ);
+    EXP_CHK_M(fs.isOpened(), return(false), "could not open " + file_name_full)
+    return ReadCalibOptions(fs.root(), opt);
+  }
+  catch(cv::Exception &e){
+    printf( "ReadCalibOptions() - could not parse %s - %s\n", file_name_full.c_str(), e.what() );
+    return false;
+  }
+}
+
+static void WriteStringSeq(cv::FileStorage &fs, const std::string &key, const std::vector<std::string> &str_vec){
+  fs << key << "[";
+  for(auto &str : str_vec)
+    fs << str;
+  fs << "]";
+}
+
+bool WriteCalibOptions(const std::string &file_name_full, const calibOptions_t &opt){
+  cv::FileStorage fs(file_name_full, cv::FileStorage::WRITE);
+  EXP_CHK_M(fs.isOpened(), return(false), "could not open " + file_name_full)
+
+  fs << "cal_photo_dir" << opt.cal_photo_dir;
+  fs << "img_ext" << opt.img_ext;
+  WriteStringSeq(fs, "file_prefix", opt.file_prefix);
+  fs << "file_glob" << opt.file_glob;
+  fs << "file_regex" << opt.file_regex;
+  fs << "pair_tolerance" << opt.pair_tolerance;
+  fs << "target_type" << opt.target_type_str;
+  fs << "target_width" << opt.target_size.width;
+  fs << "target_height" << opt.target_size.height;
+  fs << "target_spacing" << opt.target_spacing;
+  WriteStringSeq( fs, "find_target_flags", FindTargetFlagNames(opt.target_type_str, opt.find_target_flags) );
+  WriteStringSeq( fs, "calib_flags", CalibrationFlagNames(opt.calib_flags) );
+  fs << "pre_calibrate" << static_cast<int>(opt.pre_calibrate);
+  fs << "intrinsic_from_file" << static_cast<int>(opt.intrinsic_from_file);
+  fs << "input_intrinsic_1" << opt.input_intrinsic_file_name[0];
+  fs << "input_intrinsic_2" << opt.input_intrinsic_file_name[1];
+  fs << "reject_outliers" << static_cast<int>(opt.reject_outliers);
+  fs << "reject_max_error" << opt.reject_max_error;
+  fs << "reject_percentile" << opt.reject_percentile;
+  fs << "reject_max_passes" << opt.reject_max_passes;
+  WriteStringSeq(fs, "compare_models", opt.compare_models);
+  fs << "compare_folds" << opt.compare_folds;
+  fs << "rect_hartley" << static_cast<int>(!opt.rect_use_opencv);
+  fs << "rect_zero_disparity" << static_cast<int>(opt.rect_zero_disparity);
+  fs << "rect_alpha" << opt.rect_alpha;
+  fs << "rect_output_dir" << opt.rect_output_dir;
+  fs << "intrinsic_file_name" << opt.intrinsic_file_name;
+  fs << "extrinsic_file_name" << opt.extrinsic_file_name;
+  fs << "write_binary" << static_cast<int>(opt.write_binary);
+  fs << "binary_with_maps" << static_cast<int>(opt.binary_with_maps);
+  fs << "num_threads" << opt.num_threads;
+  fs << "num_decode_threads" << opt.num_decode_threads;
+  fs << "prefetch_depth" << opt.prefetch_depth;
+  fs << "use_detection_cache" << static_cast<int>(opt.use_detection_cache);
+  fs << "detect_scale" << opt.detect_scale;
+  fs << "detect_use_hint" << static_cast<int>(opt.detect_use_hint);
+  fs << "raw_bit_depth" << opt.raw_bit_depth;
+  fs << "raw_bayer" << BayerPatternName(opt.raw_bayer);
+  fs << "live_source" << opt.live_source;
+  fs << "live_max_views" << opt.live_max_views;
+  fs << "live_save_views" << static_cast<int>(opt.live_save_views);
+  fs << "trace_file" << opt.trace_file;
+
+  return true;
+}
+
+
+//trace file of a run, relative names go to the calibration directory
+static std::string TraceFileName(const calibOptions_t &opt){
+  if( opt.trace_file.empty() || opt.trace_file[0] == '/' )
+    return opt.trace_file;
+  std::string cal_photo_dir = opt.cal_photo_dir;
+  mio::FormatFilePath(cal_photo_dir);
+  return cal_photo_dir + "/" + opt.trace_file;
+}
+
+
+//what identifies a run when traces of many rigs and datasets are compared
+static void TraceRunInfo(PipelineTrace *trace, const calibOptions_t &opt, const char *mode, const int ret){
+  trace->SetInfo("mode", mode);
+  trace->SetInfo("cal_photo_dir", opt.cal_photo_dir);
+  trace->SetInfo( "num_camera", static_cast<double>( opt.NumCamera() ) );
+  trace->SetInfo( "target", opt.target_type_str + " " + std::to_string(opt.target_size.width) + "x" +
+                            std::to_string(opt.target_size.height) );
+  trace->SetInfo( "num_threads", static_cast<double>( ResolveNumThreads(opt.num_threads) ) );
+  trace->SetInfo("detect_scale", opt.detect_scale);
+  trace->SetInfo("status", ret);
+}
+
+
+//per corner residuals of the finished calibration, printed and written next to the other reports
+static void ResidualDiagnostics(const calibOptions_t &opt, const stereoCalData_t &cal_data){
+  if(cal_data.GetNumImgPerCam() == 0)
+    return;
+  std::string cal_photo_dir = opt.cal_photo_dir;
+  mio::FormatFilePath(cal_photo_dir);
+  residualReport_t report;
+  ComputeResiduals(opt.CalTarget(), cal_data, opt.NumCamera(), report, opt.num_threads);
+  if( report.cam.empty() )
+    return;
+  PrintResidualReport(report);
+  WriteResidualReport(cal_photo_dir + "/residual_report.yml", report);
+}
+
+
+//ranks opt.compare_models on the detected points, calib_flags gets the winner's model
+static int CompareModelsStage(const calibOptions_t &opt, const stereoCalData_t &cal_data, pipelineProgress_t *progress,
+                              int &calib_flags){
+  std::vector<distortionModel_t> model_vec;
+  EXP_CHK(DistortionModelsFromNames(opt.compare_models, opt.calib_flags, model_vec), return(-1))
+  std::string cal_photo_dir = opt.cal_photo_dir;
+  mio::FormatFilePath(cal_photo_dir);
+
+  modelCompareParams_t params;
+  params.num_folds = opt.compare_folds;
+  params.num_threads = opt.num_threads;
+  params.cancel = progress ? &progress->cancel : NULL;
+  modelCompareReport_t report;
+  const int ret = CompareDistortionModels(opt.CalTarget(), cal_data, opt.NumCamera(), opt.calib_flags, model_vec,
+                                          params, report);
+  if(ret != 0)
+    return ret;
+  PrintModelComparison(report);
+  WriteModelComparison(cal_photo_dir + "/model_comparison.yml", report);
+  EXP_CHK_M(report.best >= 0, return(-1), "no distortion model could be solved")
+  calib_flags = WithDistortionModel(opt.calib_flags, report.score_vec[report.best].model.flags);
+  return 0;
+}
+
+
+static int CalibrationStages(const calibOptions_t &opt, stereoCalData_t &cal_data, calibResult_t &result,
+                             const bool only_rectification, CalImageStore *img_store, pipelineProgress_t *progress,
+                             CalCoverage *coverage){
+  EXP_CHK_M(opt.NumCamera() == 1 || opt.NumCamera() == 2, return(-1),
+            "one or two file prefixes are required, see RunRigCalibrationPipeline() for more cameras")
+  const bool stereo_mode = opt.StereoMode();
+  const size_t num_camera = opt.NumCamera();
+
+  std::string cal_photo_dir = opt.cal_photo_dir;
+  mio::FormatFilePath(cal_photo_dir);
+
+  const camCalTarget_t cal_target = opt.CalTarget();
+  if(img_store)
+    img_store->SetRawParams( opt.RawParams() );
+  if(!only_rectification){
+    if( !ProgressStage(progress, "listing") )
+      return(1);
+    std::vector<std::string> img_file_name_vec;
+    EXP_CHK(ScanImageSets(cal_photo_dir, opt.ScanParams(), img_file_name_vec) >= 0, return(-1))
+    EXP_CHK(img_file_name_vec.size() > 2, return(-1))
+
+    if( !ProgressStage(progress, "detection") )
+      return(1);
+    CalCoverage local_coverage;
+    if(!coverage)
+      coverage = &local_coverage;
+    coverage->Reset(cal_target, num_camera);
+    detectPipelineParams_t detect_params = opt.DetectParams();
+    detect_params.progress = progress;
+    detect_params.coverage = coverage;
+    result.num_img_per_cam = ExtractCalTargetPointsMT(cal_photo_dir, cal_target, img_file_name_vec, cal_data,
+                                                      opt.find_target_flags | GridTypeFlag(opt.target_type_str),
+                                                      num_camera, detect_params, img_store);
+    if( ProgressCancelled(progress) )
+      return(1);
+    EXP_CHK_M(result.num_img_per_cam >= 2, return(-1), "target found in fewer than two images per camera")
+    std::cout << cal_data.GetNumImgPerCam() << " images per camera successfully detected.\n";
+    coverage->Print();
+    coverage->Write(cal_photo_dir + "/coverage_report.yml");
+  }
+
+  int calib_flags = opt.calib_flags;
+  if( !only_rectification && !opt.compare_models.empty() ){
+    if( !ProgressStage(progress, "model comparison") )
+      return(1);
+    //intrinsics loaded from files come with their own model
+    if( (opt.calib_flags & cv::CALIB_USE_INTRINSIC_GUESS) && opt.intrinsic_from_file )
+      printf("CalibrationStages(): intrinsics are loaded from files, the model comparison is skipped\n");
+    else{
+      const int ret = CompareModelsStage(opt, cal_data, progress, calib_flags);
+      if(ret != 0)
+        return ret;
+    }
+  }
+
+  if( (!only_rectification || !stereo_mode) && !ProgressStage(progress, "calibration") )
+    return(1);
+  if(stereo_mode){
+    if(!only_rectification){
+      if( (opt.calib_flags & cv::CALIB_USE_INTRINSIC_GUESS) && opt.intrinsic_from_file ){
+        LoadCameraCalData(cal_photo_dir, opt.input_intrinsic_file_name[0], opt.input_intrinsic_file_name[1], cal_data);
+          std::cout << "Loaded intrinsic parameters from file...\n";
+          mio::Print(cal_data.K[0], "M1");
+          mio::Print(cal_data.K[1], "M2");
+          mio::Print(cal_data.D[0], "D1");
+          mio::Print(cal_data.D[1], "D2");
+      }
+
+      ScopedTrace trace("stereo calibration", "calibration");
+      StereoCalibrate( cal_target,
+                       cal_data,
+                       result.repro_err_vec, result.rms_error, result.reprojection_error,
+                       calib_flags, opt.pre_calibrate );
+
+      std::cout << "reprojection error per pair of images:" << std::endl;
+      for(size_t i = 0; i < cal_data.GetNumImgPerCam(); i++)
+        std::cout << cal_data.good_img_file_names[0][i] << ", " <<
+                     cal_data.good_img_file_names[1][i] << ": " << result.repro_err_vec[i] << std::endl;
+    }
+
+  }
+  else{ //single camera mode
+    ScopedTrace trace("camera calibration", "calibration");
+    CalibrateCamera(cal_target, cal_data, 0, calib_flags);
+  }
+
+  if(opt.reject_outliers && !only_rectification){
+    if( !ProgressStage(progress, "outlier rejection") )
+      return(1);
+    ScopedTrace trace("outlier rejection", "calibration");
+    outlierRejectParams_t params;
+    params.max_view_error = opt.reject_max_error;
+    params.drop_percentile = opt.reject_percentile;
+    params.max_passes = opt.reject_max_passes;
+    params.num_threads = opt.num_threads;
+    params.cancel = progress ? &progress->cancel : NULL;
+    outlierRejectReport_t report;
+    EXP_CHK(RejectOutlierViews(cal_target, cal_data, num_camera, calib_flags, params, result, report) == 0,
+            return(-1))
+    PrintOutlierReport(report, num_camera);
+    WriteOutlierReport(cal_photo_dir + "/outlier_report.yml", report, num_camera);
+    if(img_store)
+      img_store->SetViews(cal_data);
+  }
+
+  result.calib_flags = calib_flags;
+
+  //after rectification so stereo pairs get their rectified epipolar error too
+  const int ret = RectifyAndSave(opt, cal_data, img_store, progress);
+  if(ret == 0)
+    ResidualDiagnostics(opt, cal_data);
+  return ret;
+}
+
+
+int RunCalibrationPipeline(const calibOptions_t &opt, stereoCalData_t &cal_data, calibResult_t &result,
+                           const bool only_rectification, CalImageStore *img_store, pipelineProgress_t *progress,
+                           CalCoverage *coverage){
+  TraceSession trace_session( TraceFileName(opt) );
+  const int ret = CalibrationStages(opt, cal_data, result, only_rectification, img_store, progress, coverage);
+  if( PipelineTrace *trace = trace_session.Trace() ){
+    TraceRunInfo(trace, opt, opt.StereoMode() ? "stereo" : "single", ret);
+    trace->SetInfo( "num_img_per_cam", static_cast<double>( cal_data.GetNumImgPerCam() ) );
+    trace->SetInfo("rms_error", result.rms_error);
+  }
+  return ret;
+}
+
+
+int RectifyAndSave(const calibOptions_t &opt, stereoCalData_t &cal_data, CalImageStore *img_store,
+                   pipelineProgress_t *progress){
+  std::string cal_photo_dir = opt.cal_photo_dir;
+  mio::FormatFilePath(cal_photo_dir);
+
+  if( opt.StereoMode() ){
+    if( !ProgressStage(progress, "rectification") )
+      return(1);
+    cal_data.ClearRectData();
+    {
+      ScopedTrace trace("rectification", "rectification");
+      ComputeRectification(cal_photo_dir, cal_data, opt.rect_use_opencv,
+                           opt.rect_zero_disparity ? cv::CALIB_ZERO_DISPARITY : -1, opt.rect_alpha);
+    }
+
+    if( !ProgressStage(progress, "saving") )
+      return(1);
+    {
+      ScopedTrace trace("save", "save");
+      SaveStereoCalData(cal_photo_dir, opt.intrinsic_file_name, opt.extrinsic_file_name, cal_data);
+    }
+
+    //maps are only rebuilt when the rectification parameters changed since they were saved
+    rectMaps_t rect_maps;
+    GetRectMaps(cal_photo_dir, opt.extrinsic_file_name, cal_data, rect_maps);
+    if(img_store)
+      img_store->SetRectification(rect_maps);
+    if(opt.write_binary){
+      ScopedTrace trace("save binary", "save");
+      EXP_CHK( SaveStereoCalBinary(cal_photo_dir + "/" + CalBinaryFileName(opt.extrinsic_file_name), cal_data, 2,
+                                   opt.binary_with_maps ? &rect_maps : NULL), return(-1) )
+    }
+    if( !opt.rect_output_dir.empty() ){
+      ScopedTrace trace("rectify images", "rectification");
+      const int num_written = RectifyImageSetMT(cal_photo_dir, cal_data, rect_maps, opt.rect_output_dir, opt.num_threads,
+                                                opt.RawParams());
+      std::cout << num_written << " rectified image pairs written to " << opt.rect_output_dir << std::endl;
+    }
+  }
+  else{
+    if( !ProgressStage(progress, "saving") )
+      return(1);
+    ScopedTrace trace("save", "save");
+    SaveCameraCalData(cal_photo_dir, opt.intrinsic_file_name, cal_data);
+    if(opt.write_binary)
+      EXP_CHK( SaveStereoCalBinary(cal_photo_dir + "/" + CalBinaryFileName(opt.intrinsic_file_name), cal_data, 1),
+               return(-1) )
+  }
+
+  cal_data.Print( !opt.StereoMode() );
+  return 0;
+}
+
+
+static int RigCalibrationStages(const calibOptions_t &opt, rigCalData_t &rig_data, rigCalibResult_t &result,
+                                pipelineProgress_t *progress, CalCoverage *coverage){
+  const size_t num_camera = opt.NumCamera();
+  EXP_CHK_M(num_camera >= 2, return(-1), "a rig needs at least two file prefixes")
+  if(opt.reject_outliers || opt.intrinsic_from_file || !opt.rect_output_dir.empty())
+    printf("RunRigCalibrationPipeline(): outlier rejection, intrinsic input files and rectification are not used for rigs\n");
+
+  std::string cal_photo_dir = opt.cal_photo_dir;
+  mio::FormatFilePath(cal_photo_dir);
+  const camCalTarget_t cal_target = opt.CalTarget();
+
+  if( !ProgressStage(progress, "listing") )
+    return(1);
+  std::vector<std::string> img_file_name_vec;
+  EXP_CHK(ScanImageSets(cal_photo_dir, opt.ScanParams(), img_file_name_vec) > 2, return(-1))
+
+  if( !ProgressStage(progress, "detection") )
+    return(1);
+  CalCoverage local_coverage;
+  if(!coverage)
+    coverage = &local_coverage;
+  coverage->Reset(cal_target, num_camera);
+  detectPipelineParams_t detect_params = opt.DetectParams();
+  detect_params.progress = progress;
+  detect_params.coverage = coverage;
+  const int num_view = ExtractRigTargetPointsMT(cal_photo_dir, cal_target, img_file_name_vec, rig_data,
+                                                opt.find_target_flags | GridTypeFlag(opt.target_type_str),
+                                                num_camera, detect_params);
+  if( ProgressCancelled(progress) )
+    return(1);
+  EXP_CHK_M(num_view >= 3, return(-1), "target found in fewer than three image sets")
+  for(size_t j = 0; j < num_camera; ++j)
+    std::cout << opt.file_prefix[j] << ": target found in " << rig_data.NumViewSeen(j) << " of " << num_view << " views\n";
+  coverage->Print();
+  coverage->Write(cal_photo_dir + "/coverage_report.yml");
+
+  if( !ProgressStage(progress, "calibration") )
+    return(1);
+  rigCalibParams_t params;
+  params.calib_flags = opt.calib_flags;
+  params.num_threads = opt.num_threads;
+  const int ret = CalibrateRig(cal_target, rig_data, params, result, progress ? &progress->cancel : NULL);
+  if(ret != 0)
+    return ret;
+
+  std::cout << "reprojection error per view:" << std::endl;
+  for(size_t i = 0; i < rig_data.NumView(); ++i)
+    std::cout << rig_data.good_img_file_names[0][i] << ": " << result.view_rms[i] << std::endl;
+  for(size_t j = 0; j < num_camera; ++j){
+    std::cout << "camera " << j << " (" << opt.file_prefix[j] << "), rms " << result.cam_rms[j] << std::endl;
+    mio::Print(rig_data.K[j], "K");
+    mio::Print(rig_data.D[j], "D");
+    mio::Print(rig_data.R[j], "R");
+    mio::Print(rig_data.T[j], "T");
+  }
+
+  if( !ProgressStage(progress, "saving") )
+    return(1);
+  ScopedTrace trace("save", "save");
+  EXP_CHK( SaveRigCalData(cal_photo_dir + "/" + opt.extrinsic_file_name + "_rig.yml", rig_data), return(-1) )
+  if(opt.write_binary)
+    EXP_CHK( SaveRigCalBinary(cal_photo_dir + "/" + opt.extrinsic_file_name + "_rig.ccal", rig_data), return(-1) )
+  return 0;
+}
+
+
+int RunRigCalibrationPipeline(const calibOptions_t &opt, rigCalData_t &rig_data, rigCalibResult_t &result,
+                              pipelineProgress_t *progress, CalCoverage *coverage){
+  TraceSession trace_session( TraceFileName(opt) );
+  const int ret = RigCalibrationStages(opt, rig_data, result, progress, coverage);
+  if( PipelineTrace *trace = trace_session.Trace() ){
+    TraceRunInfo(trace, opt, "rig", ret);
+    trace->SetInfo( "num_view", static_cast<double>( rig_data.NumView() ) );
+    trace->SetInfo("rms_error", result.rms_error);
+    trace->SetInfo("num_iter", result.num_iter);
+  }
+  return ret;
+}
+
+
+static int LiveCalibrationStages(const calibOptions_t &opt, stereoCalData_t &cal_data, calibResult_t &result,
+                                 liveCaptureStats_t *stats, const std::atomic<bool> *stop,
+                                 const std::function<void(const liveFrame_t&)> &on_frame,
+                                 pipelineProgress_t *progress){
+  EXP_CHK_M(opt.NumCamera() == 1, return(-1), "live capture calibrates a single camera, give one file prefix")
+  EXP_CHK_M(!opt.live_source.empty(), return(-1), "no live source")
+  std::string cal_photo_dir = opt.cal_photo_dir;
+  mio::FormatFilePath(cal_photo_dir);
+
+  //views are appended in acceptance order, so the saved names line up with good_img_file_names
+  std::vector<std::string> saved_name_vec;
+  liveCaptureParams_t params = opt.LiveParams();
+  params.cancel = progress ? &progress->cancel : NULL;
+  params.on_frame = [&](const liveFrame_t &frame){
+    if(frame.accepted && opt.live_save_views){
+      char frame_str[32];
+      snprintf(frame_str, sizeof(frame_str), "%06zu", frame.frame_idx);
+      const std::string file_name = opt.file_prefix[0] + frame_str + "." + opt.img_ext;
+      //a missing file makes the count differ, and the views then keep their frame_<idx> names
+      if( cv::imwrite(cal_photo_dir + "/" + file_name, frame.img) )
+        saved_name_vec.push_back(file_name);
+      else
+        printf( "RunLiveCalibrationPipeline(): could not write %s\n", file_name.c_str() );
+    }
+    if(on_frame)
+      on_frame(frame);
+  };
+
+  if( !ProgressStage(progress, "capture") )
+    return(1);
+  //stop ends the capture and keeps its views, progress->cancel ends it and abandons the run
+  const int ret = RunLiveCalibration(opt.CalTarget(), opt.find_target_flags | GridTypeFlag(opt.target_type_str),
+                                     opt.calib_flags, params, cal_data, result, stats, stop);
+  if( ProgressCancelled(progress) )
+    return(1);
+  if(ret != 0)
+    return ret;
+  result.calib_flags = opt.calib_flags;
+  if(opt.live_save_views && saved_name_vec.size() == cal_data.good_img_file_names[0].size())
+    cal_data.good_img_file_names[0] = saved_name_vec;
+
+  std::cout << "reprojection error per view:" << std::endl;
+  for(size_t i = 0; i < cal_data.GetNumImgPerCam() && i < result.repro_err_vec.size(); i++)
+    std::cout << cal_data.good_img_file_names[0][i] << ": " << result.repro_err_vec[i] << std::endl;
+
+  //same order as RunCalibrationPipeline()
+  const int save_ret = RectifyAndSave(opt, cal_data, NULL, progress);
+  if(save_ret == 0)
+    ResidualDiagnostics(opt, cal_data);
+  return save_ret;
+}
+
+
+int RunLiveCalibrationPipeline(const calibOptions_t &opt, stereoCalData_t &cal_data, calibResult_t &result,
+                               liveCaptureStats_t *stats, const std::atomic<bool> *stop,
+                               const std::function<void(const liveFrame_t&)> &on_frame,
+                               pipelineProgress_t *progress){
+  TraceSession trace_session( TraceFileName(opt) );
+  liveCaptureStats_t local_stats;
+  if(!stats)
+    stats = &local_stats;
+  const int ret = LiveCalibrationStages(opt, cal_data, result, stats, stop, on_frame, progress);
+  if( PipelineTrace *trace = trace_session.Trace() ){
+    TraceRunInfo(trace, opt, "live", ret);
+    trace->SetInfo("live_source", opt.live_source);
+    trace->SetInfo( "num_frames", static_cast<double>(stats->num_frames) );
+    trace->SetInfo( "num_dropped", static_cast<double>(stats->num_dropped) );
+    trace->SetInfo("capture_time_s", stats->capture_time_s);
+    trace->SetInfo( "num_view", static_cast<double>( cal_data.GetNumImgPerCam() ) );
+    trace->SetInfo("rms_error", result.rms_error);
+  }
+  return ret;
+}
@@ -0,0 +1,170 @@
+#ifndef __CALIB_PIPELINE__
+#define __CALIB_PIPELINE__
+
+#include <string>
+#include <vector>
+#include "opencv2/core.hpp"
+#include "mvg/stereo_compute.h"
+#include "cal_target_detect.h"
+#include "cal_image_store.h"
+#include "calib_coverage.h"
+#include "image_scan.h"
+#include "live_capture.h"
+#include "rect_maps.h"
+#include "rig_calib.h"
+#include "pipeline_progress.h"
+
+
+//Everything the detect -> calibrate -> rectify -> save pipeline needs. The GUI fills this from its widgets,
+//the command line tool from arguments and/or a cv::FileStorage config file.
+struct calibOptions_t{
+  std::string cal_photo_dir, img_ext;
+  std::vector<std::string> file_prefix; //one per camera, more than 2 selects RunRigCalibrationPipeline()
+  std::string file_glob, file_regex;    //optional file name patterns, see imageScanParams_t
+  double pair_tolerance;                //0 pairs equal frame keys, > 0 the nearest frame number within this
+
+  std::string target_type_str; //"chess", "circle" or "a-circle"
+  cv::Size target_size;
+  double target_spacing;
+  int find_target_flags; //cv::CALIB_CB_* flags without the grid type bit, detection adds GridTypeFlag()
+
+  int calib_flags; //cv::CALIB_* flags
+  bool pre_calibrate, intrinsic_from_file;
+  std::string input_intrinsic_file_name[2];
+  bool reject_outliers;       //drop outlier views after calibrating, see RejectOutlierViews()
+  double reject_max_error;    //views at or below this are kept, pixels, <= 0 disables
+  double reject_percentile;   //views at or below this error percentile are kept, 0..100, <= 0 disables
+  int reject_max_passes;
+  std::vector<std::string> compare_models; //distortion models ranked before calibrating, "all" for every built in one,
+                                           //see CompareDistortionModels(); the best replaces the model in calib_flags
+  int compare_folds;                       //cross-validation folds of the model comparison
+
+  bool rect_use_opencv;       //false selects Hartley rectification
+  bool rect_zero_disparity;
+  double rect_alpha;          //< 0 uses the OpenCV default
+  std::string rect_output_dir; //when set the rectified image pairs are written there
+
+  std::string intrinsic_file_name, extrinsic_file_name;
+  bool write_binary;          //also write the .ccal binary, see cal_binary_loader.h
+  bool binary_with_maps;      //include the rectification maps in the binary (stereo)
+  int num_threads;            //detection threads, <= 0 uses one thread per core
+  int num_decode_threads;     //image decode threads feeding detection
+  int prefetch_depth;         //decoded image sets buffered ahead of detection
+  bool use_detection_cache;   //reuse detection results stored in the calibration directory
+  double detect_scale;        //coarse-to-fine detection on images downscaled by this, >= 1 for full resolution
+  bool detect_use_hint;       //search around the previous image's target first (sequential captures)
+  int raw_bit_depth;          //significant bits of the image files, > 8 keeps 16 bit images at full depth
+  int raw_bayer;              //BAYER_* pattern of single channel sensor images, BAYER_NONE for developed images
+  std::string live_source;    //cv::VideoCapture source for RunLiveCalibrationPipeline(), see liveCaptureParams_t
+  int live_max_views;         //accepted views that end a live capture, 0 runs until the source ends
+  bool live_save_views;       //write the accepted frames to cal_photo_dir for a later batch run
+  std::string trace_file;     //Chrome trace of each run's stage timings, relative to cal_photo_dir, empty for none
+
+  calibOptions_t() : img_ext("png"), pair_tolerance(0), target_type_str("chess"), target_size(9, 6), target_spacing(10),
+                     find_target_flags(0), calib_flags(0), pre_calibrate(false), intrinsic_from_file(false),
+                     reject_outliers(false), reject_max_error(1.0), reject_percentile(0), reject_max_passes(10),
+                     compare_folds(5), rect_use_opencv(true), rect_zero_disparity(true), rect_alpha(-1),
+                     intrinsic_file_name("intrinsics"), extrinsic_file_name("extrinsics"), write_binary(true),
+                     binary_with_maps(false), num_threads(0),
+                     num_decode_threads(2), prefetch_depth(8), use_detection_cache(true), detect_scale(1),
+                     detect_use_hint(false), raw_bit_depth(8), raw_bayer(BAYER_NONE), live_max_views(40),
+                     live_save_views(true) {}
+
+  size_t NumCamera() const { return file_prefix.size(); }
+  bool StereoMode() const { return file_prefix.size() == 2; }
+  bool RigMode() const { return file_prefix.size() > 2; }
+  camCalTarget_t CalTarget() const { return camCalTarget_t(target_type_str, target_size, target_spacing); }
+  detectPipelineParams_t DetectParams() const {
+    detectPipelineParams_t params;
+    params.num_threads = num_threads;
+    params.num_decode_threads = num_decode_threads;
+    params.prefetch_depth = prefetch_depth > 0 ? static_cast<size_t>(prefetch_depth) : 1;
+    params.use_cache = use_detection_cache;
+    params.detect_scale = detect_scale;
+    params.use_search_hint = detect_use_hint;
+    params.raw = RawParams();
+    return params;
+  }
+  rawImageParams_t RawParams() const {
+    rawImageParams_t params;
+    params.bit_depth = raw_bit_depth;
+    params.bayer_pattern = raw_bayer;
+    return params;
+  }
+  liveCaptureParams_t LiveParams() const {
+    liveCaptureParams_t params;
+    params.source = live_source;
+    params.max_views = live_max_views > 0 ? static_cast<size_t>(live_max_views) : 0;
+    params.num_threads = num_threads;
+    params.detect_scale = detect_scale;
+    return params;
+  }
+  imageScanParams_t ScanParams() const {
+    imageScanParams_t params;
+    params.img_ext = img_ext;
+    params.file_prefix = file_prefix;
+    params.name_glob = file_glob;
+    params.name_regex = file_regex;
+    params.pair_tolerance = pair_tolerance;
+    params.num_threads = num_threads;
+    return params;
+  }
+};
+
+struct calibResult_t{
+  int num_img_per_cam;
+  double rms_error, reprojection_error; //stereo mode only
+  std::vector<double> repro_err_vec;    //per image pair, stereo mode only
+  int calib_flags;                      //flags the calibration used, the options' with a model comparison's winner
+
+  calibResult_t() : num_img_per_cam(0), rms_error(0), reprojection_error(0), calib_flags(0) {}
+};
+
+//flag name <-> value lookup used by config files and command line arguments, names follow the
+//cv::CALIB_* / cv::CALIB_CB_* enums in lower case without the prefix (ie. "rational_model", "fast_check")
+bool CalibrationFlagFromName(const std::string &name, int &flag);
+bool FindTargetFlagFromName(const std::string &target_type_str, const std::string &name, int &flag);
+std::vector<std::string> CalibrationFlagNames(const int flags);
+std::vector<std::string> FindTargetFlagNames(const std::string &target_type_str, const int flags);
+//cv::CALIB_CB_SYMMETRIC_GRID / cv::CALIB_CB_ASYMMETRIC_GRID for circle targets, 0 for chess
+int GridTypeFlag(const std::string &target_type_str);
+
+bool ReadCalibOptions(const std::string &file_name_full, calibOptions_t &opt);
+//the keys of a config file read from any map node, ie. one entry of a batch manifest. Keys that are missing
+//leave opt unchanged, so nodes can be layered over each other, except that a new target_type drops the find
+//target flags set for the previous one.
+bool ReadCalibOptions(const cv::FileNode &node, calibOptions_t &opt);
+bool WriteCalibOptions(const std::string &file_name_full, const calibOptions_t &opt);
+
+//Runs detection and calibration (skipped when only_rectification is set), then rectification and saving. When
+//img_store is non-NULL it is reset to the detected views and given the rectification maps, views are then made
+//on demand. progress, when non-NULL, gets each stage and detected image set and can cancel the run between
+//them. coverage, when non-NULL, is reset and gets each found image set during detection so it can be shown
+//while the job runs; either way the coverage is printed and written to coverage_report.yml in the calibration
+//directory. With opt.compare_models the listed distortion models are ranked on the detected points first,
+//written to model_comparison.yml, and the best one is calibrated. With opt.trace_file set each stage and image
+//is timed and written as a Chrome trace, see PipelineTrace; the rig and live pipelines do the same. Returns 0
+//on success, 1 when cancelled, -1 on failure.
+int RunCalibrationPipeline(const calibOptions_t &opt, stereoCalData_t &cal_data, calibResult_t &result,
+                           const bool only_rectification = false, CalImageStore *img_store = NULL,
+                           pipelineProgress_t *progress = NULL, CalCoverage *coverage = NULL);
+//the rectification (stereo) and saving tail of RunCalibrationPipeline(), for results refined elsewhere
+int RectifyAndSave(const calibOptions_t &opt, stereoCalData_t &cal_data, CalImageStore *img_store = NULL,
+                   pipelineProgress_t *progress = NULL);
+//RunCalibrationPipeline() for a rig of any number of cameras: one detection pass over every camera image, then
+//CalibrateRig() and saving to <extrinsic_file_name>_rig.yml (and .ccal) in the calibration directory. There is
+//no rectification, outlier rejection or intrinsic input file for rigs. coverage as for
+//RunCalibrationPipeline(). Returns 0 on success, 1 when cancelled, -1 on failure.
+int RunRigCalibrationPipeline(const calibOptions_t &opt, rigCalData_t &rig_data, rigCalibResult_t &result,
+                              pipelineProgress_t *progress = NULL, CalCoverage *coverage = NULL);
+//Single camera calibration from opt.live_source with RunLiveCalibration(), then saving like
+//RunCalibrationPipeline(). With opt.live_save_views the accepted frames are written to the calibration
+//directory as <prefix><frame>.<ext>, so a batch run can redo the calibration from them. stop ends the capture
+//and calibrates the views accepted so far, progress->cancel abandons the run. on_frame, when set, gets every
+//detected frame on the calling thread. Returns 0 on success, 1 when cancelled, -1 on failure.
+int RunLiveCalibrationPipeline(const calibOptions_t &opt, stereoCalData_t &cal_data, calibResult_t &result,
+                               liveCaptureStats_t *stats = NULL, const std::atomic<bool> *stop = NULL,
+                               const std::function<void(const liveFrame_t&)> &on_frame = NULL,
+                               pipelineProgress_t *progress = NULL);
+
+#endif //__CALIB_PIPELINE__
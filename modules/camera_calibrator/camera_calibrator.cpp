@@ -1,15 +1,20 @@
 #include "camera_calibrator.h"
 #include "ui_camera_calibrator.h"
+#include "calib_pipeline.h"
 #include "opencv2/imgproc.hpp"
 #include "opencv2/highgui.hpp"
 #include "opencv2/calib3d.hpp"
+#include <QEvent>
 #include <QFileDialog>
 #include <QStyleFactory>
+#include <QTimer>
+#include <QtConcurrent/QtConcurrentRun>
+#include <algorithm>
 #include <iostream>
+#include <sstream>
 #include <string>
 #include <vector>
 #include "mio/altro/io.h"
-#include "mio/qt/cv_mat_to_qimage.h"
 
 #include <X11/Xlib.h>
 #include <X11/Xutil.h>
@@ -78,9 +83,24 @@ void DisplayCalTarget(const std::vector<cv::Point3f> &point_vec){
 
 CameraCalibrator::CameraCalibrator(QWidget *parent) : QWidget(parent), ui(new Ui::CameraCalibrator), 
     m_default_cal_img_dir("/home"), 
-    m_use_opencv_rectification(true){
+    m_use_opencv_rectification(true),
+    m_views_match_cal_data(true){
   ui->setupUi(this);
   m_label = NULL;
+  m_disp_img_line_edit = NULL;
+  m_disp_img_idx = 0;
+  m_prerender_attempts = 0;
+
+  //called on the job thread, the store is thread safe and the signals are queued to the GUI thread
+  m_progress.on_stage = [this](const std::string &stage){
+    emit JobStage( QString::fromStdString(stage) );
+  };
+  m_progress.on_image_set = [this](const imageSetProgress_t &set_progress){
+    if(set_progress.det->found)
+      m_img_store.AppendView(set_progress.file_names, set_progress.det->img_points, set_progress.view_img);
+    emit JobImageSet( static_cast<int>(set_progress.num_done), static_cast<int>(set_progress.num_total),
+                      static_cast<int>(set_progress.num_found) );
+  };
 
   connect( ui->pushButton_setCalPhotoDir, SIGNAL( clicked() ), this, SLOT( SetCalPhotoDir() ) );
   connect( ui->pushButton_runCalibration, SIGNAL( clicked() ), this, SLOT( RunCalibration() ) );
@@ -90,17 +110,25 @@ CameraCalibrator::CameraCalibrator(QWidget *parent) : QWidget(parent), ui(new Ui
   connect( ui->pushButton_nextCalImg, SIGNAL( clicked() ), this, SLOT( NextCalImage() ) );
   connect( ui->comboBox_targetType, SIGNAL( currentIndexChanged(QString) ), this, SLOT( UpdateFindTargetOptions(QString) ) );
   connect( ui->checkBox_viewRectified, SIGNAL( stateChanged(int) ), this, SLOT( SetCalImg(int) ) );
+  connect( ui->checkBox_residuals, SIGNAL( stateChanged(int) ), this, SLOT( SetResidualOverlay(int) ) );
   connect( ui->pushButton_loadParameters, SIGNAL( clicked() ), this, SLOT( LoadStereoParameters() ) );
   connect( ui->checkBox_singleCamera, SIGNAL( stateChanged(int) ), this, SLOT( SingleCamSetup() ) );
   connect( ui->checkBox_useIntrinsicGuess, SIGNAL( stateChanged(int) ), this, SLOT( UseIntGuessStateChange() ) );
   connect( ui->checkBox_intrinsicFromFile, SIGNAL( stateChanged(int) ), this, SLOT( IntFromFileStateChange() ) );
   connect( ui->pushButton_lemon, SIGNAL( clicked() ), this, SLOT( MarkAsLemon() ) );
-
-  SetupMat2QImage();
+  connect( ui->pushButton_restoreView, SIGNAL( clicked() ), this, SLOT( RestoreView() ) );
+  connect( ui->spinBox_imgCacheMb, SIGNAL( valueChanged(int) ), this, SLOT( SetImgCacheSize(int) ) );
+  connect( ui->pushButton_cancelJob, SIGNAL( clicked() ), this, SLOT( CancelJob() ) );
+  connect( &m_job_watcher, SIGNAL( finished() ), this, SLOT( JobFinished() ) );
+  connect( this, SIGNAL( JobStage(QString) ), this, SLOT( ShowJobStage(QString) ) );
+  connect( this, SIGNAL( JobImageSet(int, int, int) ), this, SLOT( ShowJobImageSet(int, int, int) ) );
+  SetImgCacheSize( ui->spinBox_imgCacheMb->value() );
 }
 
 
 CameraCalibrator::~CameraCalibrator(){
+  m_progress.cancel = true;
+  m_job_watcher.waitForFinished();
   delete ui;
 }
 
@@ -134,60 +162,6 @@ void CameraCalibrator::SingleCamSetup(){
 }
 
 
-int CreateImageList(std::string dir_path, const std::string file_name_out, std::string file_ext, 
-                    const std::vector<std::string> &file_prefix){
-  mio::FormatFilePath(dir_path);
-  mio::FormatFileExt(file_ext);
-  const size_t file_ext_size = file_ext.size();
-
-  //get directory listing
-  std::vector<std::string> dir_list_vec;
-  mio::GetDirList(dir_path, dir_list_vec, true);
-
-  //create img_file_name_vec
-  const size_t num_prefix = file_prefix.size();
-  std::vector< std::vector<std::string> > img_file_name_vec(num_prefix);
-  for(auto &dir_item : dir_list_vec) //check the entire directory listing
-    for(size_t j = 0; j < num_prefix; ++j) //insert image file name into respective camera vector
-      if( (dir_item.compare(0, file_prefix[j].size(), file_prefix[j]) == 0) && //check the file file prefix
-          (dir_item.compare(dir_item.size() - file_ext_size, file_ext_size, file_ext) == 0) ) //check the file extension
-        img_file_name_vec[j].push_back(dir_item);
-
-  //check that each camera list is the same size
-  const size_t num_img_per_prefix = img_file_name_vec[0].size();
-  for(size_t i = 1; i < num_prefix; ++i)
-    EXP_CHK_M(num_img_per_prefix == img_file_name_vec[i].size(), return(-1), "Different number of images between prefixes");
-
-  if( mio::FileExists(dir_path + "/" + file_name_out + ".xml") )
-    printf("CreateImageList(): output file already exists, replacing it\n");
-
-  cv::FileStorage fs(dir_path + "/" + file_name_out + ".xml", cv::FileStorage::WRITE);
-  fs << "images" << "[";
-  for(size_t i = 0; i < num_img_per_prefix; ++i)
-    for(size_t j = 0; j < num_prefix; ++j)
-      fs << img_file_name_vec[j][i];
-  fs << "]";
-
-  return 0;
-}
-
-
-bool ReadStringList(const std::string fileNameFull, std::vector<std::string> &img_file_name_vec){
-  std::cout << "ReadStringList() fileNameFull: " << fileNameFull << std::endl;
-  img_file_name_vec.resize(0);
-  cv::FileStorage fs(fileNameFull, cv::FileStorage::READ);
-  if(!fs.isOpened() )
-    return false;
-  cv::FileNode n = fs.getFirstTopLevelNode();
-  if(n.type() != cv::FileNode::SEQ)
-    return false;
-  cv::FileNodeIterator it = n.begin(), it_end = n.end();
-  for(; it != it_end; ++it)
-    img_file_name_vec.push_back( static_cast<std::string>(*it) );
-  return true;
-}
-
-
 int CameraCalibrator::GetCalibrationFlags(){
   int flags = 0;
 
@@ -232,6 +206,23 @@ int CameraCalibrator::GetCalibrationFlags(){
 }
 
 
+//the distortion model checkboxes from flags, ie. after a model comparison picked one
+void CameraCalibrator::SetDistortionModelFlags(const int flags){
+  ui->checkBox_zeroTangentDist->setChecked(flags & cv::CALIB_ZERO_TANGENT_DIST);
+  ui->checkBox_fixK1->setChecked(flags & cv::CALIB_FIX_K1);
+  ui->checkBox_fixK2->setChecked(flags & cv::CALIB_FIX_K2);
+  ui->checkBox_fixK3->setChecked(flags & cv::CALIB_FIX_K3);
+  ui->checkBox_fixK4->setChecked(flags & cv::CALIB_FIX_K4);
+  ui->checkBox_fixK5->setChecked(flags & cv::CALIB_FIX_K5);
+  ui->checkBox_fixK6->setChecked(flags & cv::CALIB_FIX_K6);
+  ui->checkBox_rationalModel->setChecked(flags & cv::CALIB_RATIONAL_MODEL);
+  ui->checkBox_thinPrism->setChecked(flags & cv::CALIB_THIN_PRISM_MODEL);
+  ui->checkBox_fixThinPrism->setChecked(flags & cv::CALIB_FIX_S1_S2_S3_S4);
+  ui->checkBox_tiltedModel->setChecked(flags & cv::CALIB_TILTED_MODEL);
+  ui->checkBox_fixTauxTauy->setChecked(flags & cv::CALIB_FIX_TAUX_TAUY);
+}
+
+
 int CameraCalibrator::GetFindTargetFlags(const std::string target_type_str){
   unsigned int flags = 0;
 
@@ -288,108 +279,231 @@ void CameraCalibrator::SetCalPhotoDir(){
 }
 
 
+calibOptions_t CameraCalibrator::GetCalibOptions(){
+  calibOptions_t opt;
+  opt.cal_photo_dir = ui->lineEdit_calPhotoDir->text().toStdString();
+  opt.img_ext = ui->comboBox_imgExt->currentText().toStdString();
+  opt.file_prefix.push_back( ui->lineEdit_camPrefix1->text().toStdString() );
+  if( !( ui->checkBox_singleCamera->isChecked() ) )
+    opt.file_prefix.push_back( ui->lineEdit_camPrefix2->text().toStdString() );
+
+  opt.target_type_str = ui->comboBox_targetType->currentText().toStdString();
+  opt.target_size = cv::Size( ui->spinBox_targetWidth->value(), ui->spinBox_targetHeight->value() );
+  opt.target_spacing = ui->doubleSpinBox_spacing->value();
+  opt.find_target_flags = GetFindTargetFlags(opt.target_type_str) & ~GridTypeFlag(opt.target_type_str);
+
+  opt.calib_flags = GetCalibrationFlags();
+  opt.pre_calibrate = ui->checkBox_preCalibrate->isChecked();
+  opt.intrinsic_from_file = ui->checkBox_useIntrinsicGuess->isChecked() && ui->checkBox_intrinsicFromFile->isChecked();
+  opt.input_intrinsic_file_name[0] = ui->lineEdit_inputIntrinsic1->text().toStdString();
+  opt.input_intrinsic_file_name[1] = ui->lineEdit_inputIntrinsic2->text().toStdString();
+  opt.reject_outliers = ui->checkBox_rejectOutliers->isChecked();
+  opt.reject_max_error = ui->doubleSpinBox_rejectMaxError->value();
+  if( ui->checkBox_compareModels->isChecked() )
+    opt.compare_models.push_back("all");
+
+  opt.rect_use_opencv = !ui->checkBox_rectHartley->isChecked();
+  opt.rect_zero_disparity = ui->checkBox_rectZeroDisparity->isChecked();
+  opt.rect_alpha = ui->checkBox_rectAlpha->isChecked() ? ui->doubleSpinBox_rectAlpha->value() : -1;
+
+  opt.intrinsic_file_name = ui->lineEdit_intrinsicFileName->text().toStdString();
+  opt.extrinsic_file_name = ui->lineEdit_extrinsicFileName->text().toStdString();
+  opt.num_threads = ui->spinBox_numThreads->value();
+  opt.use_detection_cache = ui->checkBox_detectionCache->isChecked();
+  opt.detect_scale = ui->doubleSpinBox_detectScale->value();
+  opt.detect_use_hint = ui->checkBox_detectHint->isChecked();
+  opt.raw_bit_depth = ui->spinBox_bitDepth->value();
+  BayerPatternFromName(ui->comboBox_bayer->currentText().toStdString(), opt.raw_bayer);
+
+  return opt;
+}
+
+
+//runs the pipeline on a copy of the calibration, m_cal_data is only replaced when the job succeeds. Detected
+//views are added to the viewer as they finish.
 void CameraCalibrator::RunCalibration(const bool only_rectification){
+  EXP_CHK(!m_job_watcher.isRunning(), return)
   if(m_label)
     ShowCalImages();
-  const bool stereo_mode = !( ui->checkBox_singleCamera->isChecked() );
-
-  std::string cal_photo_dir = ui->lineEdit_calPhotoDir->text().toStdString();
-  mio::FormatFilePath(cal_photo_dir);
 
-  std::vector<std::string> file_prefix, img_file_name_vec;
-  camCalTarget_t cal_target;
+  const calibOptions_t opt = GetCalibOptions();
+  m_job_cal_data = CloneCalData(m_cal_data);
+  m_job_result = calibResult_t();
   if(!only_rectification){
-    file_prefix.push_back( ui->lineEdit_camPrefix1->text().toStdString() );
-    if(stereo_mode)
-      file_prefix.push_back( ui->lineEdit_camPrefix2->text().toStdString() );
-    CreateImageList(cal_photo_dir, "imgList", std::string( ui->comboBox_imgExt->currentText().toStdString() ), file_prefix);
-    ReadStringList(cal_photo_dir + "/" + "imgList.xml", img_file_name_vec);
-    EXP_CHK(img_file_name_vec.size() > 2, return)
-
-    cal_target = camCalTarget_t( ui->comboBox_targetType->currentText().toStdString(),
-                                 cv::Size( ui->spinBox_targetWidth->value(), ui->spinBox_targetHeight->value() ),
-                                 ui->doubleSpinBox_spacing->value() );
-    //DisplayCalTarget(point_vec); //assumes target spacing is in centimeters
-
-    const int num_img_per_cam = ExtractCalTargetPoints(cal_photo_dir, cal_target, img_file_name_vec, m_cal_data,
-                                                       GetFindTargetFlags(cal_target.type_str), stereo_mode ? 2 : 1);
-    if(num_img_per_cam < 2)
-      return;
-    std::cout << m_cal_data.GetNumImgPerCam() << " images per camera successfully detected.\n";
-
-    LoadCalImages(cal_photo_dir, cal_target, m_cal_data, m_cal_img_vec, stereo_mode ? 2 : 1);
+    std::string cal_photo_dir = opt.cal_photo_dir;
+    mio::FormatFilePath(cal_photo_dir);
+    m_img_store.Reset( cal_photo_dir, opt.CalTarget(), stereoCalData_t(), opt.NumCamera() );
+    m_views_match_cal_data = false;
+    UpdateResiduals();
   }
 
-  if(stereo_mode){
-    if(!only_rectification){
-      if( ui->checkBox_useIntrinsicGuess->isChecked() &&
-          ui->checkBox_intrinsicFromFile->isChecked() ){
-        LoadCameraCalData(cal_photo_dir, ui->lineEdit_inputIntrinsic1->text().toStdString(),
-                          ui->lineEdit_inputIntrinsic2->text().toStdString(), m_cal_data);
-          std::cout << "Loaded intrinsic parameters from file...\n";
-          mio::Print(m_cal_data.K[0], "M1");
-          mio::Print(m_cal_data.K[1], "M2");
-          mio::Print(m_cal_data.D[0], "D1");
-          mio::Print(m_cal_data.D[1], "D2");
+  StartJob([this, opt, only_rectification](){
+      return RunCalibrationPipeline(opt, m_job_cal_data, m_job_result, only_rectification, &m_img_store, &m_progress,
+                                    &m_coverage);
+    },
+    [this, opt, only_rectification](const int ret){
+      if(ret != 0)
+        return;
+      m_cal_data = m_job_cal_data;
+      m_views_match_cal_data = true;
+      m_dropped_view_vec.clear();
+      ui->pushButton_restoreView->setEnabled(false);
+      //later re-solves (ie. after dropping a view) keep the compared model
+      if( !opt.compare_models.empty() && !only_rectification )
+        SetDistortionModelFlags(m_job_result.calib_flags);
+      if( opt.StereoMode() && m_label )
+        ui->checkBox_viewRectified->setEnabled(true); //RecalibrateViews() disables it until the next rectification
+      UpdateResiduals();
+      if( opt.StereoMode() && !only_rectification ){
+        ui->lineEdit_rmsError->setText( QString::number(m_job_result.rms_error) );
+        ui->lineEdit_reprojectionError->setText( QString::number(m_job_result.reprojection_error) );
       }
+    });
+}
 
-      std::vector<double> repro_err_vec;
-      double repro_err_1, repro_err_2;
-      StereoCalibrate( cal_target,
-                       m_cal_data,
-                       repro_err_vec, repro_err_1, repro_err_2,
-                       GetCalibrationFlags(), ui->checkBox_preCalibrate->isChecked() );
-
-      ui->lineEdit_rmsError->setText( QString::number(repro_err_1) );
-      ui->lineEdit_reprojectionError->setText( QString::number(repro_err_2) );
-      std::cout << "reprojection error per pair of images:" << std::endl;
-      for(size_t i = 0; i < m_cal_data.GetNumImgPerCam(); i++)
-        std::cout << m_cal_data.good_img_file_names[0][i] << ", " << 
-                     m_cal_data.good_img_file_names[1][i] << ": " << repro_err_vec[i] << std::endl;
-    }
 
-    m_cal_data.ClearRectData();
-    ComputeRectification(cal_photo_dir, m_cal_data, !ui->checkBox_rectHartley->isChecked(),
-                         ui->checkBox_rectZeroDisparity->isChecked() ? cv::CALIB_ZERO_DISPARITY : -1,
-                         ui->checkBox_rectAlpha->isChecked() ? ui->doubleSpinBox_rectAlpha->value() : -1);
+void CameraCalibrator::RunRectifiction(){
+  RunCalibration(true);
+}
 
-    RectifyImages(cal_photo_dir, m_cal_data, m_rect_cal_img_vec);
 
-    SaveStereoCalData(cal_photo_dir, ui->lineEdit_intrinsicFileName->text().toStdString(),
-                      ui->lineEdit_extrinsicFileName->text().toStdString(), m_cal_data);
-  }
-  else{ //single camera mode
-    CalibrateCamera( cal_target, m_cal_data, 0, GetCalibrationFlags() );
-    SaveCameraCalData(cal_photo_dir, ui->lineEdit_intrinsicFileName->text().toStdString(), m_cal_data);
+//the rectification maps are read or rebuilt on the job thread, the viewer switches over once both are ready
+void CameraCalibrator::LoadStereoParameters(){
+  EXP_CHK(!m_job_watcher.isRunning(), return)
+  const calibOptions_t opt = GetCalibOptions();
+  std::string cal_photo_dir = opt.cal_photo_dir;
+  mio::FormatFilePath(cal_photo_dir);
+  m_job_cal_data = CloneCalData(m_cal_data);
+
+  StartJob([this, opt, cal_photo_dir](){
+      if( !ProgressStage(&m_progress, "loading") )
+        return(1);
+      LoadStereoCalData(cal_photo_dir, opt.intrinsic_file_name, opt.extrinsic_file_name, m_job_cal_data);
+      rectMaps_t rect_maps;
+      if( opt.StereoMode() ){
+        if( !ProgressStage(&m_progress, "rectification maps") )
+          return(1);
+        GetRectMaps(cal_photo_dir, opt.extrinsic_file_name, m_job_cal_data, rect_maps);
+      }
+      m_img_store.SetRawParams( opt.RawParams() );
+      m_img_store.Reset( cal_photo_dir, opt.CalTarget(), m_job_cal_data, opt.NumCamera() );
+      if( !rect_maps.Empty() )
+        m_img_store.SetRectification(rect_maps);
+      m_coverage.Reset( opt.CalTarget(), opt.NumCamera() );
+      for(size_t j = 0; j < opt.NumCamera(); ++j)
+        m_coverage.SetIntrinsics(j, m_job_cal_data.K[j], m_job_cal_data.D[j]);
+      m_coverage.AddCalData( m_job_cal_data, opt.NumCamera() );
+      m_job_cal_data.Print( opt.StereoMode() );
+      return(0);
+    },
+    [this](const int ret){
+      if(ret != 0)
+        return;
+      m_cal_data = m_job_cal_data;
+      m_views_match_cal_data = true;
+      m_dropped_view_vec.clear();
+      ui->pushButton_restoreView->setEnabled(false);
+      UpdateResiduals();
+    });
+}
+
+
+//job runs on the global thread pool, job_done on the GUI thread once it returned
+void CameraCalibrator::StartJob(const std::function<int()> &job, const std::function<void(int)> &job_done){
+  EXP_CHK_M(!m_job_watcher.isRunning(), return, "CameraCalibrator::StartJob() - a job is already running")
+  m_progress.cancel = false;
+  m_job_done = job_done;
+  SetJobRunning(true);
+  m_job_watcher.setFuture( QtConcurrent::run([job]() -> int{
+    try{
+      return job();
+    }
+    catch(cv::Exception &e){
+      printf( "CameraCalibrator::StartJob() - caught error - %s\n", e.what() );
+      return(-1);
+    }
+    //anything escaping the job would be rethrown by QFutureWatcher::result() and end the application
+    catch(std::exception &e){
+      printf( "CameraCalibrator::StartJob() - caught exception - %s\n", e.what() );
+      return(-1);
+    }
+    catch(...){
+      printf("CameraCalibrator::StartJob() - caught unknown exception\n");
+      return(-1);
+    }
+  }) );
+}
+
+
+void CameraCalibrator::SetJobRunning(const bool running){
+  const bool stereo_mode = !( ui->checkBox_singleCamera->isChecked() );
+  ui->pushButton_runCalibration->setEnabled(!running);
+  ui->pushButton_runRectification->setEnabled(!running && stereo_mode);
+  ui->pushButton_loadParameters->setEnabled(!running);
+  ui->pushButton_lemon->setEnabled(!running);
+  ui->pushButton_restoreView->setEnabled( !running && !m_dropped_view_vec.empty() );
+  ui->checkBox_singleCamera->setEnabled(!running);
+  ui->pushButton_cancelJob->setEnabled(running);
+  if(running){
+    ui->progressBar_job->setRange(0, 0); //busy until a stage reports counts
+    ui->label_jobStatus->setText("starting");
   }
+}
 
-  m_cal_data.Print(!stereo_mode);
+
+void CameraCalibrator::CancelJob(){
+  m_progress.cancel = true;
+  ui->pushButton_cancelJob->setEnabled(false);
+  ui->label_jobStatus->setText("cancelling");
 }
 
 
-void CameraCalibrator::RunRectifiction(){
-  RunCalibration(true);
+void CameraCalibrator::JobFinished(){
+  const int ret = m_job_watcher.result();
+  SetJobRunning(false);
+  ui->progressBar_job->setRange(0, 1);
+  ui->progressBar_job->setValue(ret == 0 ? 1 : 0);
+  ui->label_jobStatus->setText( ret == 0 ? "done" : ret > 0 ? "cancelled" : "failed" );
+  if(m_job_done)
+    m_job_done(ret);
+  m_job_done = nullptr;
+  RefreshCalImg();
+  UpdateImgCacheLabel();
+  UpdateCoverageLabel();
 }
 
 
-void CameraCalibrator::LoadStereoParameters(){
-  std::string cal_photo_dir = ui->lineEdit_calPhotoDir->text().toStdString();
-  mio::FormatFilePath(cal_photo_dir);
-  LoadStereoCalData(cal_photo_dir, ui->lineEdit_intrinsicFileName->text().toStdString(),
-                    ui->lineEdit_extrinsicFileName->text().toStdString(), m_cal_data);
-  camCalTarget_t cal_target( ui->comboBox_targetType->currentText().toStdString(),
-                             cv::Size( ui->spinBox_targetWidth->value(), ui->spinBox_targetHeight->value() ),
-                             ui->doubleSpinBox_spacing->value() );
-  LoadCalImages(cal_photo_dir, cal_target, m_cal_data, m_cal_img_vec, ui->checkBox_singleCamera->isChecked() ? 1 : 2);
-  RectifyImages(cal_photo_dir, m_cal_data, m_rect_cal_img_vec);
-  m_cal_data.Print( !( ui->checkBox_singleCamera->isChecked() ) );
+void CameraCalibrator::ShowJobStage(QString stage){
+  ui->progressBar_job->setRange(0, 0);
+  ui->label_jobStatus->setText(stage);
+  //detection commits its views in list order, which replaces the preview order
+  RefreshCalImg();
+}
+
+
+//views are already in m_img_store, the first found target opens the viewer
+void CameraCalibrator::ShowJobImageSet(int num_done, int num_total, int num_found){
+  ui->progressBar_job->setRange(0, num_total);
+  ui->progressBar_job->setValue(num_done);
+  ui->label_jobStatus->setText( QString("detection: %1 / %2 image sets, %3 targets found").arg(num_done)
+                                                                                          .arg(num_total)
+                                                                                          .arg(num_found) );
+  if(!m_label && num_found > 0)
+    ShowCalImages();
+  UpdateImgCacheLabel();
+  UpdateCoverageLabel();
 }
 
 
 void CameraCalibrator::ShowCalImages(){
   if(!m_label){
-    if(m_cal_img_vec.size() > 0){
+    if(m_img_store.NumViews() > 0){
+      //the label takes the space the layout gives it, views are scaled to that instead of growing the window
       m_label = new QLabel;
+      m_label->setSizePolicy(QSizePolicy::Ignored, QSizePolicy::Ignored);
+      m_label->setMinimumSize(480, 360);
+      m_label->setAlignment(Qt::AlignCenter);
+      m_label->installEventFilter(this);
       ui->verticalLayout_label->addWidget(m_label);
       m_disp_img_line_edit = new QLineEdit;
       ui->verticalLayout_label->addWidget(m_disp_img_line_edit);
@@ -406,6 +520,7 @@ void CameraCalibrator::ShowCalImages(){
     ui->verticalLayout_label->removeWidget(m_label);
     delete m_label;
     m_label = NULL;
+    m_pixmap_cache.clear();
     delete m_disp_img_line_edit;
     m_disp_img_line_edit = NULL;
     ui->pushButton_nextCalImg->setEnabled(false);
@@ -422,14 +537,135 @@ void CameraCalibrator::SetCalImg(int state){
 }
 
 
+//shares the pixel buffer of img, which must outlive the QImage
+static QImage WrapMatAsQImage(const cv::Mat &img){
+  if(img.type() == CV_8UC1)
+    return QImage(img.data, img.cols, img.rows, static_cast<int>(img.step), QImage::Format_Grayscale8);
+  if(img.type() == CV_8UC3)
+    return QImage(img.data, img.cols, img.rows, static_cast<int>(img.step), QImage::Format_RGB888);
+  return QImage();
+}
+
+
+//heat maps of the cameras side by side and the coverage summary, refreshed as detection finishes image sets
+void CameraCalibrator::UpdateCoverageLabel(){
+  ui->label_coverage->setText( QString::fromStdString( m_coverage.Summary() ).trimmed() );
+  //each camera's map with its pose histograms beside it
+  std::vector<cv::Mat> map_vec;
+  for(size_t j = 0; j < m_coverage.NumCamera(); ++j){
+    const cv::Mat map = m_coverage.CoverageImage( j, cv::Size(160, 120) );
+    if( map.empty() )
+      continue;
+    std::vector<cv::Mat> panel_vec = { map, m_coverage.HistogramImage( j, cv::Size(120, map.rows) ) };
+    const cv::Mat panel = ConcatCalImages(panel_vec);
+    if( map_vec.empty() || panel.rows == map_vec[0].rows )
+      map_vec.push_back(panel);
+  }
+  if( map_vec.empty() ){
+    ui->label_coverageMap->clear();
+    return;
+  }
+  cv::Mat map_img;
+  cv::cvtColor(ConcatCalImages(map_vec), map_img, cv::COLOR_BGR2RGB);
+  ui->label_coverageMap->setPixmap( QPixmap::fromImage( WrapMatAsQImage(map_img) ) );
+}
+
+
+//residuals of the current calibration, recomputed whenever m_cal_data changed, with one heat map per camera
+void CameraCalibrator::UpdateResiduals(){
+  m_residuals = residualReport_t();
+  const calibOptions_t opt = GetCalibOptions();
+  if( m_views_match_cal_data && !m_cal_data.K[0].empty() && m_cal_data.GetNumImgPerCam() > 0 )
+    ComputeResiduals(opt.CalTarget(), m_cal_data, opt.NumCamera(), m_residuals, opt.num_threads);
+
+  std::ostringstream oss;
+  oss.precision(3);
+  std::vector<cv::Mat> map_vec;
+  for(size_t j = 0; j < m_residuals.cam.size(); ++j){
+    const cameraResiduals_t &cam = m_residuals.cam[j];
+    oss << "camera " << j << ": rms " << cam.rms << " px, max " << cam.max_err << " px\n";
+    const cv::Mat map = ResidualHeatMap( cam, cv::Size(160, 120) );
+    if( !map.empty() && ( map_vec.empty() || map.rows == map_vec[0].rows ) )
+      map_vec.push_back(map);
+  }
+  if( !m_residuals.epi_err.empty() )
+    oss << "rectified epipolar error: rms " << m_residuals.epi_rms << " px, max " << m_residuals.epi_max << " px\n";
+  ui->label_residuals->setText( QString::fromStdString( oss.str() ).trimmed() );
+  if( map_vec.empty() )
+    ui->label_residualMap->clear();
+  else{
+    cv::Mat map_img;
+    cv::cvtColor(ConcatCalImages(map_vec), map_img, cv::COLOR_BGR2RGB);
+    ui->label_residualMap->setPixmap( QPixmap::fromImage( WrapMatAsQImage(map_img) ) );
+  }
+  SetResidualOverlay(0);
+}
+
+
+//the arrows are magnified per camera so a typical residual is visible at any rms
+void CameraCalibrator::SetResidualOverlay(int state){
+  std::vector< std::vector< std::vector<cv::Point2f> > > residuals;
+  if( ui->checkBox_residuals->isChecked() )
+    for(size_t j = 0; j < m_residuals.cam.size(); ++j)
+      residuals.push_back( ResidualVectors( m_residuals.cam[j], ResidualMagnification(m_residuals.cam[j]) ) );
+  m_img_store.SetResidualVectors(residuals);
+  if(m_label && m_img_store.NumViews() > 0)
+    SetCalImg();
+}
+
+
+QSize CameraCalibrator::CalViewSize(){
+  return m_label ? m_label->contentsRect().size() : QSize();
+}
+
+
+//hit only for the current store generation and label size, a hit becomes the most recently used entry
+bool CameraCalibrator::CachedCalViewPixmap(const int idx, const bool rectified, QPixmap &pixmap){
+  const size_t generation = m_img_store.Generation();
+  const QSize size = CalViewSize();
+  for(auto it = m_pixmap_cache.begin(); it != m_pixmap_cache.end(); ++it)
+    if(it->generation == generation && it->idx == idx && it->rectified == rectified && it->size == size){
+      const calViewPixmap_t item = *it;
+      m_pixmap_cache.erase(it);
+      m_pixmap_cache.push_front(item);
+      pixmap = item.pixmap;
+      return true;
+    }
+  return false;
+}
+
+
+//the view is scaled to the label and overlaid once, then uploaded without an intermediate QImage copy. With
+//wait false nothing is rendered while the store is still decoding the view.
+bool CameraCalibrator::CalViewPixmap(const int idx, const bool rectified, const bool wait, QPixmap &pixmap){
+  if( CachedCalViewPixmap(idx, rectified, pixmap) )
+    return true;
+  const size_t max_cached = 8, generation = m_img_store.Generation();
+  const QSize size = CalViewSize();
+  const cv::Mat disp_img = m_img_store.RenderForDisplay( idx, rectified, cv::Size( size.width(), size.height() ), wait );
+  if( disp_img.empty() )
+    return false;
+  pixmap = QPixmap::fromImage( WrapMatAsQImage(disp_img) );
+
+  m_pixmap_cache.push_front( calViewPixmap_t{generation, idx, rectified, size, pixmap} );
+  if(m_pixmap_cache.size() > max_cached)
+    m_pixmap_cache.pop_back();
+  return true;
+}
+
+
 void CameraCalibrator::SetCalImg(){
+  if( CalViewSize().isEmpty() ) //not laid out yet, the resize event renders it
+    return;
   try{
-    OpenCVMat2QImage(ui->checkBox_viewRectified->isChecked() ? m_rect_cal_img_vec[m_disp_img_idx] : 
-                     m_cal_img_vec[m_disp_img_idx], m_disp_qt_img, true);
-    m_label->setPixmap( QPixmap::fromImage(m_disp_qt_img) );
-    std::string imgNames = m_cal_data.good_img_file_names[0][m_disp_img_idx] + ", " +
-                           m_cal_data.good_img_file_names[1][m_disp_img_idx];
-    m_disp_img_line_edit->setText( imgNames.c_str() );
+    QPixmap pixmap;
+    EXP_CHK_M(CalViewPixmap(m_disp_img_idx, ui->checkBox_viewRectified->isChecked(), true, pixmap), return,
+              "could not read the images of view " + std::to_string(m_disp_img_idx))
+    m_label->setPixmap(pixmap);
+    m_disp_img_line_edit->setText( m_img_store.ViewName(m_disp_img_idx).c_str() );
+    UpdateImgCacheLabel();
+    m_prerender_attempts = 0;
+    QTimer::singleShot( 0, this, SLOT( PrerenderCalImg() ) );
   }
   catch(cv::Exception &e){
     printf( "CameraCalibrator::SetCalImg() - caught error - %s\n", e.what() );
@@ -437,8 +673,56 @@ void CameraCalibrator::SetCalImg(){
 }
 
 
+//renders the neighbours of the displayed view into the pixmap cache, one per event loop pass so input stays
+//responsive. Views the store is still prefetching are retried a few times.
+void CameraCalibrator::PrerenderCalImg(){
+  if(!m_label)
+    return;
+  const bool rectified = ui->checkBox_viewRectified->isChecked();
+  const int num_views = static_cast<int>( m_img_store.NumViews() );
+  bool pending = false;
+  for(const int offset : {1, -1, 2, -2}){
+    const int idx = m_disp_img_idx + offset;
+    QPixmap pixmap;
+    if( idx < 0 || idx >= num_views || CachedCalViewPixmap(idx, rectified, pixmap) )
+      continue;
+    try{
+      if( CalViewPixmap(idx, rectified, false, pixmap) ){
+        QTimer::singleShot( 0, this, SLOT( PrerenderCalImg() ) );
+        return;
+      }
+    }
+    catch(cv::Exception &e){
+      printf( "CameraCalibrator::PrerenderCalImg() - caught error - %s\n", e.what() );
+      return;
+    }
+    pending = true;
+  }
+  if(pending && ++m_prerender_attempts < 20)
+    QTimer::singleShot( 25, this, SLOT( PrerenderCalImg() ) );
+}
+
+
+//a resized label invalidates the cached pixmaps, the displayed view is rendered again at the new size
+bool CameraCalibrator::eventFilter(QObject *obj, QEvent *event){
+  if(obj == m_label && event->type() == QEvent::Resize && m_img_store.NumViews() > 0)
+    SetCalImg();
+  return QWidget::eventFilter(obj, event);
+}
+
+
+//keeps the displayed index valid after the view list changed
+void CameraCalibrator::RefreshCalImg(){
+  const int num_views = static_cast<int>( m_img_store.NumViews() );
+  if(!m_label || num_views == 0)
+    return;
+  m_disp_img_idx = std::max( 0, std::min(m_disp_img_idx, num_views - 1) );
+  SetCalImg();
+}
+
+
 void CameraCalibrator::NextCalImage(){
-  if( m_label && m_cal_img_vec.size() > 0 && m_disp_img_idx + 1 < m_cal_img_vec.size() ){
+  if( m_label && m_disp_img_idx + 1 < static_cast<int>( m_img_store.NumViews() ) ){
     m_disp_img_idx++;
     SetCalImg();
   }
@@ -446,39 +730,100 @@ void CameraCalibrator::NextCalImage(){
 
 
 void CameraCalibrator::PrevCalImage(){
-  if(m_label && m_cal_img_vec.size() > 0 && m_disp_img_idx > 0){
+  if(m_label && m_img_store.NumViews() > 0 && m_disp_img_idx > 0){
     m_disp_img_idx--;
     SetCalImg();
   }
 }
 
 
-void DrawCross(cv::Mat &img){
-  if( !( img.empty() ) ){
-    cv::line(img, cv::Point(0, 0), cv::Point(img.cols, img.rows), cv::Scalar::all(255), 5);
-    cv::line(img, cv::Point(0, img.rows), cv::Point(img.cols, 0), cv::Scalar::all(255), 5);
+//renames the files of the displayed view with a "lemon_" prefix, drops the view from the calibration and
+//re-solves from the current parameters
+void CameraCalibrator::MarkAsLemon(){
+  EXP_CHK(m_label && m_disp_img_idx >= 0 && m_disp_img_idx < static_cast<int>( m_img_store.NumViews() ), return)
+  EXP_CHK_M(m_views_match_cal_data, return, "the viewer shows views of an unfinished run, run the calibration first")
+  const size_t num_camera = ui->checkBox_singleCamera->isChecked() ? 1 : 2;
+  const std::string lemon_prefix = "lemon_";
+  const std::string cal_photo_dir = ui->lineEdit_calPhotoDir->text().toStdString();
+  calView_t view = RemoveCalView(m_cal_data, m_disp_img_idx, num_camera);
+  for(size_t i = 0; i < view.file_names.size(); ++i){
+    const std::string file_full = view.file_names[i];
+    if(file_full.compare(0, lemon_prefix.size(), lemon_prefix) != 0){
+      view.file_names[i].insert(0, lemon_prefix);
+      const std::string old_name = cal_photo_dir + "/" + file_full,
+                        new_name = cal_photo_dir + "/" + view.file_names[i];
+      rename( old_name.c_str(), new_name.c_str() );
+    }
   }
+  m_dropped_view_vec.push_back(view);
+  ui->pushButton_restoreView->setEnabled(true);
+
+  m_img_store.SetViews(m_cal_data);
+  m_disp_img_idx = std::max( 0, std::min( m_disp_img_idx, static_cast<int>( m_img_store.NumViews() ) - 1 ) );
+  RecalibrateViews();
 }
 
-void CameraCalibrator::MarkAsLemon(){
-  EXP_CHK(m_label && m_cal_img_vec.size() > 0 && m_disp_img_idx >= 0, return)
+
+//undoes the last MarkAsLemon()
+void CameraCalibrator::RestoreView(){
+  EXP_CHK(!m_dropped_view_vec.empty(), return)
+  EXP_CHK_M(m_views_match_cal_data, return, "the viewer shows views of an unfinished run, run the calibration first")
   const size_t num_camera = ui->checkBox_singleCamera->isChecked() ? 1 : 2;
   const std::string lemon_prefix = "lemon_";
-  for(size_t i = 0; i < num_camera; ++i){
-    const std::string file_full = m_cal_data.good_img_file_names[i][m_disp_img_idx];
-    if(file_full.compare(0, lemon_prefix.size(), lemon_prefix) != 0){
-      m_cal_data.good_img_file_names[i][m_disp_img_idx].insert(0, lemon_prefix);
-      const std::string cal_photo_dir = ui->lineEdit_calPhotoDir->text().toStdString(),
-                        old_name = cal_photo_dir + "/" + file_full,
-                        new_name = cal_photo_dir + "/" + m_cal_data.good_img_file_names[i][m_disp_img_idx];
+  const std::string cal_photo_dir = ui->lineEdit_calPhotoDir->text().toStdString();
+  calView_t view = m_dropped_view_vec.back();
+  m_dropped_view_vec.pop_back();
+  ui->pushButton_restoreView->setEnabled( !m_dropped_view_vec.empty() );
+  for(size_t i = 0; i < view.file_names.size(); ++i){
+    const std::string file_full = view.file_names[i];
+    if(file_full.compare(0, lemon_prefix.size(), lemon_prefix) == 0){
+      view.file_names[i].erase(0, lemon_prefix.size());
+      const std::string old_name = cal_photo_dir + "/" + file_full,
+                        new_name = cal_photo_dir + "/" + view.file_names[i];
       rename( old_name.c_str(), new_name.c_str() );
-      if(m_cal_img_vec.size() > m_disp_img_idx)
-        DrawCross( m_cal_img_vec[m_disp_img_idx] );
-      if(m_rect_cal_img_vec.size() > m_disp_img_idx)
-        DrawCross( m_rect_cal_img_vec[m_disp_img_idx] );
-      SetCalImg();
     }
   }
+  InsertCalView(m_cal_data, view, num_camera);
+
+  m_img_store.SetViews(m_cal_data);
+  m_disp_img_idx = static_cast<int>(view.idx);
+  RecalibrateViews();
+}
+
+
+//Warm started re-solve after the view set changed, neither detection nor the initial estimate are repeated.
+//Nothing is saved while views are being tried out; the rectification of the old solution is dropped so it is
+//not shown or used, and the next rectification or calibration run writes the result.
+void CameraCalibrator::RecalibrateViews(){
+  const calibOptions_t opt = GetCalibOptions();
+  calibResult_t result;
+  if(RecalibrateWarmStart(opt.CalTarget(), m_cal_data, opt.NumCamera(), opt.calib_flags, result) == 0){
+    if( opt.StereoMode() ){
+      ui->lineEdit_rmsError->setText( QString::number(result.rms_error) );
+      ui->lineEdit_reprojectionError->setText( QString::number(result.reprojection_error) );
+      m_cal_data.ClearRectData();
+      m_img_store.ClearRectification();
+      ui->checkBox_viewRectified->setChecked(false);
+      ui->checkBox_viewRectified->setEnabled(false);
+    }
+    ui->label_jobStatus->setText( QString("re-solved, rms %1, not saved: run %2 to save")
+                                    .arg(result.rms_error).arg( opt.StereoMode() ? "Rectification" : "Calibration" ) );
+  }
+  UpdateResiduals();
+  if(m_label && m_img_store.NumViews() > 0)
+    SetCalImg();
+}
+
+
+void CameraCalibrator::SetImgCacheSize(int size_mb){
+  m_img_store.SetMemoryCap( static_cast<size_t>(size_mb) << 20 );
+  UpdateImgCacheLabel();
+}
+
+
+void CameraCalibrator::UpdateImgCacheLabel(){
+  ui->label_imgCacheMem->setText( QString("%1 / %2 MB").arg(m_img_store.MemoryUsage() >> 20)
+                                                     .arg(m_img_store.MemoryCap() >> 20) );
 }
 
 
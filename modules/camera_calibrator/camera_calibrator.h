@@ -3,9 +3,17 @@
 
 #include <QWidget>
 #include <QLineEdit>
+#include <QFutureWatcher>
+#include <QPixmap>
+#include <deque>
+#include <functional>
 #include <vector>
 #include "opencv2/core.hpp"
 #include "mvg/stereo_compute.h"
+#include "calib_pipeline.h"
+#include "incremental_calib.h"
+#include "pipeline_progress.h"
+#include "residual_diagnostics.h"
 
 
 namespace Ui{
@@ -19,6 +27,14 @@ class CameraCalibrator : public QWidget{
     explicit CameraCalibrator(QWidget *parent = 0);
     ~CameraCalibrator();
 
+  protected:
+    bool eventFilter(QObject *obj, QEvent *event);
+
+  signals:
+    //emitted from the job thread, delivered queued on the GUI thread
+    void JobStage(QString stage);
+    void JobImageSet(int num_done, int num_total, int num_found);
+
   private slots:
     void SingleCamSetup();
     void SetCalPhotoDir();
@@ -33,6 +49,14 @@ class CameraCalibrator : public QWidget{
     void UseIntGuessStateChange();
     void IntFromFileStateChange();
     void MarkAsLemon();
+    void RestoreView();
+    void SetImgCacheSize(int);
+    void CancelJob();
+    void JobFinished();
+    void ShowJobStage(QString stage);
+    void ShowJobImageSet(int num_done, int num_total, int num_found);
+    void PrerenderCalImg();
+    void SetResidualOverlay(int);
 
   private:
     Ui::CameraCalibrator *ui;
@@ -41,17 +65,49 @@ class CameraCalibrator : public QWidget{
     bool m_use_opencv_rectification;
 
     stereoCalData_t m_cal_data;
-    std::vector<cv::Mat> m_cal_img_vec, m_rect_cal_img_vec;
+    CalImageStore m_img_store;
+    CalCoverage m_coverage;                    //of the detected views, filled by the detection workers
+    std::vector<calView_t> m_dropped_view_vec; //views removed with MarkAsLemon(), most recent last
+    bool m_views_match_cal_data;               //false while m_img_store shows views of an unfinished job
+    residualReport_t m_residuals;              //of m_cal_data, empty while it has no calibration
+
+    //one background job at a time, it only touches the m_job_* members, m_img_store and m_progress
+    QFutureWatcher<int> m_job_watcher;
+    pipelineProgress_t m_progress;
+    std::function<void(int)> m_job_done;        //runs on the GUI thread with the job's return value
+    stereoCalData_t m_job_cal_data;
+    calibResult_t m_job_result;
     
+    //screen sized pixmaps of the displayed view and its neighbours, most recently used first
+    struct calViewPixmap_t{
+      size_t generation; //CalImageStore::Generation() it was rendered from
+      int idx;
+      bool rectified;
+      QSize size;
+      QPixmap pixmap;
+    };
+
     QLabel *m_label;
     QLineEdit *m_disp_img_line_edit;
-    cv::Mat m_disp_cv_img;
-    QImage m_disp_qt_img;
     int m_disp_img_idx;
+    std::deque<calViewPixmap_t> m_pixmap_cache;
+    int m_prerender_attempts;
 
     int GetCalibrationFlags();
+    void SetDistortionModelFlags(const int flags);
     int GetFindTargetFlags(const std::string targetType);
+    calibOptions_t GetCalibOptions();
     void SetCalImg();
+    void UpdateImgCacheLabel();
+    void UpdateCoverageLabel();
+    void UpdateResiduals();
+    void RecalibrateViews();
+    void RefreshCalImg();
+    QSize CalViewSize();
+    bool CachedCalViewPixmap(const int idx, const bool rectified, QPixmap &pixmap);
+    bool CalViewPixmap(const int idx, const bool rectified, const bool wait, QPixmap &pixmap);
+    void StartJob(const std::function<int()> &job, const std::function<void(int)> &job_done);
+    void SetJobRunning(const bool running);
     void SetFindTargetOptions(const bool, const bool, const bool, const bool, const bool);
 };
 
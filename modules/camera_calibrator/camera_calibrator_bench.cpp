@@ -0,0 +1,314 @@
+#include "calib_pipeline.h"
+#include "synthetic_target.h"
+#include "rect_maps.h"
+#include "parallel_tasks.h"
+#include "mio/altro/io.h"
+#include "opencv2/imgproc.hpp"
+#include "opencv2/calib3d.hpp"
+#include <cerrno>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <sstream>
+#include <string>
+#include <sys/stat.h>
+#include <vector>
+
+
+//Renders synthetic calibration sets with a known rig and times every pipeline stage on them, for catching
+//performance regressions and sizing station hardware. Accuracy is reported against the ground truth.
+
+struct benchConfig_t{
+  std::string target_type_str;
+  cv::Size img_size;
+  size_t num_views;
+};
+
+struct benchResult_t{
+  benchConfig_t config;
+  size_t num_camera, num_detected;
+  double generate_ms, list_ms, decode_ms, detect_ms, calib_ms, rectify_ms, save_ms;
+  double detect_err_px;             //mean distance of detected to true points
+  double rms, fx_err_pct, cx_err_px, cy_err_px, k1_err, baseline_err_pct;
+
+  benchResult_t() : num_camera(0), num_detected(0), generate_ms(0), list_ms(0), decode_ms(0), detect_ms(0), calib_ms(0),
+                    rectify_ms(0), save_ms(0), detect_err_px(0), rms(0), fx_err_pct(0), cx_err_px(0), cy_err_px(0),
+                    k1_err(0), baseline_err_pct(0) {}
+};
+
+
+static double ElapsedMs(const int64 start_tick){
+  return 1000.0 * static_cast<double>(cv::getTickCount() - start_tick) / cv::getTickFrequency();
+}
+
+
+static bool MakeDir(const std::string &dir_path){
+  return mkdir(dir_path.c_str(), 0755) == 0 || errno == EEXIST;
+}
+
+
+static std::vector<std::string> SplitList(const std::string &list){
+  std::vector<std::string> item_vec;
+  std::stringstream ss(list);
+  std::string item;
+  while( std::getline(ss, item, ',') )
+    if( !item.empty() )
+      item_vec.push_back(item);
+  return item_vec;
+}
+
+
+//mean distance between detected and true points, the detectors may report a symmetric target reversed
+static double PointError(const std::vector<cv::Point2f> &detected, const std::vector<cv::Point2f> &truth){
+  if( detected.size() != truth.size() || detected.empty() )
+    return -1;
+  double err = 0, err_reversed = 0;
+  const size_t n = truth.size();
+  for(size_t k = 0; k < n; ++k){
+    err += std::hypot(detected[k].x - truth[k].x, detected[k].y - truth[k].y);
+    err_reversed += std::hypot(detected[k].x - truth[n - 1 - k].x, detected[k].y - truth[n - 1 - k].y);
+  }
+  return std::min(err, err_reversed) / n;
+}
+
+
+static bool RunBenchmark(const std::string &out_dir, const benchConfig_t &config, const size_t num_camera,
+                         const syntheticDatasetParams_t &gen_params_in, const int num_threads, const double detect_scale,
+                         benchResult_t &res){
+  res = benchResult_t();
+  res.config = config;
+  res.num_camera = num_camera;
+
+  char dir_name[256];
+  snprintf(dir_name, sizeof(dir_name), "%s_%dx%d_%zu", config.target_type_str.c_str(), config.img_size.width,
+           config.img_size.height, config.num_views);
+  const std::string dir = out_dir + "/" + dir_name;
+  EXP_CHK_M(MakeDir(dir), return(false), "could not create " + dir)
+
+  calibOptions_t opt;
+  opt.cal_photo_dir = dir;
+  opt.target_type_str = config.target_type_str;
+  opt.target_spacing = 25;
+  opt.target_size = config.target_type_str == "a-circle" ? cv::Size(4, 11) : cv::Size(9, 6);
+  opt.num_threads = num_threads;
+  opt.use_detection_cache = false;
+  opt.detect_scale = detect_scale;
+  syntheticDatasetParams_t gen_params = gen_params_in;
+  gen_params.num_views = config.num_views;
+  gen_params.num_camera = num_camera;
+  gen_params.num_threads = num_threads;
+  for(size_t j = 0; j < num_camera; ++j)
+    opt.file_prefix.push_back(gen_params.file_prefix[j]);
+  const camCalTarget_t cal_target = opt.CalTarget();
+
+  //generate, not part of the pipeline
+  const syntheticRig_t rig(config.img_size);
+  std::vector<syntheticView_t> view_vec;
+  int64 tick = cv::getTickCount();
+  EXP_CHK( GenerateSyntheticDataset(dir, cal_target, rig, gen_params, view_vec) == static_cast<int>(config.num_views),
+           return(false) )
+  WriteSyntheticGroundTruth(dir + "/ground_truth.yml", rig, view_vec);
+  res.generate_ms = ElapsedMs(tick);
+
+  //listing
+  tick = cv::getTickCount();
+  std::vector<std::string> img_file_name_vec;
+  EXP_CHK(ScanImageSets(dir, opt.ScanParams(), img_file_name_vec) >= 0, return(false))
+  res.list_ms = ElapsedMs(tick);
+  EXP_CHK(img_file_name_vec.size() == config.num_views * num_camera, return(false))
+
+  //decode on its own, detection below decodes again inside its pipeline
+  tick = cv::getTickCount();
+  ParallelTasks(img_file_name_vec.size(), num_threads, [&](const size_t i){
+    DecodeCalImage(dir + "/" + img_file_name_vec[i]);
+  });
+  res.decode_ms = ElapsedMs(tick);
+
+  //detection
+  stereoCalData_t cal_data;
+  tick = cv::getTickCount();
+  res.num_detected = ExtractCalTargetPointsMT(dir, cal_target, img_file_name_vec, cal_data,
+                                              opt.find_target_flags | GridTypeFlag(opt.target_type_str), num_camera,
+                                              opt.DetectParams());
+  res.detect_ms = ElapsedMs(tick);
+  size_t num_err = 0;
+  for(size_t k = 0; k < res.num_detected; ++k){
+    const int view_idx = SyntheticViewIndex(cal_data.good_img_file_names[0][k]);
+    for(size_t j = 0; j < num_camera && view_idx >= 0; ++j){
+      const double err = PointError(cal_data.img_points[j][k], view_vec[view_idx].img_points[j]);
+      if(err >= 0){
+        res.detect_err_px += err;
+        ++num_err;
+      }
+    }
+  }
+  res.detect_err_px = num_err > 0 ? res.detect_err_px / num_err : -1;
+  EXP_CHK_M(res.num_detected >= 3, return(false), "too few targets detected to calibrate")
+
+  //calibration
+  tick = cv::getTickCount();
+  calibResult_t result;
+  if(num_camera == 2)
+    StereoCalibrate(cal_target, cal_data, result.repro_err_vec, result.rms_error, result.reprojection_error,
+                    opt.calib_flags, opt.pre_calibrate);
+  else
+    result.rms_error = CalibrateCamera(cal_target, cal_data, 0, opt.calib_flags);
+  res.calib_ms = ElapsedMs(tick);
+  res.rms = result.rms_error;
+  res.fx_err_pct = 100.0 * (cal_data.K[0].at<double>(0, 0) - rig.K[0].at<double>(0, 0)) / rig.K[0].at<double>(0, 0);
+  res.cx_err_px = cal_data.K[0].at<double>(0, 2) - rig.K[0].at<double>(0, 2);
+  res.cy_err_px = cal_data.K[0].at<double>(1, 2) - rig.K[0].at<double>(1, 2);
+  res.k1_err = cal_data.D[0].at<double>(0) - rig.D[0].at<double>(0);
+  if(num_camera == 2)
+    res.baseline_err_pct = 100.0 * (cv::norm(cal_data.T) - cv::norm(rig.T)) / cv::norm(rig.T);
+
+  //rectification: parameters, maps and remapping the whole set in memory
+  rectMaps_t rect_maps;
+  if(num_camera == 2){
+    tick = cv::getTickCount();
+    cal_data.ClearRectData();
+    ComputeRectification(dir, cal_data, opt.rect_use_opencv, cv::CALIB_ZERO_DISPARITY, opt.rect_alpha);
+    ComputeRectMaps(cal_data, rect_maps);
+    ParallelTasks(cal_data.good_img_file_names[0].size() * 2, num_threads, [&](const size_t i){
+      const cv::Mat img = DecodeCalImage(dir + "/" + cal_data.good_img_file_names[i % 2][i / 2]);
+      cv::Mat img_rect;
+      cv::remap(img, img_rect, rect_maps.map_xy[i % 2], rect_maps.map_interp[i % 2], cv::INTER_LINEAR);
+    });
+    res.rectify_ms = ElapsedMs(tick);
+  }
+
+  //save
+  tick = cv::getTickCount();
+  if(num_camera == 2){
+    SaveStereoCalData(dir, opt.intrinsic_file_name, opt.extrinsic_file_name, cal_data);
+    SaveRectMaps(dir + "/" + RectMapsFileName(opt.extrinsic_file_name), rect_maps);
+  }
+  else
+    SaveCameraCalData(dir, opt.intrinsic_file_name, cal_data);
+  res.save_ms = ElapsedMs(tick);
+
+  return true;
+}
+
+
+static void PrintResultHeader(){
+  printf("\n%-9s %9s %5s %5s | %8s %8s %9s %9s %8s %8s %7s | %7s %7s %7s %7s %7s %8s %7s\n", "target", "size",
+         "views", "found", "list ms", "decode/s", "detect/s", "detect ms", "calib ms", "rect ms", "save ms",
+         "det px", "rms", "fx %", "cx px", "cy px", "k1", "base %");
+}
+
+
+static void PrintResult(const benchResult_t &res){
+  const double num_img = static_cast<double>(res.config.num_views * res.num_camera);
+  char size_str[32];
+  snprintf(size_str, sizeof(size_str), "%dx%d", res.config.img_size.width, res.config.img_size.height);
+  printf("%-9s %9s %5zu %5zu | %8.1f %8.1f %9.1f %9.1f %8.1f %8.1f %7.1f | %7.3f %7.3f %7.3f %7.2f %7.2f %8.4f %7.3f\n",
+         res.config.target_type_str.c_str(), size_str, res.config.num_views, res.num_detected, res.list_ms,
+         res.decode_ms > 0 ? 1000.0 * num_img / res.decode_ms : 0, res.detect_ms > 0 ? 1000.0 * num_img / res.detect_ms : 0,
+         res.detect_ms, res.calib_ms, res.rectify_ms, res.save_ms, res.detect_err_px, res.rms, res.fx_err_pct,
+         res.cx_err_px, res.cy_err_px, res.k1_err, res.baseline_err_pct);
+}
+
+
+static bool WriteResultCsv(const std::string &file_name_full, const std::vector<benchResult_t> &res_vec){
+  FILE *file = fopen(file_name_full.c_str(), "w");
+  EXP_CHK_M(file, return(false), "could not write " + file_name_full)
+  fprintf(file, "target,width,height,views,cameras,detected,generate_ms,list_ms,decode_ms,detect_ms,calib_ms,rectify_ms,"
+                "save_ms,detect_err_px,rms,fx_err_pct,cx_err_px,cy_err_px,k1_err,baseline_err_pct\n");
+  for(auto &res : res_vec)
+    fprintf(file, "%s,%d,%d,%zu,%zu,%zu,%.3f,%.3f,%.3f,%.3f,%.3f,%.3f,%.3f,%.5f,%.5f,%.5f,%.5f,%.5f,%.6f,%.5f\n",
+            res.config.target_type_str.c_str(), res.config.img_size.width, res.config.img_size.height,
+            res.config.num_views, res.num_camera, res.num_detected, res.generate_ms, res.list_ms, res.decode_ms,
+            res.detect_ms, res.calib_ms, res.rectify_ms, res.save_ms, res.detect_err_px, res.rms, res.fx_err_pct,
+            res.cx_err_px, res.cy_err_px, res.k1_err, res.baseline_err_pct);
+  fclose(file);
+  return true;
+}
+
+
+static void PrintUsage(const char *prog){
+  printf("usage: %s [options]\n"
+         "Renders synthetic calibration sets with a known rig and times each pipeline stage on them.\n"
+         "  --out DIR              scratch directory for the rendered sets (default camera_calibrator_bench_data)\n"
+         "  --target TYPE          chess, circle or a-circle, give once per target (default chess and circle)\n"
+         "  --counts N,N,...       views per set (default 10,20,40)\n"
+         "  --sizes WxH,WxH,...    image sizes (default 640x480,1280x960)\n"
+         "  --mono                 single camera sets instead of stereo pairs\n"
+         "  --threads N            worker threads, 0 uses one per core\n"
+         "  --noise SIGMA          image noise in gray levels (default 2)\n"
+         "  --detect-scale S       coarse-to-fine detection on images downscaled by S (default 1, full resolution)\n"
+         "  --seed N               pose and noise seed (default 1)\n"
+         "  --csv FILE             also write the results to FILE\n", prog);
+}
+
+
+int main(int argc, char *argv[]){
+  std::string out_dir = "camera_calibrator_bench_data", csv_file;
+  std::vector<std::string> target_vec, count_vec = SplitList("10,20,40"), size_vec = SplitList("640x480,1280x960");
+  size_t num_camera = 2;
+  int num_threads = 0;
+  double detect_scale = 1;
+  syntheticDatasetParams_t gen_params;
+  for(int i = 1; i < argc; ++i){
+    const std::string arg = argv[i];
+    const int num_remaining = argc - i - 1;
+    if(arg == "--out" && num_remaining >= 1)
+      out_dir = argv[++i];
+    else if(arg == "--target" && num_remaining >= 1)
+      target_vec.push_back(argv[++i]);
+    else if(arg == "--counts" && num_remaining >= 1)
+      count_vec = SplitList(argv[++i]);
+    else if(arg == "--sizes" && num_remaining >= 1)
+      size_vec = SplitList(argv[++i]);
+    else if(arg == "--mono")
+      num_camera = 1;
+    else if(arg == "--threads" && num_remaining >= 1)
+      num_threads = atoi(argv[++i]);
+    else if(arg == "--noise" && num_remaining >= 1)
+      gen_params.noise_sigma = atof(argv[++i]);
+    else if(arg == "--detect-scale" && num_remaining >= 1)
+      detect_scale = atof(argv[++i]);
+    else if(arg == "--seed" && num_remaining >= 1)
+      gen_params.seed = static_cast<unsigned int>( atoi(argv[++i]) );
+    else if(arg == "--csv" && num_remaining >= 1)
+      csv_file = argv[++i];
+    else{
+      PrintUsage(argv[0]);
+      return 1;
+    }
+  }
+  if( target_vec.empty() )
+    target_vec = SplitList("chess,circle");
+  EXP_CHK_M(MakeDir(out_dir), return(1), "could not create " + out_dir)
+
+  std::vector<benchConfig_t> config_vec;
+  for(auto &target : target_vec)
+    for(auto &size_str : size_vec)
+      for(auto &count_str : count_vec){
+        benchConfig_t config;
+        config.target_type_str = target;
+        EXP_CHK_M(sscanf(size_str.c_str(), "%dx%d", &config.img_size.width, &config.img_size.height) == 2,
+                  return(1), "bad image size " + size_str)
+        config.num_views = static_cast<size_t>( atoi( count_str.c_str() ) );
+        config_vec.push_back(config);
+      }
+
+  std::vector<benchResult_t> res_vec;
+  for(auto &config : config_vec){
+    benchResult_t res;
+    if( !RunBenchmark(out_dir, config, num_camera, gen_params, num_threads, detect_scale, res) ){
+      printf( "benchmark %s %dx%d %zu views failed\n", config.target_type_str.c_str(), config.img_size.width,
+              config.img_size.height, config.num_views );
+      continue;
+    }
+    res_vec.push_back(res);
+  }
+
+  PrintResultHeader();
+  for(auto &res : res_vec)
+    PrintResult(res);
+  if( !csv_file.empty() )
+    WriteResultCsv(csv_file, res_vec);
+
+  return res_vec.size() == config_vec.size() ? 0 : 2;
+}
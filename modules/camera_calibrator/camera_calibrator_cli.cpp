@@ -0,0 +1,379 @@
+#include "batch_calib.h"
+#include "calib_pipeline.h"
+#include "opencv2/calib3d.hpp"
+#include <algorithm>
+#include <atomic>
+#include <csignal>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <string>
+#include <vector>
+
+
+enum cliExitCode_t{
+  CLI_OK = 0,
+  CLI_BAD_ARGS = 1,
+  CLI_PIPELINE_FAILED = 2
+};
+
+
+static void PrintUsage(const char *prog){
+  printf("usage: %s [--config file.yml] [options]\n"
+         "Runs detect -> calibrate -> rectify -> save without a display. Options given on the command line\n"
+         "override the config file, a config file can be created with --write-config.\n"
+         "  --dir PATH                calibration image directory\n"
+         "  --ext EXT                 image file extension (default png)\n"
+         "  --prefix NAME             image file prefix, give once per camera, more than 2 calibrate a rig\n"
+         "  --glob PATTERN            only use images whose file name matches the shell pattern\n"
+         "  --regex REGEX             only use images whose file name matches REGEX, group 1 is the frame key\n"
+         "  --pair-tolerance T        pair the nearest frame numbers (ie. timestamps) within T across cameras\n"
+         "  --target TYPE             chess, circle or a-circle\n"
+         "  --target-size W H         target points along x and y\n"
+         "  --spacing MM              target spacing\n"
+         "  --target-flag NAME        find target flag, ie. adaptive_thresh, fast_check, clustering\n"
+         "  --calib-flag NAME         calibration flag, ie. rational_model, fix_k3, zero_tangent_dist\n"
+         "  --pre-calibrate           calibrate cameras individually before stereo calibration\n"
+         "  --input-intrinsic A B     load the intrinsic guess from files A and B\n"
+         "  --reject-outliers         drop views with outlier errors and re-solve, see outlier_report.yml\n"
+         "  --reject-max-error PX     never drop views at or below this error (default 1.0, 0 disables)\n"
+         "  --reject-percentile P     never drop views at or below the P-th error percentile\n"
+         "  --reject-passes N         maximum rejection passes (default 10)\n"
+         "  --compare-models LIST     rank distortion models by held out view error and calibrate the best, LIST\n"
+         "                            is all or comma separated k1, k1k2, k1k2p, k1k2k3p, rational, thin_prism,\n"
+         "                            tilted, current; see model_comparison.yml\n"
+         "  --compare-folds N         cross-validation folds of --compare-models (default 5)\n"
+         "  --hartley                 Hartley rectification instead of the OpenCV method\n"
+         "  --no-zero-disparity       do not use cv::CALIB_ZERO_DISPARITY\n"
+         "  --alpha A                 rectification free scaling parameter\n"
+         "  --rectify-out DIR         write the rectified image pairs to DIR\n"
+         "  --intrinsic-name NAME     output intrinsic file name (without extension)\n"
+         "  --extrinsic-name NAME     output extrinsic file name (without extension)\n"
+         "  --no-binary               do not write the .ccal binary calibration next to the YAML files\n"
+         "  --binary-maps             include the rectification maps in the .ccal binary (stereo)\n"
+         "  --threads N               detection threads, 0 uses one per core\n"
+         "  --decode-threads N        image decode threads (default 2)\n"
+         "  --prefetch N              decoded image sets buffered ahead of detection (default 8)\n"
+         "  --no-cache                detect every image, ignore and do not update detection_cache.bin\n"
+         "  --detect-scale S          find the target on images downscaled by S (ie. 0.25), refine at full resolution\n"
+         "  --track                   search around the previous image's target first (sequential captures)\n"
+         "  --bit-depth N             significant bits of 16 bit images (ie. 10, 12), > 8 detects at full depth\n"
+         "  --bayer PATTERN           images are undemosaiced sensor data: bg, gb, rg or gr\n"
+         "  --live SOURCE             calibrate one camera from a device index, video file or image sequence,\n"
+         "                            Ctrl-C ends the capture and calibrates the views accepted so far\n"
+         "  --live-views N            accepted views that end a live capture (default 40, 0 no limit)\n"
+         "  --live-no-save            do not write the accepted live frames to --dir\n"
+         "  --trace FILE              write stage timings as a Chrome trace (chrome://tracing) to FILE,\n"
+         "                            relative to --dir\n"
+         "  --batch MANIFEST          calibrate every dataset listed in MANIFEST, the other options are the\n"
+         "                            defaults of its entries; rerunning resumes after the finished datasets\n"
+         "  --batch-jobs N            datasets calibrated at once (default half the --threads)\n"
+         "  --batch-restart           ignore the journal of an earlier run and start over\n"
+         "  --batch-retry             with a journal, also rerun the datasets that failed\n"
+         "  --write-config FILE       write the resolved options to FILE and exit\n", prog);
+}
+
+
+static std::atomic<bool> g_live_stop(false);
+
+static void StopLiveCapture(int){
+  g_live_stop = true;
+}
+
+static std::atomic<bool> g_batch_cancel(false);
+
+static void CancelBatch(int){
+  g_batch_cancel = true;
+}
+
+
+//returns false on a malformed command line
+static bool ParseArgs(const int argc, char *argv[], calibOptions_t &opt, std::string &write_config_file,
+                      std::string &batch_file, batchParams_t &batch_params){
+  //the config file is applied first so command line options override it
+  for(int i = 1; i < argc; ++i)
+    if(strcmp(argv[i], "--config") == 0){
+      if(i + 1 >= argc || !ReadCalibOptions(argv[i + 1], opt))
+        return false;
+      break;
+    }
+
+  const std::string config_target_type_str = opt.target_type_str;
+  std::vector<std::string> prefix_vec, target_flag_vec, calib_flag_vec;
+  for(int i = 1; i < argc; ++i){
+    const std::string arg = argv[i];
+    const int num_remaining = argc - i - 1;
+    if(arg == "--config" && num_remaining >= 1)
+      ++i;
+    else if(arg == "--dir" && num_remaining >= 1)
+      opt.cal_photo_dir = argv[++i];
+    else if(arg == "--ext" && num_remaining >= 1)
+      opt.img_ext = argv[++i];
+    else if(arg == "--prefix" && num_remaining >= 1)
+      prefix_vec.push_back(argv[++i]);
+    else if(arg == "--glob" && num_remaining >= 1)
+      opt.file_glob = argv[++i];
+    else if(arg == "--regex" && num_remaining >= 1)
+      opt.file_regex = argv[++i];
+    else if(arg == "--pair-tolerance" && num_remaining >= 1)
+      opt.pair_tolerance = atof(argv[++i]);
+    else if(arg == "--target" && num_remaining >= 1)
+      opt.target_type_str = argv[++i];
+    else if(arg == "--target-size" && num_remaining >= 2){
+      opt.target_size.width = atoi(argv[++i]);
+      opt.target_size.height = atoi(argv[++i]);
+    }
+    else if(arg == "--spacing" && num_remaining >= 1)
+      opt.target_spacing = atof(argv[++i]);
+    else if(arg == "--target-flag" && num_remaining >= 1)
+      target_flag_vec.push_back(argv[++i]);
+    else if(arg == "--calib-flag" && num_remaining >= 1)
+      calib_flag_vec.push_back(argv[++i]);
+    else if(arg == "--pre-calibrate")
+      opt.pre_calibrate = true;
+    else if(arg == "--input-intrinsic" && num_remaining >= 2){
+      opt.intrinsic_from_file = true;
+      opt.calib_flags |= cv::CALIB_USE_INTRINSIC_GUESS;
+      opt.input_intrinsic_file_name[0] = argv[++i];
+      opt.input_intrinsic_file_name[1] = argv[++i];
+    }
+    else if(arg == "--reject-outliers")
+      opt.reject_outliers = true;
+    else if(arg == "--reject-max-error" && num_remaining >= 1)
+      opt.reject_max_error = atof(argv[++i]);
+    else if(arg == "--reject-percentile" && num_remaining >= 1)
+      opt.reject_percentile = atof(argv[++i]);
+    else if(arg == "--reject-passes" && num_remaining >= 1)
+      opt.reject_max_passes = atoi(argv[++i]);
+    else if(arg == "--compare-models" && num_remaining >= 1){
+      const std::string list = argv[++i];
+      opt.compare_models.clear();
+      for(size_t begin = 0; begin <= list.size();){
+        const size_t end = std::min( list.find(',', begin), list.size() );
+        if(end > begin)
+          opt.compare_models.push_back( list.substr(begin, end - begin) );
+        begin = end + 1;
+      }
+    }
+    else if(arg == "--compare-folds" && num_remaining >= 1)
+      opt.compare_folds = atoi(argv[++i]);
+    else if(arg == "--hartley")
+      opt.rect_use_opencv = false;
+    else if(arg == "--no-zero-disparity")
+      opt.rect_zero_disparity = false;
+    else if(arg == "--alpha" && num_remaining >= 1)
+      opt.rect_alpha = atof(argv[++i]);
+    else if(arg == "--rectify-out" && num_remaining >= 1)
+      opt.rect_output_dir = argv[++i];
+    else if(arg == "--intrinsic-name" && num_remaining >= 1)
+      opt.intrinsic_file_name = argv[++i];
+    else if(arg == "--extrinsic-name" && num_remaining >= 1)
+      opt.extrinsic_file_name = argv[++i];
+    else if(arg == "--no-binary")
+      opt.write_binary = false;
+    else if(arg == "--binary-maps")
+      opt.binary_with_maps = true;
+    else if(arg == "--threads" && num_remaining >= 1)
+      opt.num_threads = atoi(argv[++i]);
+    else if(arg == "--decode-threads" && num_remaining >= 1)
+      opt.num_decode_threads = atoi(argv[++i]);
+    else if(arg == "--prefetch" && num_remaining >= 1)
+      opt.prefetch_depth = atoi(argv[++i]);
+    else if(arg == "--no-cache")
+      opt.use_detection_cache = false;
+    else if(arg == "--detect-scale" && num_remaining >= 1)
+      opt.detect_scale = atof(argv[++i]);
+    else if(arg == "--track")
+      opt.detect_use_hint = true;
+    else if(arg == "--bit-depth" && num_remaining >= 1)
+      opt.raw_bit_depth = atoi(argv[++i]);
+    else if(arg == "--bayer" && num_remaining >= 1){
+      const std::string name = argv[++i];
+      if( !BayerPatternFromName(name, opt.raw_bayer) ){
+        printf( "unknown Bayer pattern: %s\n", name.c_str() );
+        return false;
+      }
+    }
+    else if(arg == "--live" && num_remaining >= 1)
+      opt.live_source = argv[++i];
+    else if(arg == "--live-views" && num_remaining >= 1)
+      opt.live_max_views = atoi(argv[++i]);
+    else if(arg == "--live-no-save")
+      opt.live_save_views = false;
+    else if(arg == "--trace" && num_remaining >= 1)
+      opt.trace_file = argv[++i];
+    else if(arg == "--batch" && num_remaining >= 1)
+      batch_file = argv[++i];
+    else if(arg == "--batch-jobs" && num_remaining >= 1)
+      batch_params.num_jobs = atoi(argv[++i]);
+    else if(arg == "--batch-restart")
+      batch_params.resume = false;
+    else if(arg == "--batch-retry")
+      batch_params.retry_failed = true;
+    else if(arg == "--write-config" && num_remaining >= 1)
+      write_config_file = argv[++i];
+    else{
+      printf( "unknown or incomplete argument: %s\n", arg.c_str() );
+      return false;
+    }
+  }
+
+  if( !prefix_vec.empty() )
+    opt.file_prefix = prefix_vec;
+  //flags given on the command line replace the config file flags of the same kind, find target flags set for
+  //another target type are dropped as they share bits between types
+  if( !target_flag_vec.empty() || opt.target_type_str != config_target_type_str ){
+    opt.find_target_flags = 0;
+    for(auto &name : target_flag_vec){
+      int flag;
+      if( !FindTargetFlagFromName(opt.target_type_str, name, flag) ){
+        printf( "unknown find target flag for target type %s: %s\n", opt.target_type_str.c_str(), name.c_str() );
+        return false;
+      }
+      opt.find_target_flags |= flag;
+    }
+  }
+  if( !calib_flag_vec.empty() ){
+    opt.calib_flags &= cv::CALIB_USE_INTRINSIC_GUESS; //keep the guess flag set by --input-intrinsic
+    for(auto &name : calib_flag_vec){
+      int flag;
+      if( !CalibrationFlagFromName(name, flag) ){
+        printf( "unknown calibration flag: %s\n", name.c_str() );
+        return false;
+      }
+      opt.calib_flags |= flag;
+    }
+  }
+
+  return true;
+}
+
+
+int main(int argc, char *argv[]){
+  if( argc < 2 || strcmp(argv[1], "--help") == 0 || strcmp(argv[1], "-h") == 0 ){
+    PrintUsage(argv[0]);
+    return argc < 2 ? CLI_BAD_ARGS : CLI_OK;
+  }
+
+  calibOptions_t opt;
+  opt.file_prefix.push_back("left");
+  opt.file_prefix.push_back("right");
+  std::string write_config_file, batch_file;
+  batchParams_t batch_params;
+  if( !ParseArgs(argc, argv, opt, write_config_file, batch_file, batch_params) ){
+    PrintUsage(argv[0]);
+    return CLI_BAD_ARGS;
+  }
+
+  if( !write_config_file.empty() )
+    return WriteCalibOptions(write_config_file, opt) ? CLI_OK : CLI_BAD_ARGS;
+
+  //journal and summary sit next to the manifest, the trace option traces the whole batch
+  if( !batch_file.empty() ){
+    std::vector<calibOptions_t> dataset_vec;
+    try{
+      if( !ReadBatchManifest(batch_file, opt, dataset_vec) )
+        return CLI_BAD_ARGS;
+    }
+    catch(cv::Exception &e){
+      printf( "could not read %s - %s\n", batch_file.c_str(), e.what() );
+      return CLI_BAD_ARGS;
+    }
+    const size_t dot_pos = batch_file.find_last_of('.'), slash_pos = batch_file.find_last_of('/');
+    const std::string batch_stem = dot_pos != std::string::npos && (slash_pos == std::string::npos || dot_pos > slash_pos) ?
+                                   batch_file.substr(0, dot_pos) : batch_file;
+    batch_params.num_threads = opt.num_threads;
+    batch_params.journal_file = batch_stem + "_journal.txt";
+    batch_params.summary_file = batch_stem + "_summary.yml";
+    batch_params.trace_file = opt.trace_file;
+    std::vector<batchDatasetResult_t> result_vec;
+    signal(SIGINT, CancelBatch);
+    const int ret = RunBatchCalibration(dataset_vec, batch_params, result_vec, &g_batch_cancel);
+    size_t num_ok = 0;
+    for(auto &result : result_vec)
+      num_ok += result.state == BATCH_OK;
+    printf("%zu of %zu datasets calibrated%s\n", num_ok, result_vec.size(), ret == 1 ? ", cancelled" : "");
+    return ret == 0 && num_ok == result_vec.size() ? CLI_OK : CLI_PIPELINE_FAILED;
+  }
+
+  if( opt.cal_photo_dir.empty() || opt.NumCamera() < 1 ){
+    printf("a calibration directory and at least one file prefix are required\n");
+    return CLI_BAD_ARGS;
+  }
+
+  if( !opt.live_source.empty() ){
+    if( opt.NumCamera() != 1 )
+      opt.file_prefix.resize(1); //live capture is single camera, the first prefix names the saved frames
+    stereoCalData_t cal_data;
+    calibResult_t result;
+    liveCaptureStats_t stats;
+    signal(SIGINT, StopLiveCapture);
+    try{
+      if(RunLiveCalibrationPipeline(opt, cal_data, result, &stats, &g_live_stop) != 0)
+        return CLI_PIPELINE_FAILED;
+    }
+    catch(cv::Exception &e){
+      printf( "calibration failed - %s\n", e.what() );
+      return CLI_PIPELINE_FAILED;
+    }
+    catch(std::exception &e){
+      printf( "calibration failed - caught exception - %s\n", e.what() );
+      return CLI_PIPELINE_FAILED;
+    }
+    catch(...){
+      printf("calibration failed - caught unknown exception\n");
+      return CLI_PIPELINE_FAILED;
+    }
+    printf("rms error: %f, %zu views accepted from %zu frames in %.1f s\n", result.rms_error, stats.num_accepted,
+           stats.num_frames, stats.capture_time_s);
+    return CLI_OK;
+  }
+
+  if( opt.RigMode() ){
+    rigCalData_t rig_data;
+    rigCalibResult_t rig_result;
+    try{
+      if(RunRigCalibrationPipeline(opt, rig_data, rig_result) != 0)
+        return CLI_PIPELINE_FAILED;
+    }
+    catch(cv::Exception &e){
+      printf( "calibration failed - %s\n", e.what() );
+      return CLI_PIPELINE_FAILED;
+    }
+    catch(std::exception &e){
+      printf( "calibration failed - caught exception - %s\n", e.what() );
+      return CLI_PIPELINE_FAILED;
+    }
+    catch(...){
+      printf("calibration failed - caught unknown exception\n");
+      return CLI_PIPELINE_FAILED;
+    }
+    printf("rms error: %f, %zu views, %d iterations\n", rig_result.rms_error, rig_data.NumView(), rig_result.num_iter);
+    return CLI_OK;
+  }
+
+  stereoCalData_t cal_data;
+  calibResult_t result;
+  try{
+    if(RunCalibrationPipeline(opt, cal_data, result) != 0)
+      return CLI_PIPELINE_FAILED;
+  }
+  catch(cv::Exception &e){
+    printf( "calibration failed - %s\n", e.what() );
+    return CLI_PIPELINE_FAILED;
+  }
+  catch(std::exception &e){
+    printf( "calibration failed - caught exception - %s\n", e.what() );
+    return CLI_PIPELINE_FAILED;
+  }
+  catch(...){
+    printf("calibration failed - caught unknown exception\n");
+    return CLI_PIPELINE_FAILED;
+  }
+
+  if( opt.StereoMode() )
+    printf("rms error: %f, avg. reprojection error: %f\n", result.rms_error, result.reprojection_error);
+  printf("%d images per camera used\n", result.num_img_per_cam);
+
+  return CLI_OK;
+}
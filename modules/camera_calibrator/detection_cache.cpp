@@ -0,0 +1,207 @@
+#include "detection_cache.h"
+#include <algorithm>
+#include <climits>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <sys/stat.h>
+#include "mio/altro/io.h"
+
+
+const char *DetectionCache::default_file_name = "detection_cache.bin";
+
+//file layout (native byte order):
+//  char[4] magic "CCDC", uint32 version, uint64 num_entries, then per entry:
+//  uint32 name_len, char[name_len] img_file_name, uint64 file_size, int64 file_mtime_ns, uint64 settings_hash,
+//  uint8 found, int32 img_width, int32 img_height, uint32 num_points, float[2*num_points] x/y pairs
+static const char cache_magic[4] = {'C', 'C', 'D', 'C'};
+static const uint32_t cache_version = 1;
+
+
+uint64_t Fnv1a64(const void *data, const size_t size, uint64_t hash){
+  const unsigned char *ptr = static_cast<const unsigned char*>(data);
+  for(size_t i = 0; i < size; ++i){
+    hash ^= ptr[i];
+    hash *= 1099511628211ULL;
+  }
+  return hash;
+}
+
+
+uint64_t DetectionSettingsHash(const camCalTarget_t &cal_target, const int find_target_flags, const double detect_scale,
+                               const rawImageParams_t &raw){
+  char buf[256];
+  int len = snprintf(buf, sizeof(buf), "%s|%d|%d|%.6f|%d", cal_target.type_str.c_str(), cal_target.size.width,
+                     cal_target.size.height, cal_target.spacing, find_target_flags);
+  if(detect_scale > 0 && detect_scale < 1 && len > 0 && len < static_cast<int>( sizeof(buf) ))
+    len += snprintf(buf + len, sizeof(buf) - len, "|%.4f", detect_scale);
+  //8 bit settings hash as before so existing caches stay valid
+  if(raw.Raw() && len > 0 && len < static_cast<int>( sizeof(buf) ))
+    snprintf(buf + len, sizeof(buf) - len, "|raw%d|%d", raw.bit_depth, raw.bayer_pattern);
+  return Fnv1a64( buf, strlen(buf) );
+}
+
+
+static bool StatFile(const std::string &file_name_full, uint64_t &file_size, int64_t &file_mtime_ns){
+  struct stat st;
+  if(stat(file_name_full.c_str(), &st) != 0)
+    return false;
+  file_size = static_cast<uint64_t>(st.st_size);
+#ifdef __APPLE__
+  file_mtime_ns = static_cast<int64_t>(st.st_mtimespec.tv_sec) * 1000000000LL + st.st_mtimespec.tv_nsec;
+#else
+  file_mtime_ns = static_cast<int64_t>(st.st_mtim.tv_sec) * 1000000000LL + st.st_mtim.tv_nsec;
+#endif
+  return true;
+}
+
+
+static std::string EntryKey(const std::string &img_file_name, const uint64_t settings_hash){
+  return img_file_name + "|" + std::to_string(settings_hash);
+}
+
+
+template <typename T>
+static bool ReadPod(std::ifstream &ifs, T &value){
+  return static_cast<bool>( ifs.read(reinterpret_cast<char*>(&value), sizeof(T)) );
+}
+
+template <typename T>
+static void WritePod(std::ofstream &ofs, const T &value){
+  ofs.write(reinterpret_cast<const char*>(&value), sizeof(T));
+}
+
+
+bool DetectionCache::Load(const std::string &dir_path, const std::string &file_name){
+  std::lock_guard<std::mutex> lock(m_mutex);
+  m_dir_path = dir_path;
+  m_file_name_full = dir_path + "/" + file_name;
+  m_entry_map.clear();
+  m_dirty = false;
+
+  std::ifstream ifs(m_file_name_full, std::ios::binary | std::ios::ate);
+  if( !ifs.is_open() )
+    return false;
+  const uint64_t file_size = static_cast<uint64_t>( ifs.tellg() );
+  ifs.seekg(0);
+  char magic[4];
+  uint32_t version;
+  uint64_t num_entries;
+  if( !ifs.read(magic, 4) || !std::equal(magic, magic + 4, cache_magic) ||
+      !ReadPod(ifs, version) || version != cache_version || !ReadPod(ifs, num_entries) ){
+    printf( "DetectionCache::Load() - %s is not a valid cache file, ignoring it\n", m_file_name_full.c_str() );
+    return false;
+  }
+
+  //lengths are checked against the bytes left before anything is sized by them, a corrupt file is dropped whole
+  auto bytes_left = [&ifs, file_size](){ return file_size - static_cast<uint64_t>( ifs.tellg() ); };
+  bool valid = true;
+  for(uint64_t i = 0; i < num_entries && valid; ++i){
+    uint32_t name_len, num_points;
+    int32_t width, height;
+    uint8_t found;
+    detectionCacheEntry_t entry;
+    valid = ReadPod(ifs, name_len) && name_len <= PATH_MAX && name_len <= bytes_left();
+    if(!valid)
+      break;
+    std::string img_file_name(name_len, '\0');
+    valid = ifs.read(&img_file_name[0], name_len) &&
+            ReadPod(ifs, entry.file_size) && ReadPod(ifs, entry.file_mtime_ns) && ReadPod(ifs, entry.settings_hash) &&
+            ReadPod(ifs, found) && ReadPod(ifs, width) && ReadPod(ifs, height) && ReadPod(ifs, num_points) &&
+            uint64_t(num_points) * 2 * sizeof(float) <= bytes_left();
+    if(!valid)
+      break;
+    entry.found = found != 0;
+    entry.img_size = cv::Size(width, height);
+    entry.img_points.resize(num_points);
+    valid = num_points == 0 ||
+            ifs.read(reinterpret_cast<char*>( entry.img_points.data() ), num_points * 2 * sizeof(float));
+    if(valid)
+      m_entry_map[EntryKey(img_file_name, entry.settings_hash)] = entry;
+  }
+  if(!valid){
+    printf( "DetectionCache::Load() - %s is truncated or corrupt after %zu of %llu entries, ignoring it\n",
+            m_file_name_full.c_str(), m_entry_map.size(), static_cast<unsigned long long>(num_entries) );
+    m_entry_map.clear();
+    return false;
+  }
+
+  return true;
+}
+
+
+bool DetectionCache::Save(){
+  std::lock_guard<std::mutex> lock(m_mutex);
+  EXP_CHK(!m_file_name_full.empty(), return(false))
+  if(!m_dirty)
+    return true;
+
+  //write to a temporary file and rename it so an interrupted run never leaves a corrupt cache behind
+  const std::string tmp_file_name_full = m_file_name_full + ".tmp";
+  {
+    std::ofstream ofs(tmp_file_name_full, std::ios::binary | std::ios::trunc);
+    EXP_CHK_M(ofs.is_open(), return(false), "could not write " + tmp_file_name_full)
+    ofs.write(cache_magic, 4);
+    WritePod(ofs, cache_version);
+    WritePod( ofs, static_cast<uint64_t>( m_entry_map.size() ) );
+    for(auto &item : m_entry_map){
+      const std::string img_file_name = item.first.substr( 0, item.first.rfind('|') );
+      const detectionCacheEntry_t &entry = item.second;
+      WritePod( ofs, static_cast<uint32_t>( img_file_name.size() ) );
+      ofs.write( img_file_name.data(), img_file_name.size() );
+      WritePod(ofs, entry.file_size);
+      WritePod(ofs, entry.file_mtime_ns);
+      WritePod(ofs, entry.settings_hash);
+      WritePod( ofs, static_cast<uint8_t>(entry.found) );
+      WritePod( ofs, static_cast<int32_t>(entry.img_size.width) );
+      WritePod( ofs, static_cast<int32_t>(entry.img_size.height) );
+      WritePod( ofs, static_cast<uint32_t>( entry.img_points.size() ) );
+      if( !entry.img_points.empty() )
+        ofs.write( reinterpret_cast<const char*>( entry.img_points.data() ), entry.img_points.size() * 2 * sizeof(float) );
+    }
+    EXP_CHK_M(ofs.good(), return(false), "error writing " + tmp_file_name_full)
+  }
+  EXP_CHK_M(rename(tmp_file_name_full.c_str(), m_file_name_full.c_str()) == 0, return(false),
+            "could not replace " + m_file_name_full)
+  m_dirty = false;
+
+  return true;
+}
+
+
+bool DetectionCache::Lookup(const std::string &img_file_name, const uint64_t settings_hash, detectionCacheEntry_t &entry){
+  uint64_t file_size;
+  int64_t file_mtime_ns;
+  if( !StatFile(m_dir_path + "/" + img_file_name, file_size, file_mtime_ns) )
+    return false;
+
+  std::lock_guard<std::mutex> lock(m_mutex);
+  auto it = m_entry_map.find( EntryKey(img_file_name, settings_hash) );
+  if( it == m_entry_map.end() || it->second.file_size != file_size || it->second.file_mtime_ns != file_mtime_ns )
+    return false;
+  entry = it->second;
+  return true;
+}
+
+
+void DetectionCache::Insert(const std::string &img_file_name, const uint64_t settings_hash, const bool found,
+                            const cv::Size img_size, const std::vector<cv::Point2f> &img_points){
+  detectionCacheEntry_t entry;
+  if( !StatFile(m_dir_path + "/" + img_file_name, entry.file_size, entry.file_mtime_ns) )
+    return;
+  entry.settings_hash = settings_hash;
+  entry.found = found;
+  entry.img_size = img_size;
+  if(found)
+    entry.img_points = img_points;
+
+  std::lock_guard<std::mutex> lock(m_mutex);
+  m_entry_map[EntryKey(img_file_name, settings_hash)] = entry;
+  m_dirty = true;
+}
+
+
+size_t DetectionCache::Size(){
+  std::lock_guard<std::mutex> lock(m_mutex);
+  return m_entry_map.size();
+}
@@ -0,0 +1,58 @@
+#ifndef __DETECTION_CACHE__
+#define __DETECTION_CACHE__
+
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include "opencv2/core.hpp"
+#include "mvg/stereo_compute.h"
+#include "raw_image.h"
+
+
+//cached detection result for one image file
+struct detectionCacheEntry_t{
+  uint64_t file_size;
+  int64_t file_mtime_ns;
+  uint64_t settings_hash;
+  bool found;
+  cv::Size img_size;
+  std::vector<cv::Point2f> img_points;
+
+  detectionCacheEntry_t() : file_size(0), file_mtime_ns(0), settings_hash(0), found(false) {}
+};
+
+//Persistent per-image detection results stored in a compact binary file inside the calibration directory.
+//An entry is valid while the image file size and modification time are unchanged and it was produced with
+//the same detector settings (see DetectionSettingsHash()). Lookup() and Insert() are thread safe.
+class DetectionCache{
+  public:
+    static const char *default_file_name;
+
+    DetectionCache() : m_dirty(false) {}
+
+    //false and an empty cache when the file is missing, truncated or corrupt
+    bool Load(const std::string &dir_path, const std::string &file_name = default_file_name);
+    bool Save();
+
+    bool Lookup(const std::string &img_file_name, const uint64_t settings_hash, detectionCacheEntry_t &entry);
+    void Insert(const std::string &img_file_name, const uint64_t settings_hash, const bool found,
+                const cv::Size img_size, const std::vector<cv::Point2f> &img_points);
+
+    size_t Size();
+
+  private:
+    std::string m_dir_path, m_file_name_full;
+    std::unordered_map<std::string, detectionCacheEntry_t> m_entry_map; //key: img_file_name + settings hash
+    std::mutex m_mutex;
+    bool m_dirty;
+};
+
+//64 bit FNV-1a, pass the previous result as hash to continue over several buffers
+uint64_t Fnv1a64(const void *data, const size_t size, uint64_t hash = 14695981039346656037ULL);
+//detect_scale only enters the hash when detection runs coarse-to-fine (< 1), full resolution entries keep their hash
+uint64_t DetectionSettingsHash(const camCalTarget_t &cal_target, const int find_target_flags, const double detect_scale = 1,
+                               const rawImageParams_t &raw = rawImageParams_t());
+
+#endif //__DETECTION_CACHE__
@@ -0,0 +1,252 @@
+#include "image_scan.h"
+#include <algorithm>
+#include <cctype>
+#include <cstdint>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <dirent.h>
+#include <fnmatch.h>
+#include <map>
+#include <regex>
+#include "opencv2/core.hpp"
+#include "mio/altro/io.h"
+#include "parallel_tasks.h"
+#include "pipeline_trace.h"
+
+
+struct scannedFile_t{
+  std::string name;
+  std::string key;  //sort/pair key, see FrameKey()
+  double number;    //last number of the frame key, NAN if there is none
+};
+
+
+//Digit runs are replaced by their length and the digits without leading zeros, so plain string comparison
+//orders keys naturally and zero padding does not matter ("7" == "007" < "12").
+static std::string FrameKey(const std::string &key_str, double &number){
+  std::string key;
+  number = NAN;
+  for(size_t i = 0; i < key_str.size();){
+    if( !isdigit( static_cast<unsigned char>(key_str[i]) ) ){
+      key += key_str[i++];
+      continue;
+    }
+    size_t end = i;
+    while( end < key_str.size() && isdigit( static_cast<unsigned char>(key_str[end]) ) )
+      ++end;
+    size_t first = i;
+    while(first + 1 < end && key_str[first] == '0')
+      ++first;
+    const std::string digits = key_str.substr(first, end - first);
+    key += static_cast<char>( std::min(digits.size(), size_t(127)) );
+    key += digits;
+    number = atof( digits.c_str() );
+    i = end;
+  }
+  return key;
+}
+
+
+static bool ListDir(const std::string &dir, std::vector<std::string> &entry_vec){
+  DIR *dir_handle = opendir( dir.c_str() );
+  if(!dir_handle)
+    return false;
+  for(struct dirent *entry = readdir(dir_handle); entry; entry = readdir(dir_handle)){
+#ifdef _DIRENT_HAVE_D_TYPE
+    if(entry->d_type == DT_DIR)
+      continue;
+#endif
+    entry_vec.push_back(entry->d_name);
+  }
+  closedir(dir_handle);
+  return true;
+}
+
+
+//pairs the files of camera j > 0 to the nearest unused frame number of camera 0 within tolerance
+static void PairByNumber(std::vector< std::vector<scannedFile_t> > &file_vec, const double tolerance,
+                         std::vector< std::vector<const scannedFile_t*> > &set_vec, std::vector<std::string> &unmatched){
+  const size_t num_camera = file_vec.size();
+  for(auto &cam_file_vec : file_vec){
+    std::stable_sort( cam_file_vec.begin(), cam_file_vec.end(),
+                      [](const scannedFile_t &a, const scannedFile_t &b){ return a.number < b.number; } );
+    while( !cam_file_vec.empty() && std::isnan(cam_file_vec.back().number) ){ //NAN sorts last
+      unmatched.push_back(cam_file_vec.back().name);
+      cam_file_vec.pop_back();
+    }
+  }
+
+  std::vector< std::vector<char> > used_vec(num_camera);
+  for(size_t j = 0; j < num_camera; ++j)
+    used_vec[j].assign(file_vec[j].size(), 0);
+  for(size_t i = 0; i < file_vec[0].size(); ++i){
+    const double number = file_vec[0][i].number;
+    std::vector<const scannedFile_t*> set(1, &file_vec[0][i]);
+    for(size_t j = 1; j < num_camera; ++j){
+      const std::vector<scannedFile_t> &cam_file_vec = file_vec[j];
+      auto it = std::lower_bound( cam_file_vec.begin(), cam_file_vec.end(), number,
+                                  [](const scannedFile_t &a, const double n){ return a.number < n; } );
+      //nearest unused candidate on either side
+      size_t best = cam_file_vec.size();
+      double best_dist = tolerance;
+      for(size_t k = it - cam_file_vec.begin(); k < cam_file_vec.size() && cam_file_vec[k].number - number <= tolerance; ++k)
+        if(!used_vec[j][k]){
+          if(cam_file_vec[k].number - number <= best_dist){
+            best = k;
+            best_dist = cam_file_vec[k].number - number;
+          }
+          break;
+        }
+      for(size_t k = it - cam_file_vec.begin(); k-- > 0 && number - cam_file_vec[k].number <= tolerance;)
+        if(!used_vec[j][k]){
+          if(number - cam_file_vec[k].number < best_dist || best == cam_file_vec.size()){
+            best = k;
+            best_dist = number - cam_file_vec[k].number;
+          }
+          break;
+        }
+      if( best == cam_file_vec.size() )
+        break;
+      set.push_back(&cam_file_vec[best]);
+    }
+    if(set.size() != num_camera){
+      unmatched.push_back(file_vec[0][i].name);
+      continue;
+    }
+    for(size_t j = 1; j < num_camera; ++j)
+      used_vec[j][ set[j] - &file_vec[j][0] ] = 1;
+    set_vec.push_back(set);
+  }
+  for(size_t j = 1; j < num_camera; ++j)
+    for(size_t k = 0; k < file_vec[j].size(); ++k)
+      if(!used_vec[j][k])
+        unmatched.push_back(file_vec[j][k].name);
+}
+
+
+//pairs equal frame keys, sets are ordered by key
+static void PairByKey(std::vector< std::vector<scannedFile_t> > &file_vec,
+                      std::vector< std::vector<const scannedFile_t*> > &set_vec, std::vector<std::string> &unmatched){
+  const size_t num_camera = file_vec.size();
+  std::map< std::string, std::vector<const scannedFile_t*> > key_map;
+  for(size_t j = 0; j < num_camera; ++j)
+    for(auto &file : file_vec[j]){
+      std::vector<const scannedFile_t*> &set = key_map[file.key];
+      set.resize(num_camera, NULL);
+      if(set[j])
+        unmatched.push_back(file.name); //duplicate key, ie. "left_7" next to "left_007"
+      else
+        set[j] = &file;
+    }
+  for(auto &key_set : key_map){
+    const std::vector<const scannedFile_t*> &set = key_set.second;
+    if( std::find(set.begin(), set.end(), static_cast<const scannedFile_t*>(NULL)) == set.end() )
+      set_vec.push_back(set);
+    else
+      for(auto file : set)
+        if(file)
+          unmatched.push_back(file->name);
+  }
+}
+
+
+int ScanImageSets(const std::string &dir, const imageScanParams_t &params, std::vector<std::string> &img_file_name_vec,
+                  imageScanReport_t *report){
+  img_file_name_vec.clear();
+  const size_t num_camera = params.file_prefix.size();
+  EXP_CHK_M(num_camera > 0, return(-1), "ScanImageSets() - no file prefix given")
+  std::string img_ext = params.img_ext;
+  if( !img_ext.empty() && img_ext[0] != '.' )
+    img_ext.insert(0, ".");
+
+  std::regex name_regex;
+  const bool use_regex = !params.name_regex.empty();
+  try{
+    if(use_regex)
+      name_regex = std::regex(params.name_regex, std::regex::ECMAScript);
+  }
+  catch(std::regex_error &e){
+    printf( "ScanImageSets() - invalid regex %s: %s\n", params.name_regex.c_str(), e.what() );
+    return(-1);
+  }
+
+  ScopedTrace trace("listing");
+  const int64_t start_tick = cv::getTickCount();
+  std::vector<std::string> entry_vec;
+  EXP_CHK_M(ListDir(dir, entry_vec), return(-1), "ScanImageSets() - could not read " + dir)
+
+  //classify in chunks, each chunk fills its own per camera lists so no locking is needed
+  const size_t chunk_size = 4096, num_chunk = (entry_vec.size() + chunk_size - 1) / chunk_size;
+  std::vector< std::vector< std::vector<scannedFile_t> > > chunk_file_vec( num_chunk,
+                                                                          std::vector< std::vector<scannedFile_t> >(num_camera) );
+  ParallelTasks(num_chunk, params.num_threads, [&](const size_t c){
+    const size_t end = std::min( (c + 1) * chunk_size, entry_vec.size() );
+    for(size_t e = c * chunk_size; e < end; ++e){
+      const std::string &name = entry_vec[e];
+      if( name.size() <= img_ext.size() || name.compare(name.size() - img_ext.size(), img_ext.size(), img_ext) != 0 )
+        continue;
+      //the longest matching prefix wins, so "cam1" and "cam10" can be told apart
+      size_t cam = num_camera;
+      for(size_t j = 0; j < num_camera; ++j)
+        if( name.compare(0, params.file_prefix[j].size(), params.file_prefix[j]) == 0 &&
+            (cam == num_camera || params.file_prefix[j].size() > params.file_prefix[cam].size()) )
+          cam = j;
+      if(cam == num_camera)
+        continue;
+      if( !params.name_glob.empty() && fnmatch(params.name_glob.c_str(), name.c_str(), 0) != 0 )
+        continue;
+      std::string key_str = name.substr( params.file_prefix[cam].size(),
+                                         name.size() - params.file_prefix[cam].size() - img_ext.size() );
+      if(use_regex){
+        std::smatch match;
+        if( !std::regex_match(name, match, name_regex) )
+          continue;
+        if(match.size() > 1 && match[1].matched)
+          key_str = match[1].str();
+      }
+      scannedFile_t file;
+      file.name = name;
+      file.key = FrameKey(key_str, file.number);
+      chunk_file_vec[c][cam].push_back(file);
+    }
+  });
+
+  std::vector< std::vector<scannedFile_t> > file_vec(num_camera);
+  for(auto &chunk : chunk_file_vec)
+    for(size_t j = 0; j < num_camera; ++j)
+      file_vec[j].insert( file_vec[j].end(), chunk[j].begin(), chunk[j].end() );
+
+  imageScanReport_t scan_report;
+  scan_report.num_entries = entry_vec.size();
+  for(size_t j = 0; j < num_camera; ++j)
+    scan_report.num_matched.push_back( file_vec[j].size() );
+
+  std::vector< std::vector<const scannedFile_t*> > set_vec;
+  if(params.pair_tolerance > 0)
+    PairByNumber(file_vec, params.pair_tolerance, set_vec, scan_report.unmatched);
+  else
+    PairByKey(file_vec, set_vec, scan_report.unmatched);
+  std::sort( scan_report.unmatched.begin(), scan_report.unmatched.end() );
+
+  img_file_name_vec.reserve(set_vec.size() * num_camera);
+  for(auto &set : set_vec)
+    for(auto file : set)
+      img_file_name_vec.push_back(file->name);
+  scan_report.num_sets = set_vec.size();
+
+  std::string matched_str;
+  for(size_t j = 0; j < num_camera; ++j)
+    matched_str += (j > 0 ? "/" : "") + std::to_string(scan_report.num_matched[j]);
+  printf( "ScanImageSets(): %zu entries, %s files per camera, %zu image sets, %zu unmatched files skipped (%.1f ms)\n",
+          scan_report.num_entries, matched_str.c_str(), scan_report.num_sets, scan_report.unmatched.size(),
+          1000.0 * static_cast<double>(cv::getTickCount() - start_tick) / cv::getTickFrequency() );
+  for(size_t i = 0; i < scan_report.unmatched.size() && i < 10; ++i)
+    printf( "  unmatched: %s\n", scan_report.unmatched[i].c_str() );
+  if(scan_report.unmatched.size() > 10)
+    printf( "  ... and %zu more\n", scan_report.unmatched.size() - 10 );
+
+  if(report)
+    *report = scan_report;
+  return static_cast<int>(scan_report.num_sets);
+}
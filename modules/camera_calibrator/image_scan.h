@@ -0,0 +1,40 @@
+#ifndef __IMAGE_SCAN__
+#define __IMAGE_SCAN__
+
+#include <string>
+#include <vector>
+
+
+//Which files of a directory are calibration images and how the cameras are paired. A file belongs to camera j
+//when it starts with file_prefix[j], ends with img_ext and matches the optional patterns. Its frame key is the
+//part of the name between prefix and extension, or regex capture group 1 when the regex has one.
+struct imageScanParams_t{
+  std::string img_ext;                  //with or without the leading dot
+  std::vector<std::string> file_prefix; //one per camera
+  std::string name_glob;                //fnmatch() pattern the file name must match too, empty for any
+  std::string name_regex;               //ECMAScript regex the whole file name must match too, empty for any
+  double pair_tolerance;                //0 pairs equal frame keys, > 0 pairs the last number in the keys (ie. a
+                                        //timestamp) to the nearest one of camera 0 within this distance
+  int num_threads;                      //<= 0 uses one thread per core
+
+  imageScanParams_t() : img_ext("png"), pair_tolerance(0), num_threads(0) {}
+};
+
+struct imageScanReport_t{
+  size_t num_entries;                   //directory entries looked at
+  std::vector<size_t> num_matched;      //[camera] files assigned to the camera
+  size_t num_sets;                      //complete image sets
+  std::vector<std::string> unmatched;   //files without a partner in every camera, or duplicate frame keys
+
+  imageScanReport_t() : num_entries(0), num_sets(0) {}
+};
+
+//Lists the image sets of dir in memory. dir is read once without a stat() per entry, the entries are
+//classified in parallel and paired by frame key. Digit runs in keys compare by value, so "left_7" pairs
+//"right_007" and sets come out in frame order. Frames missing in any camera are skipped and reported instead
+//of failing the scan. img_file_name_vec gets the file names interleaved by camera, one image set after the
+//other. Returns the number of image sets, -1 if dir or a pattern is invalid.
+int ScanImageSets(const std::string &dir, const imageScanParams_t &params, std::vector<std::string> &img_file_name_vec,
+                  imageScanReport_t *report = NULL);
+
+#endif //__IMAGE_SCAN__
@@ -0,0 +1,144 @@
+#include "incremental_calib.h"
+#include "opencv2/calib3d.hpp"
+#include <algorithm>
+#include <cmath>
+#include "mio/altro/io.h"
+#include "pipeline_trace.h"
+
+
+calView_t RemoveCalView(stereoCalData_t &cal_data, const size_t idx, const size_t num_camera){
+  calView_t view;
+  view.idx = idx;
+  for(size_t j = 0; j < num_camera; ++j){
+    EXP_CHK(idx < cal_data.good_img_file_names[j].size() && idx < cal_data.img_points[j].size(), return(view))
+    view.file_names.push_back(cal_data.good_img_file_names[j][idx]);
+    view.img_points.push_back(cal_data.img_points[j][idx]);
+  }
+  for(size_t j = 0; j < num_camera; ++j){
+    cal_data.good_img_file_names[j].erase(cal_data.good_img_file_names[j].begin() + idx);
+    cal_data.img_points[j].erase(cal_data.img_points[j].begin() + idx);
+  }
+  return view;
+}
+
+
+void InsertCalView(stereoCalData_t &cal_data, const calView_t &view, const size_t num_camera){
+  EXP_CHK(view.file_names.size() == num_camera && view.img_points.size() == num_camera, return)
+  for(size_t j = 0; j < num_camera; ++j){
+    const size_t idx = std::min( view.idx, cal_data.good_img_file_names[j].size() );
+    cal_data.good_img_file_names[j].insert(cal_data.good_img_file_names[j].begin() + idx, view.file_names[j]);
+    cal_data.img_points[j].insert(cal_data.img_points[j].begin() + idx, view.img_points[j]);
+  }
+}
+
+
+stereoCalData_t CloneCalData(const stereoCalData_t &cal_data){
+  stereoCalData_t clone = cal_data;
+  for(size_t j = 0; j < 2; ++j){
+    clone.K[j] = cal_data.K[j].clone();
+    clone.D[j] = cal_data.D[j].clone();
+    clone.R_rect[j] = cal_data.R_rect[j].clone();
+    clone.P_rect[j] = cal_data.P_rect[j].clone();
+  }
+  clone.R = cal_data.R.clone();
+  clone.T = cal_data.T.clone();
+  clone.E = cal_data.E.clone();
+  clone.F = cal_data.F.clone();
+  clone.Q = cal_data.Q.clone();
+  return clone;
+}
+
+
+std::vector<cv::Point3f> CalTargetObjectPoints(const camCalTarget_t &cal_target){
+  if( cal_target.point_vec.size() == static_cast<size_t>( cal_target.size.area() ) )
+    return cal_target.point_vec;
+
+  //same layout as the detectors report the points in, row by row
+  const float spacing = static_cast<float>(cal_target.spacing);
+  const bool asymmetric = cal_target.type_str == "a-circle";
+  std::vector<cv::Point3f> point_vec;
+  for(int y = 0; y < cal_target.size.height; ++y)
+    for(int x = 0; x < cal_target.size.width; ++x)
+      point_vec.push_back( cv::Point3f( (asymmetric ? 2*x + y % 2 : x) * spacing, y * spacing, 0 ) );
+  return point_vec;
+}
+
+
+void CombineViewErrors(const cv::Mat &per_view_errors, std::vector<double> &repro_err_vec){
+  repro_err_vec.assign(per_view_errors.rows, 0);
+  for(int i = 0; i < per_view_errors.rows; ++i){
+    double sum_sq = 0;
+    for(int j = 0; j < per_view_errors.cols; ++j)
+      sum_sq += per_view_errors.at<double>(i, j) * per_view_errors.at<double>(i, j);
+    repro_err_vec[i] = std::sqrt(sum_sq / per_view_errors.cols);
+  }
+}
+
+
+double EpipolarError(const stereoCalData_t &cal_data){
+  double err_sum = 0;
+  size_t num_point = 0;
+  for(size_t i = 0; i < cal_data.img_points[0].size(); ++i){
+    std::vector<cv::Point2f> points[2];
+    std::vector<cv::Point3f> lines[2];
+    for(int j = 0; j < 2; ++j){
+      cv::undistortPoints(cal_data.img_points[j][i], points[j], cal_data.K[j], cal_data.D[j], cv::Mat(), cal_data.K[j]);
+      cv::computeCorrespondEpilines(points[j], j + 1, cal_data.F, lines[j]);
+    }
+    for(size_t k = 0; k < points[0].size(); ++k){
+      err_sum += std::fabs(points[0][k].x*lines[1][k].x + points[0][k].y*lines[1][k].y + lines[1][k].z) +
+                 std::fabs(points[1][k].x*lines[0][k].x + points[1][k].y*lines[0][k].y + lines[0][k].z);
+    }
+    num_point += points[0].size();
+  }
+  return num_point > 0 ? err_sum / num_point : 0;
+}
+
+
+int RecalibrateWarmStart(const camCalTarget_t &cal_target, stereoCalData_t &cal_data, const size_t num_camera,
+                         const int calib_flags, calibResult_t &result){
+  EXP_CHK(num_camera == 1 || num_camera == 2, return(-1))
+  EXP_CHK_M(!cal_data.K[0].empty() && ( num_camera == 1 || ( !cal_data.K[1].empty() && !cal_data.R.empty() ) ),
+            return(-1), "no calibration to start from")
+  const size_t num_view = cal_data.img_points[0].size();
+  EXP_CHK_M(num_view >= 2, return(-1), "at least two views are required")
+
+  ScopedTrace trace("recalibrate", "calibration");
+  const int64 start_tick = cv::getTickCount();
+  const std::vector< std::vector<cv::Point3f> > obj_points(num_view, CalTargetObjectPoints(cal_target));
+  const cv::TermCriteria criteria(cv::TermCriteria::COUNT + cv::TermCriteria::EPS, 30, 1e-6);
+  cv::Mat per_view_errors;
+  try{
+    if(num_camera == 1){
+      //stereo only flags are not accepted by cv::calibrateCamera()
+      const int flags = ( calib_flags & ~(cv::CALIB_FIX_INTRINSIC | cv::CALIB_SAME_FOCAL_LENGTH) ) |
+                        cv::CALIB_USE_INTRINSIC_GUESS;
+      std::vector<cv::Mat> rvecs, tvecs;
+      result.rms_error = cv::calibrateCamera(obj_points, cal_data.img_points[0], cal_data.img_size, cal_data.K[0],
+                                             cal_data.D[0], rvecs, tvecs, cv::noArray(), cv::noArray(),
+                                             per_view_errors, flags, criteria);
+    }
+    else{
+      int flags = calib_flags | cv::CALIB_USE_INTRINSIC_GUESS;
+#if CV_VERSION_MAJOR > 4 || (CV_VERSION_MAJOR == 4 && CV_VERSION_MINOR >= 1)
+      flags |= cv::CALIB_USE_EXTRINSIC_GUESS;
+#endif
+      result.rms_error = cv::stereoCalibrate(obj_points, cal_data.img_points[0], cal_data.img_points[1],
+                                             cal_data.K[0], cal_data.D[0], cal_data.K[1], cal_data.D[1],
+                                             cal_data.img_size, cal_data.R, cal_data.T, cal_data.E, cal_data.F,
+                                             per_view_errors, flags, criteria);
+      result.reprojection_error = EpipolarError(cal_data);
+    }
+  }
+  catch(cv::Exception &e){
+    printf( "RecalibrateWarmStart() - caught error - %s\n", e.what() );
+    return(-1);
+  }
+
+  CombineViewErrors(per_view_errors, result.repro_err_vec);
+  result.num_img_per_cam = static_cast<int>(num_view);
+  printf( "RecalibrateWarmStart(): %zu views, rms %f, %.1f ms\n", num_view, result.rms_error,
+          1000.0 * static_cast<double>(cv::getTickCount() - start_tick) / cv::getTickFrequency() );
+
+  return 0;
+}
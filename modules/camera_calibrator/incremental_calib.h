@@ -0,0 +1,43 @@
+#ifndef __INCREMENTAL_CALIB__
+#define __INCREMENTAL_CALIB__
+
+#include <string>
+#include <vector>
+#include "opencv2/core.hpp"
+#include "mvg/stereo_compute.h"
+#include "calib_pipeline.h"
+
+
+//one detected image set as stored in stereoCalData_t, idx is its position in good_img_file_names
+struct calView_t{
+  size_t idx;
+  std::vector<std::string> file_names;                //[camera]
+  std::vector< std::vector<cv::Point2f> > img_points; //[camera]
+
+  calView_t() : idx(0) {}
+};
+
+//removes view idx from the good_img_file_names/img_points lists of cal_data in place and returns it
+calView_t RemoveCalView(stereoCalData_t &cal_data, const size_t idx, const size_t num_camera);
+//inserts view back at view.idx (appended when past the end)
+void InsertCalView(stereoCalData_t &cal_data, const calView_t &view, const size_t num_camera);
+
+//deep copy, cv::Mat copies share their buffers and a solve writing to the copy would change cal_data too
+stereoCalData_t CloneCalData(const stereoCalData_t &cal_data);
+
+//target points in the target frame, one entry per detected point
+std::vector<cv::Point3f> CalTargetObjectPoints(const camCalTarget_t &cal_target);
+
+//RMS reprojection error of each view from the perViewErrors of cv::calibrateCamera() or cv::stereoCalibrate(),
+//the cameras of a stereo view combined by their RMS
+void CombineViewErrors(const cv::Mat &per_view_errors, std::vector<double> &repro_err_vec);
+//mean distance of the points to the epipolar line of their match, undistorted with K/D (stereo only)
+double EpipolarError(const stereoCalData_t &cal_data);
+
+//Re-optimizes cal_data starting from its current K/D (and R/T in stereo mode) instead of from scratch, for
+//small changes of the view set such as dropping or restoring a view. result gets the new RMS, epipolar
+//(stereo) and per-view errors. Returns 0 on success.
+int RecalibrateWarmStart(const camCalTarget_t &cal_target, stereoCalData_t &cal_data, const size_t num_camera,
+                         const int calib_flags, calibResult_t &result);
+
+#endif //__INCREMENTAL_CALIB__
@@ -0,0 +1,349 @@
+#include "live_capture.h"
+#include "opencv2/calib3d.hpp"
+#include "opencv2/imgproc.hpp"
+#include "opencv2/videoio.hpp"
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <future>
+#include <limits>
+#include <thread>
+#include "mio/altro/io.h"
+#include "bounded_queue.h"
+#include "cal_target_detect.h"
+#include "calib_coverage.h"
+#include "calib_pipeline.h"
+#include "incremental_calib.h"
+#include "parallel_tasks.h"
+#include "pipeline_trace.h"
+
+
+struct liveFrameJob_t{
+  size_t frame_idx;
+  cv::Mat img;
+};
+
+//the capture and detection threads of a live run. Join() stops them and waits for them; the destructor does
+//too, so an exception leaving RunLiveCalibration() never destroys a joinable std::thread.
+struct liveThreads_t{
+  std::atomic<bool> &done;
+  BoundedQueue<liveFrameJob_t> &frame_queue;
+  BoundedQueue<liveFrame_t> &found_queue;
+  std::thread capture_thread;
+  std::vector<std::thread> worker_vec;
+
+  liveThreads_t(std::atomic<bool> &done, BoundedQueue<liveFrameJob_t> &frame_queue,
+                BoundedQueue<liveFrame_t> &found_queue) : done(done), frame_queue(frame_queue), found_queue(found_queue) {}
+  ~liveThreads_t(){ Join(); }
+
+  void Join(){
+    done = true;
+    frame_queue.Close();
+    found_queue.Close();
+    if( capture_thread.joinable() )
+      capture_thread.join();
+    for(auto &worker : worker_vec)
+      if( worker.joinable() )
+        worker.join();
+  }
+};
+
+//an accepted view, the pose is empty until there is an intrinsic estimate
+struct liveView_t{
+  std::vector<cv::Point2f> img_points;
+  cv::Mat R, tvec;
+};
+
+static bool OpenLiveSource(const liveCaptureParams_t &params, cv::VideoCapture &cap){
+  const std::string &source = params.source;
+  const bool is_device = !source.empty() &&
+                         std::all_of( source.begin(), source.end(), [](const char c){ return c >= '0' && c <= '9'; } );
+  const bool opened = is_device ? cap.open(atoi( source.c_str() ), params.api) : cap.open(source, params.api);
+  EXP_CHK_M(opened && cap.isOpened(), return(false), "could not open capture source " + source)
+  if(is_device){
+    if(params.frame_size.area() > 0){
+      cap.set(cv::CAP_PROP_FRAME_WIDTH, params.frame_size.width);
+      cap.set(cv::CAP_PROP_FRAME_HEIGHT, params.frame_size.height);
+    }
+    cap.set(cv::CAP_PROP_BUFFERSIZE, 1); //detect the newest frame, not one the driver queued a while ago
+  }
+  return true;
+}
+
+
+//the four outer target points, in detection order
+static void OuterCorners(const std::vector<cv::Point2f> &img_points, const int width, cv::Point2f corner[4]){
+  const size_t num_point = img_points.size();
+  corner[0] = img_points[0];
+  corner[1] = img_points[width - 1];
+  corner[2] = img_points[num_point - width];
+  corner[3] = img_points[num_point - 1];
+}
+
+
+//largest motion of an outer corner as a fraction of diag. Symmetric targets may be reported in reverse
+//order, so the reversed matching counts too.
+static double CornerMotion(const std::vector<cv::Point2f> &a, const std::vector<cv::Point2f> &b, const int width,
+                           const double diag){
+  cv::Point2f corner_a[4], corner_b[4];
+  OuterCorners(a, width, corner_a);
+  OuterCorners(b, width, corner_b);
+  double motion = 0, motion_rev = 0;
+  for(int k = 0; k < 4; ++k){
+    motion = std::max( motion, cv::norm(corner_a[k] - corner_b[k]) );
+    motion_rev = std::max( motion_rev, cv::norm(corner_a[k] - corner_b[3 - k]) );
+  }
+  return std::min(motion, motion_rev) / diag;
+}
+
+
+//rotation between two target poses in degrees
+static double RotationDeg(const cv::Mat &R_a, const cv::Mat &R_b){
+  const cv::Mat R_ab = R_a.t() * R_b;
+  const double trace = R_ab.at<double>(0, 0) + R_ab.at<double>(1, 1) + R_ab.at<double>(2, 2);
+  return std::acos( std::min( std::max( (trace - 1) / 2, -1.0 ), 1.0 ) ) * 180 / CV_PI;
+}
+
+
+static bool SolveViewPose(const std::vector<cv::Point3f> &obj_points, const stereoCalData_t &cal_data, liveView_t &view){
+  cv::Mat rvec;
+  view.R.release();
+  view.tvec.release();
+  if( !cv::solvePnP(obj_points, view.img_points, cal_data.K[0], cal_data.D[0], rvec, view.tvec) )
+    return false;
+  cv::Rodrigues(rvec, view.R);
+  return true;
+}
+
+
+//first estimate from scratch, later ones warm started from the K/D in cal_data
+static int EstimateIntrinsics(const camCalTarget_t &cal_target, stereoCalData_t &cal_data, const int calib_flags,
+                              calibResult_t &result){
+  if( !cal_data.K[0].empty() )
+    return RecalibrateWarmStart(cal_target, cal_data, 1, calib_flags, result);
+
+  const size_t num_view = cal_data.img_points[0].size();
+  const std::vector< std::vector<cv::Point3f> > obj_points(num_view, CalTargetObjectPoints(cal_target));
+  const int flags = calib_flags & ~(cv::CALIB_USE_INTRINSIC_GUESS | cv::CALIB_FIX_INTRINSIC | cv::CALIB_SAME_FOCAL_LENGTH);
+  cv::Mat per_view_errors;
+  try{
+    std::vector<cv::Mat> rvecs, tvecs;
+    result.rms_error = cv::calibrateCamera(obj_points, cal_data.img_points[0], cal_data.img_size, cal_data.K[0],
+                                           cal_data.D[0], rvecs, tvecs, cv::noArray(), cv::noArray(), per_view_errors,
+                                           flags);
+  }
+  catch(cv::Exception &e){
+    printf( "EstimateIntrinsics() - caught error - %s\n", e.what() );
+    cal_data.K[0].release();
+    cal_data.D[0].release();
+    return(-1);
+  }
+  CombineViewErrors(per_view_errors, result.repro_err_vec);
+  result.num_img_per_cam = static_cast<int>(num_view);
+  return 0;
+}
+
+
+int RunLiveCalibration(const camCalTarget_t &cal_target, const int find_target_flags, const int calib_flags,
+                       const liveCaptureParams_t &params, stereoCalData_t &cal_data, calibResult_t &result,
+                       liveCaptureStats_t *stats, const std::atomic<bool> *stop){
+  EXP_CHK(cal_target.size.width > 0 && cal_target.size.area() > 0, return(-1))
+  cv::VideoCapture cap;
+  if( !OpenLiveSource(params, cap) )
+    return(-1);
+
+  cal_data.img_points[0].clear();
+  cal_data.good_img_file_names[0].clear();
+  bool has_estimate = (calib_flags & cv::CALIB_USE_INTRINSIC_GUESS) && !cal_data.K[0].empty();
+  if(!has_estimate){
+    cal_data.K[0].release();
+    cal_data.D[0].release();
+  }
+  const cv::Size guess_img_size = cal_data.img_size;
+  cal_data.img_size = cv::Size();
+
+  const int num_worker = ResolveNumThreads(params.num_threads);
+  BoundedQueue<liveFrameJob_t> frame_queue( std::max(params.queue_depth, static_cast<size_t>(1)) );
+  BoundedQueue<liveFrame_t> found_queue( 4 * static_cast<size_t>(num_worker) );
+  std::atomic<bool> done(false);
+  std::atomic<size_t> num_frames(0), num_dropped(0);
+  std::atomic<int> num_worker_running(num_worker);
+  const auto start_time = std::chrono::steady_clock::now();
+  liveThreads_t threads(done, frame_queue, found_queue);
+
+  threads.capture_thread = std::thread([&](){
+    for(size_t frame_idx = 0; !done && !(stop && *stop) && !(params.cancel && *params.cancel); ++frame_idx){
+      if(params.max_frames > 0 && frame_idx >= params.max_frames)
+        break;
+      liveFrameJob_t job;
+      job.frame_idx = frame_idx;
+      if( !cap.read(job.img) || job.img.empty() )
+        break;
+      ++num_frames;
+      if(params.realtime){
+        const int num_drop = frame_queue.PushDropOldest( std::move(job) );
+        if(num_drop < 0)
+          break;
+        num_dropped += num_drop;
+      }
+      else if( !frame_queue.Push( std::move(job) ) )
+        break;
+    }
+    frame_queue.Close();
+  });
+
+  for(int w = 0; w < num_worker; ++w)
+    threads.worker_vec.emplace_back([&](){
+      cv::Rect search_hint;
+      liveFrameJob_t job;
+      while( frame_queue.Pop(job) ){
+        liveFrame_t frame;
+        frame.frame_idx = job.frame_idx;
+        frame.img = job.img;
+        ScopedTrace trace("detect", "detection");
+        try{
+          cv::Mat img_gray;
+          if(job.img.channels() == 1)
+            img_gray = job.img;
+          else
+            cv::cvtColor(job.img, img_gray, cv::COLOR_BGR2GRAY);
+          frame.found = FindCalTargetCoarseToFine(img_gray, cal_target, find_target_flags, params.detect_scale,
+                                                  params.use_search_hint ? search_hint : cv::Rect(), frame.img_points);
+        }
+        catch(cv::Exception &e){
+          printf( "RunLiveCalibration() - caught error - %s\n", e.what() );
+          frame.found = false;
+        }
+        frame.found = frame.found && frame.img_points.size() == static_cast<size_t>( cal_target.size.area() );
+        search_hint = frame.found ? TargetSearchRect(frame.img_points, job.img.size(), 0.5) : cv::Rect();
+        if( !found_queue.Push( std::move(frame) ) )
+          break;
+      }
+      if(--num_worker_running == 0)
+        found_queue.Close();
+    });
+
+  //view selection and the background estimates run here
+  const std::vector<cv::Point3f> obj_points = CalTargetObjectPoints(cal_target);
+  std::vector<liveView_t> view_vec;
+  //the same map the coverage reports use, so the selection and the reported coverage agree
+  coverageParams_t coverage_params;
+  coverage_params.grid_cells = params.coverage_grid;
+  CalCoverage coverage(coverage_params);
+  coverage.Reset(cal_target, 1);
+  double diag = 1;
+  size_t num_found = 0, num_estimates = 0;
+  stereoCalData_t job_cal_data;
+  calibResult_t job_result;
+  size_t job_num_view = 0;
+  std::future<int> calib_job; //destroyed first, waits for the estimate writing job_cal_data/job_result
+
+  auto AdoptEstimate = [&](){
+    const int ret = calib_job.get();
+    if(ret != 0)
+      return;
+    cal_data.K[0] = job_cal_data.K[0].clone();
+    cal_data.D[0] = job_cal_data.D[0].clone();
+    result = job_result;
+    has_estimate = true;
+    ++num_estimates;
+    coverage.SetIntrinsics(0, cal_data.K[0], cal_data.D[0]);
+    for(auto &view : view_vec)
+      SolveViewPose(obj_points, cal_data, view);
+  };
+
+  liveFrame_t frame;
+  while( found_queue.Pop(frame) ){
+    if(done)
+      continue; //drain so the workers can finish
+    if( cal_data.img_size.area() == 0 ){
+      cal_data.img_size = frame.img.size();
+      diag = std::sqrt( static_cast<double>(cal_data.img_size.width) * cal_data.img_size.width +
+                        static_cast<double>(cal_data.img_size.height) * cal_data.img_size.height );
+      if(has_estimate && guess_img_size != cal_data.img_size){
+        printf("RunLiveCalibration(): intrinsic guess is for another image size, not used\n");
+        cal_data.K[0].release();
+        cal_data.D[0].release();
+        has_estimate = false;
+      }
+      if(has_estimate)
+        coverage.SetIntrinsics(0, cal_data.K[0], cal_data.D[0]);
+    }
+    if(frame.img.size() != cal_data.img_size)
+      frame.found = false;
+
+    if( calib_job.valid() && calib_job.wait_for( std::chrono::seconds(0) ) == std::future_status::ready )
+      AdoptEstimate();
+
+    if(frame.found){
+      ++num_found;
+      frame.new_cells = coverage.NumNewCells(0, cal_data.img_size, frame.img_points);
+      liveView_t view;
+      view.img_points = frame.img_points;
+      const bool has_pose = has_estimate && SolveViewPose(obj_points, cal_data, view);
+      frame.pose_diff = std::numeric_limits<double>::infinity();
+      for(auto &accepted_view : view_vec){
+        double diff;
+        if(has_pose && !accepted_view.R.empty()){
+          const double rotation_deg = RotationDeg(accepted_view.R, view.R),
+                       translation = cv::norm(accepted_view.tvec - view.tvec) / std::max(cv::norm(accepted_view.tvec), 1e-9);
+          diff = std::max(rotation_deg / params.min_rotation_deg, translation / params.min_translation);
+        }
+        else
+          diff = CornerMotion(accepted_view.img_points, view.img_points, cal_target.size.width, diag) / params.min_corner_motion;
+        frame.pose_diff = std::min(frame.pose_diff, diff);
+      }
+      frame.accepted = frame.pose_diff >= 1 || frame.new_cells >= params.min_new_cells;
+      if(frame.accepted){
+        coverage.AddView(0, cal_data.img_size, frame.img_points);
+        cal_data.img_points[0].push_back(frame.img_points);
+        cal_data.good_img_file_names[0].push_back( "frame_" + std::to_string(frame.frame_idx) );
+        view_vec.push_back(view);
+      }
+    }
+    frame.num_accepted = view_vec.size();
+    frame.rms_error = result.rms_error;
+    if(params.on_frame)
+      params.on_frame(frame);
+
+    //one estimate at a time, on a copy so selection goes on meanwhile
+    const size_t num_view = view_vec.size();
+    if( !calib_job.valid() && num_view >= std::max(params.min_views_calib, static_cast<size_t>(3)) &&
+        (num_estimates == 0 || num_view >= job_num_view + std::max(params.recalib_interval, static_cast<size_t>(1))) ){
+      job_cal_data = CloneCalData(cal_data);
+      job_num_view = num_view;
+      calib_job = std::async(std::launch::async, [&](){
+        return EstimateIntrinsics(cal_target, job_cal_data, calib_flags, job_result);
+      });
+    }
+
+    if(params.max_views > 0 && num_view >= params.max_views){
+      done = true;
+      frame_queue.Close(); //unblocks the capture thread
+    }
+  }
+  threads.Join();
+  if( calib_job.valid() )
+    AdoptEstimate();
+
+  const double coverage_fraction = coverage.Camera(0).CoverageFraction();
+  if(stats){
+    stats->num_frames = num_frames;
+    stats->num_dropped = num_dropped;
+    stats->num_found = num_found;
+    stats->num_accepted = view_vec.size();
+    stats->num_estimates = num_estimates;
+    stats->coverage = coverage_fraction;
+    stats->capture_time_s = std::chrono::duration<double>(std::chrono::steady_clock::now() - start_time).count();
+  }
+  printf( "RunLiveCalibration(): %zu frames, %zu dropped, target in %zu, %zu views accepted, coverage %.0f%%\n",
+          static_cast<size_t>(num_frames), static_cast<size_t>(num_dropped), num_found, view_vec.size(),
+          100 * coverage_fraction );
+  if(params.cancel && *params.cancel)
+    return(1);
+  EXP_CHK_M(view_vec.size() >= 3, return(-1), "fewer than three views accepted")
+
+  //final solve over every accepted view
+  return EstimateIntrinsics(cal_target, cal_data, calib_flags, result);
+}
@@ -0,0 +1,81 @@
+#ifndef __LIVE_CAPTURE__
+#define __LIVE_CAPTURE__
+
+#include <atomic>
+#include <functional>
+#include <string>
+#include <vector>
+#include "opencv2/core.hpp"
+#include "mvg/stereo_compute.h"
+
+struct calibResult_t;
+
+
+//one frame of the live source after detection, handed to liveCaptureParams_t::on_frame
+struct liveFrame_t{
+  size_t frame_idx;                     //position in the source, dropped frames leave gaps
+  bool found, accepted;
+  int new_cells;                        //coverage cells this frame would add
+  double pose_diff;                     //distance to the closest accepted view in units of the thresholds, < 1 is a repeat
+  std::vector<cv::Point2f> img_points;
+  cv::Mat img;                          //the captured frame
+  size_t num_accepted;                  //accepted views after this frame
+  double rms_error;                     //of the latest intrinsic estimate, 0 before the first
+
+  liveFrame_t() : frame_idx(0), found(false), accepted(false), new_cells(0), pose_diff(0), num_accepted(0),
+                  rms_error(0) {}
+};
+
+struct liveCaptureParams_t{
+  std::string source;         //device index ("0"), video file or image sequence pattern ("seq/img_%04d.png")
+  int api;                    //cv::CAP_* backend, ie. cv::CAP_V4L2
+  cv::Size frame_size;        //requested device resolution, empty keeps the device default
+  bool realtime;              //drop the oldest waiting frame when detection falls behind, false detects every frame
+  size_t queue_depth;         //frames waiting for a detection worker
+  size_t max_views;           //stop after accepting this many views, 0 runs until the source ends
+  size_t max_frames;          //stop after this many frames, 0 for no limit
+  double min_rotation_deg;    //a view is new when its target pose differs from every accepted view by this
+  double min_translation;     //or its position by this fraction of the target distance
+  double min_corner_motion;   //before the first estimate, or an outer target corner moved by this fraction of the image diagonal
+  int coverage_grid;          //cells along the longer image side for the coverage map
+  int min_new_cells;          //a view covering this many new cells is accepted whatever its pose
+  size_t min_views_calib;     //accepted views before the first intrinsic estimate
+  size_t recalib_interval;    //accepted views between estimates
+  int num_threads;            //detection workers, <= 0 uses one per core
+  double detect_scale;        //see FindCalTargetCoarseToFine()
+  bool use_search_hint;       //each worker searches around the last target it found first
+  std::function<void(const liveFrame_t &frame)> on_frame; //every detected frame, on the calling thread
+  const std::atomic<bool> *cancel; //ends the capture like stop but skips the final solve, NULL for none
+
+  liveCaptureParams_t() : source("0"), api(0), realtime(true), queue_depth(2), max_views(40), max_frames(0),
+                          min_rotation_deg(10), min_translation(0.15), min_corner_motion(0.1), coverage_grid(16),
+                          min_new_cells(4), min_views_calib(5), recalib_interval(3), num_threads(0), detect_scale(1),
+                          use_search_hint(true), cancel(NULL) {}
+};
+
+struct liveCaptureStats_t{
+  size_t num_frames, num_dropped, num_found, num_accepted, num_estimates;
+  double coverage;            //fraction of the coverage cells hit by an accepted view
+  double capture_time_s;
+
+  liveCaptureStats_t() : num_frames(0), num_dropped(0), num_found(0), num_accepted(0), num_estimates(0), coverage(0),
+                         capture_time_s(0) {}
+};
+
+//Calibrates a single camera from a cv::VideoCapture source. A capture thread reads frames into a short queue,
+//with params.realtime the oldest waiting frame is dropped instead of stalling the device, and detection
+//workers search each frame. The calling thread selects views: a frame is accepted when it covers
+//params.min_new_cells new cells of the coverage map or its target pose differs enough from every accepted
+//view. Until the first estimate exists pose is judged by the motion of the outer target corners, afterwards
+//by solvePnP() with the current intrinsics. The intrinsics are re-estimated on a background thread every
+//params.recalib_interval accepted views, warm started from the previous estimate, so selection never waits
+//for a solve. Accepted views are appended to cal_data (camera 0, file names "frame_<idx>" unless the
+//caller renames them) and a final solve over all of them fills result. With CALIB_USE_INTRINSIC_GUESS the
+//K/D already in cal_data are the first estimate. Capture ends at params.max_views, params.max_frames, the end
+//of the source or when stop is set (ie. by the user ending a sweep); the views accepted so far are used
+//either way. Returns 0 on success, 1 when params.cancel was set, -1 on failure or fewer than 3 accepted views.
+int RunLiveCalibration(const camCalTarget_t &cal_target, const int find_target_flags, const int calib_flags,
+                       const liveCaptureParams_t &params, stereoCalData_t &cal_data, calibResult_t &result,
+                       liveCaptureStats_t *stats = NULL, const std::atomic<bool> *stop = NULL);
+
+#endif //__LIVE_CAPTURE__
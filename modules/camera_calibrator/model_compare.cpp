@@ -0,0 +1,276 @@
+#include "model_compare.h"
+#include "opencv2/calib3d.hpp"
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include "mio/altro/io.h"
+#include "calib_pipeline.h"
+#include "incremental_calib.h"
+#include "parallel_tasks.h"
+#include "pipeline_trace.h"
+
+
+static const int distortion_model_mask = cv::CALIB_RATIONAL_MODEL | cv::CALIB_THIN_PRISM_MODEL |
+                                         cv::CALIB_TILTED_MODEL | cv::CALIB_ZERO_TANGENT_DIST |
+                                         cv::CALIB_FIX_K1 | cv::CALIB_FIX_K2 | cv::CALIB_FIX_K3 |
+                                         cv::CALIB_FIX_K4 | cv::CALIB_FIX_K5 | cv::CALIB_FIX_K6 |
+                                         cv::CALIB_FIX_S1_S2_S3_S4 | cv::CALIB_FIX_TAUX_TAUY;
+
+//guesses are not available for every fold and stereo only flags are not accepted by cv::calibrateCamera()
+static const int non_compare_flags = cv::CALIB_USE_INTRINSIC_GUESS | cv::CALIB_FIX_FOCAL_LENGTH |
+                                     cv::CALIB_FIX_INTRINSIC | cv::CALIB_SAME_FOCAL_LENGTH |
+                                     cv::CALIB_ZERO_DISPARITY | cv::CALIB_USE_EXTRINSIC_GUESS;
+
+
+int DistortionModelFlags(const int calib_flags){
+  return calib_flags & distortion_model_mask;
+}
+
+
+int WithDistortionModel(const int calib_flags, const int model_flags){
+  return (calib_flags & ~distortion_model_mask) | DistortionModelFlags(model_flags);
+}
+
+
+int NumDistortionParams(const int model_flags){
+  int num_params = !(model_flags & cv::CALIB_FIX_K1) + !(model_flags & cv::CALIB_FIX_K2) +
+                   !(model_flags & cv::CALIB_FIX_K3);
+  if( !(model_flags & cv::CALIB_ZERO_TANGENT_DIST) )
+    num_params += 2;
+  if(model_flags & cv::CALIB_RATIONAL_MODEL)
+    num_params += !(model_flags & cv::CALIB_FIX_K4) + !(model_flags & cv::CALIB_FIX_K5) +
+                  !(model_flags & cv::CALIB_FIX_K6);
+  if( (model_flags & cv::CALIB_THIN_PRISM_MODEL) && !(model_flags & cv::CALIB_FIX_S1_S2_S3_S4) )
+    num_params += 4;
+  if( (model_flags & cv::CALIB_TILTED_MODEL) && !(model_flags & cv::CALIB_FIX_TAUX_TAUY) )
+    num_params += 2;
+  return num_params;
+}
+
+
+std::vector<distortionModel_t> DefaultDistortionModels(){
+  std::vector<distortionModel_t> model_vec;
+  model_vec.push_back( distortionModel_t{"k1", cv::CALIB_ZERO_TANGENT_DIST | cv::CALIB_FIX_K2 | cv::CALIB_FIX_K3} );
+  model_vec.push_back( distortionModel_t{"k1k2", cv::CALIB_ZERO_TANGENT_DIST | cv::CALIB_FIX_K3} );
+  model_vec.push_back( distortionModel_t{"k1k2p", cv::CALIB_FIX_K3} );
+  model_vec.push_back( distortionModel_t{"k1k2k3p", 0} );
+  model_vec.push_back( distortionModel_t{"rational", cv::CALIB_RATIONAL_MODEL} );
+  model_vec.push_back( distortionModel_t{"thin_prism", cv::CALIB_RATIONAL_MODEL | cv::CALIB_THIN_PRISM_MODEL} );
+  model_vec.push_back( distortionModel_t{"tilted", cv::CALIB_RATIONAL_MODEL | cv::CALIB_THIN_PRISM_MODEL |
+                                                   cv::CALIB_TILTED_MODEL} );
+  return model_vec;
+}
+
+
+bool DistortionModelFromName(const std::string &name, const int calib_flags, distortionModel_t &model){
+  if(name == "current"){
+    model = distortionModel_t{name, DistortionModelFlags(calib_flags)};
+    return true;
+  }
+  for( auto &default_model : DefaultDistortionModels() )
+    if(default_model.name == name){
+      model = default_model;
+      return true;
+    }
+  return false;
+}
+
+
+bool DistortionModelsFromNames(const std::vector<std::string> &name_vec, const int calib_flags,
+                               std::vector<distortionModel_t> &model_vec){
+  model_vec.clear();
+  for(auto &name : name_vec){
+    if(name == "all"){
+      const std::vector<distortionModel_t> default_vec = DefaultDistortionModels();
+      model_vec.insert( model_vec.end(), default_vec.begin(), default_vec.end() );
+      continue;
+    }
+    distortionModel_t model;
+    EXP_CHK_M(DistortionModelFromName(name, calib_flags, model), return(false), "unknown distortion model " + name)
+    model_vec.push_back(model);
+  }
+  return true;
+}
+
+
+//one cv::calibrateCamera() of the comparison
+struct modelSolve_t{
+  size_t model, camera;
+  int fold;               //views i with i % num_folds == fold are held out, -1 fits every view
+  bool ok;
+  double rms;
+  double held_out_err_2;  //summed squared error of the held out points
+  size_t num_held_out;
+  double time_s;
+  cv::Mat K, D;
+};
+
+
+int CompareDistortionModels(const camCalTarget_t &cal_target, const stereoCalData_t &cal_data, const size_t num_camera,
+                            const int calib_flags, const std::vector<distortionModel_t> &model_vec,
+                            const modelCompareParams_t &params, modelCompareReport_t &report){
+  report = modelCompareReport_t();
+  EXP_CHK(num_camera == 1 || num_camera == 2, return(-1))
+  EXP_CHK_M(!model_vec.empty(), return(-1), "no distortion models to compare")
+  const size_t num_view = cal_data.img_points[0].size();
+  const int num_folds = static_cast<int>( std::min(static_cast<size_t>( std::max(params.num_folds, 2) ), num_view) );
+  EXP_CHK_M(num_view >= 4 && num_view - (num_view + num_folds - 1) / num_folds >= 3, return(-1),
+            "too few views to cross-validate")
+
+  ScopedTrace trace("model comparison", "calibration");
+  const int64 start_tick = cv::getTickCount();
+  report.num_folds = num_folds;
+  const std::vector<cv::Point3f> obj_points = CalTargetObjectPoints(cal_target);
+  const int base_flags = calib_flags & ~(distortion_model_mask | non_compare_flags);
+
+  //models with more coefficients solve slower, starting them first keeps the pool busy until the end
+  std::vector<modelSolve_t> solve_vec;
+  for(size_t m = 0; m < model_vec.size(); ++m)
+    for(size_t j = 0; j < num_camera; ++j)
+      for(int fold = -1; fold < num_folds; ++fold)
+        solve_vec.push_back( modelSolve_t{m, j, fold, false, 0, 0, 0, 0, cv::Mat(), cv::Mat()} );
+  std::stable_sort( solve_vec.begin(), solve_vec.end(), [&model_vec](const modelSolve_t &a, const modelSolve_t &b){
+    return NumDistortionParams(model_vec[a.model].flags) > NumDistortionParams(model_vec[b.model].flags);
+  } );
+
+  ParallelTasks(solve_vec.size(), params.num_threads, [&](const size_t t){
+    if(params.cancel && *params.cancel)
+      return;
+    modelSolve_t &solve = solve_vec[t];
+    const distortionModel_t &model = model_vec[solve.model];
+    ScopedTrace solve_trace( "model solve", "calibration", model.name.c_str() );
+    const int64 solve_tick = cv::getTickCount();
+    const std::vector< std::vector<cv::Point2f> > &img_points = cal_data.img_points[solve.camera];
+    std::vector< std::vector<cv::Point3f> > train_obj_points;
+    std::vector< std::vector<cv::Point2f> > train_img_points;
+    for(size_t i = 0; i < num_view; ++i)
+      if(solve.fold < 0 || static_cast<int>(i % num_folds) != solve.fold){
+        train_obj_points.push_back(obj_points);
+        train_img_points.push_back(img_points[i]);
+      }
+
+    try{
+      std::vector<cv::Mat> rvecs, tvecs;
+      solve.rms = cv::calibrateCamera(train_obj_points, train_img_points, cal_data.img_size, solve.K, solve.D,
+                                      rvecs, tvecs, base_flags | DistortionModelFlags(model.flags));
+      solve.ok = std::isfinite(solve.rms);
+      //held out views only get their pose fit, the intrinsics are the fold's
+      for(size_t i = std::max(solve.fold, 0); solve.ok && solve.fold >= 0 && i < num_view; i += num_folds){
+        cv::Mat rvec, tvec;
+        std::vector<cv::Point2f> proj_points;
+        solve.ok = cv::solvePnP(obj_points, img_points[i], solve.K, solve.D, rvec, tvec);
+        if(!solve.ok)
+          break;
+        cv::projectPoints(obj_points, rvec, tvec, solve.K, solve.D, proj_points);
+        for(size_t k = 0; k < proj_points.size(); ++k){
+          const cv::Point2f diff = img_points[i][k] - proj_points[k];
+          solve.held_out_err_2 += diff.x*diff.x + diff.y*diff.y;
+        }
+        solve.num_held_out += proj_points.size();
+      }
+    }
+    catch(cv::Exception &e){
+      printf( "CompareDistortionModels(): %s, camera %zu, fold %d - caught error - %s\n", model.name.c_str(),
+              solve.camera, solve.fold, e.what() );
+      solve.ok = false;
+    }
+    solve.time_s = static_cast<double>(cv::getTickCount() - solve_tick) / cv::getTickFrequency();
+  });
+  if(params.cancel && *params.cancel)
+    return(1);
+
+  for(size_t m = 0; m < model_vec.size(); ++m){
+    modelScore_t score;
+    score.model = model_vec[m];
+    score.num_params = NumDistortionParams(score.model.flags);
+    score.ok = true;
+    std::vector<double> fold_err_2(num_folds, 0);
+    std::vector<size_t> fold_count(num_folds, 0);
+    double err_2_sum = 0;
+    size_t num_point = 0;
+    for(auto &solve : solve_vec){
+      if(solve.model != m)
+        continue;
+      score.ok = score.ok && solve.ok;
+      score.solve_time_s += solve.time_s;
+      if(solve.fold < 0){
+        score.rms_error += solve.rms / num_camera;
+        score.K[solve.camera] = solve.K;
+        score.D[solve.camera] = solve.D;
+        continue;
+      }
+      fold_err_2[solve.fold] += solve.held_out_err_2;
+      fold_count[solve.fold] += solve.num_held_out;
+      err_2_sum += solve.held_out_err_2;
+      num_point += solve.num_held_out;
+    }
+    score.cv_error = num_point > 0 ? std::sqrt(err_2_sum / num_point) : 0;
+    for(int fold = 0; fold < num_folds; ++fold)
+      score.fold_error.push_back( fold_count[fold] > 0 ? std::sqrt(fold_err_2[fold] / fold_count[fold]) : 0 );
+    report.score_vec.push_back(score);
+  }
+
+  std::stable_sort( report.score_vec.begin(), report.score_vec.end(), [](const modelScore_t &a, const modelScore_t &b){
+    return a.ok != b.ok ? a.ok : a.cv_error < b.cv_error;
+  } );
+  //extra coefficients have to earn their keep: the simplest model close to the lowest error wins
+  if( report.score_vec[0].ok ){
+    report.best = 0;
+    const double max_error = report.score_vec[0].cv_error * (1 + params.tolerance);
+    for(size_t k = 1; k < report.score_vec.size(); ++k){
+      const modelScore_t &score = report.score_vec[k];
+      if(score.ok && score.cv_error <= max_error && score.num_params < report.score_vec[report.best].num_params)
+        report.best = static_cast<int>(k);
+    }
+  }
+  report.wall_time_s = static_cast<double>(cv::getTickCount() - start_tick) / cv::getTickFrequency();
+
+  return 0;
+}
+
+
+void PrintModelComparison(const modelCompareReport_t &report){
+  printf("distortion models by held out error, %d folds, %.2f s:\n", report.num_folds, report.wall_time_s);
+  printf("   %-12s %6s %12s %10s %10s\n", "model", "coeffs", "held out rms", "fit rms", "solve s");
+  for(size_t k = 0; k < report.score_vec.size(); ++k){
+    const modelScore_t &score = report.score_vec[k];
+    if(score.ok)
+      printf(" %c %-12s %6d %12.4f %10.4f %10.2f\n", static_cast<int>(k) == report.best ? '*' : ' ',
+             score.model.name.c_str(), score.num_params, score.cv_error, score.rms_error, score.solve_time_s);
+    else
+      printf("   %-12s %6d %12s\n", score.model.name.c_str(), score.num_params, "failed");
+  }
+}
+
+
+bool WriteModelComparison(const std::string &file_name_full, const modelCompareReport_t &report){
+  cv::FileStorage fs(file_name_full, cv::FileStorage::WRITE);
+  EXP_CHK_M(fs.isOpened(), return(false), "could not write " + file_name_full)
+  fs << "num_folds" << report.num_folds;
+  fs << "wall_time_s" << report.wall_time_s;
+  fs << "best" << (report.best >= 0 ? report.score_vec[report.best].model.name : std::string());
+  fs << "models" << "[";
+  for(auto &score : report.score_vec){
+    fs << "{";
+    fs << "name" << score.model.name;
+    fs << "calib_flags" << "[";
+    for( auto &name : CalibrationFlagNames(score.model.flags) )
+      fs << name;
+    fs << "]";
+    fs << "num_params" << score.num_params;
+    fs << "ok" << static_cast<int>(score.ok);
+    fs << "cv_error" << score.cv_error;
+    fs << "fold_error" << score.fold_error;
+    fs << "rms_error" << score.rms_error;
+    fs << "solve_time_s" << score.solve_time_s;
+    for(int j = 0; j < 2; ++j)
+      if( !score.K[j].empty() ){
+        fs << (j == 0 ? "K1" : "K2") << score.K[j];
+        fs << (j == 0 ? "D1" : "D2") << score.D[j];
+      }
+    fs << "}";
+  }
+  fs << "]";
+
+  return true;
+}
@@ -0,0 +1,78 @@
+#ifndef __MODEL_COMPARE__
+#define __MODEL_COMPARE__
+
+#include <atomic>
+#include <string>
+#include <vector>
+#include "opencv2/core.hpp"
+#include "mvg/stereo_compute.h"
+
+
+//the model bits of calib_flags: rational, thin prism and tilted models, fixed and zeroed coefficients
+int DistortionModelFlags(const int calib_flags);
+//calib_flags with its model bits replaced by those of model_flags
+int WithDistortionModel(const int calib_flags, const int model_flags);
+//free distortion coefficients of a model
+int NumDistortionParams(const int model_flags);
+
+struct distortionModel_t{
+  std::string name;
+  int flags; //model bits only, see DistortionModelFlags()
+};
+
+//the built in models from simplest to most complex: "k1", "k1k2", "k1k2p", "k1k2k3p" (the OpenCV default),
+//"rational", "thin_prism" (rational plus thin prism) and "tilted" (all 14 coefficients)
+std::vector<distortionModel_t> DefaultDistortionModels();
+//a built in model, or "current" for the model bits of calib_flags
+bool DistortionModelFromName(const std::string &name, const int calib_flags, distortionModel_t &model);
+//names as above, "all" for every built in model
+bool DistortionModelsFromNames(const std::vector<std::string> &name_vec, const int calib_flags,
+                               std::vector<distortionModel_t> &model_vec);
+
+struct modelCompareParams_t{
+  int num_folds;    //views are split into this many interleaved folds, each held out once
+  double tolerance; //the model with the fewest coefficients within this fraction of the lowest held out error wins
+  int num_threads;  //solves run in parallel, <= 0 uses one thread per core
+  const std::atomic<bool> *cancel; //checked before each solve, NULL for none
+
+  modelCompareParams_t() : num_folds(5), tolerance(0.02), num_threads(0), cancel(NULL) {}
+};
+
+struct modelScore_t{
+  distortionModel_t model;
+  int num_params;
+  bool ok;                        //every solve of the model succeeded
+  double rms_error;               //fit on every view, mean over the cameras
+  double cv_error;                //rms over the held out points of every fold and camera
+  std::vector<double> fold_error; //held out rms per fold, cameras pooled
+  double solve_time_s;            //summed over the model's solves
+  cv::Mat K[2], D[2];             //fit on every view
+
+  modelScore_t() : num_params(0), ok(false), rms_error(0), cv_error(0), solve_time_s(0) {}
+};
+
+struct modelCompareReport_t{
+  std::vector<modelScore_t> score_vec; //lowest cv_error first, failed models last
+  int best;                            //index of the chosen model in score_vec, -1 when every model failed
+  int num_folds;
+  double wall_time_s;
+
+  modelCompareReport_t() : best(-1), num_folds(0), wall_time_s(0) {}
+};
+
+//Ranks distortion models by k-fold cross-validation on one shared set of detected points. Each model is
+//solved once per camera and fold on the views outside the fold, plus once on every view, and all of these
+//cv::calibrateCamera() solves run as independent tasks on a thread pool, the models with more coefficients
+//first. A held out view is scored by fitting only its pose to the intrinsics solved without it, so the error
+//measures how well a model predicts images it was not fit to, which extra coefficients can not game. Stereo
+//pairs are compared on the intrinsics of each camera. calib_flags supplies the non-model flags (ie.
+//CALIB_FIX_ASPECT_RATIO); intrinsic guesses and stereo only flags are dropped. Returns 0 on success, 1 when
+//cancelled, -1 on failure.
+int CompareDistortionModels(const camCalTarget_t &cal_target, const stereoCalData_t &cal_data, const size_t num_camera,
+                            const int calib_flags, const std::vector<distortionModel_t> &model_vec,
+                            const modelCompareParams_t &params, modelCompareReport_t &report);
+
+void PrintModelComparison(const modelCompareReport_t &report);
+bool WriteModelComparison(const std::string &file_name_full, const modelCompareReport_t &report);
+
+#endif //__MODEL_COMPARE__
@@ -0,0 +1,169 @@
+#include "outlier_rejection.h"
+#include <algorithm>
+#include <cmath>
+#include <numeric>
+#include "mio/altro/io.h"
+#include "parallel_tasks.h"
+#include "pipeline_trace.h"
+
+
+//nearest rank: the smallest value with at least percentile % of the values at or below it
+static double Percentile(std::vector<double> value_vec, const double percentile){
+  if( value_vec.empty() )
+    return 0;
+  const double rank = std::ceil(percentile * value_vec.size() / 100.0) - 1;
+  const size_t n = static_cast<size_t>( std::min( std::max(rank, 0.0), static_cast<double>(value_vec.size() - 1) ) );
+  std::nth_element(value_vec.begin(), value_vec.begin() + n, value_vec.end());
+  return value_vec[n];
+}
+
+
+//median + k * MAD, the MAD scaled to the standard deviation of normally distributed errors
+static double RobustThreshold(const std::vector<double> &value_vec, const double k){
+  const double median = Percentile(value_vec, 50);
+  std::vector<double> dev_vec;
+  for(const double value : value_vec)
+    dev_vec.push_back( std::fabs(value - median) );
+  return median + k * 1.4826 * Percentile(dev_vec, 50);
+}
+
+
+int RejectOutlierViews(const camCalTarget_t &cal_target, stereoCalData_t &cal_data, const size_t num_camera,
+                       const int calib_flags, const outlierRejectParams_t &params, calibResult_t &result,
+                       outlierRejectReport_t &report){
+  report = outlierRejectReport_t();
+  std::vector<size_t> orig_idx_vec( cal_data.img_points[0].size() );
+  std::iota(orig_idx_vec.begin(), orig_idx_vec.end(), 0);
+
+  //errors of the starting point, measured the same way as every later pass
+  calibResult_t cur_result;
+  EXP_CHK(RecalibrateWarmStart(cal_target, cal_data, num_camera, calib_flags, cur_result) == 0,
+          return(-1))
+  report.rms_vec.push_back(cur_result.rms_error);
+
+  int pass = 1;
+  for(; pass <= params.max_passes; ++pass){
+    ScopedTrace trace("outlier pass", "calibration");
+    if(params.cancel && *params.cancel){
+      report.stop_reason = "cancelled";
+      break;
+    }
+    const std::vector<double> &err_vec = cur_result.repro_err_vec;
+    double threshold = RobustThreshold(err_vec, params.mad_k);
+    char robust_criterion[64];
+    snprintf(robust_criterion, sizeof(robust_criterion), "median + %g MAD", params.mad_k);
+    std::string criterion = robust_criterion;
+    if(params.max_view_error > threshold){
+      threshold = params.max_view_error;
+      criterion = "max_view_error";
+    }
+    if(params.drop_percentile > 0 && params.drop_percentile < 100){
+      const double percentile_threshold = Percentile(err_vec, params.drop_percentile);
+      if(percentile_threshold > threshold){
+        threshold = percentile_threshold;
+        criterion = std::to_string( static_cast<int>(params.drop_percentile) ) + "th percentile";
+      }
+    }
+
+    //worst views first, never below min_views
+    std::vector<size_t> cand_vec;
+    for(size_t i = 0; i < err_vec.size(); ++i)
+      if(err_vec[i] > threshold)
+        cand_vec.push_back(i);
+    std::sort( cand_vec.begin(), cand_vec.end(), [&err_vec](const size_t a, const size_t b){ return err_vec[a] > err_vec[b]; } );
+    const size_t num_view = err_vec.size(),
+                 max_drop = num_view > params.min_views ? num_view - params.min_views : 0;
+    cand_vec.resize( std::min( cand_vec.size(), std::min(max_drop, params.max_drop_per_pass) ) );
+    if( cand_vec.empty() ){
+      report.stop_reason = max_drop == 0 && !err_vec.empty() ? "min_views reached" : "no outlier view";
+      break;
+    }
+
+    //one warm started re-solve without each candidate, the candidates run in parallel
+    std::vector<calibResult_t> cand_result_vec( cand_vec.size() );
+    std::vector<char> cand_ok_vec(cand_vec.size(), 0);
+    ParallelTasks(cand_vec.size(), params.num_threads, [&](const size_t c){
+      stereoCalData_t cand_data = CloneCalData(cal_data);
+      RemoveCalView(cand_data, cand_vec[c], num_camera);
+      cand_ok_vec[c] = RecalibrateWarmStart(cal_target, cand_data, num_camera, calib_flags, cand_result_vec[c]) == 0;
+    });
+
+    //every view dropped has to be worth it on its own, any view above the mean lowers the RMS a little
+    std::vector<size_t> drop_vec; //indices into cand_vec
+    const double max_rms = cur_result.rms_error * (1 - params.min_rms_gain);
+    for(size_t c = 0; c < cand_vec.size(); ++c)
+      if(cand_ok_vec[c] && cand_result_vec[c].rms_error < max_rms)
+        drop_vec.push_back(c);
+    if( drop_vec.empty() ){
+      report.stop_reason = "no outlier lowers the RMS error enough";
+      break;
+    }
+
+    //remove from the back so the remaining indices stay valid
+    std::sort( drop_vec.begin(), drop_vec.end(), [&cand_vec](const size_t a, const size_t b){ return cand_vec[a] > cand_vec[b]; } );
+    for(const size_t c : drop_vec){
+      const size_t idx = cand_vec[c];
+      droppedView_t dropped;
+      dropped.view = RemoveCalView(cal_data, idx, num_camera);
+      dropped.view.idx = orig_idx_vec[idx];
+      dropped.pass = pass;
+      dropped.view_error = err_vec[idx];
+      dropped.threshold = threshold;
+      dropped.rms_before = cur_result.rms_error;
+      dropped.rms_without = cand_result_vec[c].rms_error;
+      dropped.reason = "view error " + std::to_string(dropped.view_error) + " px above " + criterion + " " +
+                       std::to_string(threshold) + " px, RMS without it " + std::to_string(dropped.rms_without);
+      report.dropped_vec.push_back(dropped);
+      orig_idx_vec.erase(orig_idx_vec.begin() + idx);
+    }
+
+    EXP_CHK(RecalibrateWarmStart(cal_target, cal_data, num_camera, calib_flags, cur_result) == 0,
+            return(-1))
+    report.rms_vec.push_back(cur_result.rms_error);
+    TraceCounter("rms", cur_result.rms_error);
+  }
+  if(pass > params.max_passes)
+    report.stop_reason = "max_passes reached";
+
+  result = cur_result;
+  return 0;
+}
+
+
+void PrintOutlierReport(const outlierRejectReport_t &report, const size_t num_camera){
+  printf("outlier rejection: %zu views dropped in %zu passes, RMS %f -> %f (%s)\n", report.dropped_vec.size(),
+         report.rms_vec.size() - 1, report.rms_vec.front(), report.rms_vec.back(), report.stop_reason.c_str());
+  for(auto &dropped : report.dropped_vec){
+    std::string names;
+    for(size_t j = 0; j < num_camera && j < dropped.view.file_names.size(); ++j)
+      names += (j > 0 ? ", " : "") + dropped.view.file_names[j];
+    printf( "  pass %d, view %zu (%s): %s\n", dropped.pass, dropped.view.idx, names.c_str(), dropped.reason.c_str() );
+  }
+}
+
+
+bool WriteOutlierReport(const std::string &file_name_full, const outlierRejectReport_t &report, const size_t num_camera){
+  cv::FileStorage fs(file_name_full, cv::FileStorage::WRITE);
+  EXP_CHK_M(fs.isOpened(), return(false), "could not write " + file_name_full)
+  fs << "stop_reason" << report.stop_reason;
+  fs << "rms_per_pass" << report.rms_vec;
+  fs << "dropped" << "[";
+  for(auto &dropped : report.dropped_vec){
+    fs << "{";
+    fs << "pass" << dropped.pass;
+    fs << "index" << static_cast<int>(dropped.view.idx);
+    fs << "files" << "[";
+    for(size_t j = 0; j < num_camera && j < dropped.view.file_names.size(); ++j)
+      fs << dropped.view.file_names[j];
+    fs << "]";
+    fs << "view_error" << dropped.view_error;
+    fs << "threshold" << dropped.threshold;
+    fs << "rms_before" << dropped.rms_before;
+    fs << "rms_without" << dropped.rms_without;
+    fs << "reason" << dropped.reason;
+    fs << "}";
+  }
+  fs << "]";
+
+  return true;
+}
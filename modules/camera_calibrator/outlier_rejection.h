@@ -0,0 +1,57 @@
+#ifndef __OUTLIER_REJECTION__
+#define __OUTLIER_REJECTION__
+
+#include <atomic>
+#include <string>
+#include <vector>
+#include "opencv2/core.hpp"
+#include "mvg/stereo_compute.h"
+#include "calib_pipeline.h"
+#include "incremental_calib.h"
+
+
+//A view is an outlier when its RMS reprojection error is above the median plus mad_k scaled median absolute
+//deviations of the current per-view errors. max_view_error and drop_percentile only raise that threshold,
+//views at or below either are kept (each disabled with <= 0). Each pass re-solves without every outlier
+//(warm started, in parallel) and drops those whose removal alone lowers the overall RMS by at least
+//min_rms_gain of it. Rejection stops when no view is an outlier or no outlier's removal gains enough.
+struct outlierRejectParams_t{
+  double mad_k;               //robust threshold, median + mad_k * 1.4826 * MAD
+  double max_view_error;      //pixels
+  double drop_percentile;     //0..100
+  size_t max_drop_per_pass;   //worst outliers considered per pass
+  int max_passes;
+  double min_rms_gain;        //fraction of the RMS a drop has to remove
+  size_t min_views;           //never drop below this many views
+  int num_threads;            //candidate re-solves run in parallel, <= 0 uses one thread per core
+  const std::atomic<bool> *cancel; //checked before each pass, NULL for none
+
+  outlierRejectParams_t() : mad_k(3), max_view_error(1.0), drop_percentile(0), max_drop_per_pass(4), max_passes(10),
+                            min_rms_gain(0.01), min_views(10), num_threads(0), cancel(NULL) {}
+};
+
+struct droppedView_t{
+  calView_t view;       //view.idx is the index in the view list before rejection started
+  int pass;
+  double view_error;    //RMS of the view when it was dropped
+  double threshold;     //error threshold of that pass
+  double rms_before, rms_without; //overall RMS with and without the view, from its candidate re-solve
+  std::string reason;
+};
+
+struct outlierRejectReport_t{
+  std::vector<droppedView_t> dropped_vec;
+  std::vector<double> rms_vec; //RMS after each pass, [0] before rejection
+  std::string stop_reason;
+};
+
+//Drops outlier views from cal_data in place, which must already hold a calibration of its views. result
+//gets the final errors. Returns 0 on success.
+int RejectOutlierViews(const camCalTarget_t &cal_target, stereoCalData_t &cal_data, const size_t num_camera,
+                       const int calib_flags, const outlierRejectParams_t &params, calibResult_t &result,
+                       outlierRejectReport_t &report);
+
+void PrintOutlierReport(const outlierRejectReport_t &report, const size_t num_camera);
+bool WriteOutlierReport(const std::string &file_name_full, const outlierRejectReport_t &report, const size_t num_camera);
+
+#endif //__OUTLIER_REJECTION__
@@ -0,0 +1,60 @@
+#ifndef __PARALLEL_TASKS__
+#define __PARALLEL_TASKS__
+
+#include <algorithm>
+#include <atomic>
+#include <exception>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+
+//num_threads <= 0 selects one thread per core
+inline int ResolveNumThreads(const int num_threads){
+  if(num_threads > 0)
+    return num_threads;
+  const unsigned int num_core = std::thread::hardware_concurrency();
+  return num_core > 0 ? static_cast<int>(num_core) : 1;
+}
+
+
+//Runs task(0) ... task(num_tasks - 1) on a pool of worker threads and blocks until all have finished.
+//Workers pull the next task index from a shared counter so uneven task durations stay balanced. The
+//first exception thrown by a task is rethrown on the calling thread once every worker has stopped.
+inline void ParallelTasks(const size_t num_tasks, const int num_threads, const std::function<void(const size_t)> &task){
+  const size_t num_worker = std::min( static_cast<size_t>( ResolveNumThreads(num_threads) ), num_tasks );
+  if(num_worker <= 1){
+    for(size_t i = 0; i < num_tasks; ++i)
+      task(i);
+    return;
+  }
+
+  std::atomic<size_t> next_task(0);
+  std::exception_ptr task_exception;
+  std::mutex exception_mutex;
+  auto worker = [&](){
+    for(size_t i = next_task++; i < num_tasks; i = next_task++){
+      try{
+        task(i);
+      }
+      catch(...){
+        std::lock_guard<std::mutex> lock(exception_mutex);
+        if(!task_exception)
+          task_exception = std::current_exception();
+        next_task = num_tasks; //stop handing out work
+      }
+    }
+  };
+  std::vector<std::thread> thread_vec;
+  thread_vec.reserve(num_worker - 1);
+  for(size_t i = 1; i < num_worker; ++i)
+    thread_vec.emplace_back(worker);
+  worker(); //the calling thread is a worker too
+  for(auto &thread : thread_vec)
+    thread.join();
+  if(task_exception)
+    std::rethrow_exception(task_exception);
+}
+
+#endif //__PARALLEL_TASKS__
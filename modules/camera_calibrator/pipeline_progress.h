@@ -0,0 +1,49 @@
+#ifndef __PIPELINE_PROGRESS__
+#define __PIPELINE_PROGRESS__
+
+#include <atomic>
+#include <functional>
+#include <string>
+#include <vector>
+#include "opencv2/core.hpp"
+#include "cal_target_detect.h"
+
+
+//one finished image set of the detection stage
+struct imageSetProgress_t{
+  size_t set_idx;                     //position in the image list
+  size_t num_done, num_total, num_found;
+  std::vector<std::string> file_names; //indexed by camera
+  const calTargetDetection_t *det;
+  cv::Mat view_img;                   //ConcatCalImages() view when it was made, may be empty even if found
+};
+
+//Progress reporting and cancellation for a pipeline job running off the caller's thread. on_image_set is
+//called from the detection workers, concurrently, so both callbacks must be thread safe. Setting cancel
+//stops the job at the next image set or stage boundary; a stage that is already running (ie. the
+//calibration solve) finishes first.
+struct pipelineProgress_t{
+  std::function<void(const std::string &stage)> on_stage;
+  std::function<void(const imageSetProgress_t &set_progress)> on_image_set;
+  std::atomic<bool> cancel;
+
+  pipelineProgress_t() : cancel(false) {}
+  bool Cancelled() const { return cancel; }
+};
+
+inline bool ProgressCancelled(const pipelineProgress_t *progress){
+  return progress && progress->Cancelled();
+}
+
+//announces the next stage, false when the job was cancelled and the stage must not run
+inline bool ProgressStage(pipelineProgress_t *progress, const std::string &stage){
+  if( !progress )
+    return true;
+  if( progress->Cancelled() )
+    return false;
+  if(progress->on_stage)
+    progress->on_stage(stage);
+  return true;
+}
+
+#endif //__PIPELINE_PROGRESS__
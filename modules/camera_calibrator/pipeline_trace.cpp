@@ -0,0 +1,214 @@
+#include "pipeline_trace.h"
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <sstream>
+#include "mio/altro/io.h"
+
+
+static std::atomic<PipelineTrace*> g_active_trace(NULL);
+
+
+//small ids in the order threads first record something, Chrome trace only needs them to be distinct
+static int TraceThreadId(){
+  static std::atomic<int> next_tid(0);
+  thread_local int tid = -1;
+  if(tid < 0)
+    tid = next_tid++;
+  return tid;
+}
+
+
+static std::string JsonString(const std::string &str){
+  std::string out = "\"";
+  for(const char c : str){
+    switch(c){
+      case '"':  out += "\\\""; break;
+      case '\\': out += "\\\\"; break;
+      case '\n': out += "\\n"; break;
+      case '\t': out += "\\t"; break;
+      default:
+        if(static_cast<unsigned char>(c) < 0x20){
+          char buf[8];
+          snprintf(buf, sizeof(buf), "\\u%04x", c);
+          out += buf;
+        }
+        else
+          out += c;
+    }
+  }
+  return out + "\"";
+}
+
+
+static std::string JsonNumber(const double value){
+  char buf[32];
+  snprintf(buf, sizeof(buf), "%.3f", value);
+  return buf;
+}
+
+
+PipelineTrace::PipelineTrace(const size_t max_events) : m_start_tick( cv::getTickCount() ), m_max_events(max_events) {}
+
+
+void PipelineTrace::Reset(){
+  std::lock_guard<std::mutex> lock(m_mutex);
+  m_start_tick = cv::getTickCount();
+  m_events.clear();
+  m_counters.clear();
+  m_stats.clear();
+  m_info.clear();
+}
+
+
+double PipelineTrace::NowUs() const {
+  return 1e6 * static_cast<double>(cv::getTickCount() - m_start_tick) / cv::getTickFrequency();
+}
+
+
+void PipelineTrace::AddEvent(const char *name, const char *cat, const double start_us, const double dur_us,
+                             const char *detail){
+  const int tid = TraceThreadId();
+  std::lock_guard<std::mutex> lock(m_mutex);
+  auto it = std::find_if( m_stats.begin(), m_stats.end(),
+                          [name](const scopeStats_t &stats){ return strcmp(stats.name, name) == 0; } );
+  if( it == m_stats.end() ){
+    m_stats.push_back( scopeStats_t{name, 0, 0, 0} );
+    it = m_stats.end() - 1;
+  }
+  ++it->count;
+  it->total_us += dur_us;
+  it->max_us = std::max(it->max_us, dur_us);
+  if(m_events.size() < m_max_events)
+    m_events.push_back( traceEvent_t{name, cat, detail ? detail : "", tid, start_us, dur_us} );
+}
+
+
+void PipelineTrace::AddCounter(const char *name, const double value){
+  const int tid = TraceThreadId();
+  const double ts_us = NowUs();
+  std::lock_guard<std::mutex> lock(m_mutex);
+  if(m_counters.size() < m_max_events)
+    m_counters.push_back( traceCounter_t{name, tid, ts_us, value} );
+}
+
+
+void PipelineTrace::SetInfo(const std::string &key, const std::string &value){
+  std::lock_guard<std::mutex> lock(m_mutex);
+  m_info.push_back( std::make_pair( key, JsonString(value) ) );
+}
+
+
+void PipelineTrace::SetInfo(const std::string &key, const double value){
+  std::lock_guard<std::mutex> lock(m_mutex);
+  m_info.push_back( std::make_pair( key, JsonNumber(value) ) );
+}
+
+
+std::string PipelineTrace::Summary(){
+  std::lock_guard<std::mutex> lock(m_mutex);
+  std::ostringstream oss;
+  char buf[256];
+  for(auto &stats : m_stats){
+    snprintf(buf, sizeof(buf), "%-24s %8zu x %10.2f ms total %10.3f ms mean %10.3f ms max\n", stats.name, stats.count,
+             stats.total_us / 1000, stats.total_us / 1000 / std::max(stats.count, size_t(1)), stats.max_us / 1000);
+    oss << buf;
+  }
+  return oss.str();
+}
+
+
+void PipelineTrace::Print(){
+  printf( "%s", Summary().c_str() );
+}
+
+
+bool PipelineTrace::WriteChromeTrace(const std::string &file_name_full){
+  std::ofstream file(file_name_full.c_str(), std::ios::out | std::ios::trunc);
+  EXP_CHK_M(file.is_open(), return(false), "could not write " + file_name_full)
+
+  std::lock_guard<std::mutex> lock(m_mutex);
+  file << "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n";
+  bool first = true;
+  for(auto &event : m_events){
+    file << (first ? "" : ",\n") << "{\"name\":" << JsonString(event.name) << ",\"cat\":" << JsonString(event.cat)
+         << ",\"ph\":\"X\",\"pid\":1,\"tid\":" << event.tid << ",\"ts\":" << JsonNumber(event.start_us)
+         << ",\"dur\":" << JsonNumber(event.dur_us);
+    if( !event.detail.empty() )
+      file << ",\"args\":{\"detail\":" << JsonString(event.detail) << "}";
+    file << "}";
+    first = false;
+  }
+  for(auto &counter : m_counters){
+    file << (first ? "" : ",\n") << "{\"name\":" << JsonString(counter.name) << ",\"ph\":\"C\",\"pid\":1,\"tid\":"
+         << counter.tid << ",\"ts\":" << JsonNumber(counter.ts_us) << ",\"args\":{\"value\":"
+         << JsonNumber(counter.value) << "}}";
+    first = false;
+  }
+  file << "\n],\n\"otherData\":{";
+  for(auto &info : m_info)
+    file << JsonString(info.first) << ":" << info.second << ",";
+  file << "\"scopes\":{";
+  for(size_t k = 0; k < m_stats.size(); ++k){
+    const scopeStats_t &stats = m_stats[k];
+    file << (k > 0 ? "," : "") << JsonString(stats.name) << ":{\"count\":" << stats.count << ",\"total_ms\":"
+         << JsonNumber(stats.total_us / 1000) << ",\"max_ms\":" << JsonNumber(stats.max_us / 1000) << "}";
+  }
+  file << "}}}\n";
+  EXP_CHK_M(file.good(), return(false), "could not write " + file_name_full)
+
+  return true;
+}
+
+
+void SetActiveTrace(PipelineTrace *trace){
+  g_active_trace = trace;
+}
+
+
+PipelineTrace *ActiveTrace(){
+  return g_active_trace;
+}
+
+
+void TraceCounter(const char *name, const double value){
+  PipelineTrace *trace = g_active_trace;
+  if(trace)
+    trace->AddCounter(name, value);
+}
+
+
+ScopedTrace::ScopedTrace(const char *name, const char *cat, const char *detail) :
+    m_trace(g_active_trace), m_name(name), m_cat(cat), m_start_us(0){
+  if(!m_trace)
+    return;
+  if(detail)
+    m_detail = detail;
+  m_start_us = m_trace->NowUs();
+}
+
+
+ScopedTrace::~ScopedTrace(){
+  if(m_trace)
+    m_trace->AddEvent( m_name, m_cat, m_start_us, m_trace->NowUs() - m_start_us,
+                       m_detail.empty() ? NULL : m_detail.c_str() );
+}
+
+
+TraceSession::TraceSession(const std::string &file_name_full) : m_file_name_full(file_name_full), m_active(false){
+  if( file_name_full.empty() )
+    return;
+  PipelineTrace *expected = NULL;
+  m_active = g_active_trace.compare_exchange_strong(expected, &m_trace);
+}
+
+
+TraceSession::~TraceSession(){
+  if(!m_active)
+    return;
+  g_active_trace = NULL;
+  m_trace.Print();
+  if( m_trace.WriteChromeTrace(m_file_name_full) )
+    printf( "TraceSession: wrote %s\n", m_file_name_full.c_str() );
+}
@@ -0,0 +1,96 @@
+#ifndef __PIPELINE_TRACE__
+#define __PIPELINE_TRACE__
+
+#include <atomic>
+#include <mutex>
+#include <string>
+#include <utility>
+#include <vector>
+#include "opencv2/core.hpp"
+
+
+//one timed scope, times in microseconds since the trace was reset
+struct traceEvent_t{
+  const char *name, *cat; //string literals
+  std::string detail;     //ie. the image file name, may be empty
+  int tid;
+  double start_us, dur_us;
+};
+
+struct traceCounter_t{
+  const char *name;
+  int tid;
+  double ts_us, value;
+};
+
+//Timings and counters of one pipeline run. Scopes are recorded by ScopedTrace from any thread and written as
+//a Chrome trace (chrome://tracing, Perfetto), with the run information and a per scope summary in
+//"otherData" for scripts that only want the totals. Thread safe; at most max_events scopes are kept, later
+//ones only count towards the summary.
+class PipelineTrace{
+  public:
+    explicit PipelineTrace(const size_t max_events = size_t(1) << 20);
+    void Reset();
+    double NowUs() const;
+    void AddEvent(const char *name, const char *cat, const double start_us, const double dur_us,
+                  const char *detail = NULL);
+    void AddCounter(const char *name, const double value);
+    //run level key/value pairs, ie. the calibration directory and the resulting rms
+    void SetInfo(const std::string &key, const std::string &value);
+    void SetInfo(const std::string &key, const double value);
+
+    //count, total, mean and max ms per scope name, one line each
+    std::string Summary();
+    void Print();
+    bool WriteChromeTrace(const std::string &file_name_full);
+
+  private:
+    struct scopeStats_t{
+      const char *name;
+      size_t count;
+      double total_us, max_us;
+    };
+
+    std::mutex m_mutex;
+    int64 m_start_tick;
+    size_t m_max_events;
+    std::vector<traceEvent_t> m_events;
+    std::vector<traceCounter_t> m_counters;
+    std::vector<scopeStats_t> m_stats;                           //few names, a linear search is enough
+    std::vector< std::pair<std::string, std::string> > m_info;   //values are JSON text
+};
+
+//the trace ScopedTrace and TraceCounter() report to, NULL (the default) turns them into one atomic load
+void SetActiveTrace(PipelineTrace *trace);
+PipelineTrace *ActiveTrace();
+void TraceCounter(const char *name, const double value);
+
+//records the time from construction to destruction in the active trace, name and cat must be literals
+class ScopedTrace{
+  public:
+    explicit ScopedTrace(const char *name, const char *cat = "pipeline", const char *detail = NULL);
+    ~ScopedTrace();
+
+  private:
+    PipelineTrace *m_trace;
+    const char *m_name, *m_cat;
+    std::string m_detail;
+    double m_start_us;
+};
+
+//Makes its trace the active one for the lifetime of a pipeline run and writes it to file_name_full when it
+//ends. Does nothing for an empty file name or when another run is already being traced (nested pipelines).
+class TraceSession{
+  public:
+    explicit TraceSession(const std::string &file_name_full);
+    ~TraceSession();
+    //NULL when this session is not tracing
+    PipelineTrace *Trace() { return m_active ? &m_trace : NULL; }
+
+  private:
+    PipelineTrace m_trace;
+    std::string m_file_name_full;
+    bool m_active;
+};
+
+#endif //__PIPELINE_TRACE__
@@ -0,0 +1,107 @@
+#include "raw_image.h"
+#include "opencv2/imgproc.hpp"
+#include "opencv2/imgcodecs.hpp"
+#include <algorithm>
+#include <cctype>
+
+
+int rawImageParams_t::ImreadFlags() const {
+  return Raw() ? cv::IMREAD_UNCHANGED : cv::IMREAD_ANYCOLOR;
+}
+
+
+bool BayerPatternFromName(const std::string &name, int &bayer_pattern){
+  std::string lower = name;
+  std::transform( lower.begin(), lower.end(), lower.begin(), [](const unsigned char c){ return std::tolower(c); } );
+  if(lower == "none" || lower.empty())
+    bayer_pattern = BAYER_NONE;
+  else if(lower == "bg")
+    bayer_pattern = BAYER_BG;
+  else if(lower == "gb")
+    bayer_pattern = BAYER_GB;
+  else if(lower == "rg")
+    bayer_pattern = BAYER_RG;
+  else if(lower == "gr")
+    bayer_pattern = BAYER_GR;
+  else
+    return false;
+  return true;
+}
+
+
+std::string BayerPatternName(const int bayer_pattern){
+  switch(bayer_pattern){
+    case BAYER_BG: return "bg";
+    case BAYER_GB: return "gb";
+    case BAYER_RG: return "rg";
+    case BAYER_GR: return "gr";
+    default:       return "none";
+  }
+}
+
+
+static int BayerCode(const int bayer_pattern, const bool to_gray){
+  switch(bayer_pattern){
+    case BAYER_BG: return to_gray ? cv::COLOR_BayerBG2GRAY : cv::COLOR_BayerBG2BGR;
+    case BAYER_GB: return to_gray ? cv::COLOR_BayerGB2GRAY : cv::COLOR_BayerGB2BGR;
+    case BAYER_RG: return to_gray ? cv::COLOR_BayerRG2GRAY : cv::COLOR_BayerRG2BGR;
+    case BAYER_GR: return to_gray ? cv::COLOR_BayerGR2GRAY : cv::COLOR_BayerGR2BGR;
+    default:       return -1;
+  }
+}
+
+
+//maps the significant bits of img onto 0..255
+static double ScaleTo8Bit(const cv::Mat &img, const rawImageParams_t &raw){
+  if(img.depth() != CV_16U)
+    return 1;
+  const int bits = raw.bit_depth > 8 && raw.bit_depth <= 16 ? raw.bit_depth : 16;
+  return 255.0 / ( (1 << bits) - 1 );
+}
+
+
+//one gray pass at the stored depth
+static cv::Mat GrayCalImage(const cv::Mat &img, const rawImageParams_t &raw){
+  if(img.channels() == 1 && raw.bayer_pattern == BAYER_NONE)
+    return img;
+  cv::Mat img_gray;
+  if(img.channels() == 1)
+    cv::cvtColor( img, img_gray, BayerCode(raw.bayer_pattern, true) );
+  else if(img.channels() == 4)
+    cv::cvtColor(img, img_gray, cv::COLOR_BGRA2GRAY);
+  else
+    cv::cvtColor(img, img_gray, cv::COLOR_BGR2GRAY);
+  return img_gray;
+}
+
+
+void PrepareCalImage(const cv::Mat &img, const rawImageParams_t &raw, cv::Mat &img_detect, cv::Mat &img_refine){
+  const cv::Mat img_gray = GrayCalImage(img, raw);
+  if(img_gray.depth() == CV_8U){
+    img_detect = img_gray;
+    img_refine = img_gray;
+    return;
+  }
+  const double scale = ScaleTo8Bit(img_gray, raw);
+  img_gray.convertTo(img_detect, CV_8U, scale);
+  img_gray.convertTo(img_refine, CV_32F, scale);
+}
+
+
+cv::Mat DevelopCalImage(const cv::Mat &img, const rawImageParams_t &raw){
+  if(img.channels() != 1 || raw.bayer_pattern == BAYER_NONE)
+    return img;
+  cv::Mat img_bgr;
+  cv::cvtColor( img, img_bgr, BayerCode(raw.bayer_pattern, false) );
+  return img_bgr;
+}
+
+
+cv::Mat DisplayCalImage(const cv::Mat &img, const rawImageParams_t &raw){
+  if( img.empty() )
+    return img;
+  cv::Mat img_disp = DevelopCalImage(img, raw);
+  if(img_disp.depth() != CV_8U)
+    img_disp.convertTo( img_disp, CV_8U, ScaleTo8Bit(img_disp, raw) );
+  return img_disp;
+}
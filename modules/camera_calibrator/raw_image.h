@@ -0,0 +1,45 @@
+#ifndef __RAW_IMAGE__
+#define __RAW_IMAGE__
+
+#include <string>
+#include "opencv2/core.hpp"
+
+
+enum{
+  BAYER_NONE = 0,
+  BAYER_BG,
+  BAYER_GB,
+  BAYER_RG,
+  BAYER_GR
+};
+
+//How calibration images are stored. The defaults decode every image to 8 bits as before. bit_depth > 8 keeps
+//16 bit images at full depth, with the significant bits given (ie. 12 for 12 bit data in 16 bit words), and a
+//Bayer pattern marks single channel images as undemosaiced sensor data.
+struct rawImageParams_t{
+  int bit_depth;      //8..16
+  int bayer_pattern;  //BAYER_*
+
+  rawImageParams_t() : bit_depth(8), bayer_pattern(BAYER_NONE) {}
+  bool Raw() const { return bit_depth > 8 || bayer_pattern != BAYER_NONE; }
+  //cv::imread() flags that keep the stored depth and channels when Raw()
+  int ImreadFlags() const;
+};
+
+//"bg", "gb", "rg", "gr" or "none", case insensitive
+bool BayerPatternFromName(const std::string &name, int &bayer_pattern);
+std::string BayerPatternName(const int bayer_pattern);
+
+//Single channel images for the target finder and the corner refinement, made from one demosaic/gray pass at
+//the stored depth. img_detect is 8 bit. img_refine keeps the full precision as CV_32F on the same 0..255 scale
+//for 16 bit data and is img_detect itself for 8 bit data. Both conversions are plain OpenCV cvtColor()/convertTo()
+//calls, which are vectorized.
+void PrepareCalImage(const cv::Mat &img, const rawImageParams_t &raw, cv::Mat &img_detect, cv::Mat &img_refine);
+
+//demosaiced BGR for Bayer data at the stored depth, img itself otherwise, ie. before remapping
+cv::Mat DevelopCalImage(const cv::Mat &img, const rawImageParams_t &raw);
+
+//8 bit image for display, demosaiced and scaled by the bit depth, img itself when it already is one
+cv::Mat DisplayCalImage(const cv::Mat &img, const rawImageParams_t &raw);
+
+#endif //__RAW_IMAGE__
@@ -0,0 +1,214 @@
+#include "rect_maps.h"
+#include "opencv2/imgproc.hpp"
+#include "opencv2/imgcodecs.hpp"
+#include "opencv2/calib3d.hpp"
+#include <atomic>
+#include <cstring>
+#include <fstream>
+#include "mio/altro/io.h"
+#include "cal_target_detect.h"
+#include "detection_cache.h"
+#include "parallel_tasks.h"
+#include "pipeline_trace.h"
+
+
+static const char rect_maps_magic[4] = {'C', 'C', 'R', 'M'};
+static const uint32_t rect_maps_version = 1;
+static const size_t rect_maps_header_size = 64;
+
+
+static uint64_t HashMat(const cv::Mat &mat, const uint64_t hash){
+  cv::Mat mat_64f;
+  if( !mat.empty() )
+    mat.convertTo(mat_64f, CV_64F); //same parameters hash the same regardless of how they were loaded
+  const int32_t dims[2] = {mat_64f.rows, mat_64f.cols};
+  const uint64_t dims_hash = Fnv1a64(dims, sizeof(dims), hash);
+  return mat_64f.empty() ? dims_hash : Fnv1a64(mat_64f.data, mat_64f.total() * mat_64f.elemSize(), dims_hash);
+}
+
+
+uint64_t RectParamsHash(const stereoCalData_t &cal_data){
+  const int32_t img_size[2] = {cal_data.img_size.width, cal_data.img_size.height};
+  uint64_t hash = Fnv1a64( img_size, sizeof(img_size) );
+  for(size_t j = 0; j < 2; ++j){
+    hash = HashMat(cal_data.K[j], hash);
+    hash = HashMat(cal_data.D[j], hash);
+    hash = HashMat(cal_data.R_rect[j], hash);
+    hash = HashMat(cal_data.P_rect[j], hash);
+  }
+  return hash;
+}
+
+
+void ComputeRectMaps(const stereoCalData_t &cal_data, rectMaps_t &rect_maps){
+  rect_maps.img_size = cal_data.img_size;
+  rect_maps.params_hash = RectParamsHash(cal_data);
+  rect_maps.map_xy.assign( 2, cv::Mat() );
+  rect_maps.map_interp.assign( 2, cv::Mat() );
+  ParallelTasks(2, 2, [&](const size_t j){
+    cv::initUndistortRectifyMap(cal_data.K[j], cal_data.D[j], cal_data.R_rect[j], cal_data.P_rect[j], cal_data.img_size,
+                                CV_16SC2, rect_maps.map_xy[j], rect_maps.map_interp[j]);
+  });
+}
+
+
+std::string RectMapsFileName(const std::string &extrinsic_file_name){
+  const size_t dot_pos = extrinsic_file_name.rfind('.'),
+               slash_pos = extrinsic_file_name.rfind('/');
+  const bool has_ext = dot_pos != std::string::npos && (slash_pos == std::string::npos || dot_pos > slash_pos);
+  return (has_ext ? extrinsic_file_name.substr(0, dot_pos) : extrinsic_file_name) + "_rect_maps.bin";
+}
+
+
+template <typename T>
+static void WritePod(std::ofstream &ofs, const T &value){
+  ofs.write(reinterpret_cast<const char*>(&value), sizeof(T));
+}
+
+template <typename T>
+static bool ReadPod(std::ifstream &ifs, T &value){
+  return static_cast<bool>( ifs.read(reinterpret_cast<char*>(&value), sizeof(T)) );
+}
+
+
+static void WriteMat(std::ofstream &ofs, const cv::Mat &mat){
+  for(int r = 0; r < mat.rows; ++r) //row by row, the maps may be ROIs
+    ofs.write( reinterpret_cast<const char*>( mat.ptr(r) ), mat.cols * mat.elemSize() );
+}
+
+
+bool SaveRectMaps(const std::string &file_name_full, const rectMaps_t &rect_maps){
+  const size_t num_camera = rect_maps.map_xy.size();
+  EXP_CHK(num_camera > 0 && rect_maps.map_interp.size() == num_camera, return(false))
+  for(size_t j = 0; j < num_camera; ++j)
+    EXP_CHK_M(rect_maps.map_xy[j].type() == CV_16SC2 && rect_maps.map_interp[j].type() == CV_16UC1 &&
+              rect_maps.map_xy[j].size() == rect_maps.img_size && rect_maps.map_interp[j].size() == rect_maps.img_size,
+              return(false), "maps must be CV_16SC2 + CV_16UC1 of img_size")
+
+  //written to a temporary file and renamed so a runtime mapping the file never sees a partial one
+  const std::string tmp_file_name_full = file_name_full + ".tmp";
+  {
+    std::ofstream ofs(tmp_file_name_full, std::ios::binary | std::ios::trunc);
+    EXP_CHK_M(ofs.is_open(), return(false), "could not write " + tmp_file_name_full)
+    ofs.write(rect_maps_magic, 4);
+    WritePod(ofs, rect_maps_version);
+    WritePod( ofs, static_cast<uint32_t>(num_camera) );
+    WritePod( ofs, static_cast<int32_t>(rect_maps.img_size.width) );
+    WritePod( ofs, static_cast<int32_t>(rect_maps.img_size.height) );
+    WritePod( ofs, static_cast<uint32_t>(0) );
+    WritePod(ofs, rect_maps.params_hash);
+    const char padding[rect_maps_header_size] = {0};
+    ofs.write( padding, rect_maps_header_size - static_cast<size_t>( ofs.tellp() ) );
+    for(size_t j = 0; j < num_camera; ++j){
+      WriteMat(ofs, rect_maps.map_xy[j]);
+      WriteMat(ofs, rect_maps.map_interp[j]);
+    }
+    EXP_CHK_M(ofs.good(), return(false), "error writing " + tmp_file_name_full)
+  }
+  EXP_CHK_M(rename(tmp_file_name_full.c_str(), file_name_full.c_str()) == 0, return(false),
+            "could not replace " + file_name_full)
+
+  return true;
+}
+
+
+bool LoadRectMaps(const std::string &file_name_full, rectMaps_t &rect_maps){
+  std::ifstream ifs(file_name_full, std::ios::binary | std::ios::ate);
+  if( !ifs.is_open() )
+    return false;
+  const uint64_t file_size = static_cast<uint64_t>( ifs.tellg() );
+  ifs.seekg(0);
+  char magic[4];
+  uint32_t version, num_camera, reserved;
+  int32_t width, height;
+  uint64_t params_hash;
+  if( !ifs.read(magic, 4) || memcmp(magic, rect_maps_magic, 4) != 0 || !ReadPod(ifs, version) ||
+      version != rect_maps_version || !ReadPod(ifs, num_camera) || !ReadPod(ifs, width) || !ReadPod(ifs, height) ||
+      !ReadPod(ifs, reserved) || !ReadPod(ifs, params_hash) || num_camera == 0 || num_camera > 2 || width <= 0 ||
+      height <= 0 ){
+    printf( "LoadRectMaps() - %s is not a valid rectification map file\n", file_name_full.c_str() );
+    return false;
+  }
+  //a CV_16SC2 map_xy and a CV_16UC1 map_interp per camera, checked before the maps are allocated
+  const uint64_t map_size = static_cast<uint64_t>(width) * static_cast<uint64_t>(height) * 6;
+  if( file_size != rect_maps_header_size + num_camera * map_size ){
+    printf( "LoadRectMaps() - %s is truncated or corrupt\n", file_name_full.c_str() );
+    return false;
+  }
+
+  rectMaps_t maps;
+  maps.img_size = cv::Size(width, height);
+  maps.params_hash = params_hash;
+  ifs.seekg(rect_maps_header_size);
+  for(uint32_t j = 0; j < num_camera; ++j){
+    cv::Mat map_xy(maps.img_size, CV_16SC2), map_interp(maps.img_size, CV_16UC1);
+    if( !ifs.read( reinterpret_cast<char*>(map_xy.data), map_xy.total() * map_xy.elemSize() ) ||
+        !ifs.read( reinterpret_cast<char*>(map_interp.data), map_interp.total() * map_interp.elemSize() ) ){
+      printf( "LoadRectMaps() - could not read %s\n", file_name_full.c_str() );
+      return false;
+    }
+    maps.map_xy.push_back(map_xy);
+    maps.map_interp.push_back(map_interp);
+  }
+  rect_maps = maps;
+
+  return true;
+}
+
+
+bool GetRectMaps(const std::string &cal_img_dir, const std::string &extrinsic_file_name, const stereoCalData_t &cal_data,
+                 rectMaps_t &rect_maps){
+  ScopedTrace trace("rectification maps", "rectification");
+  const std::string file_name_full = cal_img_dir + "/" + RectMapsFileName(extrinsic_file_name);
+  const uint64_t params_hash = RectParamsHash(cal_data);
+  if( LoadRectMaps(file_name_full, rect_maps) && rect_maps.params_hash == params_hash &&
+      rect_maps.img_size == cal_data.img_size && rect_maps.map_xy.size() == 2 ){
+    printf( "GetRectMaps(): loaded %s\n", file_name_full.c_str() );
+    return true;
+  }
+
+  const int64 start_tick = cv::getTickCount();
+  ComputeRectMaps(cal_data, rect_maps);
+  printf( "GetRectMaps(): computed maps in %.1f ms\n",
+          1000.0 * static_cast<double>(cv::getTickCount() - start_tick) / cv::getTickFrequency() );
+  //the maps are usable even when they could not be saved
+  if( SaveRectMaps(file_name_full, rect_maps) )
+    printf( "GetRectMaps(): saved %s\n", file_name_full.c_str() );
+
+  return true;
+}
+
+
+int RectifyImageSetMT(const std::string &cal_img_dir, const stereoCalData_t &cal_data, const rectMaps_t &rect_maps,
+                      const std::string &out_dir, const int num_threads, const rawImageParams_t &raw){
+  EXP_CHK_M(rect_maps.map_xy.size() == 2, return(0), "stereo rectification maps required")
+  const size_t num_img_set = cal_data.good_img_file_names[0].size();
+  std::atomic<int> num_written(0);
+
+  ParallelTasks(num_img_set, num_threads, [&](const size_t i){
+    bool ok = true;
+    for(size_t j = 0; j < 2 && ok; ++j){
+      const std::string &file_name = cal_data.good_img_file_names[j][i];
+      ScopedTrace trace( "rectify image", "rectification", file_name.c_str() );
+      const cv::Mat img = DevelopCalImage(DecodeCalImage(cal_img_dir + "/" + file_name, raw), raw);
+      if( img.empty() || img.size() != rect_maps.img_size ){
+        printf( "RectifyImageSetMT() - skipping %s\n", file_name.c_str() );
+        ok = false;
+        break;
+      }
+      cv::Mat img_rect;
+      cv::remap(img, img_rect, rect_maps.map_xy[j], rect_maps.map_interp[j], cv::INTER_LINEAR);
+      try{
+        ok = cv::imwrite(out_dir + "/rect_" + file_name, img_rect);
+      }
+      catch(cv::Exception &e){
+        printf( "RectifyImageSetMT() - %s: %s\n", file_name.c_str(), e.what() );
+        ok = false;
+      }
+    }
+    if(ok)
+      ++num_written;
+  });
+
+  return num_written;
+}
@@ -0,0 +1,54 @@
+#ifndef __RECT_MAPS__
+#define __RECT_MAPS__
+
+#include <cstdint>
+#include <string>
+#include <vector>
+#include "opencv2/core.hpp"
+#include "mvg/stereo_compute.h"
+#include "raw_image.h"
+
+
+//Rectification look up tables of a stereo pair in the fixed point form cv::remap() uses directly: CV_16SC2
+//integer source coordinates plus a CV_16UC1 index into OpenCV's bilinear interpolation table. At 6 bytes per
+//pixel they are a third of the CV_32FC1 pair and remap without the float to fixed point conversion.
+struct rectMaps_t{
+  cv::Size img_size;
+  uint64_t params_hash;            //RectParamsHash() of the calibration the maps were made from
+  std::vector<cv::Mat> map_xy;     //[camera] CV_16SC2
+  std::vector<cv::Mat> map_interp; //[camera] CV_16UC1
+
+  rectMaps_t() : params_hash(0) {}
+  bool Empty() const { return map_xy.empty(); }
+};
+
+//hash of K, D, R_rect, P_rect and img_size, the maps only have to be rebuilt when it changes
+uint64_t RectParamsHash(const stereoCalData_t &cal_data);
+
+//builds the maps of both cameras, one camera per thread
+void ComputeRectMaps(const stereoCalData_t &cal_data, rectMaps_t &rect_maps);
+
+//file name of the maps stored next to an extrinsics file, ie. "extrinsics.yml" -> "extrinsics_rect_maps.bin"
+std::string RectMapsFileName(const std::string &extrinsic_file_name);
+
+//The file is laid out so a runtime can mmap() it and wrap the tables in cv::Mat headers without copying
+//(native byte order, all offsets from the start of the file):
+//  0: char[4] magic "CCRM", uint32 version, uint32 num_camera, int32 width, int32 height, uint32 reserved,
+//     uint64 params_hash, zero padding up to 64
+//  64 + j*width*height*6:                      camera j CV_16SC2 map_xy, row major, width*height*4 bytes
+//  64 + j*width*height*6 + width*height*4:     camera j CV_16UC1 map_interp, row major, width*height*2 bytes
+bool SaveRectMaps(const std::string &file_name_full, const rectMaps_t &rect_maps);
+bool LoadRectMaps(const std::string &file_name_full, rectMaps_t &rect_maps);
+
+//loads the maps saved next to the extrinsics file when they match cal_data, otherwise computes and saves them
+bool GetRectMaps(const std::string &cal_img_dir, const std::string &extrinsic_file_name, const stereoCalData_t &cal_data,
+                 rectMaps_t &rect_maps);
+
+//rectifies every detected image pair of cal_data and writes it to out_dir with a "rect_" prefix, image pairs
+//are spread over num_threads workers (<= 0 one per core). Images are decoded with raw, Bayer data is demosaiced
+//before remapping and 16 bit data is written at 16 bits. Returns the number of pairs written.
+int RectifyImageSetMT(const std::string &cal_img_dir, const stereoCalData_t &cal_data, const rectMaps_t &rect_maps,
+                      const std::string &out_dir, const int num_threads,
+                      const rawImageParams_t &raw = rawImageParams_t());
+
+#endif //__RECT_MAPS__
@@ -0,0 +1,390 @@
+#include "residual_diagnostics.h"
+#include "opencv2/calib3d.hpp"
+#include "opencv2/imgproc.hpp"
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include "incremental_calib.h"
+#include "mio/altro/io.h"
+#include "parallel_tasks.h"
+#include "pipeline_trace.h"
+
+
+#define RESIDUAL_CHUNK 16384 //points per task of the batched passes
+
+
+cameraResiduals_t::cameraResiduals_t() : rms(0), max_err(0){
+  std::fill(radial_mean, radial_mean + RESIDUAL_RADIAL_BINS, 0.0);
+  std::fill(radial_count, radial_count + RESIDUAL_RADIAL_BINS, 0);
+}
+
+
+//camera matrix and distortion coefficients of one camera as ProjectBatch() takes them
+struct batchCamera_t{
+  double fx, fy, cx, cy;
+  double d[14]; //k1 k2 p1 p2 k3 k4 k5 k6 s1 s2 s3 s4 tx ty, the ones D does not have are 0
+  bool tilted;
+};
+
+
+static batchCamera_t BatchCamera(const cv::Mat &K, const cv::Mat &D){
+  batchCamera_t cam;
+  cv::Mat K_64, D_64;
+  K.convertTo(K_64, CV_64F);
+  cam.fx = K_64.at<double>(0, 0);
+  cam.fy = K_64.at<double>(1, 1);
+  cam.cx = K_64.at<double>(0, 2);
+  cam.cy = K_64.at<double>(1, 2);
+  std::fill(cam.d, cam.d + 14, 0.0);
+  if( !D.empty() ){
+    D.convertTo(D_64, CV_64F);
+    std::copy( D_64.ptr<double>(), D_64.ptr<double>() + std::min(D_64.total(), size_t(14)), cam.d );
+  }
+  cam.tilted = cam.d[12] != 0 || cam.d[13] != 0;
+  return cam;
+}
+
+
+//target points in the camera frame of a view, X = R*obj + t
+static void TransformView(const double *R, const double *t, const std::vector<cv::Point3f> &obj_points,
+                          double *X, double *Y, double *Z){
+  const size_t n = obj_points.size();
+  for(size_t k = 0; k < n; ++k){
+    const double px = obj_points[k].x, py = obj_points[k].y, pz = obj_points[k].z;
+    X[k] = R[0]*px + R[1]*py + R[2]*pz + t[0];
+    Y[k] = R[3]*px + R[4]*py + R[5]*pz + t[1];
+    Z[k] = R[6]*px + R[7]*py + R[8]*pz + t[2];
+  }
+}
+
+
+//Projects the camera frame points [0, n) like cv::projectPoints() without the tilt terms and stores detected
+//minus projected in dx, dy. Separate arrays and a body without calls or branches let the compiler vectorize it.
+static void ProjectBatch(const batchCamera_t &cam, const size_t n, const double *X, const double *Y, const double *Z,
+                         const float *x_det, const float *y_det, float *dx, float *dy){
+  const double fx = cam.fx, fy = cam.fy, cx = cam.cx, cy = cam.cy;
+  const double k1 = cam.d[0], k2 = cam.d[1], p1 = cam.d[2], p2 = cam.d[3], k3 = cam.d[4];
+  const double k4 = cam.d[5], k5 = cam.d[6], k6 = cam.d[7];
+  const double s1 = cam.d[8], s2 = cam.d[9], s3 = cam.d[10], s4 = cam.d[11];
+  for(size_t k = 0; k < n; ++k){
+    const double inv_z = 1 / Z[k];
+    const double x = X[k]*inv_z, y = Y[k]*inv_z;
+    const double r2 = x*x + y*y, r4 = r2*r2, r6 = r4*r2;
+    const double radial = (1 + k1*r2 + k2*r4 + k3*r6) / (1 + k4*r2 + k5*r4 + k6*r6);
+    const double xd = x*radial + 2*p1*x*y + p2*(r2 + 2*x*x) + s1*r2 + s2*r4;
+    const double yd = y*radial + p1*(r2 + 2*y*y) + 2*p2*x*y + s3*r2 + s4*r4;
+    dx[k] = static_cast<float>( x_det[k] - (fx*xd + cx) );
+    dy[k] = static_cast<float>( y_det[k] - (fy*yd + cy) );
+  }
+}
+
+
+//rms, max, per view rms and the radial profile from dx, dy; views without a pose are zeroed and left out
+static void ResidualStats(cameraResiduals_t &res, const std::vector<unsigned char> &view_ok){
+  const size_t num_view = res.NumViews();
+  const double r_max = 0.5 * std::hypot(res.img_size.width, res.img_size.height);
+  double err_sum = 0;
+  size_t num_point = 0;
+  res.view_rms.assign(num_view, -1);
+  for(size_t i = 0; i < num_view; ++i){
+    const size_t begin = res.view_offset[i], end = res.view_offset[i + 1];
+    if(!view_ok[i]){
+      std::fill(res.dx.begin() + begin, res.dx.begin() + end, 0.0f);
+      std::fill(res.dy.begin() + begin, res.dy.begin() + end, 0.0f);
+      continue;
+    }
+    double view_sum = 0;
+    for(size_t k = begin; k < end; ++k){
+      const double err_2 = res.dx[k]*res.dx[k] + res.dy[k]*res.dy[k];
+      view_sum += err_2;
+      res.max_err = std::max( res.max_err, std::sqrt(err_2) );
+
+      const double rx = res.x[k] - res.principal_point.x, ry = res.y[k] - res.principal_point.y;
+      const double r = std::hypot(rx, ry);
+      if(r <= 0 || r_max <= 0)
+        continue;
+      const int bin = std::min( static_cast<int>(RESIDUAL_RADIAL_BINS * r / r_max), RESIDUAL_RADIAL_BINS - 1 );
+      res.radial_mean[bin] += (res.dx[k]*rx + res.dy[k]*ry) / r;
+      ++res.radial_count[bin];
+    }
+    res.view_rms[i] = end > begin ? std::sqrt( view_sum / (end - begin) ) : 0;
+    err_sum += view_sum;
+    num_point += end - begin;
+  }
+  res.rms = num_point > 0 ? std::sqrt(err_sum / num_point) : 0;
+  for(int b = 0; b < RESIDUAL_RADIAL_BINS; ++b)
+    if(res.radial_count[b] > 0)
+      res.radial_mean[b] /= res.radial_count[b];
+}
+
+
+//rectified row difference of every point pair, undistortPoints() over chunks of the concatenated views
+static void EpipolarResiduals(const stereoCalData_t &cal_data, residualReport_t &report, const int num_threads){
+  const cameraResiduals_t &cam_0 = report.cam[0], &cam_1 = report.cam[1];
+  const size_t n = cam_0.NumPoints();
+  report.epi_err.assign(n, 0.0f);
+  const size_t num_chunk = (n + RESIDUAL_CHUNK - 1) / RESIDUAL_CHUNK;
+  ParallelTasks(num_chunk, num_threads, [&](const size_t c){
+    const size_t begin = c * RESIDUAL_CHUNK, end = std::min(begin + RESIDUAL_CHUNK, n);
+    std::vector<cv::Point2f> points[2], rect_points[2];
+    for(int j = 0; j < 2; ++j){
+      const cameraResiduals_t &cam = report.cam[j];
+      points[j].resize(end - begin);
+      for(size_t k = begin; k < end; ++k)
+        points[j][k - begin] = cv::Point2f(cam.x[k], cam.y[k]);
+      cv::undistortPoints(points[j], rect_points[j], cal_data.K[j], cal_data.D[j], cal_data.R_rect[j],
+                          cal_data.P_rect[j]);
+    }
+    for(size_t k = begin; k < end; ++k)
+      report.epi_err[k] = rect_points[0][k - begin].y - rect_points[1][k - begin].y;
+  });
+
+  double err_sum = 0;
+  report.view_epi_rms.assign(cam_0.NumViews(), 0);
+  for(size_t i = 0; i < cam_0.NumViews(); ++i){
+    double view_sum = 0;
+    for(size_t k = cam_0.view_offset[i]; k < cam_0.view_offset[i + 1]; ++k){
+      view_sum += report.epi_err[k] * report.epi_err[k];
+      report.epi_max = std::max( report.epi_max, static_cast<double>( std::fabs(report.epi_err[k]) ) );
+    }
+    const size_t num_point = cam_0.view_offset[i + 1] - cam_0.view_offset[i];
+    report.view_epi_rms[i] = num_point > 0 ? std::sqrt(view_sum / num_point) : 0;
+    err_sum += view_sum;
+  }
+  report.epi_rms = n > 0 && cam_1.NumPoints() == n ? std::sqrt(err_sum / n) : 0;
+}
+
+
+void ComputeResiduals(const camCalTarget_t &cal_target, const stereoCalData_t &cal_data, const size_t num_camera,
+                      residualReport_t &report, const int num_threads){
+  report = residualReport_t();
+  EXP_CHK(num_camera == 1 || num_camera == 2, return)
+  EXP_CHK_M(!cal_data.K[0].empty() && ( num_camera == 1 || ( !cal_data.K[1].empty() && !cal_data.R.empty() ) ),
+            return, "no calibration to compute residuals of")
+  const size_t num_view = cal_data.img_points[0].size();
+  EXP_CHK(num_camera == 1 || cal_data.img_points[1].size() == num_view, return)
+
+  ScopedTrace trace("residuals", "diagnostics");
+  const int64 start_tick = cv::getTickCount();
+  report.num_camera = num_camera;
+  report.cam.assign( num_camera, cameraResiduals_t() );
+  const std::vector<cv::Point3f> obj_points = CalTargetObjectPoints(cal_target);
+
+  //detected points of every view end to end
+  batchCamera_t batch_cam[2];
+  std::vector<double> X[2], Y[2], Z[2];
+  for(size_t j = 0; j < num_camera; ++j){
+    cameraResiduals_t &cam = report.cam[j];
+    batch_cam[j] = BatchCamera(cal_data.K[j], cal_data.D[j]);
+    cam.img_size = cal_data.img_size;
+    cam.principal_point = cv::Point2d(batch_cam[j].cx, batch_cam[j].cy);
+    cam.view_offset.assign(num_view + 1, 0);
+    for(size_t i = 0; i < num_view; ++i)
+      cam.view_offset[i + 1] = cam.view_offset[i] + cal_data.img_points[j][i].size();
+    const size_t n = cam.view_offset[num_view];
+    cam.x.resize(n);
+    cam.y.resize(n);
+    cam.dx.assign(n, 0.0f);
+    cam.dy.assign(n, 0.0f);
+    for(size_t i = 0; i < num_view; ++i)
+      for(size_t k = 0; k < cal_data.img_points[j][i].size(); ++k){
+        cam.x[cam.view_offset[i] + k] = cal_data.img_points[j][i][k].x;
+        cam.y[cam.view_offset[i] + k] = cal_data.img_points[j][i][k].y;
+      }
+    X[j].assign(n, 0);
+    Y[j].assign(n, 0);
+    Z[j].assign(n, 1);
+  }
+
+  //target pose per view, the points of tilted sensor models are projected right away
+  std::vector<unsigned char> view_ok(num_view, 0);
+  ParallelTasks(num_view, num_threads, [&](const size_t i){
+    for(size_t j = 0; j < num_camera; ++j)
+      if(cal_data.img_points[j][i].size() != obj_points.size())
+        return;
+    cv::Mat rvec, tvec, R_view;
+    if( !cv::solvePnP(obj_points, cal_data.img_points[0][i], cal_data.K[0], cal_data.D[0], rvec, tvec) )
+      return;
+    cv::Rodrigues(rvec, R_view);
+    for(size_t j = 0; j < num_camera; ++j){
+      if(j == 1){ //pose in camera 1: x1 = R*x0 + T
+        R_view = cal_data.R * R_view;
+        tvec = cal_data.R * tvec + cal_data.T;
+      }
+      cameraResiduals_t &cam = report.cam[j];
+      const size_t offset = cam.view_offset[i];
+      if(batch_cam[j].tilted){
+        cv::Mat rvec_j;
+        std::vector<cv::Point2f> proj_points;
+        cv::Rodrigues(R_view, rvec_j);
+        cv::projectPoints(obj_points, rvec_j, tvec, cal_data.K[j], cal_data.D[j], proj_points);
+        for(size_t k = 0; k < proj_points.size(); ++k){
+          cam.dx[offset + k] = cam.x[offset + k] - proj_points[k].x;
+          cam.dy[offset + k] = cam.y[offset + k] - proj_points[k].y;
+        }
+      }
+      else
+        TransformView(R_view.ptr<double>(), tvec.ptr<double>(), obj_points, &X[j][offset], &Y[j][offset],
+                      &Z[j][offset]);
+    }
+    view_ok[i] = 1;
+  });
+
+  //one batched projection per camera, split in chunks across the threads
+  std::vector< std::pair<size_t, size_t> > chunk_vec; //camera, first point
+  for(size_t j = 0; j < num_camera; ++j)
+    if(!batch_cam[j].tilted)
+      for(size_t begin = 0; begin < report.cam[j].NumPoints(); begin += RESIDUAL_CHUNK)
+        chunk_vec.push_back( std::make_pair(j, begin) );
+  ParallelTasks(chunk_vec.size(), num_threads, [&](const size_t c){
+    const size_t j = chunk_vec[c].first, begin = chunk_vec[c].second;
+    cameraResiduals_t &cam = report.cam[j];
+    const size_t n = std::min(begin + RESIDUAL_CHUNK, cam.NumPoints()) - begin;
+    ProjectBatch(batch_cam[j], n, &X[j][begin], &Y[j][begin], &Z[j][begin], &cam.x[begin], &cam.y[begin],
+                 &cam.dx[begin], &cam.dy[begin]);
+  });
+
+  size_t num_point = 0;
+  for(size_t j = 0; j < num_camera; ++j){
+    ResidualStats(report.cam[j], view_ok);
+    num_point += report.cam[j].NumPoints();
+  }
+  if( num_camera == 2 && !cal_data.R_rect[0].empty() && !cal_data.P_rect[0].empty() &&
+      report.cam[1].NumPoints() == report.cam[0].NumPoints() )
+    EpipolarResiduals(cal_data, report, num_threads);
+
+  report.time_ms = 1000.0 * static_cast<double>(cv::getTickCount() - start_tick) / cv::getTickFrequency();
+  TraceCounter("residual points", static_cast<double>(num_point));
+  printf("ComputeResiduals(): %zu points in %zu views, %.1f ms\n", num_point, num_view, report.time_ms);
+}
+
+
+cv::Mat ResidualGrid(const cameraResiduals_t &res, const int grid_cells){
+  if(res.img_size.area() == 0 || grid_cells <= 0)
+    return cv::Mat();
+  const double cell_size = static_cast<double>( std::max(res.img_size.width, res.img_size.height) ) / grid_cells;
+  const int grid_w = std::max( static_cast<int>( std::ceil(res.img_size.width / cell_size) ), 1 );
+  const int grid_h = std::max( static_cast<int>( std::ceil(res.img_size.height / cell_size) ), 1 );
+  cv::Mat err_sum = cv::Mat::zeros(grid_h, grid_w, CV_64F), count = cv::Mat::zeros(grid_h, grid_w, CV_32S);
+  for(size_t i = 0; i < res.NumViews(); ++i){
+    if(res.view_rms[i] < 0)
+      continue;
+    for(size_t k = res.view_offset[i]; k < res.view_offset[i + 1]; ++k){
+      const int gx = std::min( std::max(static_cast<int>(res.x[k] / cell_size), 0), grid_w - 1 );
+      const int gy = std::min( std::max(static_cast<int>(res.y[k] / cell_size), 0), grid_h - 1 );
+      err_sum.at<double>(gy, gx) += std::hypot(res.dx[k], res.dy[k]);
+      ++count.at<int>(gy, gx);
+    }
+  }
+  cv::Mat grid(grid_h, grid_w, CV_32F);
+  for(int y = 0; y < grid_h; ++y)
+    for(int x = 0; x < grid_w; ++x){
+      const int n = count.at<int>(y, x);
+      grid.at<float>(y, x) = n > 0 ? static_cast<float>(err_sum.at<double>(y, x) / n) : 0.0f;
+    }
+  return grid;
+}
+
+
+cv::Mat ResidualHeatMap(const cameraResiduals_t &res, const cv::Size max_size, const int grid_cells,
+                        const double max_err){
+  const cv::Mat grid = ResidualGrid(res, grid_cells);
+  if(grid.empty() || max_size.area() == 0)
+    return cv::Mat();
+
+  double top = max_err;
+  if(top <= 0)
+    cv::minMaxLoc(grid, NULL, &top);
+  top = std::max(top, 1e-6);
+  cv::Mat level(grid.rows, grid.cols, CV_8UC1);
+  for(int y = 0; y < grid.rows; ++y)
+    for(int x = 0; x < grid.cols; ++x){
+      const float err = grid.at<float>(y, x);
+      level.at<unsigned char>(y, x) = err <= 0 ? 0 :
+        static_cast<unsigned char>( 64 + 191 * std::min(err / top, 1.0) );
+    }
+  cv::Mat heat_map;
+  cv::applyColorMap(level, heat_map, cv::COLORMAP_JET);
+  heat_map.setTo(cv::Scalar::all(0), level == 0);
+
+  const double scale = std::min( static_cast<double>(max_size.width) / res.img_size.width,
+                                 static_cast<double>(max_size.height) / res.img_size.height );
+  const cv::Size disp_size( std::max( static_cast<int>(res.img_size.width * scale), 1 ),
+                            std::max( static_cast<int>(res.img_size.height * scale), 1 ) );
+  cv::Mat img;
+  cv::resize(heat_map, img, disp_size, 0, 0, cv::INTER_NEAREST);
+  return img;
+}
+
+
+double ResidualMagnification(const cameraResiduals_t &res){
+  const double diag = std::hypot(res.img_size.width, res.img_size.height);
+  return res.rms > 0 ? 0.01 * diag / res.rms : 1;
+}
+
+
+std::vector< std::vector<cv::Point2f> > ResidualVectors(const cameraResiduals_t &res, const double magnification){
+  std::vector< std::vector<cv::Point2f> > vectors( res.NumViews() );
+  for(size_t i = 0; i < res.NumViews(); ++i){
+    vectors[i].reserve(res.view_offset[i + 1] - res.view_offset[i]);
+    for(size_t k = res.view_offset[i]; k < res.view_offset[i + 1]; ++k)
+      vectors[i].push_back( cv::Point2f(res.dx[k] * magnification, res.dy[k] * magnification) );
+  }
+  return vectors;
+}
+
+
+void PrintResidualReport(const residualReport_t &report){
+  for(size_t j = 0; j < report.cam.size(); ++j){
+    const cameraResiduals_t &cam = report.cam[j];
+    size_t worst = 0;
+    for(size_t i = 1; i < cam.view_rms.size(); ++i)
+      if(cam.view_rms[i] > cam.view_rms[worst])
+        worst = i;
+    printf("camera %zu: %zu points, rms %.3f px, max %.3f px", j, cam.NumPoints(), cam.rms, cam.max_err);
+    if( !cam.view_rms.empty() )
+      printf(", worst view %zu (%.3f px)", worst, cam.view_rms[worst]);
+    printf("\n  radial residual by distance from the center:");
+    for(int b = 0; b < RESIDUAL_RADIAL_BINS; ++b)
+      if(cam.radial_count[b] > 0)
+        printf(" %+.3f", cam.radial_mean[b]);
+      else
+        printf("   -   ");
+    printf("\n");
+  }
+  if( !report.epi_err.empty() )
+    printf("rectified epipolar error: rms %.3f px, max %.3f px\n", report.epi_rms, report.epi_max);
+}
+
+
+bool WriteResidualReport(const std::string &file_name_full, const residualReport_t &report){
+  cv::FileStorage fs(file_name_full, cv::FileStorage::WRITE);
+  EXP_CHK_M(fs.isOpened(), return(false), "could not write " + file_name_full)
+  fs << "num_camera" << static_cast<int>(report.num_camera);
+  fs << "time_ms" << report.time_ms;
+  fs << "cameras" << "[";
+  for(size_t j = 0; j < report.cam.size(); ++j){
+    const cameraResiduals_t &cam = report.cam[j];
+    fs << "{";
+    fs << "image_width" << cam.img_size.width;
+    fs << "image_height" << cam.img_size.height;
+    fs << "num_point" << static_cast<int>( cam.NumPoints() );
+    fs << "rms" << cam.rms;
+    fs << "max_err" << cam.max_err;
+    fs << "view_rms" << cam.view_rms;
+    fs << "radial_mean" << std::vector<double>(cam.radial_mean, cam.radial_mean + RESIDUAL_RADIAL_BINS);
+    fs << "radial_count" << std::vector<int>(cam.radial_count, cam.radial_count + RESIDUAL_RADIAL_BINS);
+    const cv::Mat grid = ResidualGrid(cam);
+    if( !grid.empty() )
+      fs << "residual_grid" << grid;
+    fs << "}";
+  }
+  fs << "]";
+  if( !report.epi_err.empty() ){
+    fs << "epipolar_rms" << report.epi_rms;
+    fs << "epipolar_max" << report.epi_max;
+    fs << "view_epipolar_rms" << report.view_epi_rms;
+  }
+
+  return true;
+}
@@ -0,0 +1,67 @@
+#ifndef __RESIDUAL_DIAGNOSTICS__
+#define __RESIDUAL_DIAGNOSTICS__
+
+#include <string>
+#include <vector>
+#include "opencv2/core.hpp"
+#include "mvg/stereo_compute.h"
+
+
+#define RESIDUAL_RADIAL_BINS 10 //distance from the principal point over the half image diagonal, 0.1 wide
+
+//Residuals of one camera over every view as separate arrays in view order, view i owns the points
+//view_offset[i] ... view_offset[i + 1] - 1.
+struct cameraResiduals_t{
+  cv::Size img_size;
+  cv::Point2d principal_point;
+  std::vector<float> x, y;          //detected points
+  std::vector<float> dx, dy;        //detected minus reprojected, pixels
+  std::vector<size_t> view_offset;  //num views + 1
+  std::vector<double> view_rms;
+  double rms, max_err;
+  //mean residual component pointing away from the principal point per distance bin. A trend over the bins
+  //that the views share is what a lens model with too few or wrong distortion terms leaves behind.
+  double radial_mean[RESIDUAL_RADIAL_BINS];
+  int radial_count[RESIDUAL_RADIAL_BINS];
+
+  cameraResiduals_t();
+  size_t NumPoints() const { return dx.size(); }
+  size_t NumViews() const { return view_offset.empty() ? 0 : view_offset.size() - 1; }
+};
+
+struct residualReport_t{
+  size_t num_camera;
+  std::vector<cameraResiduals_t> cam;
+  //rectified stereo only: rectified y of camera 0 minus camera 1 per point, laid out like cam[0]
+  std::vector<float> epi_err;
+  std::vector<double> view_epi_rms;
+  double epi_rms, epi_max;
+  double time_ms;
+
+  residualReport_t() : num_camera(0), epi_rms(0), epi_max(0), time_ms(0) {}
+};
+
+//Reprojects every detected point of cal_data. Each view's target pose comes from solvePnP() in camera 0, and
+//through R/T in camera 1. The points of all views are then transformed and projected in one batched pass per
+//camera. The pass covers the OpenCV distortion model up to the thin prism terms and falls back to
+//cv::projectPoints() for tilted sensor models. With rectification data the rectified row difference of every
+//stereo point pair is added.
+void ComputeResiduals(const camCalTarget_t &cal_target, const stereoCalData_t &cal_data, const size_t num_camera,
+                      residualReport_t &report, const int num_threads = 0);
+
+//mean residual length per cell of a grid over the image (grid_cells along the longer side), CV_32F, 0 where
+//no point fell
+cv::Mat ResidualGrid(const cameraResiduals_t &res, const int grid_cells = 16);
+//ResidualGrid() as a BGR heat map scaled to fit max_size, empty cells black. max_err is the top of the color
+//scale, <= 0 uses the largest cell.
+cv::Mat ResidualHeatMap(const cameraResiduals_t &res, const cv::Size max_size, const int grid_cells = 16,
+                        const double max_err = 0);
+//magnification that draws the residual vectors about 1% of the image diagonal long at the rms error
+double ResidualMagnification(const cameraResiduals_t &res);
+//per view residual vectors magnified by magnification, [view][point], for CalImageStore::SetResidualVectors()
+std::vector< std::vector<cv::Point2f> > ResidualVectors(const cameraResiduals_t &res, const double magnification);
+
+void PrintResidualReport(const residualReport_t &report);
+bool WriteResidualReport(const std::string &file_name_full, const residualReport_t &report);
+
+#endif //__RESIDUAL_DIAGNOSTICS__
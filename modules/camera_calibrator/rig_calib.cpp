@@ -0,0 +1,631 @@
+#include "rig_calib.h"
+#include "opencv2/calib3d.hpp"
+#include <algorithm>
+#include <cmath>
+#include "mio/altro/io.h"
+#include "incremental_calib.h"
+#include "parallel_tasks.h"
+#include "pipeline_trace.h"
+
+
+size_t rigCalData_t::NumViewSeen(const size_t j) const{
+  size_t num_seen = 0;
+  for(auto &points : img_points[j])
+    num_seen += !points.empty();
+  return num_seen;
+}
+
+
+void rigCalData_t::Resize(const size_t num_camera){
+  img_size.resize(num_camera);
+  K.resize(num_camera);
+  D.resize(num_camera);
+  R.resize(num_camera);
+  T.resize(num_camera);
+  img_points.resize(num_camera);
+  good_img_file_names.resize(num_camera);
+}
+
+
+static double ElapsedMs(const int64 start_tick){
+  return 1000.0 * static_cast<double>(cv::getTickCount() - start_tick) / cv::getTickFrequency();
+}
+
+
+static cv::Mat ColVec(const double *val, const int n){
+  cv::Mat vec(n, 1, CV_64F);
+  std::copy( val, val + n, vec.ptr<double>() );
+  return vec;
+}
+
+
+//The joint problem. Camera j has the parameters [fx fy cx cy d_0 .. d_n-1 r_x r_y r_z t_x t_y t_z] (extrinsics as
+//a rotation vector, unused for camera 0), each view the target pose [r t] in camera 0. Only the free camera
+//parameters enter the reduced system, camera j's at columns cam_offset[j]...
+struct rigProblem_t{
+  const rigCalData_t *rig_data;
+  std::vector<cv::Point3f> obj_points;
+  std::vector<int> num_dist;                //[camera]
+  std::vector< std::vector<int> > cam_free; //[camera] free parameter indices
+  std::vector<int> cam_offset;              //[camera]
+  int num_free;                             //columns of the reduced system
+  int num_chunk;                            //views are split into this many strided chunks
+
+  size_t NumCamera() const { return num_dist.size(); }
+  size_t NumView() const { return rig_data->NumView(); }
+  int CamParamSize(const size_t j) const { return 4 + num_dist[j] + 6; }
+  bool Seen(const size_t j, const size_t i) const { return !rig_data->img_points[j][i].empty(); }
+};
+
+struct rigParams_t{
+  std::vector< std::vector<double> > cam; //[camera]
+  std::vector<double> view;               //6 per view
+};
+
+//normal equations of the current parameters, the view blocks are kept apart for the Schur complement
+struct rigNormalEq_t{
+  cv::Mat A, g_cam;                //camera block and gradient
+  std::vector<cv::Mat> V, g_view;  //[view] 6x6 and 6x1
+  std::vector<cv::Mat> W;          //[view] num_free x 6 camera/view coupling
+};
+
+
+//free parameters of camera j as indices into its parameters, see rigProblem_t
+static std::vector<int> FreeCamParams(const int calib_flags, const int num_dist, const bool ref_camera){
+  std::vector<int> free_vec;
+  if( !(calib_flags & cv::CALIB_FIX_INTRINSIC) ){
+    if( !(calib_flags & cv::CALIB_FIX_FOCAL_LENGTH) ){
+      free_vec.push_back(0);
+      free_vec.push_back(1);
+    }
+    if( !(calib_flags & cv::CALIB_FIX_PRINCIPAL_POINT) ){
+      free_vec.push_back(2);
+      free_vec.push_back(3);
+    }
+    //k1 k2 p1 p2 k3 k4 k5 k6, coefficients past the rational model keep their per camera values
+    const int fix_flag[8] = { cv::CALIB_FIX_K1, cv::CALIB_FIX_K2, cv::CALIB_ZERO_TANGENT_DIST, cv::CALIB_ZERO_TANGENT_DIST,
+                              cv::CALIB_FIX_K3, cv::CALIB_FIX_K4, cv::CALIB_FIX_K5, cv::CALIB_FIX_K6 };
+    for(int k = 0; k < std::min(num_dist, 8); ++k)
+      if( !(calib_flags & fix_flag[k]) )
+        free_vec.push_back(4 + k);
+  }
+  if(!ref_camera)
+    for(int k = 0; k < 6; ++k)
+      free_vec.push_back(4 + num_dist + k);
+  return free_vec;
+}
+
+
+//Projects the target of view i into camera j. With J_cam and J_view the jacobians of the projection with
+//respect to all camera parameters (2N x CamParamSize(j)) and the view pose (2N x 6) are returned as well.
+static void ProjectView(const rigProblem_t &prob, const rigParams_t &par, const size_t j, const size_t i,
+                        std::vector<cv::Point2f> &proj_points, cv::Mat *J_cam = NULL, cv::Mat *J_view = NULL){
+  const double *cam = &par.cam[j][0], *view = &par.view[6*i];
+  const int num_dist = prob.num_dist[j];
+  const cv::Mat K = (cv::Mat_<double>(3, 3) << cam[0], 0, cam[2], 0, cam[1], cam[3], 0, 0, 1);
+  const cv::Mat D = ColVec(cam + 4, num_dist);
+  const cv::Mat view_rvec = ColVec(view, 3), view_tvec = ColVec(view + 3, 3);
+
+  //x_j = R_j*(R_view*X + t_view) + T_j
+  cv::Mat rvec, tvec, dr3dr1, dr3dt1, dr3dr2, dr3dt2, dt3dr1, dt3dt1, dt3dr2, dt3dt2;
+  if(j == 0){
+    rvec = view_rvec;
+    tvec = view_tvec;
+  }
+  else
+    cv::composeRT(view_rvec, view_tvec, ColVec(cam + 4 + num_dist, 3), ColVec(cam + 7 + num_dist, 3), rvec, tvec,
+                  dr3dr1, dr3dt1, dr3dr2, dr3dt2, dt3dr1, dt3dt1, dt3dr2, dt3dt2);
+  if(!J_cam){
+    cv::projectPoints(prob.obj_points, rvec, tvec, K, D, proj_points);
+    return;
+  }
+
+  //columns of J: rotation, translation, fx fy, cx cy, distortion
+  cv::Mat J;
+  cv::projectPoints(prob.obj_points, rvec, tvec, K, D, proj_points, J);
+  const cv::Mat J_r = J.colRange(0, 3), J_t = J.colRange(3, 6);
+  J_cam->create(J.rows, prob.CamParamSize(j), CV_64F);
+  J.colRange( 6, 10 + num_dist ).copyTo( J_cam->colRange(0, 4 + num_dist) );
+  if(j == 0){
+    J_cam->colRange(4 + num_dist, 10 + num_dist).setTo(0);
+    J.colRange(0, 6).copyTo(*J_view);
+    return;
+  }
+  J_view->create(J.rows, 6, CV_64F);
+  cv::Mat(J_r*dr3dr1 + J_t*dt3dr1).copyTo( J_view->colRange(0, 3) );
+  cv::Mat(J_r*dr3dt1 + J_t*dt3dt1).copyTo( J_view->colRange(3, 6) );
+  cv::Mat(J_r*dr3dr2 + J_t*dt3dr2).copyTo( J_cam->colRange(4 + num_dist, 7 + num_dist) );
+  cv::Mat(J_r*dr3dt2 + J_t*dt3dt2).copyTo( J_cam->colRange(7 + num_dist, 10 + num_dist) );
+}
+
+
+static void Residuals(const std::vector<cv::Point2f> &proj_points, const std::vector<cv::Point2f> &img_points, cv::Mat &err){
+  err.create(static_cast<int>(2*img_points.size()), 1, CV_64F);
+  double *err_ptr = err.ptr<double>();
+  for(size_t k = 0; k < img_points.size(); ++k){
+    err_ptr[2*k] = proj_points[k].x - img_points[k].x;
+    err_ptr[2*k + 1] = proj_points[k].y - img_points[k].y;
+  }
+}
+
+
+//squared reprojection error of every view and camera, [view*num_camera + camera], views in parallel
+static double RigCost(const rigProblem_t &prob, const rigParams_t &par, const int num_threads,
+                      std::vector<double> *sq_err_vec = NULL){
+  const size_t num_camera = prob.NumCamera(), num_view = prob.NumView();
+  std::vector<double> sq_err(num_view*num_camera, 0);
+  ParallelTasks(num_view, num_threads, [&](const size_t i){
+    std::vector<cv::Point2f> proj_points;
+    for(size_t j = 0; j < num_camera; ++j)
+      if( prob.Seen(j, i) ){
+        ProjectView(prob, par, j, i, proj_points);
+        const std::vector<cv::Point2f> &img_points = prob.rig_data->img_points[j][i];
+        for(size_t k = 0; k < img_points.size(); ++k){
+          const double dx = proj_points[k].x - img_points[k].x, dy = proj_points[k].y - img_points[k].y;
+          sq_err[i*num_camera + j] += dx*dx + dy*dy;
+        }
+      }
+  });
+  double cost = 0;
+  for(auto err : sq_err)
+    cost += err;
+  if(sq_err_vec)
+    sq_err_vec->swap(sq_err);
+  return cost;
+}
+
+
+//Builds the normal equations. Each chunk of views sums its own copy of the camera block, the view blocks
+//only belong to their view.
+static void BuildNormalEq(const rigProblem_t &prob, const rigParams_t &par, const int num_threads, rigNormalEq_t &eq){
+  const size_t num_camera = prob.NumCamera(), num_view = prob.NumView();
+  const int num_free = prob.num_free;
+  eq.V.resize(num_view);
+  eq.g_view.resize(num_view);
+  eq.W.resize(num_view);
+  std::vector<cv::Mat> A_chunk(prob.num_chunk), g_chunk(prob.num_chunk);
+
+  ParallelTasks(prob.num_chunk, num_threads, [&](const size_t c){
+    cv::Mat A = cv::Mat::zeros(num_free, num_free, CV_64F), g_cam = cv::Mat::zeros(num_free, 1, CV_64F);
+    std::vector<cv::Point2f> proj_points;
+    cv::Mat J_cam, J_view, err;
+    for(size_t i = c; i < num_view; i += prob.num_chunk){
+      cv::Mat V = cv::Mat::zeros(6, 6, CV_64F), g_view = cv::Mat::zeros(6, 1, CV_64F),
+              W = cv::Mat::zeros(num_free, 6, CV_64F);
+      for(size_t j = 0; j < num_camera; ++j){
+        if( !prob.Seen(j, i) )
+          continue;
+        ProjectView(prob, par, j, i, proj_points, &J_cam, &J_view);
+        Residuals(proj_points, prob.rig_data->img_points[j][i], err);
+        V += J_view.t() * J_view;
+        g_view += J_view.t() * err;
+
+        const std::vector<int> &cam_free = prob.cam_free[j];
+        if( cam_free.empty() )
+          continue;
+        cv::Mat J_free(J_cam.rows, static_cast<int>( cam_free.size() ), CV_64F);
+        for(size_t k = 0; k < cam_free.size(); ++k)
+          J_cam.col(cam_free[k]).copyTo( J_free.col( static_cast<int>(k) ) );
+        const cv::Range cam_range( prob.cam_offset[j], prob.cam_offset[j] + static_cast<int>( cam_free.size() ) );
+        cv::Mat A_cam = A(cam_range, cam_range), g_cam_j = g_cam.rowRange(cam_range), W_cam = W.rowRange(cam_range);
+        A_cam += J_free.t() * J_free;
+        g_cam_j += J_free.t() * err;
+        W_cam += J_free.t() * J_view;
+      }
+      eq.V[i] = V;
+      eq.g_view[i] = g_view;
+      eq.W[i] = W;
+    }
+    A_chunk[c] = A;
+    g_chunk[c] = g_cam;
+  });
+
+  eq.A = cv::Mat::zeros(num_free, num_free, CV_64F);
+  eq.g_cam = cv::Mat::zeros(num_free, 1, CV_64F);
+  for(int c = 0; c < prob.num_chunk; ++c){
+    eq.A += A_chunk[c];
+    eq.g_cam += g_chunk[c];
+  }
+}
+
+
+static void Damp(cv::Mat &H, const double lambda){
+  for(int k = 0; k < H.rows; ++k)
+    H.at<double>(k, k) += lambda * std::max(H.at<double>(k, k), 1e-9);
+}
+
+
+//Solves the damped normal equations for the camera step with the view blocks eliminated,
+//(A - sum W V^-1 W^t) d_cam = -(g_cam - sum W V^-1 g_view), then the view steps d_view = -V^-1 (g_view + W^t d_cam).
+//False when the reduced system is not positive definite.
+static bool SolveStep(const rigProblem_t &prob, const rigNormalEq_t &eq, const double lambda, const int num_threads,
+                      cv::Mat &d_cam, std::vector<cv::Mat> &d_view){
+  const size_t num_view = prob.NumView();
+  const int num_free = prob.num_free;
+  std::vector<cv::Mat> V_inv(num_view), S_chunk(prob.num_chunk), b_chunk(prob.num_chunk);
+  std::vector<char> view_ok(num_view, 1);
+  ParallelTasks(prob.num_chunk, num_threads, [&](const size_t c){
+    cv::Mat S = cv::Mat::zeros(num_free, num_free, CV_64F), b = cv::Mat::zeros(num_free, 1, CV_64F);
+    for(size_t i = c; i < num_view; i += prob.num_chunk){
+      cv::Mat V = eq.V[i].clone();
+      Damp(V, lambda);
+      if( !cv::invert(V, V_inv[i], cv::DECOMP_CHOLESKY) ){
+        view_ok[i] = 0;
+        continue;
+      }
+      if(num_free > 0){
+        const cv::Mat Y = eq.W[i] * V_inv[i];
+        S += Y * eq.W[i].t();
+        b += Y * eq.g_view[i];
+      }
+    }
+    S_chunk[c] = S;
+    b_chunk[c] = b;
+  });
+  if( std::find(view_ok.begin(), view_ok.end(), 0) != view_ok.end() )
+    return false;
+
+  d_cam = cv::Mat::zeros(num_free, 1, CV_64F);
+  if(num_free > 0){
+    cv::Mat S = eq.A.clone(), b = eq.g_cam.clone();
+    Damp(S, lambda);
+    for(int c = 0; c < prob.num_chunk; ++c){
+      S -= S_chunk[c];
+      b -= b_chunk[c];
+    }
+    if( !cv::solve(S, -b, d_cam, cv::DECOMP_CHOLESKY) )
+      return false;
+  }
+
+  d_view.resize(num_view);
+  ParallelTasks(num_view, num_threads, [&](const size_t i){
+    cv::Mat rhs = eq.g_view[i].clone();
+    if(num_free > 0)
+      rhs += eq.W[i].t() * d_cam;
+    d_view[i] = -V_inv[i] * rhs;
+  });
+  return true;
+}
+
+
+static rigParams_t ApplyStep(const rigProblem_t &prob, const rigParams_t &par, const cv::Mat &d_cam,
+                             const std::vector<cv::Mat> &d_view){
+  rigParams_t new_par = par;
+  for(size_t j = 0; j < prob.NumCamera(); ++j)
+    for(size_t k = 0; k < prob.cam_free[j].size(); ++k)
+      new_par.cam[j][ prob.cam_free[j][k] ] += d_cam.at<double>(prob.cam_offset[j] + static_cast<int>(k));
+  for(size_t i = 0; i < prob.NumView(); ++i)
+    for(int k = 0; k < 6; ++k)
+      new_par.view[6*i + k] += d_view[i].at<double>(k);
+  return new_par;
+}
+
+
+//rotation/translation from camera a to camera b averaged over the views both saw: the chordal mean of the
+//rotations and the per component median of the translations
+static void RelativePose(const std::vector<cv::Mat> &rvec_a, const std::vector<cv::Mat> &tvec_a,
+                         const std::vector<cv::Mat> &rvec_b, const std::vector<cv::Mat> &tvec_b,
+                         cv::Mat &R_ab, cv::Mat &t_ab){
+  cv::Mat R_sum = cv::Mat::zeros(3, 3, CV_64F);
+  std::vector<cv::Mat> t_vec;
+  for(size_t i = 0; i < rvec_a.size(); ++i){
+    if( rvec_a[i].empty() || rvec_b[i].empty() )
+      continue;
+    cv::Mat R_a, R_b;
+    cv::Rodrigues(rvec_a[i], R_a);
+    cv::Rodrigues(rvec_b[i], R_b);
+    const cv::Mat R = R_b * R_a.t();
+    R_sum += R;
+    t_vec.push_back(tvec_b[i] - R * tvec_a[i]);
+  }
+  cv::SVD svd(R_sum);
+  R_ab = svd.u * svd.vt;
+  if(cv::determinant(R_ab) < 0)
+    R_ab = svd.u * cv::Mat::diag( (cv::Mat_<double>(3, 1) << 1, 1, -1) ) * svd.vt;
+
+  t_ab.create(3, 1, CV_64F);
+  for(int k = 0; k < 3; ++k){
+    std::vector<double> val_vec;
+    for(auto &t : t_vec)
+      val_vec.push_back( t.at<double>(k) );
+    std::nth_element(val_vec.begin(), val_vec.begin() + val_vec.size()/2, val_vec.end());
+    t_ab.at<double>(k) = val_vec[val_vec.size()/2];
+  }
+}
+
+
+//per camera calibration and the chained extrinsics, the starting point of the joint solve
+static bool InitRig(const rigCalData_t &rig_data, const rigCalibParams_t &params,
+                    const std::vector<cv::Point3f> &obj_points, rigParams_t &par){
+  const size_t num_camera = rig_data.NumCamera(), num_view = rig_data.NumView();
+  std::vector<cv::Mat> K(num_camera), D(num_camera);
+  std::vector< std::vector<cv::Mat> > pose_rvec(num_camera, std::vector<cv::Mat>(num_view)),
+                                      pose_tvec(num_camera, std::vector<cv::Mat>(num_view));
+  std::vector<char> cam_ok(num_camera, 0);
+  const cv::TermCriteria criteria(cv::TermCriteria::COUNT + cv::TermCriteria::EPS, 30, 1e-6);
+
+  ParallelTasks(num_camera, params.num_threads, [&](const size_t j){
+    std::vector<size_t> view_idx;
+    std::vector< std::vector<cv::Point2f> > img_points;
+    for(size_t i = 0; i < num_view; ++i)
+      if( !rig_data.img_points[j][i].empty() ){
+        view_idx.push_back(i);
+        img_points.push_back(rig_data.img_points[j][i]);
+      }
+    if(view_idx.size() < 3){
+      printf("InitRig() - camera %zu found the target in %zu views, at least 3 are required\n", j, view_idx.size());
+      return;
+    }
+    const bool have_guess = !rig_data.K[j].empty() && !rig_data.D[j].empty();
+    if(have_guess){
+      rig_data.K[j].convertTo(K[j], CV_64F);
+      rig_data.D[j].convertTo(D[j], CV_64F);
+    }
+    try{
+      std::vector<cv::Mat> rvecs, tvecs;
+      if( have_guess && (params.calib_flags & cv::CALIB_FIX_INTRINSIC) ){
+        for(size_t k = 0; k < view_idx.size(); ++k){
+          cv::Mat rvec, tvec;
+          cv::solvePnP(obj_points, img_points[k], K[j], D[j], rvec, tvec);
+          rvecs.push_back(rvec);
+          tvecs.push_back(tvec);
+        }
+      }
+      else{
+        //stereo only flags are not accepted by cv::calibrateCamera()
+        int flags = params.calib_flags & ~(cv::CALIB_FIX_INTRINSIC | cv::CALIB_SAME_FOCAL_LENGTH |
+                                           cv::CALIB_USE_EXTRINSIC_GUESS | cv::CALIB_ZERO_DISPARITY);
+        if(!have_guess)
+          flags &= ~cv::CALIB_USE_INTRINSIC_GUESS;
+        const std::vector< std::vector<cv::Point3f> > obj_point_vec(view_idx.size(), obj_points);
+        const double rms = cv::calibrateCamera(obj_point_vec, img_points, rig_data.img_size[j], K[j], D[j],
+                                               rvecs, tvecs, flags, criteria);
+        printf("InitRig(): camera %zu, %zu views, rms %f\n", j, view_idx.size(), rms);
+      }
+      for(size_t k = 0; k < view_idx.size(); ++k){
+        rvecs[k].convertTo(pose_rvec[j][ view_idx[k] ], CV_64F);
+        tvecs[k].convertTo(pose_tvec[j][ view_idx[k] ], CV_64F);
+      }
+      cam_ok[j] = 1;
+    }
+    catch(cv::Exception &e){
+      printf( "InitRig() - camera %zu - caught error - %s\n", j, e.what() );
+    }
+  });
+  if( std::find(cam_ok.begin(), cam_ok.end(), 0) != cam_ok.end() )
+    return false;
+
+  //chain the extrinsics from camera 0, each camera joins through the linked camera it shares the most views with
+  std::vector<cv::Mat> R(num_camera), T(num_camera);
+  R[0] = cv::Mat::eye(3, 3, CV_64F);
+  T[0] = cv::Mat::zeros(3, 1, CV_64F);
+  std::vector<char> linked(num_camera, 0);
+  linked[0] = 1;
+  for(size_t n = 1; n < num_camera; ++n){
+    size_t best_a = 0, best_b = 0, best_shared = 0;
+    for(size_t a = 0; a < num_camera; ++a)
+      for(size_t b = 0; b < num_camera; ++b){
+        if(!linked[a] || linked[b])
+          continue;
+        size_t num_shared = 0;
+        for(size_t i = 0; i < num_view; ++i)
+          num_shared += !pose_rvec[a][i].empty() && !pose_rvec[b][i].empty();
+        if(num_shared > best_shared){
+          best_a = a;
+          best_b = b;
+          best_shared = num_shared;
+        }
+      }
+    if(best_shared == 0){
+      printf("InitRig() - some cameras share no view with camera 0 or the cameras linked to it\n");
+      return false;
+    }
+    cv::Mat R_ab, t_ab;
+    RelativePose(pose_rvec[best_a], pose_tvec[best_a], pose_rvec[best_b], pose_tvec[best_b], R_ab, t_ab);
+    R[best_b] = R_ab * R[best_a];
+    T[best_b] = R_ab * T[best_a] + t_ab;
+    linked[best_b] = 1;
+    printf("InitRig(): camera %zu linked to camera %zu by %zu shared views\n", best_b, best_a, best_shared);
+  }
+
+  par.cam.resize(num_camera);
+  for(size_t j = 0; j < num_camera; ++j){
+    std::vector<double> &cam = par.cam[j];
+    cam.assign(4 + D[j].total() + 6, 0);
+    cam[0] = K[j].at<double>(0, 0);
+    cam[1] = K[j].at<double>(1, 1);
+    cam[2] = K[j].at<double>(0, 2);
+    cam[3] = K[j].at<double>(1, 2);
+    for(size_t k = 0; k < D[j].total(); ++k)
+      cam[4 + k] = D[j].ptr<double>()[k];
+    cv::Mat rvec;
+    cv::Rodrigues(R[j], rvec);
+    for(int k = 0; k < 3; ++k){
+      cam[4 + D[j].total() + k] = rvec.at<double>(k);
+      cam[7 + D[j].total() + k] = T[j].at<double>(k);
+    }
+  }
+
+  //target pose in camera 0 from the first camera that saw the view: R_view = R_j^t R_ij, t_view = R_j^t (t_ij - T_j)
+  par.view.assign(6*num_view, 0);
+  for(size_t i = 0; i < num_view; ++i)
+    for(size_t j = 0; j < num_camera; ++j)
+      if( !pose_rvec[j][i].empty() ){
+        cv::Mat R_ij, rvec;
+        cv::Rodrigues(pose_rvec[j][i], R_ij);
+        cv::Rodrigues(R[j].t() * R_ij, rvec);
+        const cv::Mat tvec = R[j].t() * (pose_tvec[j][i] - T[j]);
+        for(int k = 0; k < 3; ++k){
+          par.view[6*i + k] = rvec.at<double>(k);
+          par.view[6*i + 3 + k] = tvec.at<double>(k);
+        }
+        break;
+      }
+  return true;
+}
+
+
+int CalibrateRig(const camCalTarget_t &cal_target, rigCalData_t &rig_data, const rigCalibParams_t &params,
+                 rigCalibResult_t &result, const std::atomic<bool> *cancel){
+  const size_t num_camera = rig_data.NumCamera(), num_view = rig_data.NumView();
+  EXP_CHK_M(num_camera >= 1 && num_view >= 3, return(-1), "CalibrateRig() - at least 3 views are required")
+  for(size_t j = 0; j < num_camera; ++j)
+    EXP_CHK(rig_data.img_points[j].size() == num_view, return(-1))
+
+  const int64 start_tick = cv::getTickCount();
+  rigProblem_t prob;
+  prob.rig_data = &rig_data;
+  prob.obj_points = CalTargetObjectPoints(cal_target);
+  for(size_t j = 0; j < num_camera; ++j)
+    for(size_t i = 0; i < num_view; ++i)
+      EXP_CHK_M(rig_data.img_points[j][i].empty() || rig_data.img_points[j][i].size() == prob.obj_points.size(),
+                return(-1), "CalibrateRig() - point count does not match the target")
+
+  rigParams_t par;
+  {
+    ScopedTrace trace("rig init", "calibration");
+    if( !InitRig(rig_data, params, prob.obj_points, par) )
+      return(-1);
+  }
+  if(cancel && *cancel)
+    return(1);
+  const double init_ms = ElapsedMs(start_tick);
+
+  prob.num_free = 0;
+  for(size_t j = 0; j < num_camera; ++j){
+    prob.num_dist.push_back( static_cast<int>(par.cam[j].size()) - 10 );
+    prob.cam_free.push_back( FreeCamParams(params.calib_flags, prob.num_dist[j], j == 0) );
+    prob.cam_offset.push_back(prob.num_free);
+    prob.num_free += static_cast<int>( prob.cam_free[j].size() );
+  }
+  prob.num_chunk = static_cast<int>( std::min( num_view, static_cast<size_t>( ResolveNumThreads(params.num_threads) ) ) );
+
+  //Levenberg-Marquardt, a step is only taken when it lowers the error
+  double cost = RigCost(prob, par, params.num_threads), lambda = 1e-3;
+  const double init_cost = cost;
+  rigNormalEq_t eq;
+  cv::Mat d_cam;
+  std::vector<cv::Mat> d_view;
+  result.num_iter = 0;
+  for(int iter = 0; iter < params.max_iter; ++iter){
+    if(cancel && *cancel)
+      return(1);
+    ScopedTrace trace("rig iteration", "calibration");
+    BuildNormalEq(prob, par, params.num_threads, eq);
+    bool improved = false;
+    double new_cost = cost;
+    for(int attempt = 0; attempt < 10 && !improved; ++attempt){
+      if( SolveStep(prob, eq, lambda, params.num_threads, d_cam, d_view) ){
+        rigParams_t new_par = ApplyStep(prob, par, d_cam, d_view);
+        new_cost = RigCost(prob, new_par, params.num_threads);
+        if(new_cost < cost){
+          par = new_par;
+          improved = true;
+          lambda = std::max(lambda / 10, 1e-12);
+          continue;
+        }
+      }
+      lambda *= 10;
+    }
+    if(!improved)
+      break;
+    result.num_iter = iter + 1;
+    TraceCounter("rig cost", new_cost);
+    const double rel_decrease = (cost - new_cost) / std::max(cost, 1e-300);
+    cost = new_cost;
+    if(rel_decrease < params.eps)
+      break;
+  }
+
+  //results, errors per camera and view from one more evaluation
+  std::vector<double> sq_err;
+  RigCost(prob, par, params.num_threads, &sq_err);
+  const double num_points = static_cast<double>( prob.obj_points.size() );
+  result.cam_rms.assign(num_camera, 0);
+  result.view_rms.assign(num_view, 0);
+  result.view_rvec.resize(num_view);
+  result.view_tvec.resize(num_view);
+  double sq_sum = 0;
+  size_t num_obs = 0;
+  for(size_t i = 0; i < num_view; ++i){
+    size_t num_view_obs = 0;
+    for(size_t j = 0; j < num_camera; ++j)
+      if( prob.Seen(j, i) ){
+        result.view_rms[i] += sq_err[i*num_camera + j];
+        result.cam_rms[j] += sq_err[i*num_camera + j];
+        ++num_view_obs;
+      }
+    sq_sum += result.view_rms[i];
+    num_obs += num_view_obs;
+    result.view_rms[i] = num_view_obs > 0 ? std::sqrt( result.view_rms[i] / (num_view_obs*num_points) ) : 0;
+    result.view_rvec[i] = ColVec(&par.view[6*i], 3);
+    result.view_tvec[i] = ColVec(&par.view[6*i + 3], 3);
+  }
+  for(size_t j = 0; j < num_camera; ++j){
+    const size_t num_seen = rig_data.NumViewSeen(j);
+    result.cam_rms[j] = num_seen > 0 ? std::sqrt( result.cam_rms[j] / (num_seen*num_points) ) : 0;
+  }
+  result.rms_error = num_obs > 0 ? std::sqrt( sq_sum / (num_obs*num_points) ) : 0;
+
+  for(size_t j = 0; j < num_camera; ++j){
+    const double *cam = &par.cam[j][0];
+    const int num_dist = prob.num_dist[j];
+    rig_data.K[j] = (cv::Mat_<double>(3, 3) << cam[0], 0, cam[2], 0, cam[1], cam[3], 0, 0, 1);
+    rig_data.D[j] = ColVec(cam + 4, num_dist).t();
+    cv::Rodrigues(ColVec(cam + 4 + num_dist, 3), rig_data.R[j]);
+    rig_data.T[j] = ColVec(cam + 7 + num_dist, 3);
+  }
+
+  printf( "CalibrateRig(): %zu cameras, %zu views, %d free camera parameters, rms %f -> %f in %d iterations, "
+          "%.1f ms init, %.1f ms total\n", num_camera, num_view, prob.num_free,
+          std::sqrt( init_cost / std::max(num_obs*num_points, 1.0) ), result.rms_error, result.num_iter,
+          init_ms, ElapsedMs(start_tick) );
+
+  return 0;
+}
+
+
+bool SaveRigCalData(const std::string &file_name_full, const rigCalData_t &rig_data){
+  cv::FileStorage fs(file_name_full, cv::FileStorage::WRITE);
+  EXP_CHK_M(fs.isOpened(), return(false), "could not open " + file_name_full)
+
+  fs << "num_camera" << static_cast<int>( rig_data.NumCamera() );
+  for(size_t j = 0; j < rig_data.NumCamera(); ++j){
+    const std::string suffix = "_" + std::to_string(j);
+    fs << "image_width" + suffix << rig_data.img_size[j].width;
+    fs << "image_height" + suffix << rig_data.img_size[j].height;
+    fs << "K" + suffix << rig_data.K[j];
+    fs << "D" + suffix << rig_data.D[j];
+    fs << "R" + suffix << rig_data.R[j];
+    fs << "T" + suffix << rig_data.T[j];
+  }
+  return true;
+}
+
+
+bool LoadRigCalData(const std::string &file_name_full, rigCalData_t &rig_data){
+  cv::FileStorage fs(file_name_full, cv::FileStorage::READ);
+  EXP_CHK_M(fs.isOpened(), return(false), "could not open " + file_name_full)
+
+  //num_camera has to match the camera nodes before anything is allocated for it, the limit is the .ccal one
+  int num_camera = 0;
+  fs["num_camera"] >> num_camera;
+  EXP_CHK_M(num_camera > 0 && num_camera <= 1024, return(false), "bad camera count in " + file_name_full)
+  int num_camera_node = 0;
+  while( num_camera_node <= num_camera && !fs["K_" + std::to_string(num_camera_node)].empty() )
+    ++num_camera_node;
+  EXP_CHK_M(num_camera_node == num_camera, return(false), "camera count does not match the cameras in " + file_name_full)
+
+  rig_data.Resize(num_camera);
+  for(int j = 0; j < num_camera; ++j){
+    const std::string suffix = "_" + std::to_string(j);
+    fs["image_width" + suffix] >> rig_data.img_size[j].width;
+    fs["image_height" + suffix] >> rig_data.img_size[j].height;
+    fs["K" + suffix] >> rig_data.K[j];
+    fs["D" + suffix] >> rig_data.D[j];
+    fs["R" + suffix] >> rig_data.R[j];
+    fs["T" + suffix] >> rig_data.T[j];
+    EXP_CHK_M(!rig_data.K[j].empty() && !rig_data.R[j].empty(), return(false), "incomplete camera in " + file_name_full)
+  }
+  return true;
+}
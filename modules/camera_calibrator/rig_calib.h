@@ -0,0 +1,64 @@
+#ifndef __RIG_CALIB__
+#define __RIG_CALIB__
+
+#include <atomic>
+#include <string>
+#include <vector>
+#include "opencv2/core.hpp"
+#include "mvg/stereo_compute.h"
+
+
+//Calibration data of a rig of any number of cameras, the N camera counterpart of stereoCalData_t. Camera 0 is
+//the rig frame: a point x_0 in camera 0 is x_j = R[j]*x_0 + T[j] in camera j.
+struct rigCalData_t{
+  std::vector<cv::Size> img_size;  //[camera]
+  std::vector<cv::Mat> K, D;       //[camera]
+  std::vector<cv::Mat> R, T;       //[camera], identity and zero for camera 0
+  std::vector< std::vector< std::vector<cv::Point2f> > > img_points; //[camera][view], empty where not found
+  std::vector< std::vector<std::string> > good_img_file_names;       //[camera][view]
+
+  size_t NumCamera() const { return img_points.size(); }
+  size_t NumView() const { return img_points.empty() ? 0 : img_points[0].size(); }
+  //views in which camera j found the target
+  size_t NumViewSeen(const size_t j) const;
+  void Resize(const size_t num_camera);
+};
+
+struct rigCalibParams_t{
+  int calib_flags;  //cv::CALIB_* flags, see CalibrateRig()
+  int max_iter;     //joint optimization iterations
+  double eps;       //stops when the relative decrease of the squared error falls below this
+  int num_threads;  //<= 0 uses one thread per core
+
+  rigCalibParams_t() : calib_flags(0), max_iter(50), eps(1e-10), num_threads(0) {}
+};
+
+struct rigCalibResult_t{
+  double rms_error;                 //pixels, all cameras and views
+  std::vector<double> cam_rms;      //[camera]
+  std::vector<double> view_rms;     //[view], over the cameras that saw the view
+  std::vector<cv::Mat> view_rvec, view_tvec; //[view], target pose in camera 0
+  int num_iter;
+
+  rigCalibResult_t() : rms_error(0), num_iter(0) {}
+};
+
+//Calibrates all cameras of rig_data at once. Each camera is first calibrated on its own views (cameras in
+//parallel), the extrinsics are chained from camera 0 along the pairs that share the most views and every
+//view gets a target pose in camera 0. A single Levenberg-Marquardt solve then refines all intrinsics,
+//extrinsics and target poses together. The target pose blocks are eliminated with the Schur complement,
+//so an iteration costs one small dense solve in the camera parameters however many views there are, and
+//the per view work runs on params.num_threads. Views need not be seen by every camera, but every camera
+//must see the target in at least 3 views and share views with the rest of the rig.
+//CALIB_FIX_INTRINSIC keeps the intrinsics given in rig_data (or the per camera results when there are none),
+//CALIB_USE_INTRINSIC_GUESS starts from them. CALIB_FIX_FOCAL_LENGTH, CALIB_FIX_PRINCIPAL_POINT,
+//CALIB_ZERO_TANGENT_DIST and CALIB_FIX_K1..K6 hold those parameters in the joint solve, the remaining flags
+//only apply to the per camera step. Returns 0 on success, 1 when cancel was set, -1 on failure.
+int CalibrateRig(const camCalTarget_t &cal_target, rigCalData_t &rig_data, const rigCalibParams_t &params,
+                 rigCalibResult_t &result, const std::atomic<bool> *cancel = NULL);
+
+//K, D, R, T and the image size of each camera, cv::FileStorage format
+bool SaveRigCalData(const std::string &file_name_full, const rigCalData_t &rig_data);
+bool LoadRigCalData(const std::string &file_name_full, rigCalData_t &rig_data);
+
+#endif //__RIG_CALIB__
@@ -0,0 +1,244 @@
+#include "synthetic_target.h"
+#include "opencv2/imgproc.hpp"
+#include "opencv2/imgcodecs.hpp"
+#include "opencv2/calib3d.hpp"
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <cstdlib>
+#include <random>
+#include "mio/altro/io.h"
+#include "incremental_calib.h"
+#include "parallel_tasks.h"
+
+
+syntheticRig_t::syntheticRig_t(const cv::Size img_size_) : img_size(img_size_){
+  const double w = img_size.width, h = img_size.height;
+  K[0] = (cv::Mat_<double>(3, 3) << 0.90*w, 0, 0.505*w, 0, 0.90*w, 0.495*h, 0, 0, 1);
+  K[1] = (cv::Mat_<double>(3, 3) << 0.91*w, 0, 0.497*w, 0, 0.91*w, 0.502*h, 0, 0, 1);
+  D[0] = (cv::Mat_<double>(1, 5) << -0.25, 0.08, 0.0005, -0.0003, 0);
+  D[1] = (cv::Mat_<double>(1, 5) << -0.23, 0.07, -0.0004, 0.0002, 0);
+  const cv::Mat rvec = (cv::Mat_<double>(3, 1) << 0.01, -0.02, 0.005);
+  cv::Rodrigues(rvec, R);
+  T = (cv::Mat_<double>(3, 1) << -60, 0.5, 0.3);
+}
+
+
+//target plane drawing, texel (u, v) shows target coordinates origin + (u, v) / px_per_unit
+struct targetTexture_t{
+  cv::Mat img;
+  cv::Point2d origin;
+  double px_per_unit;
+};
+
+
+static targetTexture_t RenderTargetTexture(const camCalTarget_t &cal_target){
+  const double s = cal_target.spacing;
+  const int w = cal_target.size.width, h = cal_target.size.height;
+  const bool chess = cal_target.type_str == "chess", asymmetric = cal_target.type_str == "a-circle";
+  //chess: one outer square plus a white border of one square around the inner corners
+  const double border = chess ? 2*s : 1.5*s,
+               x_max = (asymmetric ? 2*(w - 1) + 1 : w - 1) * s + border,
+               y_max = (h - 1) * s + border;
+
+  targetTexture_t tex;
+  tex.origin = cv::Point2d(-border, -border);
+  tex.px_per_unit = 2048.0 / std::max(x_max + border, y_max + border);
+  tex.img = cv::Mat(cvRound( (y_max + border) * tex.px_per_unit ), cvRound( (x_max + border) * tex.px_per_unit ),
+                    CV_8UC1, cv::Scalar(255));
+  auto to_tex = [&tex](const double x, const double y){
+    return cv::Point( cvRound( (x - tex.origin.x) * tex.px_per_unit ), cvRound( (y - tex.origin.y) * tex.px_per_unit ) );
+  };
+
+  if(chess){
+    for(int j = 0; j <= h; ++j)
+      for(int i = 0; i <= w; ++i)
+        if( (i + j) % 2 == 0 )
+          cv::rectangle(tex.img, to_tex( (i - 1) * s, (j - 1) * s ), to_tex(i * s, j * s), cv::Scalar(0), cv::FILLED);
+  }
+  else{
+    const int shift = 4; //sub pixel circle placement
+    const double radius = 0.3 * s * tex.px_per_unit;
+    for(auto &point : CalTargetObjectPoints(cal_target) ){
+      const cv::Point2d center( (point.x - tex.origin.x) * tex.px_per_unit, (point.y - tex.origin.y) * tex.px_per_unit );
+      cv::circle(tex.img, cv::Point( cvRound(center.x * (1 << shift)), cvRound(center.y * (1 << shift)) ),
+                 cvRound(radius * (1 << shift)), cv::Scalar(0), cv::FILLED, cv::LINE_AA, shift);
+    }
+  }
+
+  return tex;
+}
+
+
+cv::Mat RenderTargetView(const camCalTarget_t &cal_target, const cv::Mat &K, const cv::Mat &D, const cv::Size img_size,
+                         const cv::Mat &rvec, const cv::Mat &tvec, const double noise_sigma, const double blur_sigma,
+                         const unsigned int noise_seed){
+  targetTexture_t tex = RenderTargetTexture(cal_target);
+  cv::Mat R, t;
+  cv::Rodrigues(rvec, R);
+  tvec.convertTo(t, CV_64F);
+
+  //H = K * [r1 r2 t] maps target plane points to undistorted pixels
+  cv::Mat H_rt(3, 3, CV_64F);
+  for(int r = 0; r < 3; ++r){
+    H_rt.at<double>(r, 0) = R.at<double>(r, 0);
+    H_rt.at<double>(r, 1) = R.at<double>(r, 1);
+    H_rt.at<double>(r, 2) = t.at<double>(r);
+  }
+  cv::Mat H_inv;
+  cv::Mat(K * H_rt).convertTo(H_inv, CV_64F);
+  H_inv = H_inv.inv();
+
+  //low pass the texture to about the pixel footprint so the resampling below does not alias
+  const double texel_per_px = tex.px_per_unit * t.at<double>(2) / K.at<double>(0, 0);
+  if(texel_per_px > 1)
+    cv::GaussianBlur(tex.img, tex.img, cv::Size(0, 0), 0.5 * texel_per_px);
+
+  std::vector<cv::Point2f> px_vec, und_vec;
+  px_vec.reserve( img_size.area() );
+  for(int y = 0; y < img_size.height; ++y)
+    for(int x = 0; x < img_size.width; ++x)
+      px_vec.push_back( cv::Point2f(x, y) );
+  cv::undistortPoints(px_vec, und_vec, K, D, cv::Mat(), K);
+
+  cv::Mat map_x(img_size, CV_32FC1), map_y(img_size, CV_32FC1);
+  const double *h = H_inv.ptr<double>(0);
+  for(int y = 0; y < img_size.height; ++y){
+    float *map_x_row = map_x.ptr<float>(y), *map_y_row = map_y.ptr<float>(y);
+    for(int x = 0; x < img_size.width; ++x){
+      const cv::Point2f &p = und_vec[y*img_size.width + x];
+      const double X = h[0]*p.x + h[1]*p.y + h[2],
+                   Y = h[3]*p.x + h[4]*p.y + h[5],
+                   Z = h[6]*p.x + h[7]*p.y + h[8];
+      map_x_row[x] = static_cast<float>( (X / Z - tex.origin.x) * tex.px_per_unit );
+      map_y_row[x] = static_cast<float>( (Y / Z - tex.origin.y) * tex.px_per_unit );
+    }
+  }
+
+  cv::Mat img;
+  cv::remap(tex.img, img, map_x, map_y, cv::INTER_LINEAR, cv::BORDER_CONSTANT, cv::Scalar(128));
+  if(blur_sigma > 0)
+    cv::GaussianBlur(img, img, cv::Size(0, 0), blur_sigma);
+  if(noise_sigma > 0){
+    cv::Mat img_f, noise(img_size, CV_32FC1);
+    cv::RNG rng(noise_seed);
+    rng.fill(noise, cv::RNG::NORMAL, 0.0, noise_sigma);
+    img.convertTo(img_f, CV_32F);
+    img_f = img_f + noise;
+    img_f.convertTo(img, CV_8U);
+  }
+
+  return img;
+}
+
+
+static void ProjectView(const std::vector<cv::Point3f> &obj_points, const syntheticRig_t &rig, const size_t num_camera,
+                        syntheticView_t &view){
+  view.img_points.assign( num_camera, std::vector<cv::Point2f>() );
+  cv::projectPoints(obj_points, view.rvec, view.tvec, rig.K[0], rig.D[0], view.img_points[0]);
+  if(num_camera > 1){
+    cv::Mat R_0, rvec_1;
+    cv::Rodrigues(view.rvec, R_0);
+    cv::Rodrigues(rig.R * R_0, rvec_1);
+    const cv::Mat tvec_1 = rig.R * view.tvec + rig.T;
+    cv::projectPoints(obj_points, rvec_1, tvec_1, rig.K[1], rig.D[1], view.img_points[1]);
+  }
+}
+
+
+int GenerateSyntheticDataset(const std::string &dir, const camCalTarget_t &cal_target, const syntheticRig_t &rig,
+                             const syntheticDatasetParams_t &params, std::vector<syntheticView_t> &view_vec){
+  EXP_CHK(params.num_camera == 1 || params.num_camera == 2, return(0))
+  const std::vector<cv::Point3f> obj_points = CalTargetObjectPoints(cal_target);
+  cv::Point3f target_center(0, 0, 0), target_max(0, 0, 0);
+  for(auto &point : obj_points){
+    target_center.x += point.x / obj_points.size();
+    target_center.y += point.y / obj_points.size();
+    target_max.x = std::max(target_max.x, point.x);
+    target_max.y = std::max(target_max.y, point.y);
+  }
+
+  //random poses are drawn up front so the dataset only depends on the seed, not on scheduling
+  const double fx = rig.K[0].at<double>(0, 0),
+               width = rig.img_size.width, height = rig.img_size.height,
+               margin = 0.04 * width,
+               z_nominal = fx * std::max(target_max.x, target_max.y) / (0.5 * width);
+  std::mt19937 rng(params.seed);
+  std::uniform_real_distribution<double> tilt(-0.6, 0.6), roll(-0.25, 0.25), depth(0.8, 1.3), offset(-0.25, 0.25);
+  view_vec.clear();
+  for(size_t attempt = 0; view_vec.size() < params.num_views && attempt < 200 * params.num_views; ++attempt){
+    syntheticView_t view;
+    //drawn in a fixed order, the evaluation order of the comma initializer arguments is unspecified
+    const double tilt_x = tilt(rng), tilt_y = tilt(rng), roll_z = roll(rng);
+    const double z = depth(rng) * z_nominal;
+    const double offset_x = offset(rng) * z * width / fx, offset_y = offset(rng) * z * height / fx;
+    view.rvec = (cv::Mat_<double>(3, 1) << tilt_x, tilt_y, roll_z);
+    cv::Mat R;
+    cv::Rodrigues(view.rvec, R);
+    const cv::Mat center = (cv::Mat_<double>(3, 1) << offset_x, offset_y, z),
+                  target_center_mat = (cv::Mat_<double>(3, 1) << target_center.x, target_center.y, 0);
+    view.tvec = center - R * target_center_mat;
+    ProjectView(obj_points, rig, params.num_camera, view);
+
+    bool visible = true;
+    for(auto &point_vec : view.img_points)
+      for(auto &point : point_vec)
+        visible = visible && point.x > margin && point.y > margin && point.x < width - margin && point.y < height - margin;
+    if(visible)
+      view_vec.push_back(view);
+  }
+  EXP_CHK_M(view_vec.size() == params.num_views, return(0), "could not place the target fully inside every image")
+
+  std::atomic<int> num_written(0);
+  ParallelTasks(view_vec.size(), params.num_threads, [&](const size_t i){
+    const syntheticView_t &view = view_vec[i];
+    bool ok = true;
+    for(size_t j = 0; j < params.num_camera; ++j){
+      cv::Mat rvec = view.rvec, tvec = view.tvec;
+      if(j == 1){
+        cv::Mat R_0;
+        cv::Rodrigues(view.rvec, R_0);
+        cv::Rodrigues(rig.R * R_0, rvec);
+        tvec = rig.R * view.tvec + rig.T;
+      }
+      const cv::Mat img = RenderTargetView(cal_target, rig.K[j], rig.D[j], rig.img_size, rvec, tvec,
+                                           params.noise_sigma, params.blur_sigma,
+                                           static_cast<unsigned int>(params.seed * 7919 + i * 2 + j));
+      char file_name[256];
+      snprintf(file_name, sizeof(file_name), "%s_%03zu.%s", params.file_prefix[j].c_str(), i, params.img_ext.c_str());
+      ok = ok && cv::imwrite(dir + "/" + file_name, img);
+    }
+    if(ok)
+      ++num_written;
+  });
+
+  return num_written;
+}
+
+
+int SyntheticViewIndex(const std::string &file_name){
+  const size_t underscore_pos = file_name.rfind('_'), dot_pos = file_name.rfind('.');
+  if(underscore_pos == std::string::npos || dot_pos == std::string::npos || dot_pos <= underscore_pos + 1)
+    return -1;
+  const std::string index_str = file_name.substr(underscore_pos + 1, dot_pos - underscore_pos - 1);
+  if(index_str.find_first_not_of("0123456789") != std::string::npos)
+    return -1;
+  return atoi( index_str.c_str() );
+}
+
+
+bool WriteSyntheticGroundTruth(const std::string &file_name_full, const syntheticRig_t &rig,
+                               const std::vector<syntheticView_t> &view_vec){
+  cv::FileStorage fs(file_name_full, cv::FileStorage::WRITE);
+  EXP_CHK_M(fs.isOpened(), return(false), "could not write " + file_name_full)
+  fs << "img_width" << rig.img_size.width;
+  fs << "img_height" << rig.img_size.height;
+  fs << "K1" << rig.K[0] << "D1" << rig.D[0] << "K2" << rig.K[1] << "D2" << rig.D[1];
+  fs << "R" << rig.R << "T" << rig.T;
+  fs << "views" << "[";
+  for(auto &view : view_vec)
+    fs << "{" << "rvec" << view.rvec << "tvec" << view.tvec << "}";
+  fs << "]";
+
+  return true;
+}
@@ -0,0 +1,55 @@
+#ifndef __SYNTHETIC_TARGET__
+#define __SYNTHETIC_TARGET__
+
+#include <string>
+#include <vector>
+#include "opencv2/core.hpp"
+#include "mvg/stereo_compute.h"
+
+
+//ground truth camera pair, lengths in the units of the target spacing (ie. mm)
+struct syntheticRig_t{
+  cv::Size img_size;
+  cv::Mat K[2], D[2]; //CV_64F, 5 distortion coefficients
+  cv::Mat R, T;       //camera 1 relative to camera 0, x1 = R*x0 + T
+
+  //a plausible rig: ~58 degree horizontal field of view, moderate barrel distortion, 60 unit baseline
+  explicit syntheticRig_t( const cv::Size img_size_ = cv::Size(1280, 960) );
+};
+
+struct syntheticView_t{
+  cv::Mat rvec, tvec;                                 //target pose in camera 0
+  std::vector< std::vector<cv::Point2f> > img_points; //[camera] projected target points, detector order
+};
+
+struct syntheticDatasetParams_t{
+  size_t num_views;
+  size_t num_camera;
+  double noise_sigma;  //additive gaussian noise, gray levels
+  double blur_sigma;   //optical blur, pixels
+  unsigned int seed;
+  int num_threads;     //views are rendered in parallel, <= 0 uses one thread per core
+  std::string file_prefix[2], img_ext;
+
+  syntheticDatasetParams_t() : num_views(20), num_camera(2), noise_sigma(2), blur_sigma(0.7), seed(1), num_threads(0),
+                               img_ext("png") { file_prefix[0] = "left"; file_prefix[1] = "right"; }
+};
+
+//8 bit gray image of cal_target at pose rvec/tvec seen through K/D, rendered by mapping each pixel back onto
+//the target plane
+cv::Mat RenderTargetView(const camCalTarget_t &cal_target, const cv::Mat &K, const cv::Mat &D, const cv::Size img_size,
+                         const cv::Mat &rvec, const cv::Mat &tvec, const double noise_sigma, const double blur_sigma,
+                         const unsigned int noise_seed = 1);
+
+//renders num_views random target poses that are fully visible in every camera and writes them to dir as
+//<prefix>_<index>.<ext>. view_vec gets the ground truth. Returns the number of views written.
+int GenerateSyntheticDataset(const std::string &dir, const camCalTarget_t &cal_target, const syntheticRig_t &rig,
+                             const syntheticDatasetParams_t &params, std::vector<syntheticView_t> &view_vec);
+
+//index of a file written by GenerateSyntheticDataset(), -1 if the name does not match
+int SyntheticViewIndex(const std::string &file_name);
+
+bool WriteSyntheticGroundTruth(const std::string &file_name_full, const syntheticRig_t &rig,
+                               const std::vector<syntheticView_t> &view_vec);
+
+#endif //__SYNTHETIC_TARGET__